@@ -0,0 +1,884 @@
+/*
+ * TCP client to retrieve waveforms concurrently from several Rigol MSO5000 (Linux epoll or io_uring event loop)
+ */
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdarg.h>
+#include <inttypes.h>
+#include <float.h>
+#include <math.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+#include "socket_portable.h"
+#include "ieee488_block.h"
+
+#define APP_NAME "MSO5000_MULTI"
+#define VERSION "v0.1.2 13/12/2020 B.VERNOUX"
+
+#define BANNER1 APP_NAME " " VERSION "\n"
+#define BANNER2 APP_NAME " <hostname:port> [<hostname:port> ...] [-n<nb_waveform>] [-f<waveform_rx_raw_data_prefix>] [-u]\n"
+#define SYNTAX "Syntax: " APP_NAME " <hostname or ip:port> [<hostname or ip:port> ...] [-n<nb_waveform>] [-f<waveform_rx_raw_data_prefix (one file <prefix>_<hostname>_<port>.bin per instrument)>] [-u (io_uring multishot recv of all instruments instead of epoll + recv)]\nExample:\n" APP_NAME " 10.23.73.21:5555 10.23.73.22:5555 -n10000 -fwaveform_rx_raw_data\nStop with Ctrl-C\n"
+
+#define MAX_INSTRUMENTS (64)
+#define RX_BUF_SIZE (1024*1024)
+#define TX_BUF_SIZE (4096)
+#define INSTRUMENT_TIMEOUT_S (40)
+#define EPOLL_WAIT_MS (1000)
+
+#define CURR_TIME_SIZE (40)
+char currTime[CURR_TIME_SIZE+1] = "";
+struct timeval start_tv;
+struct timeval curr_tv;
+
+typedef enum
+{
+	INST_CONNECTING = 0,
+	INST_SETUP, /* Waiting *OPC?, *IDN? and :CHANn:DISP? replies */
+	INST_PREAMBLE, /* Waiting :WAV:PRE? replies */
+	INST_TRIG_WAIT, /* Waiting :TRIG:STAT? reply */
+	INST_DATA, /* Receiving :WAV:DATA? blocks */
+	INST_DONE,
+	INST_FAILED
+} inst_state_t;
+
+/* State of one instrument */
+typedef struct
+{
+	int idx;
+	char hostname[128];
+	int portno;
+	int fd;
+	inst_state_t state;
+
+	char filename[256];
+	FILE* outfp;
+
+	unsigned char tx_buf[TX_BUF_SIZE];
+	int tx_len;
+	unsigned char* rx_buf;
+	int rx_len;
+
+	int nb_replies; /* Replies received in current state */
+	int chan_list[4];
+	int nb_chan;
+
+	/* :WAV:DATA? block being received */
+	ieee488_block_t blk;
+
+	// Analog waveform data from WAV:PRE?
+	int format;
+	int type;
+	size_t npoints;
+	int unused3;
+	double sec_per_sample;
+	double xorigin;
+	double xreference;
+	double yincrement;
+	double yorigin;
+	double yreference;
+
+	int nb_waveform_left;
+	int nb_waveform_cnt;
+	unsigned int nb_trig_polls;
+	struct timeval start_acq;
+	struct timeval last_activity;
+	float acq_time_min;
+	float acq_time_max;
+	float acq_time_sum;
+	unsigned long long total_bytes;
+} instrument_t;
+
+instrument_t* inst_list[MAX_INSTRUMENTS];
+int nb_inst = 0;
+int epfd = -1;
+unsigned int nb_epoll_wait;
+unsigned int nb_recv;
+
+/* -u option: multishot recv of all the instruments in a provided buffer ring, epoll only for connect()/EPOLLOUT */
+#define URING_ENTRIES (256)
+#define URING_NB_BUFS (256)
+#define URING_BUF_SIZE (64*1024)
+#define URING_UD_EPOLL (0) /* user_data of the multishot poll on epfd, else instrument idx + 1 */
+sock_uring_t* uring = NULL;
+unsigned int nb_uring_cqe;
+
+void error(char *msg);
+
+void printf_dbg(const char *fmt, ...)
+{
+	va_list args;
+
+	gettimeofday(&curr_tv, NULL);
+	get_CurrentTime(currTime, CURR_TIME_SIZE);
+	printf("%s (%05.03f s) ", currTime, TimevalDiff(&curr_tv, &start_tv));
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+void syntax(void)
+{
+	printf(BANNER2);
+	printf(SYNTAX);
+}
+
+void consoleHandler(int s)
+{
+	if (s == SIGINT) // Ctrl-C
+	{
+		printf("\nCtrl-C pressed\nExit\n");
+		error(NULL);
+	}
+}
+
+void inst_close(instrument_t* inst)
+{
+	if(inst->fd != -1)
+	{
+		epoll_ctl(epfd, EPOLL_CTL_DEL, inst->fd, NULL);
+		/* The multishot recv holds a reference on the socket, it completes on shutdown() */
+		if(uring != NULL)
+			shutdown(inst->fd, SHUT_RDWR);
+		close(inst->fd);
+		inst->fd = -1;
+	}
+	if(inst->outfp != NULL)
+	{
+		fclose(inst->outfp);
+		inst->outfp = NULL;
+	}
+}
+
+void cleanup(void)
+{
+	int i;
+
+	for(i = 0; i < nb_inst; i++)
+	{
+		inst_close(inst_list[i]);
+		free(inst_list[i]->rx_buf);
+		free(inst_list[i]);
+	}
+	nb_inst = 0;
+
+	sockUringQuit();
+	uring = NULL;
+	if(epfd != -1)
+	{
+		close(epfd);
+		epfd = -1;
+	}
+	sockQuit();
+}
+
+/*
+* error - wrapper for perror
+*/
+void error(char *msg)
+{
+	if(msg != NULL)
+	{
+		if(sockGetErrno() != 0)
+		{
+			printf("%s:\n %s\n", msg, sockStrError(sockGetErrno()));
+		}else
+		{
+			printf("%s\n", msg);
+		}
+	}
+
+	cleanup();
+
+	exit(-1);
+}
+
+void inst_fail(instrument_t* inst, const char* msg)
+{
+	printf_dbg("#%d %s:%d ERROR %s (state=%d)\n", inst->idx, inst->hostname, inst->portno, msg, inst->state);
+	inst->state = INST_FAILED;
+	inst_close(inst);
+}
+
+void inst_update_events(instrument_t* inst)
+{
+	struct epoll_event ev;
+
+	ev.events = (uring != NULL) ? 0 : EPOLLIN;
+	if( (inst->state == INST_CONNECTING) || (inst->tx_len > 0) )
+		ev.events |= EPOLLOUT;
+	ev.data.ptr = inst;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, inst->fd, &ev);
+}
+
+/* Write as much queued commands as possible without blocking */
+void inst_flush(instrument_t* inst)
+{
+	int nb_sent;
+	int had_pending = (inst->tx_len > 0);
+
+	if(inst->fd == -1)
+		return;
+	while(inst->tx_len > 0)
+	{
+		nb_sent = send(inst->fd, (const char*)inst->tx_buf, inst->tx_len, MSG_NOSIGNAL);
+		if(nb_sent < 0)
+		{
+			if( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+				break;
+			inst_fail(inst, "send()");
+			return;
+		}
+		inst->tx_len -= nb_sent;
+		memmove(inst->tx_buf, &inst->tx_buf[nb_sent], inst->tx_len);
+	}
+	if(had_pending != (inst->tx_len > 0))
+		inst_update_events(inst);
+}
+
+/* Queue commands, all commands queued are sent with a single write by inst_flush() */
+void inst_cmd(instrument_t* inst, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf((char *)&inst->tx_buf[inst->tx_len], TX_BUF_SIZE - inst->tx_len, fmt, args);
+	va_end(args);
+	if( (len < 0) || (len >= (TX_BUF_SIZE - inst->tx_len)) )
+	{
+		inst_fail(inst, "TX buffer full");
+		return;
+	}
+	inst->tx_len += len;
+}
+
+void inst_start_waveform(instrument_t* inst)
+{
+	if(inst->nb_waveform_left == 0)
+	{
+		inst->state = INST_DONE;
+		inst_close(inst);
+		return;
+	}
+	if(inst->nb_waveform_left > 0)
+		inst->nb_waveform_left--;
+	inst->nb_waveform_cnt++;
+
+	gettimeofday(&inst->start_acq, NULL);
+	inst->state = INST_TRIG_WAIT;
+	inst_cmd(inst, ":SING\n:TRIG:STAT?\n*WAI\n");
+}
+
+void inst_end_waveform(instrument_t* inst)
+{
+	struct timeval curr_acq;
+	float acq_time;
+
+	gettimeofday(&curr_acq, NULL);
+	acq_time = TimevalDiff(&curr_acq, &inst->start_acq);
+	inst->acq_time_sum += acq_time;
+	if(acq_time < inst->acq_time_min)
+		inst->acq_time_min = acq_time;
+	if(acq_time > inst->acq_time_max)
+		inst->acq_time_max = acq_time;
+
+	printf_dbg("#%d %s:%d Waveform %d Acq Time %05.04f s (%zu pts x %d chan, start t=%05.04f s)\n",
+			inst->idx, inst->hostname, inst->portno, inst->nb_waveform_cnt, acq_time,
+			inst->npoints, inst->nb_chan, TimevalDiff(&inst->start_acq, &start_tv));
+
+	inst_start_waveform(inst);
+}
+
+void inst_on_line(instrument_t* inst, char* line)
+{
+	int i;
+
+	switch(inst->state)
+	{
+		case INST_SETUP:
+			/* *OPC?, *IDN?, :CHAN1:DISP? ... :CHAN4:DISP? */
+			if(inst->nb_replies == 1)
+			{
+				printf_dbg("#%d %s:%d IDN?=%s", inst->idx, inst->hostname, inst->portno, line);
+			} else if(inst->nb_replies >= 2)
+			{
+				if(atoi(line) == 1)
+					inst->chan_list[inst->nb_chan++] = inst->nb_replies - 2;
+			}
+			inst->nb_replies++;
+			if(inst->nb_replies == 6)
+			{
+				if(inst->nb_chan == 0)
+				{
+					inst_fail(inst, "no channel enabled");
+					return;
+				}
+				for(i = 0; i < inst->nb_chan; i++)
+					inst_cmd(inst, ":WAV:SOUR CHAN%d\n:WAV:PRE?\n", inst->chan_list[i] + 1);
+				inst->nb_replies = 0;
+				inst->state = INST_PREAMBLE;
+			}
+			break;
+
+		case INST_PREAMBLE:
+			sscanf(line,
+					"%d,%d,%zu,%d,%lf,%lf,%lf,%lf,%lf,%lf",
+					&inst->format,
+					&inst->type,
+					&inst->npoints,
+					&inst->unused3,
+					&inst->sec_per_sample,
+					&inst->xorigin,
+					&inst->xreference,
+					&inst->yincrement,
+					&inst->yorigin,
+					&inst->yreference);
+			printf_dbg("#%d %s:%d CH%d :WAV:PRE?=%s", inst->idx, inst->hostname, inst->portno,
+					inst->chan_list[inst->nb_replies] + 1, line);
+			inst->nb_replies++;
+			if(inst->nb_replies == inst->nb_chan)
+				inst_start_waveform(inst);
+			break;
+
+		case INST_TRIG_WAIT:
+			inst->nb_trig_polls++;
+			if( strncmp(line, "STOP", 4) == 0 )
+			{
+				/* All channels requested at once, blocks are received in order */
+				for(i = 0; i < inst->nb_chan; i++)
+					inst_cmd(inst, ":WAV:SOUR CHAN%d\n:WAV:DATA?\n", inst->chan_list[i] + 1);
+				inst->nb_replies = 0;
+				ieee488_block_reset(&inst->blk);
+				inst->state = INST_DATA;
+			} else
+			{
+				inst_cmd(inst, ":TRIG:STAT?\n*WAI\n");
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* :WAV:DATA? payload written to the output file as it arrives */
+int inst_on_payload(void* ctx, const unsigned char* data, size_t len)
+{
+	instrument_t* inst = (instrument_t*)ctx;
+
+	if(inst->outfp != NULL)
+	{
+		if(fwrite(data, sizeof(char), len, inst->outfp) != len)
+			printf_dbg("#%d fwrite() on outfp error len=%zu\n", inst->idx, len);
+	}
+	inst->total_bytes += len;
+	return 0;
+}
+
+/* A #0 block would end at the first sample equal to 0x0A, only definite length blocks are accepted */
+int inst_on_header(void* ctx, long long length)
+{
+	(void)ctx;
+	return (length == IEEE488_BLOCK_INDEFINITE) ? -1 : 0;
+}
+
+const ieee488_block_cb_t inst_blk_cb = { inst_on_header, inst_on_payload, NULL };
+
+/* Consume :WAV:DATA? block data, return nb bytes consumed or -1 in case of error */
+int inst_on_data(instrument_t* inst, unsigned char* data, int len)
+{
+	long nb;
+
+	nb = ieee488_block_feed(&inst->blk, data, len);
+	if(nb < 0)
+		return -1;
+	if(ieee488_block_done(&inst->blk))
+	{
+		ieee488_block_reset(&inst->blk);
+		inst->nb_replies++;
+		if(inst->nb_replies == inst->nb_chan)
+			inst_end_waveform(inst);
+	}
+	return (int)nb;
+}
+
+/* Consume replies/block data, return nb bytes consumed (a partial line is not) or -1 if the instrument failed */
+int inst_consume(instrument_t* inst, unsigned char* data, int len)
+{
+	int pos = 0;
+	int n;
+	unsigned char* eol;
+	char line[256];
+	int line_len;
+
+	while( (pos < len) && (inst->state != INST_FAILED) && (inst->state != INST_DONE) )
+	{
+		if(inst->state == INST_DATA)
+		{
+			n = inst_on_data(inst, &data[pos], len - pos);
+			if(n < 0)
+			{
+				inst_fail(inst, inst->blk.error);
+				return -1;
+			}
+			pos += n;
+		} else
+		{
+			eol = memchr(&data[pos], '\n', len - pos);
+			if(eol == NULL)
+				break;
+			n = (eol - &data[pos]) + 1;
+			line_len = (n < (int)sizeof(line)) ? n : (int)sizeof(line) - 1;
+			memcpy(line, &data[pos], line_len);
+			line[line_len] = '\0';
+			pos += n;
+			inst_on_line(inst, line);
+		}
+	}
+	if(inst->state == INST_FAILED)
+		return -1;
+	return pos;
+}
+
+void inst_process_rx(instrument_t* inst)
+{
+	int pos;
+
+	pos = inst_consume(inst, inst->rx_buf, inst->rx_len);
+	if(pos < 0)
+		return;
+
+	/* Keep not consumed data (partial line) */
+	inst->rx_len -= pos;
+	memmove(inst->rx_buf, &inst->rx_buf[pos], inst->rx_len);
+	if(inst->rx_len == RX_BUF_SIZE)
+		inst_fail(inst, "reply too long");
+}
+
+void inst_on_event(instrument_t* inst, unsigned int events)
+{
+	int read_nb;
+	int so_error;
+	socklen_t optlen;
+
+	gettimeofday(&inst->last_activity, NULL);
+
+	if(inst->state == INST_CONNECTING)
+	{
+		if(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+		{
+			so_error = 0;
+			optlen = sizeof(so_error);
+			getsockopt(inst->fd, SOL_SOCKET, SO_ERROR, (char*)&so_error, &optlen);
+			if(so_error != 0)
+			{
+				printf_dbg("#%d connect() %s\n", inst->idx, sockStrError(so_error));
+				inst_fail(inst, "connect()");
+				return;
+			}
+			printf_dbg("#%d %s:%d connected\n", inst->idx, inst->hostname, inst->portno);
+			inst->state = INST_SETUP;
+			inst->nb_replies = 0;
+			inst_cmd(inst, "*CLS\n:STOP\n*OPC?\n*IDN?\n:WAV:MODE RAW\n:WAV:FORM BYTE\n");
+			inst_cmd(inst, ":CHAN1:DISP?\n:CHAN2:DISP?\n:CHAN3:DISP?\n:CHAN4:DISP?\n");
+			if( (uring != NULL) && (sock_uring_recv_multishot(uring, inst->fd, inst->idx + 1) != 0) )
+			{
+				inst_fail(inst, "sock_uring_recv_multishot()");
+				return;
+			}
+			inst_update_events(inst);
+			inst_flush(inst);
+		}
+		return;
+	}
+
+	if(events & EPOLLOUT)
+	{
+		inst_flush(inst);
+		if(inst->fd == -1)
+			return;
+	}
+
+	/* With io_uring data and errors are reported by the multishot recv */
+	if( (uring == NULL) && (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) )
+	{
+		/* Single recv() per event so all instruments are served fairly */
+		read_nb = recv(inst->fd, (char *)&inst->rx_buf[inst->rx_len], RX_BUF_SIZE - inst->rx_len, 0);
+		nb_recv++;
+		if(read_nb == 0)
+		{
+			inst_fail(inst, "connection closed by server");
+			return;
+		}
+		if(read_nb < 0)
+		{
+			if( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+				return;
+			inst_fail(inst, "recv()");
+			return;
+		}
+		inst->rx_len += read_nb;
+		inst_process_rx(inst);
+		if(inst->fd != -1)
+			inst_flush(inst);
+	}
+}
+
+/* -u: data of a multishot recv completion, consumed in place in the provided buffer when no partial line is pending */
+void inst_on_recv(instrument_t* inst, unsigned char* data, int len)
+{
+	int n;
+
+	gettimeofday(&inst->last_activity, NULL);
+	if(inst->rx_len == 0)
+	{
+		n = inst_consume(inst, data, len);
+		if( (n < 0) || (inst->fd == -1) )
+			return;
+		data += n;
+		len -= n;
+	}
+	if(len > 0)
+	{
+		if(len > (RX_BUF_SIZE - inst->rx_len))
+		{
+			inst_fail(inst, "reply too long");
+			return;
+		}
+		memcpy(&inst->rx_buf[inst->rx_len], data, len);
+		inst->rx_len += len;
+		inst_process_rx(inst);
+	}
+	if(inst->fd != -1)
+		inst_flush(inst);
+}
+
+void epoll_dispatch(struct epoll_event* events, int nb_events)
+{
+	int i;
+
+	for(i = 0; i < nb_events; i++)
+	{
+		instrument_t* inst = (instrument_t*)events[i].data.ptr;
+		if(inst->fd != -1)
+			inst_on_event(inst, events[i].events);
+	}
+}
+
+/* -u: wait for and process the io_uring completions, return -1 in case of error */
+int uring_process(struct epoll_event* events)
+{
+	sock_uring_cqe_t cqe;
+	instrument_t* inst;
+	int nb_events;
+
+	if(sock_uring_wait(uring, EPOLL_WAIT_MS) < 0)
+		return -1;
+	while(sock_uring_next(uring, &cqe))
+	{
+		nb_uring_cqe++;
+		if(cqe.user_data == URING_UD_EPOLL)
+		{
+			/* epfd is readable: connect()/EPOLLOUT events */
+			nb_events = epoll_wait(epfd, events, MAX_INSTRUMENTS, 0);
+			nb_epoll_wait++;
+			if(nb_events > 0)
+				epoll_dispatch(events, nb_events);
+			if(!sock_uring_cqe_more(&cqe))
+				sock_uring_poll_multishot(uring, epfd, POLLIN, URING_UD_EPOLL);
+			continue;
+		}
+		inst = inst_list[cqe.user_data - 1];
+		if(inst->fd != -1)
+		{
+			if(cqe.res > 0)
+				inst_on_recv(inst, sock_uring_cqe_buffer(uring, &cqe), cqe.res);
+			else if(cqe.res == 0)
+				inst_fail(inst, "connection closed by server");
+			else if(cqe.res != -ENOBUFS)
+				inst_fail(inst, sockStrError(-cqe.res));
+		}
+		sock_uring_buffer_recycle(uring, &cqe);
+		/* Multishot recv stopped (all provided buffers in use...) */
+		if( (inst->fd != -1) && !sock_uring_cqe_more(&cqe) )
+			sock_uring_recv_multishot(uring, inst->fd, cqe.user_data);
+	}
+	return 0;
+}
+
+instrument_t* inst_open(int idx, const char* host_port, int nb_waveform, const char* prefix)
+{
+	instrument_t* inst;
+	struct sockaddr_in serveraddr;
+	struct hostent *server;
+	struct epoll_event ev;
+	char* sep;
+	int i;
+
+	inst = calloc(1, sizeof(instrument_t));
+	if(inst == NULL)
+		error("ERROR calloc(instrument_t)");
+	inst->idx = idx;
+	inst->fd = -1;
+	inst->nb_waveform_left = nb_waveform;
+	inst->acq_time_min = FLT_MAX;
+	inst->acq_time_max = 0;
+
+	strncpy(inst->hostname, host_port, sizeof(inst->hostname) - 1);
+	sep = strrchr(inst->hostname, ':');
+	if(sep == NULL)
+	{
+		printf("Error %s shall be <hostname:port>\n", host_port);
+		syntax();
+		exit(-3);
+	}
+	*sep = '\0';
+	inst->portno = atoi(sep + 1);
+
+	inst->rx_buf = malloc(RX_BUF_SIZE);
+	if(inst->rx_buf == NULL)
+		error("ERROR malloc(RX_BUF_SIZE)");
+	ieee488_block_init(&inst->blk, &inst_blk_cb, inst);
+
+	if(prefix != NULL)
+	{
+		snprintf(inst->filename, sizeof(inst->filename), "%s_%s_%d.bin", prefix, inst->hostname, inst->portno);
+		for(i = strlen(prefix); inst->filename[i] != '\0'; i++)
+		{
+			if(inst->filename[i] == '/' || inst->filename[i] == '\\')
+				inst->filename[i] = '_';
+		}
+		inst->outfp = fopen(inst->filename, "wb");
+		if(inst->outfp == NULL)
+		{
+			printf("waveform_rx_raw_data_file error to create file: %s\n", inst->filename);
+			exit(-3);
+		}
+		printf("#%d waveform_rx_raw_data_file: %s\n", idx, inst->filename);
+	}
+
+	server = gethostbyname(inst->hostname);
+	if (server == NULL) {
+		printf("ERROR no such host as %s\n", inst->hostname);
+		error("ERROR gethostbyname()");
+	}
+	bzero((char *) &serveraddr, sizeof(serveraddr));
+	serveraddr.sin_family = AF_INET;
+	bcopy((char *)server->h_addr, (char *)&serveraddr.sin_addr.s_addr, server->h_length);
+	serveraddr.sin_port = htons(inst->portno);
+
+	inst->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (inst->fd < 0)
+	{
+		error("ERROR opening socket");
+	}
+	// TCP_NODELAY = 1 => Disable Nagle's algorithm for send coalescing.
+	sockSetOpt(inst->fd, "TCP_NODELAY", IPPROTO_TCP, TCP_NODELAY, 1);
+	fcntl(inst->fd, F_SETFL, fcntl(inst->fd, F_GETFL, 0) | O_NONBLOCK);
+
+	inst->state = INST_CONNECTING;
+	if( (connect(inst->fd, (const struct sockaddr*)&serveraddr, sizeof(serveraddr)) < 0) && (errno != EINPROGRESS) )
+	{
+		error("ERROR connect()");
+	}
+	gettimeofday(&inst->last_activity, NULL);
+
+	ev.events = (uring != NULL) ? EPOLLOUT : (EPOLLIN | EPOLLOUT);
+	ev.data.ptr = inst;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, inst->fd, &ev) < 0)
+	{
+		error("ERROR epoll_ctl()");
+	}
+	return inst;
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_event events[MAX_INSTRUMENTS];
+	char* prefix = NULL;
+	int nb_waveform = -1;
+	int use_uring = 0;
+	int nb_events;
+	int nb_active;
+	int i;
+	float wall_time_s;
+	unsigned long long total_bytes;
+	int total_waveforms;
+
+	sockInit();
+
+	printf(BANNER1);
+	printf("Stop with Ctrl-C\n");
+	printf("Parameters:\n");
+	for(i = 0; i < argc; i++)
+	{
+		printf("%s ", argv[i]);
+	}
+	printf("\n");
+
+	/* check command line arguments */
+	if (argc < 2)
+	{
+		syntax();
+		exit(0);
+	}
+	for(i = 1; i < argc; i++)
+	{
+		if(strncmp(argv[i], "-n", 2) == 0)
+		{
+			nb_waveform = atoi(&argv[i][2]);
+			printf("nb_waveform: %d\n", nb_waveform);
+		} else if(strncmp(argv[i], "-f", 2) == 0)
+		{
+			prefix = &argv[i][2];
+			printf("waveform_rx_raw_data_prefix: %s\n", prefix);
+		} else if(strcmp(argv[i], "-u") == 0)
+		{
+			use_uring = 1;
+			printf("io_uring: 1\n");
+		} else if(argv[i][0] == '-')
+		{
+			printf("Error unknown argument %s\n", argv[i]);
+			syntax();
+			exit(-3);
+		}
+	}
+
+	epfd = epoll_create1(0);
+	if(epfd < 0)
+	{
+		error("ERROR epoll_create1()");
+	}
+	if(use_uring)
+	{
+		if( (sockUringInit(URING_ENTRIES, 0) == 0) &&
+			(sock_uring_setup_buffers(sockUring(), URING_NB_BUFS, URING_BUF_SIZE) == 0) )
+		{
+			uring = sockUring();
+			sock_uring_poll_multishot(uring, epfd, POLLIN, URING_UD_EPOLL);
+			printf("io_uring event loop, %d provided buffers of %d bytes\n", URING_NB_BUFS, URING_BUF_SIZE);
+		} else
+		{
+			printf("io_uring not available (%s), epoll used\n", sockUringError());
+			sockUringQuit();
+		}
+	}
+
+	gettimeofday(&start_tv, NULL);
+
+	for(i = 1; i < argc; i++)
+	{
+		if(argv[i][0] == '-')
+			continue;
+		if(nb_inst == MAX_INSTRUMENTS)
+		{
+			printf("Error too many instruments (max %d)\n", MAX_INSTRUMENTS);
+			exit(-3);
+		}
+		inst_list[nb_inst] = inst_open(nb_inst, argv[i], nb_waveform, prefix);
+		nb_inst++;
+	}
+	if(nb_inst == 0)
+	{
+		syntax();
+		exit(0);
+	}
+
+	/* Event loop: each instrument progresses through its state machine on socket events */
+	while(1)
+	{
+		nb_active = 0;
+		gettimeofday(&curr_tv, NULL);
+		for(i = 0; i < nb_inst; i++)
+		{
+			if( (inst_list[i]->state == INST_DONE) || (inst_list[i]->state == INST_FAILED) )
+				continue;
+			if(TimevalDiff(&curr_tv, &inst_list[i]->last_activity) > INSTRUMENT_TIMEOUT_S)
+			{
+				inst_fail(inst_list[i], "timeout");
+				continue;
+			}
+			nb_active++;
+		}
+		if(nb_active == 0)
+			break;
+
+		if(uring != NULL)
+		{
+			if(uring_process(events) < 0)
+				error("ERROR io_uring_enter()");
+			continue;
+		}
+		nb_events = epoll_wait(epfd, events, MAX_INSTRUMENTS, EPOLL_WAIT_MS);
+		nb_epoll_wait++;
+		if(nb_events < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			error("ERROR epoll_wait()");
+		}
+		epoll_dispatch(events, nb_events);
+	}
+
+	gettimeofday(&curr_tv, NULL);
+	wall_time_s = TimevalDiff(&curr_tv, &start_tv);
+	get_CurrentTime(currTime, CURR_TIME_SIZE);
+
+	printf("\n");
+	total_bytes = 0;
+	total_waveforms = 0;
+	for(i = 0; i < nb_inst; i++)
+	{
+		instrument_t* inst = inst_list[i];
+		int nb_ok = (inst->state == INST_DONE) ? inst->nb_waveform_cnt : (inst->nb_waveform_cnt - 1);
+		if(nb_ok < 0)
+			nb_ok = 0;
+		printf("%s #%d %s:%d %s nb_waveform_cnt=%d, Acq Time min=%05.04fs, max=%05.04fs, avg=%05.04fs, %05.03f MBytes/s, trig polls=%u\n",
+				currTime, inst->idx, inst->hostname, inst->portno,
+				(inst->state == INST_DONE) ? "DONE" : "FAILED",
+				nb_ok,
+				(nb_ok > 0) ? inst->acq_time_min : 0.0f, inst->acq_time_max,
+				(nb_ok > 0) ? (inst->acq_time_sum / nb_ok) : 0.0f,
+				(inst->total_bytes / (1024.0*1024.0)) / wall_time_s,
+				inst->nb_trig_polls);
+		total_bytes += inst->total_bytes;
+		total_waveforms += nb_ok;
+	}
+	printf("\n%s Total %d instruments, %d waveforms, %llu bytes in %05.04f s (%05.03f MBytes/s, %05.03f waveforms/s)\n",
+			currTime, nb_inst, total_waveforms, total_bytes, wall_time_s,
+			(total_bytes / (1024.0*1024.0)) / wall_time_s, total_waveforms / wall_time_s);
+	if(uring != NULL)
+	{
+		printf("%s io_uring: io_uring_enter calls=%u, completions=%u, epoll_wait calls=%u\n",
+				currTime, uring->nb_enter, nb_uring_cqe, nb_epoll_wait);
+	} else
+	{
+		printf("%s epoll_wait calls=%u, recv calls=%u\n", currTime, nb_epoll_wait, nb_recv);
+	}
+	printf("\n");
+
+	cleanup();
+
+	return 0;
+}
@@ -23,33 +23,254 @@
 #include <stdarg.h>
 #include <inttypes.h>
 #include <float.h>
+#include <limits.h>
 #include <math.h>
 
 #include "socket_portable.h"
+#include "scpi_queue.h"
+#include "scpi_session.h"
+#include "hislip.h"
+#include "transport_profile.h"
+#include "mmap_file.h"
+#include "capture_ring.h"
+#include "codec_writer.h"
+#include "lod_pyramid.h"
+#include "meas_engine.h"
+#include "spectrum.h"
+#include "la_capture.h"
+#include "buffer_pool.h"
+#include "sample_convert.h"
+#include "rg01_writer.h"
+#include "ieee488_block.h"
+#include "latency_hist.h"
+#include "async_log.h"
 
 #define APP_NAME "MSO5000_SCPI"
 #define VERSION "v0.1.2 13/12/2020 B.VERNOUX"
 
 #define BANNER1 APP_NAME " " VERSION "\n"
-#define BANNER2 APP_NAME " <hostname> <port> [-n<nb_waveform>] [-f<waveform_rx_raw_data.bin>]\n"
-#define SYNTAX "Syntax: " APP_NAME " <hostname or ip> <port> [-n<nb_waveform>] [-f<waveform_rx_raw_data_file (data received from server)>]\nExample:\n" APP_NAME " 10.23.73.21 5555 -n10000 -fwaveform_rx_raw_data.bin\nStop with Ctrl-C\n"
+#define BANNER2 APP_NAME " <hostname> <port> [-n<nb_waveform>] [-f<waveform_rx_raw_data.bin>] [-p<pipeline_depth>] [-m] [-w<nb_buffers> [-d]] [-t<poll|opc|esr|stb|srq>] [-o<raw|float|rg01>] [-c<window_points>] [-s<stats.json|stats.csv> [-i<period_s>]] [-P<none|bulk|lowlat>] [-a<cpu>] [-u] [-z[<nb_threads>]] [-l] [-F<nb_frames>] [-R<pre>[,<post>[,<max_events>]] [-T<chan>,<level_volts>[,below]]] [-M[<meas.csv>]] [-S<spectrum.spc> [-W<hann|blackman|flattop>[,<nfft>[,<nb_avg>[,<nb_threads>]]]]] [-D<la_file>[,edges]] [-H[<thp|hugetlb>]] [-j<nb_sessions>] [-I[<sub_address>]] [-L<error|info|debug|trace>[,sync]]\n"
+#define SYNTAX "Syntax: " APP_NAME " <hostname or ip> <port> [-n<nb_waveform>] [-f<waveform_rx_raw_data_file (data received from server)>] [-p<nb :WAV:DATA? queries in flight (default 4, 1=no pipelining)>] [-m (write -f file through a memory mapping, data received directly in it)] [-w<nb capture buffers written to -f file by a writer thread> [-d (drop waveforms when all buffers are full)]] [-t<trigger wait: poll (:TRIG:STAT? tight poll, default), opc (*OPC?), esr (*ESR? poll with backoff), stb (*STB? poll with backoff), srq (service request on the HiSLIP asynchronous channel, requires -I)>] [-o<output format: raw (bytes, default), float (float32 volts), rg01 (Rigol MSO5000 .bin file with float32 volts)>] [-c<:WAV:DATA? by windows of window_points with :WAV:STAR/:WAV:STOP, only the failed window is requested again>] [-s<latency histograms of each phase exported at the end to .json or .csv file> [-i<export period in seconds>]] [-P<transport profile: none (kernel defaults), bulk (SO_RCVBUF sized for the blocks in flight + MSG_WAITALL reads, default), lowlat (bulk + SO_BUSY_POLL/TCP_QUICKACK)>] [-a<pin the receive thread to cpu>] [-u (io_uring receive backend, raw -f data written by a write chained to each recv, GNU/Linux only)] [-z<compress the raw -f file (DBR1 delta + bit-packing + RLE, decompressed by MSO5000_UNPACK) with nb_threads threads (default 4)>] [-l (min/max LOD pyramid of each channel built while receiving, written to <-f file>.lod)] [-F<record nb_frames with the waveform recording (:FUNC:WREC) then download all frames in one pipelined batch>] [-R<ring recording: only the pre waveforms before an event (SIGUSR1 or -T), the waveform of the event and the post waveforms after it are written (default post 0, max_events 0=unlimited)> [-T<event when a sample of channel chan (1 to 4) is above (or below) level_volts>]] [-M<on-host measurements (Vpp, mean, RMS, frequency, rise/fall time) of each channel on worker threads, one row per waveform written to the csv file (printed without file)>] [-S<windowed FFT magnitude spectrum (dBV) of each channel written to the spc file> [-W<window (default hann)>,<FFT points (default whole record, 50%% overlapped segments if smaller)>,<waveforms averaged per spectrum (default 1)>,<FFT threads (default 4)>]] [-D<logic analyzer D0 to D15 displayed: bit-packed uint16 words and edge list of each waveform written to la_file, only the edge list with ,edges>] [-H<capture buffers backed by huge pages: hugetlb (MAP_HUGETLB, thp if no huge page is reserved, default) or thp (transparent huge pages)>] [-j<channels received concurrently over nb_sessions (2 to 8) SCPI sessions, single connection if the instrument shares the waveform source between sessions or is not faster with them, not used with -F, -u and -I>] [-I<HiSLIP session (port 4880) in overlapped mode instead of the raw SCPI socket (port 5555), sub_address default hislip0>] [-L<log level: error, info (progress of the acquisitions), debug (SCPI dialog, default) or trace (each data packet), written by a log thread (per packet events only counted below trace) or by the caller with ,sync>]\nExample:\n" APP_NAME " 10.23.73.21 5555 -n10000 -fwaveform_rx_raw_data.bin\nStop with Ctrl-C\n"
 
 #define __USE_MINGW_ANSI_STDIO 1 // Required for MSYS2 mingw64 to support format "%z" ...
 
+#ifdef _WIN32
+	#define fseeko _fseeki64
+	#define ftello _ftelli64
+#endif
+
 FILE* outfp = NULL;
 int sockfd = -1;
 
+/* -m option: data received directly in a memory mapping of the -f file */
+int mmap_mode = 0;
+mmap_file_t out_mf = MMAP_FILE_INIT;
+
+/* -w option: waveforms are received in a ring of buffers written to the -f file by a writer thread */
+int nb_ring_buffers = 0;
+int ring_drop_when_full = 0;
+capture_ring_t capture_ring;
+capture_slot_t* cur_slot = NULL;
+
+/* -z option: raw samples of the -f file compressed by blocks on worker threads */
+#define CODEC_THREADS_DEFAULT (4)
+int codec_threads = 0;
+codec_writer_t codec_writer;
+
+/* -l option: min/max pyramid of each channel built from the received samples, written to the <-f file>.lod sidecar */
+int lod_mode = 0;
+FILE* lod_fp = NULL;
+lod_pyramid_t lod[4];
+lod_mark_t lod_mark[4]; /* End of the last request received without error */
+unsigned long long lod_nb_samples = 0;
+double lod_time_s = 0;
+
+/* -R/-T options: ring recording, the last waveforms are kept in the capture ring and only the ones around an event are written */
+int retain_pre = -1; /* Waveforms written before the event (-1 = -R not used) */
+int retain_post = 0; /* Waveforms written after the event */
+unsigned int retain_max_events = 0; /* Stop after the post waveforms of max_events events (0 = unlimited) */
+int event_chan = -1; /* -T: host side condition on the samples of this channel */
+double event_level_v = 0;
+int event_below = 0;
+int event_detected = 0; /* -T condition true for the current waveform */
+volatile sig_atomic_t event_signal = 0; /* SIGUSR1 received */
+volatile sig_atomic_t stop_signal = 0; /* Ctrl-C received, the acquisition stops from the main loop */
+
+/* -M option: measurements of each channel computed by worker threads, one row per waveform */
+int meas_mode = 0;
+char* meas_filename = NULL; /* NULL: rows printed */
+meas_engine_t meas;
+
+/* -S/-W options: windowed FFT magnitude spectrum of each channel, averaged over segments and waveforms (Welch) */
+#define SPECTRUM_THREADS_DEFAULT (4)
+char* spectrum_filename = NULL;
+spectrum_window_t spectrum_window = SPECTRUM_WINDOW_HANN;
+size_t spectrum_nfft = 0; /* 0 = whole record */
+unsigned int spectrum_nb_avg = 1;
+int spectrum_threads = SPECTRUM_THREADS_DEFAULT;
+int spectrum_mode = 0;
+spectrum_t spectrum;
+
+/* -D option: digital channels D0 to D15 (fetch_req_t chan LA_CHAN_BASE + n) packed in uint16 words with an edge list */
+#define LA_CHAN_BASE (4)
+#define NB_CHAN_MAX (LA_CHAN_BASE + LA_NB_CHAN)
+char* la_filename = NULL;
+int la_edges_only = 0;
+int la_mode = 0;
+uint16_t la_chan_mask = 0; /* :LA:DIG<n>:DISP? */
+int la_first_chan = -1;
+la_capture_t la;
+
+/* -o option: output file format */
+typedef enum
+{
+	OUT_RAW = 0, /* Bytes as received */
+	OUT_FLOAT, /* float32 volts converted with :WAV:PRE? scaling while data is received */
+	OUT_RG01 /* Rigol MSO5000 .bin file (RG01), a header per channel before the float32 volts */
+} out_format_t;
+const char* out_format_name[] = { "raw", "float", "rg01" };
+out_format_t out_format = OUT_RAW;
+size_t out_sample_size = 1; /* Size in bytes of one sample in the output file */
+float* fbuf = NULL; /* float samples when neither -m nor -w is used (slab of pool) */
+size_t fbuf_nb_samples = 0;
+float convert_time_s = 0;
+char* out_filename = NULL;
+rg01_writer_t rg01;
+size_t out_hdr_size = 0; /* Size of the header before the samples of each channel (-org01) */
+
+/* -c option: each channel is requested by windows of window_points with :WAV:STAR/:WAV:STOP (0 = whole channel) */
+size_t window_points = 0;
+
+/* -F option: nb_frames recorded by the scope (waveform recording) then downloaded in one pipelined batch (0 = :SING per waveform) */
+int nb_frames = 0;
+int wrec_frames_max = 0; /* :FUNC:WREC:FMAX? */
+double wrec_interval_s = 0; /* :FUNC:WREC:FINT?, time tag of frame n is (n - 1) * wrec_interval_s after the start */
+int wrep_frame_sent = 0; /* Last :FUNC:WREP:FCUR sent (0 = unknown) */
+
+/* One :WAV:DATA? request, a whole channel or a window of a channel */
+typedef struct
+{
+	int frame; /* Recorded frame (1 based) selected with :FUNC:WREP:FCUR, 0 without -F */
+	int chan;
+	size_t start; /* First point (1 based), 0 for a whole channel without :WAV:STAR/:WAV:STOP */
+	size_t nb_points;
+	int first; /* First request of the channel */
+	int last; /* Last request of the channel */
+	struct timeval sent_tv; /* :WAV:DATA? written to the socket */
+} fetch_req_t;
+fetch_req_t* fetch_list = NULL;
+int nb_fetch = 0;
+
+/* *IDN? reply, used as marker to resynchronize after an error */
+char idn_reply[256];
+#define NB_RETRY 10
+
+/* -s/-i options: latency histogram of each phase exported as JSON/CSV at the end and every stats_period_s */
+typedef enum
+{
+	PHASE_TRIG_WAIT = 0, /* :SING to STOP */
+	PHASE_DATA_HEADER, /* :WAV:DATA? sent (or end of previous reply when pipelined) to block header */
+	PHASE_DATA_PAYLOAD, /* Block header to last payload byte */
+	PHASE_DATA_TERMINATOR, /* Last payload byte to block terminator */
+	PHASE_DISK_WRITE, /* fwrite() of a channel (-f) or of a waveform (-w writer thread), not measured with -m */
+	NB_PHASES
+} phase_t;
+const char* phase_name[NB_PHASES] = { "trig_wait", "data_header", "data_payload", "data_terminator", "disk_write" };
+latency_hist_t phase_hist[NB_PHASES];
+latency_hist_t* phase_hist_list[NB_PHASES];
+char* stats_filename = NULL;
+float stats_period_s = 0;
+
+/* -t option: how the end of the acquisition is detected after :SING */
+typedef enum
+{
+	TRIG_WAIT_POLL = 0, /* :TRIG:STAT? + *WAI tight poll until STOP */
+	TRIG_WAIT_OPC, /* *OPC? (blocks until operations are complete) */
+	TRIG_WAIT_ESR, /* *OPC then *ESR? poll with exponential backoff until OPC bit is set */
+	TRIG_WAIT_STB, /* *OPC then *STB? poll with exponential backoff until ESB bit is set */
+	TRIG_WAIT_SRQ /* *OPC then wait for the service request (ESB enabled by *SRE) on the HiSLIP asynchronous channel */
+} trig_wait_t;
+const char* trig_wait_name[] = { "poll", "opc", "esr", "stb", "srq" };
+trig_wait_t trig_wait = TRIG_WAIT_POLL;
+
+#define TRIG_WAIT_BACKOFF_MIN_MS (1)
+#define TRIG_WAIT_BACKOFF_MAX_MS (100)
+/* Status byte read on the asynchronous channel when no service request is received for this time (lost SRQ) */
+#define TRIG_WAIT_SRQ_TIMEOUT_MS (1000)
+#define ESR_OPC_BIT (0x01)
+#define STB_ESB_BIT (0x20)
+
+/* Trigger wait latency measurements */
+struct timeval sing_tv; /* :SING sent */
+int first_byte_pending; /* Set until the first byte of the first :WAV:DATA? reply is received */
+float trig_first_byte_s;
+
+scpi_queue_t scpi_q;
+#define PIPELINE_DEPTH_DEFAULT (4)
+int pipeline_depth = PIPELINE_DEPTH_DEFAULT;
+
+/* -P/-a options: socket tuning of the data connection and CPU of the receive thread */
+transport_profile_t transport;
+transport_profile_mode_t transport_mode = TRANSPORT_PROFILE_BULK;
+int transport_cpu = -1;
+
+/* -u option: io_uring receive backend, raw -f data written by writes chained to the recv */
+#define URING_ENTRIES (16)
+int use_uring = 0;
+int uring_write = 0;
+unsigned long long uring_bytes_written;
+
+/* -j option: the channels are received concurrently over nb_sessions SCPI sessions, the main connection only triggers */
+#define SESSION_PROBE_POINTS (1000000)
+int nb_sessions = 0;
+int sessions_active = 0;
+scpi_sessions_t sessions;
+scpi_session_req_t* session_reqs = NULL; /* Request k of fetch_list */
+
+/* -L option: records up to log_level written (debug: per packet events only counted), by the log thread unless log_sync */
+async_log_level_t log_level = ASYNC_LOG_DEBUG;
+int log_sync = 0;
+
+/* -I option: HiSLIP session instead of the raw SCPI socket (sockfd is its synchronous channel) */
+int hislip_mode = 0;
+const char* hislip_sub_address = HISLIP_SUB_ADDRESS_DEFAULT;
+hislip_t hislip;
+
 #define CURR_TIME_SIZE (40)
 char currTime[CURR_TIME_SIZE+1] = "";
 struct timeval start_tv;
 struct timeval curr_tv;
 
-#define BUFSIZE (250000000) // Max 250 Millions samples on Rigol MSO5000
+#define BUFSIZE (1024*1024) // Replies/flush and #0 blocks of the channels without slab (data received in the output file mapping or the capture ring)
+#define CHAN_RX_HDR_SIZE (64) // First recv() of a :WAV:DATA? reply (block header + start of payload)
 unsigned char* buf = NULL;
+size_t buf_size;
+
+/* Capture buffers sized from :WAV:PRE? and mapped once (-H: huge pages), reused by all the waveforms */
+buffer_pool_t pool;
+buffer_pool_pages_t pool_pages = BUFFER_POOL_PAGES_DEFAULT;
+/* Slab of each channel kept for the whole waveform (windows at their offset, digital channels share one), NULL if received in the output */
+unsigned char* chan_slab[NB_CHAN_MAX];
+size_t chan_slab_size[NB_CHAN_MAX];
 unsigned int total_bytes;
 unsigned int packet_nb;
 
-// Analog waveform data from WAV:PRE?
+// Analog waveform data from WAV:PRE? (of each channel, and of the last channel in globals below)
+typedef struct
+{
+	int format;
+	int type;
+	size_t npoints;
+	int unused3;
+	double sec_per_sample;
+	double xorigin;
+	double xreference;
+	double yincrement;
+	double yorigin;
+	double yreference;
+} wav_preamble_t;
+wav_preamble_t chan_preamble[NB_CHAN_MAX];
+
 int format;
 int type;
 size_t npoints;
@@ -66,16 +287,32 @@ size_t fs_per_sample;
 
 void error(char *msg);
 
+/* Formatted and written by the log thread (-L), prefixed with the time since start */
 void printf_dbg(const char *fmt, ...)
 {
 	va_list args;
 
-	gettimeofday(&curr_tv, NULL);
-	get_CurrentTime(currTime, CURR_TIME_SIZE);
-	printf("%s (%05.03f s) ", currTime, TimevalDiff(&curr_tv, &start_tv));
+	va_start(args, fmt);
+	async_log_vprintf(ASYNC_LOG_DEBUG, ASYNC_LOG_PREFIX_REL, fmt, args);
+	va_end(args);
+}
+
+void printf_err(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	async_log_vprintf(ASYNC_LOG_ERROR, ASYNC_LOG_PREFIX_REL, fmt, args);
+	va_end(args);
+}
+
+/* Progress of the acquisitions */
+void printf_info(async_log_prefix_t prefix, const char *fmt, ...)
+{
+	va_list args;
 
 	va_start(args, fmt);
-	vprintf(fmt, args);
+	async_log_vprintf(ASYNC_LOG_INFO, prefix, fmt, args);
 	va_end(args);
 }
 
@@ -85,13 +322,18 @@ void syntax(void)
 	printf(SYNTAX);
 }
 
+/*
+ * Only the stop flag is set (cleanup() takes locks, joins threads and uses stdio), the
+ * main loop and the waits check it. A second Ctrl-C terminates the process at once.
+ */
 #ifdef _WIN32
 BOOL WINAPI consoleHandler(DWORD signal)
 {
 	if (signal == CTRL_C_EVENT)
 	{
-		printf("\nCtrl-C pressed\nExit\n");
-		error(NULL);
+		if(stop_signal)
+			return FALSE;
+		stop_signal = 1;
 	}
 	return TRUE;
 }
@@ -100,26 +342,114 @@ void consoleHandler(int s)
 {
 	if (s == SIGINT) // Ctrl-C
 	{
+		stop_signal = 1;
+		signal(SIGINT, SIG_DFL);
+	}
+}
+#endif
+
+/* Ctrl-C while waiting in a waveform: exit without finishing it */
+void stop_if_requested(void)
+{
+	if(stop_signal)
+	{
+		async_log_flush();
 		printf("\nCtrl-C pressed\nExit\n");
 		error(NULL);
 	}
 }
+
+#ifndef _WIN32
+void eventHandler(int s)
+{
+	if (s == SIGUSR1)
+		event_signal = 1;
+}
 #endif
 
+/* -T: 1 if a sample is above (or below with event_below) level_code */
+int event_condition(const unsigned char* data, int nb, float level_code)
+{
+	unsigned char vmin = 0xFF;
+	unsigned char vmax = 0;
+	int i;
+
+	/* Plain min/max loop, vectorized by the compiler */
+	for(i = 0; i < nb; i++)
+	{
+		vmin = (data[i] < vmin) ? data[i] : vmin;
+		vmax = (data[i] > vmax) ? data[i] : vmax;
+	}
+	if(nb == 0)
+		return 0;
+	return event_below ? (vmin < level_code) : (vmax > level_code);
+}
+
+/* Called from the normal control flow after the log lines are flushed (error() or end of main()) */
 void cleanup(void)
 {
+	/* Before the pool, the session threads receive in the slabs */
+	scpi_sessions_close(&sessions);
+	sessions_active = 0;
+	if(session_reqs != NULL)
+	{
+		free(session_reqs);
+		session_reqs = NULL;
+	}
+
+	capture_ring_close(&capture_ring);
+
+	if(stats_filename != NULL)
+	{
+		gettimeofday(&curr_tv, NULL);
+		if(latency_hist_export(stats_filename, phase_hist_list, NB_PHASES, TimevalDiff(&curr_tv, &start_tv)) == 0)
+			printf("Latency histograms exported to %s\n", stats_filename);
+		stats_filename = NULL;
+	}
+
+	codec_writer_close(&codec_writer);
+	meas_engine_close(&meas);
+	spectrum_close(&spectrum);
+	la_capture_close(&la);
+	if(lod_fp != NULL)
+	{
+		fclose(lod_fp);
+		lod_fp = NULL;
+	}
+	for(int k = 0; k < 4; k++)
+		lod_pyramid_free(&lod[k]);
 	if(outfp != NULL)
 	{
+		if(uring_write)
+		{
+			/* Chained writes of a failed channel can go past the data kept */
+			fflush(outfp);
+			if(ftruncate(fileno(outfp), ftello(outfp)) != 0)
+				printf("ERROR ftruncate() of the output file\n");
+		}
 		fclose(outfp);
 		outfp = NULL;
 	}
+	mmap_file_close(&out_mf);
+
+	if( (out_format == OUT_RG01) && (out_filename != NULL) )
+	{
+		/* Patch file_size/nb_waveforms now that all data is written */
+		int nb_rg01_waveforms = rg01_writer_finish(out_filename);
+		if(nb_rg01_waveforms >= 0)
+			printf("RG01 file %s: nb_waveforms=%d\n", out_filename, nb_rg01_waveforms);
+		out_filename = NULL;
+	}
 
+	if(hislip_mode)
+		hislip_close(&hislip);
 	if(sockfd != -1)
 	{
 		sockClose(sockfd);
 		sockfd = -1;
 	}
 
+	sockUringQuit();
 	sockQuit();
 
 	if(buf != NULL)
@@ -127,6 +457,20 @@ void cleanup(void)
 		free(buf);
 		buf = NULL;
 	}
+
+	/* fbuf and the channel slabs */
+	buffer_pool_free(&pool);
+	fbuf = NULL;
+	fbuf_nb_samples = 0;
+	memset(chan_slab, 0, sizeof(chan_slab));
+
+	if(fetch_list != NULL)
+	{
+		free(fetch_list);
+		fetch_list = NULL;
+	}
+
+	async_log_stop();
 }
 
 /*
@@ -134,6 +478,8 @@ void cleanup(void)
 */
 void error(char *msg)
 {
+	/* The message after the lines logged before */
+	async_log_flush();
 	if(msg != NULL)
 	{
 		if(sockGetErrno() != 0)
@@ -150,428 +496,1961 @@ void error(char *msg)
 	exit(-1);
 }
 
-/* Return nb data read or 0 in case of error */
-int read_chan_data(int chan)
+/* Queue a command, it is written to the socket with the next scpi_queue_flush() */
+void scpi_cmd(const char *cmd)
 {
-	int read_nb, fwrite_nb;
-	int nb_data;
-	unsigned char str_buf[256];
-	unsigned char buf_last_data[1];
+	printf_dbg("%s", cmd);
+	if(scpi_queue_cmd(&scpi_q, cmd) < 0)
+		error("ERROR scpi_queue_cmd()");
+}
 
-	sprintf((char *)str_buf, ":WAV:DATA?\n");
-	printf_dbg("%s", str_buf);
-	socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
+/* Queue a query, the reply shall be read later with scpi_read_reply() (FIFO order) */
+void scpi_query(const char *query)
+{
+	printf_dbg("%s", query);
+	if(scpi_queue_query(&scpi_q, query) < 0)
+		error("ERROR scpi_queue_query()");
+}
 
-	if(chan == 0)
-	{
-		sprintf((char *)str_buf, "*WAI\n");
-		printf_dbg("%s", str_buf);
-		socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
-	}
+/* Read the reply of the oldest pending query */
+void scpi_read_reply(char *reply, int reply_size)
+{
+	int read_nb;
 
-	/* receive header from the server */
-	bzero(buf, 12);
-	read_nb = socket_read_nbytes(sockfd, buf, 11);
-	if(read_nb != 11)
+	read_nb = scpi_queue_read_line(&scpi_q, reply, reply_size);
+	if(read_nb <= 0)
 	{
-		printf_dbg("ERROR socket_read_nbytes() to read from socket\n");
+		printf_err("ERROR recv() to read from socket\n");
 		error("ERROR recv()");
 	}
-	nb_data = atoi((char *)&buf[2]);
-	printf_dbg("WAV:DATA?=%s (nb_data=%d)\n", buf, nb_data);
-	// Add robustness check to avoid buffer overflow/underflow
-	if(nb_data < 0)
-	{
-		printf_dbg("Error nb_data(%d)< 0\n", nb_data);
-		return 0;
-	}
-	if(nb_data >= BUFSIZE)
-	{
-		printf_dbg("Error nb_data(%d) >= BUFSIZE(%d)\n", nb_data, BUFSIZE);
-		return 0;
-	}
+}
 
-	int expected_nb_data = nb_data;
-	int nb_total_read = 0;
-	while(expected_nb_data > 0)
+/* Queue :WAV:DATA? requests of fetch_list until max_in_flight queries are in flight */
+void request_chan_data(int* next_req, int max_in_flight)
+{
+	char str_buf[64];
+	fetch_req_t* req;
+	int first_req = *next_req;
+
+	/* -j: all the requests are sent by the sessions */
+	if(sessions_active)
+		return;
+	while( (*next_req < nb_fetch) && (scpi_queue_in_flight(&scpi_q) < max_in_flight) )
 	{
-		read_nb = recv(sockfd, (char *)(&buf[nb_total_read]), expected_nb_data, 0);
-		if(read_nb == 0)
-		{
-			printf_dbg("\nEnd of file/connection closed by server\n");	
-			return 0;
-		}
-		if(read_nb < 0)
+		req = &fetch_list[*next_req];
+
+		if( (req->frame > 0) && (req->frame != wrep_frame_sent) )
 		{
-			printf_dbg("ERROR recv() to read from socket\n");
-			return 0;
+			sprintf(str_buf, ":FUNC:WREP:FCUR %d\n", req->frame);
+			scpi_cmd(str_buf);
+			wrep_frame_sent = req->frame;
 		}
-		if(read_nb == 1) // Error
+		if(req->chan >= LA_CHAN_BASE)
+			sprintf(str_buf, ":WAV:SOUR D%d\n", req->chan - LA_CHAN_BASE);
+		else
+			sprintf(str_buf, ":WAV:SOUR CHAN%d\n", req->chan+1);
+		scpi_cmd(str_buf);
+		if(req->start > 0)
 		{
-			printf_dbg("Error RigolMSO5000 READ 0x%02X (expected %d data)\n", buf[nb_total_read], expected_nb_data);
-			if(buf[nb_total_read] == 0x0A)
+			/* :WAV:STAR 1 first so :WAV:STOP is never before :WAV:STAR whatever the previous window */
+			scpi_cmd(":WAV:STAR 1\n");
+			sprintf(str_buf, ":WAV:STOP %zu\n", req->start + req->nb_points - 1);
+			scpi_cmd(str_buf);
+			if(req->start > 1)
 			{
-				return 0;
+				sprintf(str_buf, ":WAV:STAR %zu\n", req->start);
+				scpi_cmd(str_buf);
 			}
 		}
-		expected_nb_data -= read_nb;
-		total_bytes += read_nb;
-		nb_total_read += read_nb;
-		packet_nb++;
-		printf_dbg("packet_nb=%05d TotalBytes=%08d (recv=%04d nb_total_read=%04d)\n",
-				packet_nb, total_bytes,
-				read_nb, nb_total_read);
+		if(req->chan == 0)
+			scpi_cmd("*WAI\n");
+
+		scpi_query(":WAV:DATA?\n");
+		if(req->chan == 0)
+			scpi_cmd("*WAI\n");
+
+		(*next_req)++;
 	}
-	if(read_nb > 0)
-	{
-		/* Read last data 0x0A END */
-		bzero(buf_last_data, 1);
-		read_nb = socket_read_nbytes(sockfd, buf_last_data, 1);
-		if(read_nb != 1)
-		{
-			printf_dbg("ERROR socket_read_nbytes() to read from socket\n");
-			error("ERROR recv()");
-		}
+	scpi_queue_flush(&scpi_q);
+	gettimeofday(&curr_tv, NULL);
+	for(; first_req < *next_req; first_req++)
+		fetch_list[first_req].sent_tv = curr_tv;
+}
 
-		//printf_dbg("End=0x%02X\n",	buf_last_data[0]);
-		if(buf_last_data[0] == 0x0A)
+void parse_wav_preamble(const char* reply, wav_preamble_t* pre)
+{
+	sscanf(reply,
+			"%d,%d,%zu,%d,%lf,%lf,%lf,%lf,%lf,%lf",
+			&pre->format,
+			&pre->type,
+			&pre->npoints,
+			&pre->unused3,
+			&pre->sec_per_sample,
+			&pre->xorigin,
+			&pre->xreference,
+			&pre->yincrement,
+			&pre->yorigin,
+			&pre->yreference);
+}
+
+/* Build fetch_list, one request per channel or per window of window_points (of each frame with -F) */
+void build_fetch_list(int* chan_list, int nb_chan)
+{
+	size_t nb_points;
+	size_t start;
+	int nb = 0;
+	int frame;
+	int k;
+
+	for(k = 0; k < nb_chan; k++)
+	{
+		nb_points = chan_preamble[chan_list[k]].npoints;
+		nb += (window_points > 0) ? ((nb_points + window_points - 1) / window_points) : 1;
+	}
+	if(nb_frames > 0)
+		nb *= nb_frames;
+	fetch_list = calloc((nb > 0) ? nb : 1, sizeof(fetch_req_t));
+	if(fetch_list == NULL)
+		error("ERROR calloc(fetch_list)");
+
+	nb_fetch = 0;
+	/* Frame 0 is the last acquisition (no :FUNC:WREP:FCUR) */
+	for(frame = (nb_frames > 0) ? 1 : 0; frame <= nb_frames; frame++)
+	{
+		for(k = 0; k < nb_chan; k++)
 		{
-			/* Write data received to file */
-			if(read_nb > 0)
+			nb_points = chan_preamble[chan_list[k]].npoints;
+			if(window_points == 0)
 			{
-				if(outfp != NULL)
-				{
-					// double ydelta = yorigin + yreference;
-					// float v = (float(buf[j]) - ydelta) * yincrement;
-					fwrite_nb = fwrite(buf, sizeof(char), nb_total_read, outfp);
-					if(fwrite_nb != nb_total_read)
-					{
-						printf_dbg("fwrite() on outfp error len=%d != expected %d\n", fwrite_nb, nb_total_read);
-					}
-				}
+				fetch_list[nb_fetch].frame = frame;
+				fetch_list[nb_fetch].chan = chan_list[k];
+				fetch_list[nb_fetch].start = 0;
+				fetch_list[nb_fetch].nb_points = nb_points;
+				fetch_list[nb_fetch].first = 1;
+				fetch_list[nb_fetch].last = 1;
+				nb_fetch++;
+				continue;
 			}
-			return nb_data;
-		}	else
-		{
-			printf_dbg("ERROR RigolMSO5000 Read (first data=0x%02X) last data=0x%02X != 0x0A => flush all data\n", buf[0], buf_last_data[0]);
-			read_nb = recv(sockfd, (char *)buf, BUFSIZE, 0);
-			if(read_nb > 0)
-			{
-				printf_dbg("Flush %d data (last data=0x%02X)\n", read_nb, buf[read_nb-1]);
-			} else
+			for(start = 1; start <= nb_points; start += window_points)
 			{
-				printf_dbg("Flush 0 data\n");
+				fetch_list[nb_fetch].frame = frame;
+				fetch_list[nb_fetch].chan = chan_list[k];
+				fetch_list[nb_fetch].start = start;
+				fetch_list[nb_fetch].nb_points = ((nb_points - start + 1) < window_points) ? (nb_points - start + 1) : window_points;
+				fetch_list[nb_fetch].first = (start == 1);
+				fetch_list[nb_fetch].last = ((start + window_points) > nb_points);
+				nb_fetch++;
 			}
-			return 0;
 		}
 	}
-	return 0;
 }
 
-int main(int argc, char **argv)
+/*
+ * Drop the queries in flight and all data received until the reply to *IDN?
+ * (the replies are sent in order so the data after it is in sync), return 0 if OK
+ * With -I the replies in flight are dropped by a HiSLIP device clear.
+ */
+int scpi_resync(void)
 {
-	static unsigned char str_buf[255+1];
-	struct sockaddr_in serveraddr;
-	struct hostent *server;
-	int portno;
-	char *hostname;
-	char *from_server_filename;
-	int err_connect;
-	int read_nb;
-	int is_chan_enabled[4];
-	int nb_chan;
-	int nb_total_acq_failed;
-	int nb_acq_failed;
-	int nb_acq_failed_curr_chan;
-	int nb_waveform = -1;
-	int nb_retry = 10;
-	int i;
-	
-	struct timeval start_acq;
-	struct timeval curr_acq;
+	long long nb_dropped;
 
-	float acq_time;
-	float acq_time_min = FLT_MAX;
-	float acq_time_max = FLT_MIN;
-	float acq_time_sum = 0;
+	nb_dropped = scpi_queue_resync(&scpi_q, idn_reply, buf, buf_size);
+	if(nb_dropped < 0)
+	{
+		printf_err("ERROR scpi_resync() recv()\n");
+		return -1;
+	}
+	printf_dbg("scpi_resync() %lld bytes dropped\n", nb_dropped);
+	return 0;
+}
 
-	struct timeval start_data;
-	struct timeval curr_data;
+/* :WAV:SOUR parameter of chan */
+void session_source(char* source, int chan)
+{
+	if(chan >= LA_CHAN_BASE)
+		sprintf(source, "D%d", chan - LA_CHAN_BASE);
+	else
+		sprintf(source, "CHAN%d", chan+1);
+}
 
-	sockInit();
+/*
+ * -j: open the sessions, check that each one keeps its own :WAV:SOUR and that they are faster
+ * than a single one, then assign the requests of fetch_list (one session per channel of chan_list),
+ * return 0 if the sessions are used or -1 (single connection)
+ */
+int sessions_setup(const char* hostname, int portno, int timeout_s, const int* chan_list, int nb_chan, size_t block_size)
+{
+	scpi_session_req_t probe_reqs[SCPI_SESSION_MAX];
+	const char* sources[SCPI_SESSION_MAX];
+	char str_buf[64];
+	size_t max_points = 0;
+	int k, n;
 
-	printf(BANNER1);
-	printf("Stop with Ctrl-C\n");
-	printf("Parameters:\n");
-	for(i = 0; i < argc; i++)
+	if(nb_chan < nb_sessions)
 	{
-		printf("%s ", argv[i]);
+		printf("scpi_sessions: %d channels, %d sessions used\n", nb_chan, nb_chan);
+		nb_sessions = nb_chan;
 	}
-	printf("\n");
-
-	/* check command line arguments */
-	if ( (argc < 3) || (argc > 5) ) 
+	if(nb_sessions < 2)
+		return -1;
+	if(scpi_sessions_open(&sessions, hostname, portno, nb_sessions, timeout_s, transport_mode, pipeline_depth, transport_cpu) != 0)
+		return -1;
+	for(k = 0; k < nb_sessions; k++)
+		transport_profile_apply(&sessions.s[k].tp, block_size, pipeline_depth);
+
+	/* The first window of a channel per session, received in the slab of the channel */
+	memset(probe_reqs, 0, sizeof(probe_reqs));
+	for(k = 0; k < nb_sessions; k++)
 	{
-		syntax();
-		exit(0);
+		session_source(probe_reqs[k].source, chan_list[k]);
+		sources[k] = probe_reqs[k].source;
+		probe_reqs[k].start = 1;
+		probe_reqs[k].nb_points = (chan_preamble[chan_list[k]].npoints < SESSION_PROBE_POINTS) ? chan_preamble[chan_list[k]].npoints : SESSION_PROBE_POINTS;
+		probe_reqs[k].dst = chan_slab[chan_list[k]];
+		probe_reqs[k].dst_size = chan_slab_size[chan_list[k]];
 	}
-	hostname = argv[1];
-	portno = atoi(argv[2]);
-	if(argc > 3)
+	if(scpi_sessions_check_source(&sessions, sources) != 0)
 	{
-		for(i = 3; i < argc; i++)
-		{
-			if(strncmp(argv[i], "-n", 2) == 0)
-			{
-				nb_waveform = atoi(&argv[i][2]);
-				printf("nb_waveform: %d\n", nb_waveform);
-			} else if(strncmp(argv[i], "-f", 2) == 0)
-			{
-				from_server_filename = &argv[i][2];
-				printf("waveform_rx_raw_data_file: %s\n", from_server_filename);
-				outfp = fopen(from_server_filename, "wb");
-				if (outfp != NULL)
-				{
-					printf("waveform_rx_raw_data_file created OK\n");
-				}
-				else
-				{
-					printf("waveform_rx_raw_data_file error to create file: %s\n", from_server_filename);
-					exit(-3);
-				}
-			} else 
-			{
-				printf("Error unknown argument %s\n", argv[i]);
-				syntax();
-				exit(-3);
-			}
-		}
+		scpi_sessions_close(&sessions);
+		return -1;
 	}
-
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd < 0)
+	n = scpi_sessions_probe(&sessions, probe_reqs, nb_sessions);
+	/* Whole channels are requested without :WAV:STAR/:WAV:STOP, back to all the points */
+	for(k = 0; k < nb_chan; k++)
 	{
-		printf("ERROR socket return %d\n", sockfd);
-		error("ERROR opening socket");
-	}
-
-	server = gethostbyname(hostname);
-	if (server == NULL) {
-		printf("ERROR no such host as %s\n", hostname);
-		error("ERROR gethostbyname()");
+		if(chan_preamble[chan_list[k]].npoints > max_points)
+			max_points = chan_preamble[chan_list[k]].npoints;
 	}
-
-	/* build the server's Internet address */
-	bzero((char *) &serveraddr, sizeof(serveraddr));
-	serveraddr.sin_family = AF_INET;
-	bcopy((char *)server->h_addr, (char *)&serveraddr.sin_addr.s_addr, server->h_length);
-	serveraddr.sin_port = htons(portno);
-
-	/* connect: create a connection with the server */
-	err_connect = connect(sockfd, (const struct sockaddr*)&serveraddr, sizeof(serveraddr));
-	if(err_connect < 0)
+	sprintf(str_buf, ":WAV:STAR 1\n:WAV:STOP %zu\n", max_points);
+	if( (scpi_sessions_cmd(&sessions, str_buf) != 0) || (n != 0) )
 	{
-		error("ERROR connect()");
+		scpi_sessions_close(&sessions);
+		return -1;
 	}
 
-	// TCP_NODELAY = 1 => Disable Nagle's algorithm for send coalescing.
-	sockSetOpt(sockfd, "TCP_NODELAY", IPPROTO_TCP, TCP_NODELAY, 1);
-	int timeout_in_seconds = 40;
-	// Set RX & TX Timeout to 40 seconds required to capture up to 200Mpts
-	sockSetOpt_Timeout(sockfd, "SO_RCVTIMEO", SOL_SOCKET, SO_RCVTIMEO, timeout_in_seconds);
-	sockSetOpt_Timeout(sockfd, "SO_SNDTIMEO", SOL_SOCKET, SO_SNDTIMEO, timeout_in_seconds);
-
-	buf = malloc(BUFSIZE);
-	if(buf == NULL)
+	session_reqs = calloc(nb_fetch, sizeof(scpi_session_req_t));
+	if(session_reqs == NULL)
+		error("ERROR calloc(session_reqs)");
+	for(k = 0; k < nb_fetch; k++)
 	{
-		error("ERROR malloc(BUFSIZE)");
+		const fetch_req_t* req = &fetch_list[k];
+		size_t base = (req->start > 0) ? (req->start - 1) : 0;
+
+		for(n = 0; chan_list[n] != req->chan; n++)
+			;
+		session_reqs[k].session = n % nb_sessions;
+		session_source(session_reqs[k].source, req->chan);
+		session_reqs[k].start = req->start;
+		session_reqs[k].nb_points = req->nb_points;
+		session_reqs[k].dst = &chan_slab[req->chan][base];
+		session_reqs[k].dst_size = chan_slab_size[req->chan] - base;
 	}
+	sessions.stop_flag = &stop_signal;
+	return 0;
+}
 
-	total_bytes = 0;
-	packet_nb = 0;
+/* Send a query (not traced) and read its reply */
+void trig_wait_query(const char *query, char *reply, int reply_size)
+{
+	if(scpi_queue_query(&scpi_q, query) < 0)
+		error("ERROR scpi_queue_query()");
+	scpi_read_reply(reply, reply_size);
+}
 
-	gettimeofday(&start_tv, NULL);
+/*
+ * Send :SING and wait for the end of the acquisition with the trig_wait strategy
+ * Return the number of queries sent to wait
+ */
+int wait_trigger(void)
+{
+	char reply[32];
+	int nb_queries = 0;
+	int backoff_ms = TRIG_WAIT_BACKOFF_MIN_MS;
+	int status;
 
-	/* Clears all the event registers, and also clears the error queue. */
-	sprintf((char *)str_buf, "*CLS\n");
-	printf_dbg("%s", str_buf);
-	socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
+	gettimeofday(&sing_tv, NULL);
+	first_byte_pending = 1;
 
-	sprintf((char *)str_buf, ":STOP\n");
-	printf_dbg("%s", str_buf);
-	socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
+	/* :SING is sent in the same write as the first query */
+	scpi_cmd(":SING\n");
 
-	/* Check Operation Complete */
-	sprintf((char *)str_buf, "*OPC?\n");
-	printf_dbg("%s", str_buf);
-	socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
-	/* receive info from the server */
-	bzero(buf, 21);
-	read_nb = recv(sockfd, (char *)buf, 20, 0);
-	if(read_nb <= 0)
+	switch(trig_wait)
 	{
-		printf_dbg("ERROR recv() to read from socket\n");
-		error("ERROR recv()");
+		case TRIG_WAIT_OPC:
+			trig_wait_query("*OPC?\n", reply, sizeof(reply));
+			nb_queries++;
+			break;
+
+		case TRIG_WAIT_ESR:
+		case TRIG_WAIT_STB:
+			/* OPC bit of the Standard Event Register is set once :SING is complete */
+			scpi_cmd("*OPC\n");
+			while(1)
+			{
+				if(trig_wait == TRIG_WAIT_ESR)
+				{
+					trig_wait_query("*ESR?\n", reply, sizeof(reply));
+					status = atoi(reply) & ESR_OPC_BIT;
+				} else
+				{
+					trig_wait_query("*STB?\n", reply, sizeof(reply));
+					status = atoi(reply) & STB_ESB_BIT;
+				}
+				nb_queries++;
+				if(status)
+					break;
+				stop_if_requested();
+				/* Adaptive backoff to not flood the SCPI parser during slow triggers */
+				sleep_ms(backoff_ms);
+				backoff_ms *= 2;
+				if(backoff_ms > TRIG_WAIT_BACKOFF_MAX_MS)
+					backoff_ms = TRIG_WAIT_BACKOFF_MAX_MS;
+			}
+			if(trig_wait == TRIG_WAIT_STB)
+			{
+				/* Clear the Standard Event Register */
+				trig_wait_query("*ESR?\n", reply, sizeof(reply));
+				nb_queries++;
+			}
+			break;
+
+		case TRIG_WAIT_SRQ:
+			/* No polling of the synchronous channel, the instrument requests service once :SING is complete */
+			scpi_cmd("*OPC\n");
+			if(scpi_queue_flush(&scpi_q) <= 0)
+				error("ERROR scpi_queue_flush()");
+			while(1)
+			{
+				if(hislip_wait_srq(&hislip, TRIG_WAIT_SRQ_TIMEOUT_MS) < 0)
+					error("ERROR hislip_wait_srq()");
+				status = hislip_status_query(&hislip);
+				if(status < 0)
+					error("ERROR hislip_status_query()");
+				nb_queries++;
+				if(status & STB_ESB_BIT)
+					break;
+				stop_if_requested();
+			}
+			/* Clear the Standard Event Register (ESB and the service request) */
+			trig_wait_query("*ESR?\n", reply, sizeof(reply));
+			nb_queries++;
+			break;
+
+		case TRIG_WAIT_POLL:
+		default:
+			break;
 	}
-	printf_dbg("*OPC?=%s", buf);
-	/* Check Operation Complete */
 
-	sprintf((char *)str_buf, "*IDN?\n");
-	printf_dbg("%s", str_buf);
-	socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
-	/* receive info from the server */
-	bzero(buf, 201);
-	read_nb = recv(sockfd, (char *)buf, 200, 0);
-	if(read_nb <= 0)
+	/* Check acquisition is stopped (tight poll for TRIG_WAIT_POLL, backoff for other strategies) */
+	backoff_ms = TRIG_WAIT_BACKOFF_MIN_MS;
+	while(1)
 	{
-		printf_dbg("ERROR recv() to read from socket\n");
-		error("ERROR recv()");
+		if(scpi_queue_query(&scpi_q, ":TRIG:STAT?\n") < 0)
+			error("ERROR scpi_queue_query()");
+		scpi_queue_cmd(&scpi_q, "*WAI\n");
+		scpi_read_reply(reply, sizeof(reply));
+		nb_queries++;
+		if( strncmp(reply, "STOP", 4) == 0 )
+			break;
+		stop_if_requested();
+		if(trig_wait != TRIG_WAIT_POLL)
+		{
+			sleep_ms(backoff_ms);
+			backoff_ms *= 2;
+			if(backoff_ms > TRIG_WAIT_BACKOFF_MAX_MS)
+				backoff_ms = TRIG_WAIT_BACKOFF_MAX_MS;
+		}
 	}
-	printf_dbg("IDN?=%s", buf);
+	return nb_queries;
+}
 
-	sprintf((char *)str_buf, ":WAV:MODE RAW\n");
-	printf_dbg("%s", str_buf);
-	socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
+/*
+ * -F: record nb_frames with the waveform recording (:FUNC:WREC:FEND set at start)
+ * and wait for the end of the recording, return the number of queries sent to wait
+ */
+int wait_recording(void)
+{
+	char reply[32];
+	int nb_queries = 0;
+	int backoff_ms = TRIG_WAIT_BACKOFF_MIN_MS;
 
-	sprintf((char *)str_buf, ":WAV:FORM BYTE\n");
-	printf_dbg("%s", str_buf);
-	socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
+	gettimeofday(&sing_tv, NULL);
+	first_byte_pending = 1;
 
-	/* Retrieve Channels details */
-	nb_chan = 0;
-	for(i = 0; i < 4; i++)
+	/* :FUNC:WREC:OPER RUN is sent in the same write as the first query */
+	scpi_cmd(":FUNC:WREC:OPER RUN\n");
+	while(1)
 	{
-		sprintf((char *)str_buf, ":CHAN%d:DISP?\n", i+1 );
-		printf_dbg("%s", str_buf);
-		socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
-		/* receive info from the server */
-		bzero(buf, 11);
-		read_nb = recv(sockfd, (char *)buf, 10, 0);
-		if(read_nb <= 0)
-		{
-			printf_dbg("ERROR recv() to read from socket\n");
-			error("ERROR recv()");
+		trig_wait_query(":FUNC:WREC:OPER?\n", reply, sizeof(reply));
+		nb_queries++;
+		if( strncmp(reply, "STOP", 4) == 0 )
+			break;
+		stop_if_requested();
+		/* A recording lasts at least nb_frames triggers */
+		sleep_ms(backoff_ms);
+		backoff_ms *= 2;
+		if(backoff_ms > TRIG_WAIT_BACKOFF_MAX_MS)
+			backoff_ms = TRIG_WAIT_BACKOFF_MAX_MS;
+	}
+	/* The current frame is reset by the recording */
+	wrep_frame_sent = 0;
+	return nb_queries;
+}
+
+/* :WAV:DATA? block being received by read_chan_data() */
+typedef struct
+{
+	int chan;
+	long long nb_data; /* IEEE488_BLOCK_INDEFINITE for #0 */
+	unsigned char* dst; /* Where data is received */
+	unsigned char* rx_buf; /* Where data is received when not directly in the output: chan_slab at base or buf */
+	size_t rx_buf_size;
+	unsigned char* out; /* Where output samples are stored (dst for raw output) */
+	unsigned char* out_hdr; /* Header before the samples (-org01) */
+	rigol_mso5k_bin_waveforms wfm_hdr;
+	float* fdst; /* float output samples (-ofloat/-org01) */
+	float ydelta;
+	float yinc;
+	size_t hdr_size; /* out_hdr_size for the first request of the channel, else 0 */
+	size_t base; /* First point of the request in the channel (0 based) */
+	int nb_total_read;
+	long long file_base; /* -u: offset of the channel in the -f file */
+	int nb_written; /* -u: payload bytes written by the chained writes */
+	struct timeval header_tv;
+	struct timeval payload_end_tv;
+} chan_rx_t;
+
+/*
+ * Select where the nb_data samples of the channel are received and stored, return 0 if OK
+ * dst has 1 spare byte so the terminator can be received with the end of the payload
+ */
+int chan_rx_setup(chan_rx_t* rx, int nb_data)
+{
+	if(rx->chan >= LA_CHAN_BASE)
+	{
+		/* Digital channel received in its slab, packed by la_capture_feed() and not written to the -f file */
+		if((size_t)nb_data >= rx->rx_buf_size)
+		{
+			printf_err("Error nb_data(%d) >= slab size(%zu)\n", nb_data, rx->rx_buf_size);
+			return -1;
+		}
+		rx->out_hdr = (unsigned char*)&rx->wfm_hdr;
+		rx->dst = rx->rx_buf;
+		rx->out = rx->rx_buf;
+		return 0;
+	}
+	if( ((mmap_mode == 0) && (cur_slot == NULL)) || (out_format != OUT_RAW) )
+	{
+		/* Data is received in the slab of the channel */
+		if((size_t)nb_data >= rx->rx_buf_size)
+		{
+			printf_err("Error nb_data(%d) >= slab size(%zu)\n", nb_data, rx->rx_buf_size);
+			return -1;
+		}
+	}
+	if(mmap_mode)
+	{
+		/* Receive the payload (or store converted samples) directly in the output file */
+		rx->out_hdr = mmap_file_reserve(&out_mf, rx->hdr_size + nb_data * out_sample_size + 1);
+		if(rx->out_hdr == NULL)
+		{
+			error("ERROR mmap_file_reserve()");
+		}
+		rx->out = rx->out_hdr + rx->hdr_size;
+	} else if(cur_slot != NULL)
+	{
+		/* All channels of the waveform are stored one after the other in the capture buffer */
+		if((rx->hdr_size + nb_data * out_sample_size + 1) > (cur_slot->capacity - cur_slot->len))
+		{
+			printf_err("Error nb_data(%d) > capture buffer free space(%zu)\n", nb_data, cur_slot->capacity - cur_slot->len);
+			return -1;
+		}
+		rx->out_hdr = &cur_slot->data[cur_slot->len];
+		rx->out = rx->out_hdr + rx->hdr_size;
+	} else
+	{
+		rx->out_hdr = (unsigned char*)&rx->wfm_hdr;
+		rx->out = rx->rx_buf;
+		if(out_format != OUT_RAW)
+		{
+			if(fbuf_nb_samples < (size_t)nb_data)
+			{
+				printf_err("Error nb_data(%d) > fbuf(%zu samples)\n", nb_data, fbuf_nb_samples);
+				return -1;
+			}
+			rx->out = (unsigned char*)fbuf;
+		}
+	}
+	if(out_format != OUT_RAW)
+	{
+		rx->dst = rx->rx_buf;
+		rx->fdst = (float*)rx->out;
+	} else
+	{
+		rx->dst = rx->out;
+	}
+	return 0;
+}
+
+int chan_rx_on_header(void* ctx, long long length)
+{
+	chan_rx_t* rx = (chan_rx_t*)ctx;
+
+	gettimeofday(&rx->header_tv, NULL);
+	if(rx->chan >= LA_CHAN_BASE)
+		async_log_event(ASYNC_LOG_DEBUG, "WAV:DATA? D%lld block length=%lld\n", rx->chan - LA_CHAN_BASE, length, 0, 0);
+	else
+		async_log_event(ASYNC_LOG_DEBUG, "WAV:DATA? CH%lld block length=%lld\n", rx->chan+1, length, 0, 0);
+	rx->nb_data = length;
+	if(length == 0)
+		rx->payload_end_tv = rx->header_tv;
+	if(length == IEEE488_BLOCK_INDEFINITE)
+	{
+		/* Size known at the end, data is received in the slab (or buf) and stored after */
+		rx->dst = rx->rx_buf;
+		return 0;
+	}
+	return chan_rx_setup(rx, (int)length);
+}
+
+void chan_rx_convert(chan_rx_t* rx, int pos, int nb)
+{
+	struct timeval start_convert;
+	struct timeval end_convert;
+
+	gettimeofday(&start_convert, NULL);
+	sample_convert(&rx->dst[pos], &rx->fdst[pos], nb, rx->ydelta, rx->yinc);
+	gettimeofday(&end_convert, NULL);
+	convert_time_s += TimevalDiff(&end_convert, &start_convert);
+}
+
+int chan_rx_on_payload(void* ctx, const unsigned char* data, size_t len)
+{
+	chan_rx_t* rx = (chan_rx_t*)ctx;
+	unsigned char* p = &rx->dst[rx->nb_total_read];
+
+	if( (rx->nb_data == IEEE488_BLOCK_INDEFINITE) && ((rx->nb_total_read + len) >= rx->rx_buf_size) )
+	{
+		printf_err("Error #0 block bigger than %zu bytes\n", rx->rx_buf_size);
+		return -1;
+	}
+	/* Bulk data is received in place, only the bytes received with the header are copied */
+	if(data != p)
+		memcpy(p, data, len);
+	if(rx->fdst != NULL)
+	{
+		/* Convert each chunk as it arrives (data still in cache) */
+		chan_rx_convert(rx, rx->nb_total_read, len);
+	}
+	if(rx->chan >= LA_CHAN_BASE)
+	{
+		if(la_capture_feed(&la, rx->chan - LA_CHAN_BASE, rx->base + rx->nb_total_read, p, len) != 0)
+		{
+			printf_err("Error la_capture_feed() D%d\n", rx->chan - LA_CHAN_BASE);
+			return -1;
+		}
+	} else if(lod_fp != NULL)
+	{
+		struct timeval start_lod;
+		struct timeval end_lod;
+
+		gettimeofday(&start_lod, NULL);
+		if(lod_pyramid_feed(&lod[rx->chan], p, len) != 0)
+		{
+			printf_err("Error lod_pyramid_feed() out of memory\n");
+			return -1;
+		}
+		gettimeofday(&end_lod, NULL);
+		lod_time_s += TimevalDiff(&end_lod, &start_lod);
+		lod_nb_samples += len;
+	}
+	if( meas_mode && (rx->chan < LA_CHAN_BASE) && (meas_engine_feed(&meas, rx->chan, rx->base + rx->nb_total_read, p, len) != 0) )
+	{
+		printf_err("Error meas_engine_feed() CH%d more points than :WAV:PRE?\n", rx->chan+1);
+		return -1;
+	}
+	if( spectrum_mode && (rx->chan < LA_CHAN_BASE) && (spectrum_feed(&spectrum, rx->chan, rx->base + rx->nb_total_read, p, len) != 0) )
+	{
+		printf_err("Error spectrum_feed() CH%d more points than :WAV:PRE?\n", rx->chan+1);
+		return -1;
+	}
+	total_bytes += len;
+	rx->nb_total_read += len;
+	if(rx->nb_total_read == rx->nb_data)
+		gettimeofday(&rx->payload_end_tv, NULL);
+	packet_nb++;
+	/* Binary record formatted by the log thread, only counted below -Ltrace */
+	async_log_event(ASYNC_LOG_TRACE, "packet_nb=%05lld TotalBytes=%08lld (recv=%04lld nb_total_read=%04lld)\n",
+					packet_nb, total_bytes, len, rx->nb_total_read);
+	return 0;
+}
+
+const ieee488_block_cb_t chan_rx_cb = { chan_rx_on_header, chan_rx_on_payload, NULL };
+
+/*
+ * -u: receive the next part of the payload with a write of the payload not yet written
+ * (the bytes of this recv included) to the -f file chained in the same io_uring_enter()
+ */
+int chan_rx_recv_write(chan_rx_t* rx, unsigned char* p, size_t max_nb)
+{
+	size_t payload_nb;
+	int written;
+	int read_nb;
+
+	if(max_nb > TRANSPORT_PROFILE_WAITALL_MAX)
+		max_nb = TRANSPORT_PROFILE_WAITALL_MAX;
+	/* The terminator is received but not written */
+	payload_nb = rx->nb_data - rx->nb_total_read;
+	if(payload_nb > max_nb)
+		payload_nb = max_nb;
+	read_nb = scpi_queue_recv_write(&scpi_q, p, (int)max_nb, fileno(outfp), &rx->dst[rx->nb_written],
+									(rx->nb_total_read - rx->nb_written) + payload_nb, rx->file_base + rx->nb_written, &written);
+	if(written > 0)
+	{
+		rx->nb_written += written;
+		uring_bytes_written += written;
+	} else if(written < 0)
+	{
+		printf_err("ERROR chained write() (errno=%d)\n", -written);
+	}
+	return read_nb;
+}
+
+/*
+ * -j: the reply was received by the session of the channel in rx_buf, processed by chunks of
+ * BUFSIZE as if it was received (converted while in cache), return 0 if OK
+ */
+int chan_rx_session(chan_rx_t* rx, const scpi_session_req_t* sreq)
+{
+	size_t pos;
+	size_t len;
+
+	if(sreq->state != SCPI_SESSION_REQ_DONE)
+	{
+		printf_err("ERROR %s failed %u times on session %d\n", sreq->source, sreq->nb_failed, sreq->session);
+		return -1;
+	}
+	if(first_byte_pending)
+	{
+		trig_first_byte_s = TimevalDiff(&sreq->header_tv, &sing_tv);
+		first_byte_pending = 0;
+	}
+	if(chan_rx_on_header(rx, sreq->nb_read) != 0)
+		return -1;
+	for(pos = 0; pos < (size_t)sreq->nb_read; pos += len)
+	{
+		len = (((size_t)sreq->nb_read - pos) < BUFSIZE) ? ((size_t)sreq->nb_read - pos) : BUFSIZE;
+		if(chan_rx_on_payload(rx, &rx->rx_buf[pos], len) != 0)
+			return -1;
+	}
+	rx->header_tv = sreq->header_tv;
+	rx->payload_end_tv = sreq->end_tv;
+	return 0;
+}
+
+/* Read the reply of a request of fetch_list, return nb data read or 0 in case of error */
+int read_chan_data(const fetch_req_t* req, int waveform_nb)
+{
+	int chan = req->chan;
+	int digital = (chan >= LA_CHAN_BASE);
+	static unsigned char hdr_buf[CHAN_RX_HDR_SIZE];
+	ieee488_block_t blk;
+	chan_rx_t rx;
+	unsigned char* p;
+	size_t max_nb;
+	long nb;
+	int read_nb, fwrite_nb;
+	const char* query;
+	struct timeval start_tv_reply;
+	struct timeval end_tv_reply;
+	struct timeval start_write;
+	struct timeval end_write;
+	const scpi_session_req_t* sreq = NULL;
+
+	if(sessions_active)
+	{
+		/* Received by the session of the channel */
+		sreq = scpi_sessions_wait(&sessions, (int)(req - fetch_list));
+		if(sreq == NULL)
+			stop_if_requested();
+		start_tv_reply = sreq->sent_tv;
+	} else
+	{
+		/* Replies are matched to the queries in FIFO order */
+		query = scpi_queue_begin_reply(&scpi_q);
+		if( (query == NULL) || (strncmp(query, ":WAV:DATA?", 10) != 0) )
+		{
+			printf_err("ERROR %s%d expected reply to :WAV:DATA? (pending query %s)\n", digital ? "D" : "CH", digital ? chan - LA_CHAN_BASE : chan+1,
+						(query == NULL) ? "none\n" : query);
+			return 0;
+		}
+
+		/* With pipelining the reply can only be read once the previous one is consumed */
+		gettimeofday(&start_tv_reply, NULL);
+		if(timercmp(&req->sent_tv, &start_tv_reply, >))
+			start_tv_reply = req->sent_tv;
+	}
+
+	memset(&rx, 0, sizeof(rx));
+	rx.chan = chan;
+	rx.hdr_size = (req->first && !digital) ? out_hdr_size : 0;
+	rx.base = (req->start > 0) ? (req->start - 1) : 0;
+	if(chan_slab[chan] != NULL)
+	{
+		rx.rx_buf = &chan_slab[chan][rx.base];
+		rx.rx_buf_size = chan_slab_size[chan] - rx.base;
+	} else
+	{
+		rx.rx_buf = buf;
+		rx.rx_buf_size = buf_size;
+	}
+	rx.ydelta = (float)(chan_preamble[chan].yorigin + chan_preamble[chan].yreference);
+	rx.yinc = (float)chan_preamble[chan].yincrement;
+	if(uring_write && !digital)
+	{
+		/* Chained writes go to the file descriptor at the current position */
+		fflush(outfp);
+		rx.file_base = ftello(outfp);
+	}
+	if( (lod_fp != NULL) && !digital )
+	{
+		if(req->first)
+		{
+			if(lod_pyramid_begin(&lod[chan], chan_preamble[chan].npoints) != 0)
+				error("ERROR lod_pyramid_begin()");
+			lod_pyramid_mark(&lod[chan], &lod_mark[chan]);
+		} else
+		{
+			/* Samples of a failed attempt of this window are removed */
+			lod_pyramid_rollback(&lod[chan], &lod_mark[chan]);
+		}
+	}
+	if(meas_mode && req->first && !digital)
+	{
+		/* Waits for the measurements of the previous waveform to be written */
+		meas_engine_begin(&meas, chan);
+	}
+	if(spectrum_mode && req->first && !digital)
+		spectrum_begin(&spectrum, chan);
+	if(la_mode && req->first && (chan == LA_CHAN_BASE + la_first_chan))
+		la_capture_begin(&la);
+	ieee488_block_init(&blk, &chan_rx_cb, &rx);
+	if( (sreq != NULL) && (chan_rx_session(&rx, sreq) != 0) )
+		return 0;
+	while( (sreq == NULL) && !ieee488_block_done(&blk) )
+	{
+		if(rx.dst == NULL)
+		{
+			/* Header, a single recv() also gets the start of the payload */
+			p = hdr_buf;
+			max_nb = sizeof(hdr_buf);
+		} else if(rx.nb_data == IEEE488_BLOCK_INDEFINITE)
+		{
+			p = &rx.dst[rx.nb_total_read];
+			max_nb = rx.rx_buf_size - 1 - rx.nb_total_read;
+		} else
+		{
+			/* Payload received in place with the terminator, never after the end of the block */
+			p = &rx.dst[rx.nb_total_read];
+			max_nb = ieee488_block_bytes_left(&blk);
+		}
+		if(max_nb > INT_MAX)
+			max_nb = INT_MAX;
+		if( (rx.dst != NULL) && (rx.nb_data != IEEE488_BLOCK_INDEFINITE) && uring_write && !digital )
+			read_nb = chan_rx_recv_write(&rx, p, max_nb);
+		else if( (rx.dst != NULL) && (rx.nb_data != IEEE488_BLOCK_INDEFINITE) )
+			read_nb = scpi_queue_recv_exact(&scpi_q, p, (int)max_nb);
+		else
+			read_nb = scpi_queue_recv(&scpi_q, p, (int)max_nb);
+		if(read_nb == 0)
+		{
+			printf_err("\nEnd of file/connection closed by server\n");
+			return 0;
+		}
+		if(read_nb < 0)
+		{
+			printf_err("ERROR recv() to read from socket\n");
+			return 0;
+		}
+		if(first_byte_pending)
+		{
+			gettimeofday(&curr_tv, NULL);
+			trig_first_byte_s = TimevalDiff(&curr_tv, &sing_tv);
+			first_byte_pending = 0;
+		}
+
+		nb = ieee488_block_feed(&blk, p, read_nb);
+		if(nb < 0)
+		{
+			printf_err("ERROR RigolMSO5000 %s%d %s (first data=0x%02X)\n", digital ? "D" : "CH", digital ? chan - LA_CHAN_BASE : chan+1, blk.error, p[0]);
+			return 0;
+		}
+		if(nb < read_nb)
+		{
+			/* Start of the next reply (small or #0 block) */
+			scpi_queue_unread(&scpi_q, &p[nb], read_nb - nb);
+		}
+	}
+
+	if(sreq != NULL)
+		end_tv_reply = sreq->end_tv;
+	else
+		gettimeofday(&end_tv_reply, NULL);
+	latency_hist_record_s(&phase_hist[PHASE_DATA_HEADER], TimevalDiff(&rx.header_tv, &start_tv_reply));
+	if(rx.nb_data == IEEE488_BLOCK_INDEFINITE)
+	{
+		latency_hist_record_s(&phase_hist[PHASE_DATA_PAYLOAD], TimevalDiff(&end_tv_reply, &rx.header_tv));
+	} else
+	{
+		latency_hist_record_s(&phase_hist[PHASE_DATA_PAYLOAD], TimevalDiff(&rx.payload_end_tv, &rx.header_tv));
+		latency_hist_record_s(&phase_hist[PHASE_DATA_TERMINATOR], TimevalDiff(&end_tv_reply, &rx.payload_end_tv));
+	}
+
+	if((size_t)rx.nb_total_read != req->nb_points)
+	{
+		/*
+		 * The channel or window shall be complete (the channel header was written with all points),
+		 * a #0 block also ends early at the first sample equal to 0x0A
+		 */
+		if(req->start > 0)
+		{
+			printf_err("ERROR %s%d window %zu: %d points received (expected %zu)\n", digital ? "D" : "CH", digital ? chan - LA_CHAN_BASE : chan+1,
+						req->start, rx.nb_total_read, req->nb_points);
+		} else
+		{
+			printf_err("ERROR %s%d: %d points received (expected %zu)\n", digital ? "D" : "CH", digital ? chan - LA_CHAN_BASE : chan+1,
+						rx.nb_total_read, req->nb_points);
+		}
+		return 0;
+	}
+	if(digital)
+	{
+		/* Packed while received, the record is written once the last digital channel is complete */
+		return rx.nb_total_read;
+	}
+
+	if(rx.nb_data == IEEE488_BLOCK_INDEFINITE)
+	{
+		/* #0 block received in rx_buf, stored now that the size is known */
+		if(chan_rx_setup(&rx, rx.nb_total_read) != 0)
+			return 0;
+		if(rx.dst != rx.rx_buf)
+			memcpy(rx.dst, rx.rx_buf, rx.nb_total_read);
+		if(rx.fdst != NULL)
+			chan_rx_convert(&rx, 0, rx.nb_total_read);
+	}
+
+	if( (chan == event_chan) && !event_detected )
+	{
+		/* Raw code of the level: volts = (code - (yorigin + yreference)) * yincrement */
+		event_detected = event_condition(rx.dst, rx.nb_total_read, (float)(event_level_v / rx.yinc) + rx.ydelta);
+		if(event_detected)
+			printf_dbg("Event CH%d %s %f V\n", chan+1, event_below ? "below" : "above", event_level_v);
+	}
+
+	if(lod_fp != NULL)
+	{
+		lod_pyramid_mark(&lod[chan], &lod_mark[chan]);
+		if( req->last && ((lod_pyramid_finish(&lod[chan]) != 0) || (lod_pyramid_write(&lod[chan], lod_fp, waveform_nb, chan) != 0)) )
+		{
+			printf_err("ERROR lod_pyramid_write() CH%d\n", chan+1);
+		}
+	}
+
+	/* Write data received to file */
+	if( (out_format == OUT_RG01) && req->first )
+	{
+		/* Header written with the size of the data actually received (all windows with -c) */
+		rg01_writer_waveform_header(&rg01, (rigol_mso5k_bin_waveforms*)rx.out_hdr, chan,
+									(req->start > 0) ? chan_preamble[chan].npoints : (size_t)rx.nb_total_read,
+									chan_preamble[chan].sec_per_sample, chan_preamble[chan].xorigin,
+									waveform_nb, TimevalDiff(&sing_tv, &start_tv) + ((req->frame > 0) ? (req->frame - 1) * wrec_interval_s : 0));
+	}
+	if(mmap_mode)
+	{
+		/* Data is already in the file */
+		mmap_file_commit(&out_mf, rx.hdr_size + rx.nb_total_read * out_sample_size);
+	} else if(cur_slot != NULL)
+	{
+		/* Written by the writer thread once the waveform is complete */
+		cur_slot->len += rx.hdr_size + rx.nb_total_read * out_sample_size;
+	} else if(uring_write)
+	{
+		/* Only the bytes not written by the chained writes (#0 block, short read...) */
+		fseeko(outfp, rx.file_base + rx.nb_written, SEEK_SET);
+		fwrite_nb = fwrite(&rx.out[rx.nb_written], 1, rx.nb_total_read - rx.nb_written, outfp);
+		if(fwrite_nb != (rx.nb_total_read - rx.nb_written))
+		{
+			printf_err("fwrite() on outfp error len=%d != expected %d\n", fwrite_nb, rx.nb_total_read - rx.nb_written);
+		}
+	} else if(codec_threads)
+	{
+		gettimeofday(&start_write, NULL);
+		if(codec_writer_write(&codec_writer, rx.out, rx.nb_total_read) != 0)
+		{
+			printf_err("codec_writer_write() on outfp error len=%d\n", rx.nb_total_read);
+		}
+		gettimeofday(&end_write, NULL);
+		latency_hist_record_s(&phase_hist[PHASE_DISK_WRITE], TimevalDiff(&end_write, &start_write));
+	} else if(outfp != NULL)
+	{
+		gettimeofday(&start_write, NULL);
+		if( (rx.hdr_size > 0) && (fwrite(rx.out_hdr, rx.hdr_size, 1, outfp) != 1) )
+		{
+			printf_err("fwrite() on outfp header error\n");
+		}
+		fwrite_nb = fwrite(rx.out, out_sample_size, rx.nb_total_read, outfp);
+		if(fwrite_nb != rx.nb_total_read)
+		{
+			printf_err("fwrite() on outfp error len=%d != expected %d\n", fwrite_nb, rx.nb_total_read);
+		}
+		gettimeofday(&end_write, NULL);
+		latency_hist_record_s(&phase_hist[PHASE_DISK_WRITE], TimevalDiff(&end_write, &start_write));
+	}
+	return rx.nb_total_read;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char str_buf[255+1];
+	struct sockaddr_in serveraddr;
+	struct hostent *server;
+	int portno;
+	char *hostname;
+	char *from_server_filename = NULL;
+	int err_connect;
+	int chan_list[NB_CHAN_MAX]; /* Analog channels then digital channels (LA_CHAN_BASE + n) */
+	int nb_chan; /* Analog channels */
+	int nb_fetch_chan; /* Analog + digital channels */
+	int nb_total_acq_failed;
+	int nb_acq_failed;
+	int nb_acq_failed_curr_chan = 0;
+	unsigned int packet_nb_curr_chan = 0; /* packet_nb at the first request of the channel */
+	int nb_waveform = -1;
+	int spectrum_options = 0; /* -W used */
+	int next_req;
+	int i, k;
+	unsigned char* ring_buffers = NULL; /* -w capture ring slots (pool slab) */
+	size_t ring_slot_size = 0;
+	
+	struct timeval start_acq;
+	struct timeval curr_acq;
+
+	float acq_time;
+	float acq_time_min = FLT_MAX;
+	float acq_time_max = FLT_MIN;
+	float acq_time_sum = 0;
+
+	int nb_trig_queries;
+	int frames_per_acq = 1; /* Waveforms stored per acquisition (nb_frames with -F) */
+	unsigned int nb_trig_queries_sum = 0;
+	float trig_wait_s;
+	float trig_wait_min = FLT_MAX;
+	float trig_wait_max = 0;
+	float trig_wait_sum = 0;
+	float trig_first_byte_min = FLT_MAX;
+	float trig_first_byte_max = 0;
+	float trig_first_byte_sum = 0;
+
+	struct timeval start_data;
+	struct timeval curr_data;
+	struct timeval last_stats_tv;
+
+	sockInit();
+
+	for(i = 0; i < NB_PHASES; i++)
+	{
+		latency_hist_init(&phase_hist[i], phase_name[i]);
+		phase_hist_list[i] = &phase_hist[i];
+	}
+
+	printf(BANNER1);
+	printf("Stop with Ctrl-C\n");
+	printf("Parameters:\n");
+	for(i = 0; i < argc; i++)
+	{
+		printf("%s ", argv[i]);
+	}
+	printf("\n");
+
+	/* check command line arguments */
+	if (argc < 3) 
+	{
+		syntax();
+		exit(0);
+	}
+	hostname = argv[1];
+	portno = atoi(argv[2]);
+	if(argc > 3)
+	{
+		for(i = 3; i < argc; i++)
+		{
+			if(strncmp(argv[i], "-n", 2) == 0)
+			{
+				nb_waveform = atoi(&argv[i][2]);
+				printf("nb_waveform: %d\n", nb_waveform);
+			} else if(strncmp(argv[i], "-f", 2) == 0)
+			{
+				from_server_filename = &argv[i][2];
+				printf("waveform_rx_raw_data_file: %s\n", from_server_filename);
+			} else if(strcmp(argv[i], "-m") == 0)
+			{
+				mmap_mode = 1;
+				printf("mmap_mode: 1\n");
+			} else if(strncmp(argv[i], "-w", 2) == 0)
+			{
+				nb_ring_buffers = atoi(&argv[i][2]);
+				if(nb_ring_buffers < 2)
+				{
+					printf("Error nb_buffers shall be >= 2\n");
+					exit(-3);
+				}
+				printf("nb_ring_buffers: %d\n", nb_ring_buffers);
+			} else if(strncmp(argv[i], "-t", 2) == 0)
+			{
+				for(k = 0; k <= TRIG_WAIT_SRQ; k++)
+				{
+					if(strcmp(&argv[i][2], trig_wait_name[k]) == 0)
+						break;
+				}
+				if(k > TRIG_WAIT_SRQ)
+				{
+					printf("Error unknown trigger wait %s\n", &argv[i][2]);
+					syntax();
+					exit(-3);
+				}
+				trig_wait = (trig_wait_t)k;
+				printf("trig_wait: %s\n", trig_wait_name[trig_wait]);
+			} else if(strncmp(argv[i], "-o", 2) == 0)
+			{
+				for(k = 0; k <= OUT_RG01; k++)
+				{
+					if(strcmp(&argv[i][2], out_format_name[k]) == 0)
+						break;
+				}
+				if(k > OUT_RG01)
+				{
+					printf("Error unknown output format %s\n", &argv[i][2]);
+					syntax();
+					exit(-3);
+				}
+				out_format = (out_format_t)k;
+				out_sample_size = (out_format == OUT_RAW) ? 1 : sizeof(float);
+				out_hdr_size = (out_format == OUT_RG01) ? sizeof(rigol_mso5k_bin_waveforms) : 0;
+				printf("out_format: %s\n", out_format_name[out_format]);
+			} else if(strcmp(argv[i], "-d") == 0)
+			{
+				ring_drop_when_full = 1;
+				printf("ring_drop_when_full: 1\n");
+			} else if(strncmp(argv[i], "-c", 2) == 0)
+			{
+				window_points = strtoul(&argv[i][2], NULL, 10);
+				if(window_points < 1)
+				{
+					printf("Error window_points shall be >= 1\n");
+					exit(-3);
+				}
+				printf("window_points: %zu\n", window_points);
+			} else if(strncmp(argv[i], "-s", 2) == 0)
+			{
+				stats_filename = &argv[i][2];
+				printf("stats_file: %s\n", stats_filename);
+			} else if(strncmp(argv[i], "-i", 2) == 0)
+			{
+				stats_period_s = atof(&argv[i][2]);
+				printf("stats_period_s: %.3f\n", stats_period_s);
+			} else if(strncmp(argv[i], "-p", 2) == 0)
+			{
+				pipeline_depth = atoi(&argv[i][2]);
+				if( (pipeline_depth < 1) || (pipeline_depth > SCPI_QUEUE_MAX_PENDING) )
+				{
+					printf("Error pipeline_depth shall be between 1 and %d\n", SCPI_QUEUE_MAX_PENDING);
+					exit(-3);
+				}
+				printf("pipeline_depth: %d\n", pipeline_depth);
+			} else if(strncmp(argv[i], "-P", 2) == 0)
+			{
+				k = transport_profile_parse(&argv[i][2]);
+				if(k < 0)
+				{
+					printf("Error unknown transport profile %s\n", &argv[i][2]);
+					syntax();
+					exit(-3);
+				}
+				transport_mode = (transport_profile_mode_t)k;
+				printf("transport_profile: %s\n", transport_profile_name(transport_mode));
+			} else if(strncmp(argv[i], "-a", 2) == 0)
+			{
+				transport_cpu = atoi(&argv[i][2]);
+				if(transport_cpu < 0)
+				{
+					printf("Error cpu shall be >= 0\n");
+					exit(-3);
+				}
+				printf("transport_cpu: %d\n", transport_cpu);
+			} else if(strcmp(argv[i], "-u") == 0)
+			{
+				use_uring = 1;
+				printf("io_uring: 1\n");
+			} else if(strncmp(argv[i], "-z", 2) == 0)
+			{
+				codec_threads = (argv[i][2] != '\0') ? atoi(&argv[i][2]) : CODEC_THREADS_DEFAULT;
+				if( (codec_threads < 1) || (codec_threads > CODEC_WRITER_MAX_THREADS) )
+				{
+					printf("Error nb_threads shall be between 1 and %d\n", CODEC_WRITER_MAX_THREADS);
+					exit(-3);
+				}
+				printf("codec_threads: %d\n", codec_threads);
+			} else if(strncmp(argv[i], "-F", 2) == 0)
+			{
+				nb_frames = atoi(&argv[i][2]);
+				if(nb_frames < 1)
+				{
+					printf("Error nb_frames shall be >= 1\n");
+					exit(-3);
+				}
+				printf("nb_frames: %d\n", nb_frames);
+			} else if(strncmp(argv[i], "-R", 2) == 0)
+			{
+				if( (sscanf(&argv[i][2], "%d,%d,%u", &retain_pre, &retain_post, &retain_max_events) < 1) ||
+					(retain_pre < 0) || (retain_post < 0) )
+				{
+					printf("Error -R<pre>[,<post>[,<max_events>]] pre and post shall be >= 0\n");
+					exit(-3);
+				}
+				printf("ring recording: pre=%d post=%d max_events=%u\n", retain_pre, retain_post, retain_max_events);
+			} else if(strncmp(argv[i], "-T", 2) == 0)
+			{
+				if( (sscanf(&argv[i][2], "%d,%lf", &event_chan, &event_level_v) != 2) || (event_chan < 1) || (event_chan > 4) )
+				{
+					printf("Error -T<chan>,<level_volts>[,below] chan shall be 1 to 4\n");
+					exit(-3);
+				}
+				event_chan--;
+				event_below = (strstr(&argv[i][2], ",below") != NULL);
+				printf("event: CH%d %s %f V\n", event_chan+1, event_below ? "below" : "above", event_level_v);
+			} else if(strcmp(argv[i], "-l") == 0)
+			{
+				lod_mode = 1;
+				printf("lod: 1\n");
+			} else if(strncmp(argv[i], "-M", 2) == 0)
+			{
+				meas_mode = 1;
+				meas_filename = (argv[i][2] != '\0') ? &argv[i][2] : NULL;
+				printf("meas: %s\n", (meas_filename != NULL) ? meas_filename : "printed");
+			} else if(strncmp(argv[i], "-D", 2) == 0)
+			{
+				la_filename = &argv[i][2];
+				if(strstr(la_filename, ",edges") != NULL)
+				{
+					*strstr(la_filename, ",edges") = '\0';
+					la_edges_only = 1;
+				}
+				printf("la_file: %s (%s)\n", la_filename, la_edges_only ? "edges only" : "words + edges");
+			} else if(strncmp(argv[i], "-H", 2) == 0)
+			{
+				int pages = (argv[i][2] == '\0') ? BUFFER_POOL_PAGES_HUGETLB : buffer_pool_pages_parse(&argv[i][2]);
+
+				if(pages < 0)
+				{
+					printf("Error unknown huge pages %s\n", &argv[i][2]);
+					printf(SYNTAX);
+					exit(-3);
+				}
+				pool_pages = (buffer_pool_pages_t)pages;
+				printf("pool pages: %s\n", buffer_pool_pages_name(pool_pages));
+			} else if(strncmp(argv[i], "-j", 2) == 0)
+			{
+				nb_sessions = atoi(&argv[i][2]);
+				if( (nb_sessions < 2) || (nb_sessions > SCPI_SESSION_MAX) )
+				{
+					printf("Error nb_sessions shall be 2 to %d\n", SCPI_SESSION_MAX);
+					exit(-3);
+				}
+				printf("nb_sessions: %d\n", nb_sessions);
+			} else if(strncmp(argv[i], "-I", 2) == 0)
+			{
+				hislip_mode = 1;
+				if(argv[i][2] != '\0')
+					hislip_sub_address = &argv[i][2];
+				if(strlen(hislip_sub_address) >= HISLIP_SUB_ADDRESS_MAX_SIZE)
+				{
+					printf("Error HiSLIP sub_address too long\n");
+					exit(-3);
+				}
+				printf("hislip: %s\n", hislip_sub_address);
+			} else if(strncmp(argv[i], "-L", 2) == 0)
+			{
+				char level_name[16] = "";
+				char mode_name[16] = "";
+				int level;
+
+				if( (sscanf(&argv[i][2], "%15[a-z],%15s", level_name, mode_name) < 1) ||
+					((level = async_log_level_parse(level_name)) < 0) ||
+					((mode_name[0] != '\0') && (strcmp(mode_name, "sync") != 0)) )
+				{
+					printf("Error -L<error|info|debug|trace>[,sync]\n");
+					exit(-3);
+				}
+				log_level = (async_log_level_t)level;
+				log_sync = (mode_name[0] != '\0');
+				printf("log: level=%s %s\n", async_log_level_name(log_level), log_sync ? "sync" : "async");
+			} else if(strncmp(argv[i], "-S", 2) == 0)
+			{
+				spectrum_filename = &argv[i][2];
+				printf("spectrum_file: %s\n", spectrum_filename);
+			} else if(strncmp(argv[i], "-W", 2) == 0)
+			{
+				char window_name[16] = "";
+				unsigned long long nfft = 0;
+
+				/* Fields after the window name are optional */
+				if( (sscanf(&argv[i][2], "%15[a-z],%llu,%u,%d", window_name, &nfft, &spectrum_nb_avg, &spectrum_threads) < 1) ||
+					(spectrum_window_parse(window_name) < 0) || (spectrum_nb_avg < 1) ||
+					(spectrum_threads < 1) || (spectrum_threads > FFT_MAX_THREADS) )
+				{
+					printf("Error -W<hann|blackman|flattop>[,<nfft>[,<nb_avg>[,<nb_threads>]]] nb_avg >= 1, nb_threads 1 to %d\n", FFT_MAX_THREADS);
+					exit(-3);
+				}
+				spectrum_window = (spectrum_window_t)spectrum_window_parse(window_name);
+				spectrum_nfft = (size_t)nfft;
+				spectrum_options = 1;
+				printf("spectrum: window=%s nfft=%zu nb_avg=%u nb_threads=%d\n", spectrum_window_name(spectrum_window),
+						spectrum_nfft, spectrum_nb_avg, spectrum_threads);
+			} else 
+			{
+				printf("Error unknown argument %s\n", argv[i]);
+				syntax();
+				exit(-3);
+			}
+		}
+	}
+
+	/* Relative times since start_tv (set once connected) */
+	async_log_init(log_level, &start_tv);
+	if(!log_sync)
+		async_log_start();
+
+	if(retain_pre >= 0)
+	{
+		if( (from_server_filename == NULL) || mmap_mode || lod_mode )
+		{
+			printf("Error -R requires -f<waveform_rx_raw_data_file> and can not be used with -m or -l\n");
+			exit(-3);
+		}
+		/* The waveforms are kept in the capture buffers, pre + 1 being received + 1 being written */
+		if(nb_ring_buffers == 0)
+			nb_ring_buffers = retain_pre + 2;
+		if(nb_ring_buffers <= retain_pre)
+		{
+			printf("Error -w<nb_buffers> shall be > pre with -R\n");
+			exit(-3);
+		}
+		printf("nb_ring_buffers: %d\n", nb_ring_buffers);
+#ifndef _WIN32
+		signal(SIGUSR1, eventHandler);
+#endif
+	} else if(event_chan >= 0)
+	{
+		printf("Error -T requires -R<pre>\n");
+		exit(-3);
+	}
+
+	if(from_server_filename != NULL)
+	{
+		int err_open;
+		if(mmap_mode)
+		{
+			err_open = mmap_file_open(&out_mf, from_server_filename);
+		} else
+		{
+			outfp = fopen(from_server_filename, "wb");
+			err_open = (outfp == NULL) ? -1 : 0;
+		}
+		if (err_open == 0)
+		{
+			printf("waveform_rx_raw_data_file created OK\n");
+			if(out_format == OUT_RG01)
+			{
+				/* nb_waveforms/file_size patched at the end by cleanup() */
+				rigol_mso5k_bin file_hdr;
+				rg01_writer_file_header(&file_hdr);
+				if(mmap_mode)
+				{
+					unsigned char* p = mmap_file_reserve(&out_mf, sizeof(file_hdr));
+					err_open = (p == NULL) ? -1 : 0;
+					if(p != NULL)
+					{
+						memcpy(p, &file_hdr, sizeof(file_hdr));
+						mmap_file_commit(&out_mf, sizeof(file_hdr));
+					}
+				} else
+				{
+					err_open = (fwrite(&file_hdr, sizeof(file_hdr), 1, outfp) == 1) ? 0 : -1;
+				}
+				out_filename = from_server_filename;
+			}
 		}
+		if (err_open != 0)
+		{
+			printf("waveform_rx_raw_data_file error to create file: %s\n", from_server_filename);
+			exit(-3);
+		}
+	} else if(mmap_mode || nb_ring_buffers || (out_format == OUT_RG01))
+	{
+		printf("Error -m/-w/-org01 requires -f<waveform_rx_raw_data_file>\n");
+		exit(-3);
+	}
+	if( (stats_period_s > 0) && (stats_filename == NULL) )
+	{
+		printf("Error -i requires -s<stats_file>\n");
+		exit(-3);
+	}
+	if(spectrum_options && (spectrum_filename == NULL))
+	{
+		printf("Error -W requires -S<spectrum_file>\n");
+		exit(-3);
+	}
+	if(mmap_mode && nb_ring_buffers)
+	{
+		printf("Error -m and -w can not be used together\n");
+		exit(-3);
+	}
+	if(codec_threads)
+	{
+		if( (outfp == NULL) || (out_format != OUT_RAW) )
+		{
+			printf("Error -z requires -f<waveform_rx_raw_data_file> with raw output and can not be used with -m\n");
+			exit(-3);
+		}
+		if(codec_writer_init(&codec_writer, outfp, codec_threads) != 0)
+		{
+			error("ERROR codec_writer_init()");
+		}
+	}
+	if( (trig_wait == TRIG_WAIT_SRQ) && !hislip_mode )
+	{
+		printf("Error -tsrq requires -I (HiSLIP)\n");
+		exit(-3);
+	}
+
+	if(lod_mode)
+	{
+		char lod_filename[FILENAME_MAX];
+
+		if(from_server_filename == NULL)
+		{
+			printf("Error -l requires -f<waveform_rx_raw_data_file>\n");
+			exit(-3);
+		}
+		snprintf(lod_filename, sizeof(lod_filename), "%s.lod", from_server_filename);
+		lod_fp = fopen(lod_filename, "wb");
+		if( (lod_fp == NULL) || (lod_file_header(lod_fp) != 0) )
+		{
+			error("ERROR fopen(lod_file)");
+		}
+		lod_init();
+		printf("lod_pyramid: %s (kernel %s)\n", lod_filename, lod_kernel_name());
+	}
+
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sockfd < 0)
+	{
+		printf("ERROR socket return %d\n", sockfd);
+		error("ERROR opening socket");
+	}
+
+	server = gethostbyname(hostname);
+	if (server == NULL) {
+		printf("ERROR no such host as %s\n", hostname);
+		error("ERROR gethostbyname()");
+	}
+
+	/* build the server's Internet address */
+	bzero((char *) &serveraddr, sizeof(serveraddr));
+	serveraddr.sin_family = AF_INET;
+	bcopy((char *)server->h_addr, (char *)&serveraddr.sin_addr.s_addr, server->h_length);
+	serveraddr.sin_port = htons(portno);
+
+	/* connect: create a connection with the server */
+	err_connect = connect(sockfd, (const struct sockaddr*)&serveraddr, sizeof(serveraddr));
+	if(err_connect < 0)
+	{
+		error("ERROR connect()");
+	}
+
+	// TCP_NODELAY = 1 => Disable Nagle's algorithm for send coalescing.
+	sockSetOpt(sockfd, "TCP_NODELAY", IPPROTO_TCP, TCP_NODELAY, 1);
+	int timeout_in_seconds = 40;
+	// Set RX & TX Timeout to 40 seconds required to capture up to 200Mpts
+	sockSetOpt_Timeout(sockfd, "SO_RCVTIMEO", SOL_SOCKET, SO_RCVTIMEO, timeout_in_seconds);
+	sockSetOpt_Timeout(sockfd, "SO_SNDTIMEO", SOL_SOCKET, SO_SNDTIMEO, timeout_in_seconds);
+
+	scpi_queue_init(&scpi_q, sockfd);
+	transport_profile_init(&transport, sockfd, transport_mode, transport_cpu);
+	scpi_queue_set_transport(&scpi_q, &transport);
+	if(hislip_mode)
+	{
+		/* sockfd is the synchronous channel, the asynchronous channel is connected to the same port */
+		if(hislip_open(&hislip, sockfd, hostname, portno, hislip_sub_address, timeout_in_seconds) != 0)
+		{
+			error("ERROR hislip_open()");
+		}
+		hislip_set_transport(&hislip, &transport);
+		scpi_queue_set_hislip(&scpi_q, &hislip);
+		printf("HiSLIP session %u (%s mode)\n", hislip.session_id, hislip.overlapped ? "overlapped" : "synchronized");
+		if(use_uring)
+		{
+			/* The writes chained to the recv need the raw stream (no message headers) */
+			printf("io_uring: not used with -I, recv() used\n");
+			use_uring = 0;
+		}
+	}
+	if(use_uring)
+	{
+		/* Same timeout as SO_RCVTIMEO (not applied to io_uring operations) */
+		if(sockUringInit(URING_ENTRIES, timeout_in_seconds) == 0)
+		{
+			printf("io_uring receive backend enabled\n");
+		} else
+		{
+			printf("io_uring not available (%s), recv() used\n", sockUringError());
+			use_uring = 0;
+		}
+	}
+
+	if(out_format != OUT_RAW)
+	{
+		sample_convert_init();
+		printf("sample_convert: %s\n", sample_convert_name());
+	}
+
+	/* Replies, the channels are received in the slabs of pool once :WAV:PRE? is known */
+	buf_size = BUFSIZE;
+	buf = malloc(buf_size);
+	if(buf == NULL)
+	{
+		error("ERROR malloc(buf_size)");
+	}
+	buffer_pool_init(&pool);
+
+	total_bytes = 0;
+	packet_nb = 0;
+
+	gettimeofday(&start_tv, NULL);
+	last_stats_tv = start_tv;
+
+	/* All setup commands/queries are sent with a single write, replies are read in FIFO order */
+	/* Clears all the event registers, and also clears the error queue. */
+	scpi_cmd("*CLS\n");
+	scpi_cmd(":STOP\n");
+	if( (trig_wait == TRIG_WAIT_STB) || (trig_wait == TRIG_WAIT_SRQ) )
+	{
+		/* Enable OPC bit of the Standard Event Register in the ESB bit of the Status Byte */
+		scpi_cmd("*ESE 1\n");
+	}
+	if(trig_wait == TRIG_WAIT_SRQ)
+	{
+		/* Service request when ESB is set */
+		scpi_cmd("*SRE 32\n");
+	}
+	/* Check Operation Complete */
+	scpi_query("*OPC?\n");
+	scpi_query("*IDN?\n");
+	scpi_cmd(":WAV:MODE RAW\n");
+	scpi_cmd(":WAV:FORM BYTE\n");
+	for(i = 0; i < 4; i++)
+	{
+		sprintf((char *)str_buf, ":CHAN%d:DISP?\n", i+1 );
+		scpi_query((char *)str_buf);
+	}
+	if(la_filename != NULL)
+	{
+		scpi_query(":LA:STAT?\n");
+		for(i = 0; i < LA_NB_CHAN; i++)
+		{
+			sprintf((char *)str_buf, ":LA:DIG%d:DISP?\n", i);
+			scpi_query((char *)str_buf);
+		}
+	}
+
+	/* receive info from the server */
+	bzero(buf, 201);
+	scpi_read_reply((char *)buf, 200);
+	printf_dbg("*OPC?=%s", buf);
+	/* Check Operation Complete */
+
+	bzero(buf, 201);
+	scpi_read_reply((char *)buf, 200);
+	printf_dbg("IDN?=%s", buf);
+	strncpy(idn_reply, (char *)buf, sizeof(idn_reply) - 1);
+	rg01_writer_init(&rg01, (char *)buf);
+
+	/* Retrieve Channels details */
+	nb_chan = 0;
+	for(i = 0; i < 4; i++)
+	{
+		bzero(buf, 201);
+		scpi_read_reply((char *)buf, 200);
 		printf_dbg(":CHAN%d:DISP?=%s", i+1, buf);
 		int chan_enabled = atoi((char *)buf);
 		if(chan_enabled == 1)
 		{
-			is_chan_enabled[i] = 1;
-
-			sprintf((char *)str_buf, ":WAV:SOUR CHAN%d\n", i+1);
-			printf_dbg("%s", str_buf);
-			socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
+			chan_list[nb_chan] = i;
+			nb_chan++;
+		}
+	}
+	nb_fetch_chan = nb_chan;
+	if(la_filename != NULL)
+	{
+		int la_enabled;
 
-			sprintf((char *)str_buf, ":WAV:PRE?\n");
-			printf_dbg("%s", str_buf);
-			socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
+		bzero(buf, 201);
+		scpi_read_reply((char *)buf, 200);
+		printf_dbg(":LA:STAT?=%s", buf);
+		la_enabled = atoi((char *)buf);
+		for(i = 0; i < LA_NB_CHAN; i++)
+		{
 			bzero(buf, 201);
-			read_nb = recv(sockfd, (char *)buf, 200, 0);
-			if(read_nb <= 0)
+			scpi_read_reply((char *)buf, 200);
+			if( la_enabled && (atoi((char *)buf) == 1) )
 			{
-				printf_dbg("ERROR recv() to read from socket\n");
-				error("ERROR recv()");
+				la_chan_mask |= (1 << i);
+				/* Digital channels are fetched after the analog channels */
+				chan_list[nb_fetch_chan++] = LA_CHAN_BASE + i;
+				if(la_first_chan < 0)
+					la_first_chan = i;
 			}
-			printf_dbg(":WAV:PRE?=%s", buf);
-			sscanf((char *)buf,
-							"%d,%d,%zu,%d,%lf,%lf,%lf,%lf,%lf,%lf",
-							&format,
-							&type,
-							&npoints,
-							&unused3,
-							&sec_per_sample,
-							&xorigin,
-							&xreference,
-							&yincrement,
-							&yorigin,
-							&yreference);
-
-			fs_per_sample = round(sec_per_sample * FS_PER_SECOND);
-			printf_dbg("X: %zu points, %.8f origin, ref %.8f fs_per_sample %zu\n", npoints, xorigin, xreference, fs_per_sample);
-			printf_dbg("Y: %.8f inc, %.8f origin, %.8f ref\n", yincrement, yorigin, yreference);
+		}
+		printf_dbg("LA channels mask=0x%04X\n", la_chan_mask);
+		if(la_chan_mask == 0)
+		{
+			printf("ERROR -D requires a digital channel displayed (:LA:STAT? and :LA:DIG<n>:DISP?)\n");
+			error(NULL);
+		}
+	}
 
-			nb_chan++;
-		} else {
-			is_chan_enabled[i] = 0;
+	if(nb_frames > 0)
+	{
+		scpi_cmd(":FUNC:WREC:ENAB ON\n");
+		scpi_query(":FUNC:WREC:FMAX?\n");
+		scpi_query(":FUNC:WREC:FINT?\n");
+		bzero(buf, 201);
+		scpi_read_reply((char *)buf, 200);
+		wrec_frames_max = atoi((char *)buf);
+		bzero(buf, 201);
+		scpi_read_reply((char *)buf, 200);
+		wrec_interval_s = atof((char *)buf);
+		printf_dbg(":FUNC:WREC:FMAX?=%d :FUNC:WREC:FINT?=%e\n", wrec_frames_max, wrec_interval_s);
+		if(nb_frames > wrec_frames_max)
+		{
+			printf("ERROR nb_frames(%d) > max frames of the waveform recording at this memory depth (%d)\n", nb_frames, wrec_frames_max);
+			error(NULL);
+		}
+		sprintf((char *)str_buf, ":FUNC:WREC:FEND %d\n", nb_frames);
+		scpi_cmd((char *)str_buf);
+	}
+
+	for(k = 0; k < nb_chan; k++)
+	{
+		sprintf((char *)str_buf, ":WAV:SOUR CHAN%d\n", chan_list[k]+1);
+		scpi_cmd((char *)str_buf);
+		scpi_query(":WAV:PRE?\n");
+	}
+	if(la_chan_mask != 0)
+	{
+		/* Same preamble for all the digital channels */
+		sprintf((char *)str_buf, ":WAV:SOUR D%d\n", la_first_chan);
+		scpi_cmd((char *)str_buf);
+		scpi_query(":WAV:PRE?\n");
+	}
+	for(k = 0; k < nb_chan; k++)
+	{
+		bzero(buf, 201);
+		scpi_read_reply((char *)buf, 200);
+		printf_dbg("CH%d :WAV:PRE?=%s", chan_list[k]+1, buf);
+		wav_preamble_t* pre = &chan_preamble[chan_list[k]];
+		parse_wav_preamble((char *)buf, pre);
+		format = pre->format;
+		type = pre->type;
+		npoints = pre->npoints;
+		unused3 = pre->unused3;
+		sec_per_sample = pre->sec_per_sample;
+		xorigin = pre->xorigin;
+		xreference = pre->xreference;
+		yincrement = pre->yincrement;
+		yorigin = pre->yorigin;
+		yreference = pre->yreference;
+
+		fs_per_sample = round(sec_per_sample * FS_PER_SECOND);
+		printf_dbg("X: %zu points, %.8f origin, ref %.8f fs_per_sample %zu\n", npoints, xorigin, xreference, fs_per_sample);
+		printf_dbg("Y: %.8f inc, %.8f origin, %.8f ref\n", yincrement, yorigin, yreference);
+	}
+
+	if(la_chan_mask != 0)
+	{
+		bzero(buf, 201);
+		scpi_read_reply((char *)buf, 200);
+		printf_dbg("D%d :WAV:PRE?=%s", la_first_chan, buf);
+		parse_wav_preamble((char *)buf, &chan_preamble[LA_CHAN_BASE + la_first_chan]);
+		for(k = nb_chan; k < nb_fetch_chan; k++)
+			chan_preamble[chan_list[k]] = chan_preamble[LA_CHAN_BASE + la_first_chan];
+
+		la_init();
+		if(la_capture_init(&la, la_filename, la_chan_mask, chan_preamble[LA_CHAN_BASE + la_first_chan].npoints, la_edges_only) != 0)
+		{
+			error("ERROR la_capture_init()");
+		}
+		la_mode = 1;
+		printf_dbg("la: %d digital channels (mask 0x%04X) of %zu points, %s (kernel %s)\n", nb_fetch_chan - nb_chan, la_chan_mask,
+					chan_preamble[LA_CHAN_BASE + la_first_chan].npoints, la_edges_only ? "edges only" : "words + edges", la_kernel_name());
+	}
+
+	build_fetch_list(chan_list, nb_fetch_chan);
+	printf_dbg("%d :WAV:DATA? requests per waveform (window_points=%zu, nb_frames=%d)\n", nb_fetch, window_points, nb_frames);
+	frames_per_acq = (nb_frames > 0) ? nb_frames : 1;
+
+	if( (nb_sessions > 0) && ((nb_frames > 0) || use_uring || hislip_mode) )
+	{
+		/* The frame selected and the io_uring ring are shared, the sessions are raw SCPI sockets */
+		printf("scpi_sessions: not used with -F, -u or -I, single connection\n");
+		nb_sessions = 0;
+	}
+
+	/*
+	 * One slab per channel for the whole waveform (raw data is received directly in the output with -m or -w
+	 * unless the channels are received concurrently with -j), one slab shared by the digital channels
+	 * (packed as they are received, one per channel with -j), fbuf for -ofloat/-org01 without -m/-w
+	 * and one slab split in the -w capture ring slots (+ scratch slot with -d)
+	 */
+	{
+		int slab_mode = (nb_sessions > 0) || !((mmap_mode || nb_ring_buffers) && (out_format == OUT_RAW));
+		int chan_slab_idx[NB_CHAN_MAX];
+		int fbuf_idx = -1;
+		int ring_idx = -1;
+		size_t max_points = 0;
+		size_t max_req_points = 0;
+
+		memset(chan_slab, 0, sizeof(chan_slab));
+		for(k = 0; k < nb_chan; k++)
+		{
+			if(chan_preamble[chan_list[k]].npoints > max_points)
+				max_points = chan_preamble[chan_list[k]].npoints;
+		}
+		for(k = 0; k < nb_fetch; k++)
+		{
+			if( (fetch_list[k].chan < LA_CHAN_BASE) && (fetch_list[k].nb_points > max_req_points) )
+				max_req_points = fetch_list[k].nb_points;
+		}
+		for(k = 0; k < nb_chan; k++)
+			chan_slab_idx[k] = slab_mode ? buffer_pool_add(&pool, max_points + 1) : -1;
+		for(k = nb_chan; k < nb_fetch_chan; k++)
+			chan_slab_idx[k] = ((k == nb_chan) || (nb_sessions > 0)) ? buffer_pool_add(&pool, chan_preamble[chan_list[k]].npoints + 1) : chan_slab_idx[nb_chan];
+		if( (out_format != OUT_RAW) && !mmap_mode && !nb_ring_buffers )
+			fbuf_idx = buffer_pool_add(&pool, max_req_points * sizeof(float));
+		if(nb_ring_buffers)
+		{
+			/* Biggest analog channel (npoints is the last channel parsed), 1 spare byte after the last channel for the block terminator */
+			ring_slot_size = (out_hdr_size + max_points * out_sample_size) * nb_chan * frames_per_acq + 1;
+			ring_idx = buffer_pool_add(&pool, capture_ring_buffers_size(nb_ring_buffers, ring_slot_size, ring_drop_when_full));
+		}
+		if(buffer_pool_map(&pool, pool_pages) != 0)
+		{
+			error("ERROR buffer_pool_map()");
+		}
+		for(k = 0; k < nb_chan; k++)
+		{
+			chan_slab[chan_list[k]] = buffer_pool_slab(&pool, chan_slab_idx[k]);
+			chan_slab_size[chan_list[k]] = max_points + 1;
+		}
+		for(k = nb_chan; k < nb_fetch_chan; k++)
+		{
+			chan_slab[chan_list[k]] = buffer_pool_slab(&pool, chan_slab_idx[k]);
+			chan_slab_size[chan_list[k]] = chan_preamble[chan_list[k]].npoints + 1;
+		}
+		if(fbuf_idx >= 0)
+		{
+			fbuf = (float*)buffer_pool_slab(&pool, fbuf_idx);
+			fbuf_nb_samples = max_req_points;
+		}
+		if(ring_idx >= 0)
+			ring_buffers = buffer_pool_slab(&pool, ring_idx);
+		printf_dbg("pool: %d slabs (%d channels of %zu points, fbuf of %zu samples, %d ring slots), %zu bytes mapped with %s pages\n",
+					pool.nb_slabs, slab_mode ? nb_chan : 0, max_points, fbuf_nb_samples,
+					(ring_idx >= 0) ? nb_ring_buffers + ring_drop_when_full : 0, pool.map_len, buffer_pool_pages_name(pool.pages));
+	}
+	if(use_uring)
+	{
+		/* Bulk data is received in the pool (buf when data goes directly in the output) */
+		if( ((pool.size > 0) ? sockUringRegisterBuffer(pool.map, pool.map_len) : sockUringRegisterBuffer(buf, buf_size)) != 0 )
+			printf("io_uring %s, buffers not registered\n", sockUringError());
+		/* Raw data received in the slabs can be written to the -f file by the kernel */
+		uring_write = (outfp != NULL) && !mmap_mode && !nb_ring_buffers && !codec_threads && (out_format == OUT_RAW);
+		printf("io_uring: fixed buffer=%s, chained recv/write=%s\n", (sockUring()->fixed_buf != NULL) ? "on" : "off", uring_write ? "on" : "off");
+	}
+
+	if(meas_mode && (nb_chan > 0))
+	{
+		size_t max_points = 0;
+
+		for(k = 0; k < nb_chan; k++)
+		{
+			if(chan_preamble[chan_list[k]].npoints > max_points)
+				max_points = chan_preamble[chan_list[k]].npoints;
+		}
+		meas_init();
+		if(meas_engine_init(&meas, meas_filename, chan_list, nb_chan, max_points, chan_slab) != 0)
+		{
+			error("ERROR meas_engine_init()");
+		}
+		printf_dbg("meas: %d worker threads, slabs of %zu points (kernel %s)\n", nb_chan, max_points, meas_kernel_name());
+	} else
+	{
+		meas_mode = 0;
+	}
+
+	if( (spectrum_filename != NULL) && (nb_chan > 0) )
+	{
+		size_t max_points = 0;
+		size_t nfft;
+
+		for(k = 0; k < nb_chan; k++)
+		{
+			if(chan_preamble[chan_list[k]].npoints > max_points)
+				max_points = chan_preamble[chan_list[k]].npoints;
+		}
+		/* Mixed-radix FFT sizes only (even, n/2 with 2, 3 and 5 factors) */
+		nfft = fft_size_valid( ((spectrum_nfft > 0) && (spectrum_nfft < max_points)) ? spectrum_nfft : max_points );
+		if( (spectrum_nfft > 0) && (nfft != spectrum_nfft) )
+			printf("spectrum: nfft %zu not supported, %zu used\n", spectrum_nfft, nfft);
+		sample_convert_init();
+		if(spectrum_init(&spectrum, spectrum_filename, spectrum_window, nfft, spectrum_nb_avg, spectrum_threads,
+						chan_list, nb_chan, max_points, chan_slab) != 0)
+		{
+			error("ERROR spectrum_init()");
 		}
+		spectrum_mode = 1;
+		printf_dbg("spectrum: %s window, nfft=%zu (%zu bins of %e Hz), %zu segments per channel, nb_avg=%u, %d threads\n",
+					spectrum_window_name(spectrum_window), nfft, nfft / 2 + 1, 1.0 / (nfft * sec_per_sample),
+					(npoints - nfft) / ((nfft / 2 > 0) ? nfft / 2 : 1) + 1, spectrum_nb_avg, spectrum_threads);
+	}
+
+	if(nb_ring_buffers)
+	{
+		printf_dbg("Capture ring %d buffers of %zu bytes (drop_when_full=%d)\n", nb_ring_buffers, ring_slot_size, ring_drop_when_full);
+		if(capture_ring_init(&capture_ring, nb_ring_buffers, ring_buffers, ring_slot_size, outfp, ring_drop_when_full) != 0)
+		{
+			error("ERROR capture_ring_init()");
+		}
+		capture_ring.write_hist = &phase_hist[PHASE_DISK_WRITE];
+		capture_ring.stop_flag = &stop_signal;
+		if(codec_threads)
+			capture_ring.codec = &codec_writer;
+		if( (retain_pre >= 0) && (capture_ring_set_retention(&capture_ring, retain_pre, retain_post) != 0) )
+		{
+			error("ERROR capture_ring_set_retention()");
+		}
+	}
+
+	{
+		size_t block_size = 0;
+
+		/* #9 header + biggest request + terminator */
+		for(k = 0; k < nb_fetch; k++)
+		{
+			if(fetch_list[k].nb_points > block_size)
+				block_size = fetch_list[k].nb_points;
+		}
+		transport_profile_apply(&transport, 11 + block_size + 1, pipeline_depth);
+		if(nb_sessions > 0)
+		{
+			sessions_active = (sessions_setup(hostname, portno, timeout_in_seconds, chan_list, nb_fetch_chan, 11 + block_size + 1) == 0);
+			if(sessions_active)
+				printf("scpi_sessions: %d sessions (speedup %.2f), one per channel\n", sessions.nb_sessions, sessions.speedup);
+			else
+				printf("scpi_sessions: single connection used\n");
+		}
+	}
+	/*
+	 * After the writer and session threads creation so they do not inherit the CPU affinity,
+	 * with -j the session threads are pinned (the main thread only triggers)
+	 */
+	if(sessions_active)
+		transport.cpu = -1;
+	if(transport_profile_pin_cpu(&transport) != 0)
+	{
+		printf_err("ERROR transport_profile_pin_cpu(%d)\n", transport_cpu);
 	}
+	transport_profile_print(&transport);
 
 	int nb_waveform_cnt = 0;
 	nb_total_acq_failed = 0;
-	while(nb_waveform != 0)
+	while( (nb_waveform != 0) && !stop_signal )
 	{
 		if(nb_waveform > 0)
 			nb_waveform--;
 
 		nb_waveform_cnt++;
-		fprintf(stdout, "\nWaveform %d\n", nb_waveform_cnt);
+		printf_info(ASYNC_LOG_PREFIX_NONE, "\nWaveform %d\n", nb_waveform_cnt);
 
 		nb_acq_failed = 0;
+		event_detected = 0;
 		gettimeofday(&start_acq, NULL);
 
-		sprintf((char *)str_buf, ":SING\n");
-		printf_dbg("%s", str_buf);
-		socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
-
-		while(1)
+		if(nb_ring_buffers)
 		{
-			sprintf((char *)str_buf, ":TRIG:STAT?\n");
-			printf_dbg("%s", str_buf);
-			socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
-
-			sprintf((char *)str_buf, "*WAI\n");
-			printf_dbg("%s", str_buf);
-			socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
-
-			/* receive info from the server */
-			bzero(buf, 21);
-			read_nb = recv(sockfd, (char *)buf, 20, 0);
-			if(read_nb <= 0)
-			{
-				printf_dbg("ERROR recv() to read from socket\n");
-				error("ERROR recv()");
-			}
-			printf_dbg(":TRIG:STAT?=%s", buf);
-			if( strncmp((char*)buf, "STOP", 4) == 0 )
-				break;
+			/* Wait for a free buffer (back-pressure) unless drop mode */
+			cur_slot = capture_ring_acquire(&capture_ring);
+			if(cur_slot == NULL)
+				stop_if_requested();
+			cur_slot->waveform_nb = nb_waveform_cnt;
 		}
 
-		for(i = 0; i < 4; i++)
+		if(nb_frames > 0)
 		{
-			nb_acq_failed_curr_chan = 0;
-			if(is_chan_enabled[i] != 1)
-				continue;
+			nb_trig_queries = wait_recording();
+			gettimeofday(&curr_tv, NULL);
+			trig_wait_s = TimevalDiff(&curr_tv, &sing_tv);
+			printf_dbg(":FUNC:WREC:OPER?=STOP (%d frames recorded in %05.04f s, %d queries)\n", nb_frames, trig_wait_s, nb_trig_queries);
+		} else
+		{
+			nb_trig_queries = wait_trigger();
+			gettimeofday(&curr_tv, NULL);
+			trig_wait_s = TimevalDiff(&curr_tv, &sing_tv);
+			printf_dbg(":TRIG:STAT?=STOP (trig_wait=%s %05.04f s, %d queries)\n", trig_wait_name[trig_wait], trig_wait_s, nb_trig_queries);
+		}
+		latency_hist_record_s(&phase_hist[PHASE_TRIG_WAIT], trig_wait_s);
 
-			sprintf((char *)str_buf, ":WAV:SOUR CHAN%d\n", i+1);
-			printf_dbg("%s", str_buf);
-			socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
+		if(sessions_active)
+		{
+			/* The slabs are received again once the measurements of the previous waveform are done */
+			for(k = 0; meas_mode && (k < nb_chan); k++)
+				meas_engine_begin(&meas, chan_list[k]);
+			scpi_sessions_start(&sessions, session_reqs, nb_fetch);
+		}
 
-			if(i == 0)
+		/* Keep up to pipeline_depth :WAV:DATA? in flight */
+		next_req = 0;
+		request_chan_data(&next_req, pipeline_depth);
+		for(k = 0; k < nb_fetch; k++)
+		{
+			const fetch_req_t* req = &fetch_list[k];
+			i = req->chan;
+			if(req->first)
 			{
-				sprintf((char *)str_buf, "*WAI\n");
-				printf_dbg("%s", str_buf);
-				socket_write_nbytes(sockfd, str_buf, strlen((char *)str_buf));
+				nb_acq_failed_curr_chan = 0;
+				packet_nb_curr_chan = packet_nb;
+				gettimeofday(&start_data, NULL);
 			}
 
 			int retry;
 			float time_diff_s;
 			double speed_mbytes_per_sec;
-			gettimeofday(&start_data, NULL);
-			for(retry = 0; retry < nb_retry; retry++)
+			/* Each frame is stored as a waveform */
+			int waveform_nb = (nb_waveform_cnt - 1) * frames_per_acq + ((req->frame > 0) ? req->frame : 1);
+			if(sessions_active)
 			{
-				if(read_chan_data(i) > 0)
-					break;
-				nb_total_acq_failed++;
-				nb_acq_failed++;
-				nb_acq_failed_curr_chan++;
+				/* The failed attempts were requested again by the session (after a resync of its connection) */
+				retry = (read_chan_data(req, waveform_nb) > 0) ? 0 : NB_RETRY;
+				nb_total_acq_failed += session_reqs[k].nb_failed;
+				nb_acq_failed += session_reqs[k].nb_failed;
+				nb_acq_failed_curr_chan += session_reqs[k].nb_failed;
+			} else
+			{
+				for(retry = 0; retry < NB_RETRY; retry++)
+				{
+					if(read_chan_data(req, waveform_nb) > 0)
+						break;
+					nb_total_acq_failed++;
+					nb_acq_failed++;
+					nb_acq_failed_curr_chan++;
+					stop_if_requested();
+					/*
+					 * Desync: drop the replies in flight and request again the failed channel/window alone,
+					 * the next ones are requested again once it is received (a retry is not sent with the
+					 * same requests after it which could fail it again the same way)
+					 */
+					if(scpi_resync() != 0)
+					{
+						error("ERROR scpi_resync()");
+					}
+					next_req = k;
+					wrep_frame_sent = 0;
+					request_chan_data(&next_req, 1);
+				}
+			}
+			if(retry == NB_RETRY)
+			{
+				/* The data of the channel would be incomplete or misaligned in all the outputs */
+				if(req->start > 0)
+				{
+					printf_err("ERROR %s%d window %zu failed %d times\n", (i >= LA_CHAN_BASE) ? "D" : "CH",
+							(i >= LA_CHAN_BASE) ? i - LA_CHAN_BASE : i+1, req->start, NB_RETRY);
+				} else
+				{
+					printf_err("ERROR %s%d failed %d times\n", (i >= LA_CHAN_BASE) ? "D" : "CH",
+							(i >= LA_CHAN_BASE) ? i - LA_CHAN_BASE : i+1, NB_RETRY);
+				}
+				error(NULL);
+			}
+			request_chan_data(&next_req, pipeline_depth);
+			if(!req->last)
+				continue;
+			if(i >= LA_CHAN_BASE)
+			{
+				if( la_mode && (i == (LA_CHAN_BASE + la.last_chan)) && (la_capture_write(&la, waveform_nb, chan_preamble[i].sec_per_sample) != 0) )
+					printf_err("ERROR la_capture_write()\n");
+				gettimeofday(&curr_data, NULL);
+				printf_info(ASYNC_LOG_PREFIX_TIME, "D%d read_chan_data %05.04f s, %zu pts, %u packets (nb_acq_failed_curr_chan=%d)\n", i - LA_CHAN_BASE,
+						TimevalDiff(&curr_data, &start_data), chan_preamble[i].npoints, packet_nb - packet_nb_curr_chan, nb_acq_failed_curr_chan);
+				continue;
+			}
+			if(meas_mode)
+			{
+				/* Measured by the worker of the channel while the next channels are received */
+				meas_engine_submit(&meas, i, waveform_nb, chan_preamble[i].yorigin + chan_preamble[i].yreference,
+									chan_preamble[i].yincrement, chan_preamble[i].sec_per_sample);
+			}
+			if( spectrum_mode &&
+				(spectrum_channel(&spectrum, i, waveform_nb, chan_preamble[i].yorigin + chan_preamble[i].yreference,
+								chan_preamble[i].yincrement, chan_preamble[i].sec_per_sample) != 0) )
+			{
+				printf_err("ERROR spectrum_channel() CH%d\n", i+1);
 			}
 			gettimeofday(&curr_data, NULL);
-			get_CurrentTime(currTime, CURR_TIME_SIZE);
 			time_diff_s = TimevalDiff(&curr_data, &start_data);
 			speed_mbytes_per_sec = (float)(((double)npoints)/(1024.0*1024.0)) / time_diff_s;
-			printf("%s CH%d read_chan_data %05.04f s, %zu pts, %05.03f MBytes/s (nb_acq_failed_curr_chan=%d)\n", currTime, i+1, time_diff_s, npoints, speed_mbytes_per_sec, nb_acq_failed_curr_chan);
+			if(req->frame > 0)
+			{
+				printf_info(ASYNC_LOG_PREFIX_TIME, "Frame %d (time tag %05.06f s) CH%d read_chan_data %05.04f s, %zu pts, %u packets, %05.03f MBytes/s (nb_acq_failed_curr_chan=%d)\n",
+							req->frame, (req->frame - 1) * wrec_interval_s, i+1, time_diff_s, npoints, packet_nb - packet_nb_curr_chan,
+							speed_mbytes_per_sec, nb_acq_failed_curr_chan);
+			} else
+			{
+				printf_info(ASYNC_LOG_PREFIX_TIME, "CH%d read_chan_data %05.04f s, %zu pts, %u packets, %05.03f MBytes/s (nb_acq_failed_curr_chan=%d)\n",
+							i+1, time_diff_s, npoints, packet_nb - packet_nb_curr_chan, speed_mbytes_per_sec, nb_acq_failed_curr_chan);
+			}
 		} // Analog channels loop
 
+		if( (retain_pre >= 0) && (event_signal || event_detected) &&
+			((retain_max_events == 0) || (capture_ring.nb_events < retain_max_events)) )
+		{
+			printf_info(ASYNC_LOG_PREFIX_NONE, "Event on waveform %d (%s), waveforms %d to %d written\n", nb_waveform_cnt, event_signal ? "SIGUSR1" : "-T condition",
+					nb_waveform_cnt - ((capture_ring.nb_held < retain_pre) ? capture_ring.nb_held : retain_pre), nb_waveform_cnt + retain_post);
+			event_signal = 0;
+			capture_ring_event(&capture_ring);
+		}
+		if(cur_slot != NULL)
+		{
+			capture_ring_submit(&capture_ring, cur_slot);
+			cur_slot = NULL;
+		}
+		if( (retain_max_events > 0) && (capture_ring.nb_events >= retain_max_events) && (capture_ring.post_left == 0) )
+		{
+			printf_info(ASYNC_LOG_PREFIX_NONE, "%u events recorded\n", capture_ring.nb_events);
+			nb_waveform = 0;
+		}
+
 		gettimeofday(&curr_acq, NULL);
 		acq_time = TimevalDiff(&curr_acq, &start_acq);
 		acq_time_sum +=  acq_time;
@@ -582,19 +2461,129 @@ int main(int argc, char **argv)
 		if(acq_time > acq_time_max)
 			acq_time_max = acq_time;
 
-		get_CurrentTime(currTime, CURR_TIME_SIZE);
-		printf("%s Acq Time %05.04f s (%zu pts x %d chan, nb_acq_failed=%d)\n", currTime, acq_time, npoints, nb_chan, nb_acq_failed);
+		nb_trig_queries_sum += nb_trig_queries;
+		trig_wait_sum += trig_wait_s;
+		if(trig_wait_s < trig_wait_min)
+			trig_wait_min = trig_wait_s;
+		if(trig_wait_s > trig_wait_max)
+			trig_wait_max = trig_wait_s;
+		trig_first_byte_sum += trig_first_byte_s;
+		if(trig_first_byte_s < trig_first_byte_min)
+			trig_first_byte_min = trig_first_byte_s;
+		if(trig_first_byte_s > trig_first_byte_max)
+			trig_first_byte_max = trig_first_byte_s;
+
+		printf_info(ASYNC_LOG_PREFIX_TIME, "Trig wait %05.04f s (%d queries), :SING to first data byte %05.04f s\n", trig_wait_s, nb_trig_queries, trig_first_byte_s);
+		printf_info(ASYNC_LOG_PREFIX_TIME, "Acq Time %05.04f s (%zu pts x %d chan x %d frames, nb_acq_failed=%d)\n", acq_time, npoints, nb_chan, frames_per_acq, nb_acq_failed);
+
+		if( (stats_filename != NULL) && (stats_period_s > 0) && (TimevalDiff(&curr_acq, &last_stats_tv) >= stats_period_s) )
+		{
+			/* The writer thread records disk_write under the ring lock */
+			if(nb_ring_buffers)
+				pthread_mutex_lock(&capture_ring.lock);
+			latency_hist_export(stats_filename, phase_hist_list, NB_PHASES, TimevalDiff(&curr_acq, &start_tv));
+			if(nb_ring_buffers)
+				pthread_mutex_unlock(&capture_ring.lock);
+			last_stats_tv = curr_acq;
+		}
 	} // end while
+	if(nb_frames > 0)
+	{
+		/* Back to normal acquisitions */
+		scpi_cmd(":FUNC:WREC:ENAB OFF\n");
+		scpi_queue_flush(&scpi_q);
+	}
 
+	/* The summary after the lines of the last waveform */
+	async_log_flush();
+	if(stop_signal)
+		printf("\nCtrl-C pressed\nExit\n");
 	get_CurrentTime(currTime, CURR_TIME_SIZE);
 
 	float ack_time_avg_s;
 	double speed_mbytes_per_sec;
 	ack_time_avg_s = (acq_time_sum / nb_waveform_cnt);
-	speed_mbytes_per_sec = (float)(((double)npoints*nb_chan)/(1024.0*1024.0)) / ack_time_avg_s;
+	speed_mbytes_per_sec = (float)(((double)npoints*nb_chan*frames_per_acq)/(1024.0*1024.0)) / ack_time_avg_s;
 
 	printf("\n%s Acq Time min=%05.04fs, max=%05.04fs, avg=%05.04fs(%05.03f MBytes/s), nb_waveform_cnt=%d, nb_total_acq_failed=%d\n", 
 				currTime, acq_time_min, acq_time_max, ack_time_avg_s, speed_mbytes_per_sec, nb_waveform_cnt, nb_total_acq_failed);
+	{
+		struct timeval end_tv;
+		float elapsed_s;
+
+		/* End to end (setup, trigger, transfer and storage), as reported by make bench */
+		gettimeofday(&end_tv, NULL);
+		elapsed_s = TimevalDiff(&end_tv, &start_tv);
+		printf("Throughput: %d waveforms in %05.04f s (%05.03f waveforms/s, %05.03f MBytes/s)\n",
+				nb_waveform_cnt * frames_per_acq, elapsed_s, nb_waveform_cnt * frames_per_acq / elapsed_s,
+				(((double)npoints * nb_chan * frames_per_acq * nb_waveform_cnt) / (1024.0*1024.0)) / elapsed_s);
+	}
+	printf("SCPI commands=%u, socket writes=%u (pipeline_depth=%d)\n", scpi_q.nb_cmd, scpi_q.nb_write, pipeline_depth);
+	if(sessions_active)
+		scpi_sessions_print(&sessions);
+	if(hislip_mode)
+		hislip_print(&hislip);
+	printf("Transport profile %s: recv calls=%u (MSG_WAITALL=%u), data packets=%u\n", transport_profile_name(transport.mode),
+			transport.nb_recv, transport.nb_recv_waitall, packet_nb);
+	if(use_uring)
+	{
+		printf("io_uring: io_uring_enter calls=%u, SQEs=%u, bytes written by chained writes=%llu\n",
+				sockUring()->nb_enter, sockUring()->nb_sqe, uring_bytes_written);
+	}
+	if(out_format != OUT_RAW)
+	{
+		printf("sample_convert %s: %u samples in %05.04f s (%05.03f MSamples/s)\n", sample_convert_name(),
+				total_bytes, convert_time_s, (total_bytes / 1e6) / convert_time_s);
+	}
+	printf("Trig wait %s: min=%05.04fs, max=%05.04fs, avg=%05.04fs (avg %.1f queries), :SING to first data byte min=%05.04fs, max=%05.04fs, avg=%05.04fs\n",
+				trig_wait_name[trig_wait], trig_wait_min, trig_wait_max, trig_wait_sum / nb_waveform_cnt,
+				(float)nb_trig_queries_sum / nb_waveform_cnt,
+				trig_first_byte_min, trig_first_byte_max, trig_first_byte_sum / nb_waveform_cnt);
+
+	if(nb_ring_buffers)
+	{
+		struct timeval start_close;
+		struct timeval end_close;
+
+		/* Wait for the writer thread to write the remaining buffers */
+		gettimeofday(&start_close, NULL);
+		capture_ring_close(&capture_ring);
+		gettimeofday(&end_close, NULL);
+		printf("Writer: nb_written=%u (%llu bytes, write time %05.04f s, final flush %05.04f s, write errors=%u), max buffers in use=%u/%d\n",
+				capture_ring.nb_written, capture_ring.bytes_written, capture_ring.write_time_s,
+				TimevalDiff(&end_close, &start_close), capture_ring.nb_write_error,
+				capture_ring.max_count, nb_ring_buffers);
+		printf("Writer: back-pressure waits=%u (%05.04f s), dropped waveforms=%u\n",
+				capture_ring.nb_full_wait, capture_ring.full_wait_time_s, capture_ring.nb_dropped);
+		if(retain_pre >= 0)
+		{
+			printf("Ring recording: events=%u, waveforms written=%u, discarded=%u (pre=%d, post=%d)\n",
+					capture_ring.nb_events, capture_ring.nb_written, nb_waveform_cnt - capture_ring.nb_written - capture_ring.nb_dropped,
+					retain_pre, retain_post);
+		}
+	}
+	if(codec_threads)
+		codec_writer_print(&codec_writer);
+	if(meas_mode)
+	{
+		/* Wait for the rows of the last waveform */
+		meas_engine_close(&meas);
+		meas_engine_print(&meas);
+	}
+	if(spectrum_mode)
+		spectrum_print(&spectrum);
+	if(la_mode)
+		la_capture_print(&la);
+	buffer_pool_print(&pool);
+	if(lod_fp != NULL)
+	{
+		fflush(lod_fp);
+		printf("lod_pyramid %s: %llu samples in %05.04f s (%05.03f MSamples/s), index %lld bytes\n", lod_kernel_name(),
+				lod_nb_samples, lod_time_s, (lod_time_s > 0) ? (lod_nb_samples / 1e6) / lod_time_s : 0.0, (long long)ftello(lod_fp));
+	}
+
+	latency_hist_print(phase_hist_list, NB_PHASES);
+	async_log_print();
 
 	printf("\n");
 
@@ -0,0 +1,464 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "async_log.h"
+
+#define ASYNC_LOG_RING_MASK (ASYNC_LOG_RING_SIZE - 1)
+#define ASYNC_LOG_LINE_SIZE (1024)
+#define ASYNC_LOG_DATE_SIZE (40)
+#define ASYNC_LOG_MAX_RECS_PER_LINE (256) /* Longer lines written by the caller */
+
+#ifdef _WIN32
+	#define flockfile _lock_file
+	#define funlockfile _unlock_file
+#endif
+
+typedef struct
+{
+	struct timeval tv;
+	const char* fmt; /* Event format, NULL for a text */
+	unsigned char level;
+	unsigned char prefix;
+	unsigned char nb_next; /* Text: number of records following with the rest of the line */
+	unsigned char len; /* Text bytes in this record */
+	union
+	{
+		long long args[ASYNC_LOG_EVENT_ARGS];
+		char text[ASYNC_LOG_TEXT_SIZE];
+	} u;
+} async_log_rec_t;
+
+typedef struct
+{
+	async_log_rec_t* recs;
+	unsigned int head; /* Next record written (producer) */
+	unsigned int tail; /* Next record read (log thread) */
+	unsigned long long nb_dropped; /* Written by the producer only */
+} async_log_ring_t;
+
+static async_log_level_t log_level = ASYNC_LOG_DEBUG;
+static const struct timeval* log_start_tv;
+static int log_running;
+static int log_async; /* async_log_start() succeeded */
+static int log_stop;
+static pthread_t log_thread;
+
+static async_log_ring_t* rings[ASYNC_LOG_MAX_THREADS];
+static int nb_rings;
+static __thread async_log_ring_t* thread_ring;
+static __thread int thread_ring_failed;
+
+/* Statistics */
+static unsigned long long nb_lines; /* Written by the log thread (or the callers in sync mode) */
+static unsigned long long nb_filtered;
+static unsigned long long nb_sync_lines;
+
+static const char* level_names[ASYNC_LOG_NB_LEVELS] = { "error", "info", "debug", "trace" };
+
+int async_log_level_parse(const char* name)
+{
+	int i;
+
+	for(i = 0; i < ASYNC_LOG_NB_LEVELS; i++)
+	{
+		if(strcmp(name, level_names[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+const char* async_log_level_name(async_log_level_t level)
+{
+	if((unsigned int)level >= ASYNC_LOG_NB_LEVELS)
+		return "?";
+	return level_names[level];
+}
+
+void async_log_init(async_log_level_t level, const struct timeval* start_tv)
+{
+	log_level = level;
+	log_start_tv = start_tv;
+}
+
+int async_log_enabled(async_log_level_t level)
+{
+	return (level <= log_level);
+}
+
+/* "date " or "date (seconds since start) " of the time tv */
+static int format_prefix(char* dst, size_t dst_size, const struct timeval* tv, async_log_prefix_t prefix)
+{
+	char date[ASYNC_LOG_DATE_SIZE];
+	time_t t;
+	struct tm tm;
+
+	if(prefix == ASYNC_LOG_PREFIX_NONE)
+	{
+		dst[0] = 0;
+		return 0;
+	}
+	t = tv->tv_sec;
+#ifdef _WIN32
+	localtime_s(&tm, &t);
+#else
+	localtime_r(&t, &tm);
+#endif
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+	if((prefix == ASYNC_LOG_PREFIX_REL) && (log_start_tv != NULL))
+		return snprintf(dst, dst_size, "%s.%03d (%05.03f s) ", date, (int)(tv->tv_usec / 1000), TimevalDiff(tv, log_start_tv));
+	return snprintf(dst, dst_size, "%s.%03d ", date, (int)(tv->tv_usec / 1000));
+}
+
+/* Write a line formatted by the caller (sync mode or line longer than a ring) */
+static void write_direct(const struct timeval* tv, async_log_prefix_t prefix, const char* text)
+{
+	char prefix_str[ASYNC_LOG_DATE_SIZE + 32];
+
+	format_prefix(prefix_str, sizeof(prefix_str), tv, prefix);
+	flockfile(stdout);
+	fputs(prefix_str, stdout);
+	fputs(text, stdout);
+	funlockfile(stdout);
+	__atomic_fetch_add(&nb_sync_lines, 1, __ATOMIC_RELAXED);
+}
+
+/* Ring of the calling thread, allocated on its first record (NULL if no ring left) */
+static async_log_ring_t* get_ring(void)
+{
+	async_log_ring_t* ring;
+	int idx;
+
+	if(thread_ring != NULL || thread_ring_failed)
+		return thread_ring;
+
+	thread_ring_failed = 1;
+	ring = calloc(1, sizeof(async_log_ring_t));
+	if(ring == NULL)
+		return NULL;
+	ring->recs = malloc(ASYNC_LOG_RING_SIZE * sizeof(async_log_rec_t));
+	if(ring->recs == NULL)
+	{
+		free(ring);
+		return NULL;
+	}
+	idx = __atomic_fetch_add(&nb_rings, 1, __ATOMIC_ACQ_REL);
+	if(idx >= ASYNC_LOG_MAX_THREADS)
+	{
+		/* The records of this thread are written directly */
+		free(ring->recs);
+		free(ring);
+		return NULL;
+	}
+	__atomic_store_n(&rings[idx], ring, __ATOMIC_RELEASE);
+	thread_ring = ring;
+	thread_ring_failed = 0;
+	return ring;
+}
+
+/*
+ * Reserve nb_recs consecutive records of the ring, return the index of the first or -1
+ * (full ring: debug/trace dropped, error/info wait for the log thread)
+ */
+static int ring_reserve(async_log_ring_t* ring, async_log_level_t level, unsigned int nb_recs)
+{
+	for(;;)
+	{
+		if((ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) + nb_recs <= ASYNC_LOG_RING_SIZE)
+			return ring->head;
+		if(level >= ASYNC_LOG_DEBUG || !__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+		{
+			ring->nb_dropped++;
+			return -1;
+		}
+		sleep_ms(1);
+	}
+}
+
+void async_log_event(async_log_level_t level, const char* fmt, long long a0, long long a1, long long a2, long long a3)
+{
+	async_log_ring_t* ring;
+	async_log_rec_t* rec;
+	char line[ASYNC_LOG_LINE_SIZE];
+	struct timeval tv;
+	int idx;
+
+	if(level > log_level)
+	{
+		__atomic_fetch_add(&nb_filtered, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	gettimeofday(&tv, NULL);
+	if(!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE) || (ring = get_ring()) == NULL)
+	{
+		snprintf(line, sizeof(line), fmt, a0, a1, a2, a3);
+		write_direct(&tv, ASYNC_LOG_PREFIX_REL, line);
+		return;
+	}
+	idx = ring_reserve(ring, level, 1);
+	if(idx < 0)
+		return;
+	rec = &ring->recs[idx & ASYNC_LOG_RING_MASK];
+	rec->tv = tv;
+	rec->fmt = fmt;
+	rec->level = level;
+	rec->prefix = ASYNC_LOG_PREFIX_REL;
+	rec->nb_next = 0;
+	rec->u.args[0] = a0;
+	rec->u.args[1] = a1;
+	rec->u.args[2] = a2;
+	rec->u.args[3] = a3;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void async_log_vprintf(async_log_level_t level, async_log_prefix_t prefix, const char* fmt, va_list args)
+{
+	async_log_ring_t* ring;
+	async_log_rec_t* rec;
+	char line[ASYNC_LOG_LINE_SIZE];
+	char* text = line;
+	struct timeval tv;
+	va_list args_copy;
+	unsigned int nb_recs;
+	unsigned int i;
+	int len;
+	int idx;
+
+	if(level > log_level)
+	{
+		__atomic_fetch_add(&nb_filtered, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	gettimeofday(&tv, NULL);
+	va_copy(args_copy, args);
+	len = vsnprintf(line, sizeof(line), fmt, args);
+	if(len < 0)
+	{
+		va_end(args_copy);
+		return;
+	}
+	if(len >= (int)sizeof(line))
+	{
+		text = malloc(len + 1);
+		if(text != NULL)
+			vsnprintf(text, len + 1, fmt, args_copy);
+		else
+		{
+			text = line;
+			len = sizeof(line) - 1;
+		}
+	}
+	va_end(args_copy);
+
+	nb_recs = (len + ASYNC_LOG_TEXT_SIZE - 1) / ASYNC_LOG_TEXT_SIZE;
+	if(nb_recs == 0)
+		nb_recs = 1;
+	if(!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE) || nb_recs > ASYNC_LOG_MAX_RECS_PER_LINE || (ring = get_ring()) == NULL)
+	{
+		/* After the records already logged by this thread */
+		if(nb_recs > ASYNC_LOG_MAX_RECS_PER_LINE)
+			async_log_flush();
+		write_direct(&tv, prefix, text);
+	}
+	else if((idx = ring_reserve(ring, level, nb_recs)) >= 0)
+	{
+		for(i = 0; i < nb_recs; i++)
+		{
+			rec = &ring->recs[(idx + i) & ASYNC_LOG_RING_MASK];
+			rec->tv = tv;
+			rec->fmt = NULL;
+			rec->level = level;
+			rec->prefix = (i == 0) ? prefix : ASYNC_LOG_PREFIX_NONE;
+			rec->nb_next = nb_recs - 1 - i;
+			rec->len = (i < nb_recs - 1) ? ASYNC_LOG_TEXT_SIZE : len - i * ASYNC_LOG_TEXT_SIZE;
+			memcpy(rec->u.text, &text[i * ASYNC_LOG_TEXT_SIZE], rec->len);
+		}
+		/* All the records of the line are visible at once */
+		__atomic_store_n(&ring->head, ring->head + nb_recs, __ATOMIC_RELEASE);
+	}
+	if(text != line)
+		free(text);
+}
+
+void async_log_printf(async_log_level_t level, async_log_prefix_t prefix, const char* fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	async_log_vprintf(level, prefix, fmt, args);
+	va_end(args);
+}
+
+/* Write the oldest record of all the rings (with its continuation records), return 0 if all the rings are empty */
+static int write_oldest(void)
+{
+	async_log_ring_t* ring;
+	async_log_ring_t* oldest = NULL;
+	async_log_rec_t* rec;
+	async_log_rec_t* oldest_rec = NULL;
+	char line[ASYNC_LOG_LINE_SIZE];
+	unsigned int tail;
+	int n;
+	int i;
+
+	n = __atomic_load_n(&nb_rings, __ATOMIC_ACQUIRE);
+	if(n > ASYNC_LOG_MAX_THREADS)
+		n = ASYNC_LOG_MAX_THREADS;
+	for(i = 0; i < n; i++)
+	{
+		ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+		if(ring == NULL || ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+			continue;
+		rec = &ring->recs[ring->tail & ASYNC_LOG_RING_MASK];
+		if( oldest_rec == NULL || rec->tv.tv_sec < oldest_rec->tv.tv_sec ||
+			(rec->tv.tv_sec == oldest_rec->tv.tv_sec && rec->tv.tv_usec < oldest_rec->tv.tv_usec) )
+		{
+			oldest = ring;
+			oldest_rec = rec;
+		}
+	}
+	if(oldest == NULL)
+		return 0;
+
+	tail = oldest->tail;
+	rec = oldest_rec;
+	format_prefix(line, sizeof(line), &rec->tv, rec->prefix);
+	flockfile(stdout);
+	fputs(line, stdout);
+	if(rec->fmt != NULL)
+	{
+		snprintf(line, sizeof(line), rec->fmt, rec->u.args[0], rec->u.args[1], rec->u.args[2], rec->u.args[3]);
+		fputs(line, stdout);
+		tail++;
+	}
+	else
+	{
+		for(;;)
+		{
+			fwrite(rec->u.text, 1, rec->len, stdout);
+			tail++;
+			if(rec->nb_next == 0)
+				break;
+			rec = &oldest->recs[tail & ASYNC_LOG_RING_MASK];
+		}
+	}
+	funlockfile(stdout);
+	nb_lines++;
+	__atomic_store_n(&oldest->tail, tail, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static void* log_thread_main(void* arg)
+{
+	(void)arg;
+	for(;;)
+	{
+		if(write_oldest())
+			continue;
+		/* Idle: the lines written are visible before sleeping */
+		fflush(stdout);
+		if(__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE))
+			break;
+		sleep_ms(ASYNC_LOG_IDLE_US / 1000);
+	}
+	return NULL;
+}
+
+int async_log_start(void)
+{
+	if(log_running)
+		return 0;
+	log_stop = 0;
+	/* Written only by the log thread from now */
+	__atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+	if(pthread_create(&log_thread, NULL, log_thread_main, NULL) != 0)
+	{
+		__atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+		printf("ERROR async_log_start() pthread_create()\n");
+		return -1;
+	}
+	log_async = 1;
+	return 0;
+}
+
+void async_log_flush(void)
+{
+	unsigned int heads[ASYNC_LOG_MAX_THREADS];
+	async_log_ring_t* ring;
+	int n;
+	int i;
+
+	if(!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+	{
+		fflush(stdout);
+		return;
+	}
+	n = __atomic_load_n(&nb_rings, __ATOMIC_ACQUIRE);
+	if(n > ASYNC_LOG_MAX_THREADS)
+		n = ASYNC_LOG_MAX_THREADS;
+	for(i = 0; i < n; i++)
+	{
+		ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+		heads[i] = (ring != NULL) ? __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) : 0;
+	}
+	for(i = 0; i < n; i++)
+	{
+		ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+		if(ring == NULL)
+			continue;
+		while((int)(heads[i] - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) > 0)
+			sleep_ms(1);
+	}
+	fflush(stdout);
+}
+
+void async_log_stop(void)
+{
+	if(!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+		return;
+	__atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(log_thread, NULL);
+	__atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+	/* Records logged while the log thread was exiting */
+	while(write_oldest())
+		;
+	fflush(stdout);
+}
+
+void async_log_print(void)
+{
+	unsigned long long nb_dropped = 0;
+	async_log_ring_t* ring;
+	int n;
+	int i;
+
+	n = __atomic_load_n(&nb_rings, __ATOMIC_ACQUIRE);
+	if(n > ASYNC_LOG_MAX_THREADS)
+		n = ASYNC_LOG_MAX_THREADS;
+	for(i = 0; i < n; i++)
+	{
+		ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+		if(ring != NULL)
+			nb_dropped += ring->nb_dropped;
+	}
+	printf("Log: level %s, %s (%d threads), %llu lines (%llu written by the caller), %llu records above level not written, %llu dropped (ring full)\n",
+			level_names[log_level], log_async ? "async" : "sync", n, nb_lines + nb_sync_lines, nb_sync_lines,
+			__atomic_load_n(&nb_filtered, __ATOMIC_RELAXED), nb_dropped);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __ASYNC_LOG_H__
+#define __ASYNC_LOG_H__
+
+#include <stdarg.h>
+
+#include "socket_portable.h"
+
+/*
+ * Leveled logging with the output done by a background thread
+ * Each thread logging has its own single producer/single consumer ring of
+ * records (lock-free, allocated on its first record). A record has the time
+ * it was logged and either:
+ * - an event: format (string literal with only %lld conversions) and up to
+ *   ASYNC_LOG_EVENT_ARGS integers, nothing is formatted by the caller (hot path)
+ * - a text: line formatted by the caller (longer lines use several records)
+ * The log thread merges the rings in time order, formats the date/relative
+ * time prefix and the events and writes them to stdout.
+ * Records above the level are only counted. When a ring is full the debug and
+ * trace records are dropped (counted) so the caller never waits, error and
+ * info records wait for room.
+ * Without async_log_start() (or if the thread cannot be started) the records
+ * are written by the caller as before.
+ */
+
+#define ASYNC_LOG_RING_SIZE (4096) /* Records per thread (power of 2) */
+#define ASYNC_LOG_MAX_THREADS (16)
+#define ASYNC_LOG_EVENT_ARGS (4)
+#define ASYNC_LOG_TEXT_SIZE (216)
+#define ASYNC_LOG_IDLE_US (1000) /* Log thread sleep when all the rings are empty */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	ASYNC_LOG_ERROR = 0,
+	ASYNC_LOG_INFO,
+	ASYNC_LOG_DEBUG,
+	ASYNC_LOG_TRACE, /* Per packet events */
+	ASYNC_LOG_NB_LEVELS
+} async_log_level_t;
+
+typedef enum
+{
+	ASYNC_LOG_PREFIX_NONE = 0,
+	ASYNC_LOG_PREFIX_TIME, /* "date " */
+	ASYNC_LOG_PREFIX_REL /* "date (seconds since start) " */
+} async_log_prefix_t;
+
+/* Level from its name ("error", "info", "debug" or "trace") or -1 */
+int async_log_level_parse(const char* name);
+const char* async_log_level_name(async_log_level_t level);
+
+/* Records up to level are written, start_tv is the origin of the relative times (read when each record is written) */
+void async_log_init(async_log_level_t level, const struct timeval* start_tv);
+/* Start the log thread, return 0 if OK or -1 (records written by the caller) */
+int async_log_start(void);
+/* Wait until all the records logged before are written */
+void async_log_flush(void);
+/* Flush and stop the log thread (records written by the caller afterwards) */
+void async_log_stop(void);
+
+/* Non zero if the records of level are written */
+int async_log_enabled(async_log_level_t level);
+void async_log_vprintf(async_log_level_t level, async_log_prefix_t prefix, const char* fmt, va_list args);
+void async_log_printf(async_log_level_t level, async_log_prefix_t prefix, const char* fmt, ...);
+/* Event with the ASYNC_LOG_PREFIX_REL prefix, fmt shall be a string literal with only %lld conversions */
+void async_log_event(async_log_level_t level, const char* fmt, long long a0, long long a1, long long a2, long long a3);
+
+void async_log_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __ASYNC_LOG_H__ */
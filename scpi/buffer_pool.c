@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer_pool.h"
+
+/* Alignment of each slab (page) */
+#define BUFFER_POOL_ALIGN (4096)
+
+static const char* buffer_pool_pages_names[BUFFER_POOL_NB_PAGES] = { "default", "thp", "hugetlb" };
+
+int buffer_pool_pages_parse(const char* name)
+{
+	int k;
+
+	for(k = 0; k < BUFFER_POOL_NB_PAGES; k++)
+	{
+		if(strcmp(name, buffer_pool_pages_names[k]) == 0)
+			return k;
+	}
+	return -1;
+}
+
+const char* buffer_pool_pages_name(buffer_pool_pages_t pages)
+{
+	return ((unsigned int)pages < BUFFER_POOL_NB_PAGES) ? buffer_pool_pages_names[pages] : "unknown";
+}
+
+void buffer_pool_init(buffer_pool_t* pool)
+{
+	memset(pool, 0, sizeof(buffer_pool_t));
+}
+
+int buffer_pool_add(buffer_pool_t* pool, size_t size)
+{
+	if( (pool->map != NULL) || (pool->nb_slabs == BUFFER_POOL_MAX_SLABS) )
+		return -1;
+	pool->slab_offset[pool->nb_slabs] = pool->size;
+	pool->slab_size[pool->nb_slabs] = size;
+	pool->size += (size + BUFFER_POOL_ALIGN - 1) & ~((size_t)BUFFER_POOL_ALIGN - 1);
+	return pool->nb_slabs++;
+}
+
+unsigned char* buffer_pool_slab(const buffer_pool_t* pool, int slab)
+{
+	if( (pool->map == NULL) || (slab < 0) || (slab >= pool->nb_slabs) )
+		return NULL;
+	return &pool->map[pool->slab_offset[slab]];
+}
+
+#ifdef _WIN32
+
+int buffer_pool_map(buffer_pool_t* pool, buffer_pool_pages_t pages)
+{
+	if(pool->map != NULL)
+		return -1;
+	/* Over-allocated to align the first slab */
+	pool->map_len = pool->size + BUFFER_POOL_ALIGN;
+	pool->alloc = malloc(pool->map_len);
+	if(pool->alloc == NULL)
+	{
+		printf("ERROR buffer_pool_map() malloc(%zu)\n", pool->map_len);
+		return -1;
+	}
+	pool->map = (unsigned char*)(((size_t)pool->alloc + BUFFER_POOL_ALIGN - 1) & ~((size_t)BUFFER_POOL_ALIGN - 1));
+	pool->pages = BUFFER_POOL_PAGES_DEFAULT;
+	return 0;
+}
+
+void buffer_pool_free(buffer_pool_t* pool)
+{
+	free(pool->alloc);
+	pool->alloc = NULL;
+	pool->map = NULL;
+	pool->map_len = 0;
+}
+
+void buffer_pool_print(const buffer_pool_t* pool)
+{
+	printf("buffer_pool: %d slabs, %zu bytes allocated (%s pages)\n",
+			pool->nb_slabs, pool->map_len, buffer_pool_pages_name(pool->pages));
+}
+
+#else
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static unsigned char* buffer_pool_mmap_thp(size_t len, int* thp)
+{
+	void* map;
+	size_t head;
+	size_t align_len = len + BUFFER_POOL_HUGE_PAGE_SIZE;
+
+	*thp = 0;
+	/* Over-mapped then trimmed so the mapping starts on a huge page boundary */
+	map = mmap(NULL, align_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED)
+		return NULL;
+	head = (BUFFER_POOL_HUGE_PAGE_SIZE - ((size_t)map % BUFFER_POOL_HUGE_PAGE_SIZE)) % BUFFER_POOL_HUGE_PAGE_SIZE;
+	if(head > 0)
+		munmap(map, head);
+	if((align_len - head) > len)
+		munmap((unsigned char*)map + head + len, align_len - head - len);
+	map = (unsigned char*)map + head;
+#ifdef MADV_HUGEPAGE
+	*thp = (madvise(map, len, MADV_HUGEPAGE) == 0);
+#endif
+	return (unsigned char*)map;
+}
+
+int buffer_pool_map(buffer_pool_t* pool, buffer_pool_pages_t pages)
+{
+	size_t page_size = (pages == BUFFER_POOL_PAGES_DEFAULT) ? (size_t)sysconf(_SC_PAGESIZE) : BUFFER_POOL_HUGE_PAGE_SIZE;
+	void* map;
+	int thp;
+
+	if(pool->map != NULL)
+		return -1;
+	pool->map_len = (pool->size + page_size - 1) / page_size * page_size;
+	if(pool->map_len == 0)
+		pool->map_len = page_size;
+	pool->pages = BUFFER_POOL_PAGES_DEFAULT;
+#ifdef MAP_HUGETLB
+	if(pages == BUFFER_POOL_PAGES_HUGETLB)
+	{
+		map = mmap(NULL, pool->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(map != MAP_FAILED)
+		{
+			pool->map = (unsigned char*)map;
+			pool->pages = BUFFER_POOL_PAGES_HUGETLB;
+			return 0;
+		}
+		printf("buffer_pool: MAP_HUGETLB of %zu bytes failed (errno=%d, no huge pages reserved in /proc/sys/vm/nr_hugepages?), thp used\n",
+				pool->map_len, errno);
+	}
+#endif
+	if(pages != BUFFER_POOL_PAGES_DEFAULT)
+	{
+		pool->map = buffer_pool_mmap_thp(pool->map_len, &thp);
+		if(thp)
+			pool->pages = BUFFER_POOL_PAGES_THP;
+	} else
+	{
+		map = mmap(NULL, pool->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		pool->map = (map != MAP_FAILED) ? (unsigned char*)map : NULL;
+	}
+	if(pool->map == NULL)
+	{
+		printf("ERROR buffer_pool_map() mmap(%zu) (errno=%d)\n", pool->map_len, errno);
+		pool->map_len = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void buffer_pool_free(buffer_pool_t* pool)
+{
+	if(pool->map != NULL)
+		munmap(pool->map, pool->map_len);
+	pool->map = NULL;
+	pool->map_len = 0;
+}
+
+/* Bytes of the mapping backed by memory */
+static size_t buffer_pool_resident(const buffer_pool_t* pool)
+{
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t nb_pages = (pool->map_len + page_size - 1) / page_size;
+	size_t nb_resident = 0;
+	unsigned char* vec;
+	size_t i;
+
+	if(pool->map == NULL)
+		return 0;
+	vec = malloc(nb_pages);
+	if(vec == NULL)
+		return 0;
+	if(mincore(pool->map, pool->map_len, (void*)vec) == 0)
+	{
+		for(i = 0; i < nb_pages; i++)
+			nb_resident += (vec[i] & 1);
+	}
+	free(vec);
+	return nb_resident * page_size;
+}
+
+void buffer_pool_print(const buffer_pool_t* pool)
+{
+	printf("buffer_pool: %d slabs, %zu bytes mapped (%s pages), %zu bytes resident\n",
+			pool->nb_slabs, pool->map_len, buffer_pool_pages_name(pool->pages), buffer_pool_resident(pool));
+}
+
+#endif
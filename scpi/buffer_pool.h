@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <stddef.h>
+
+/*
+ * Capture buffers sized from :WAV:PRE? and allocated once
+ * The slabs are added with their size, then mapped with a single anonymous
+ * mapping (each slab page aligned), optionally backed by huge pages:
+ * - thp: mapping aligned on BUFFER_POOL_HUGE_PAGE_SIZE with madvise(MADV_HUGEPAGE)
+ * - hugetlb: MAP_HUGETLB (pages reserved in /proc/sys/vm/nr_hugepages), thp if it fails
+ * Pages are only backed when touched, the slabs are reused by all the waveforms.
+ * On Windows the pool is allocated with malloc() (no huge pages).
+ */
+
+#define BUFFER_POOL_MAX_SLABS (32)
+#define BUFFER_POOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	BUFFER_POOL_PAGES_DEFAULT = 0,
+	BUFFER_POOL_PAGES_THP,
+	BUFFER_POOL_PAGES_HUGETLB,
+	BUFFER_POOL_NB_PAGES
+} buffer_pool_pages_t;
+
+typedef struct
+{
+	unsigned char* map;
+	size_t map_len;
+	void* alloc; /* malloc() block containing map (Windows) */
+	size_t size; /* Bytes of the slabs (page aligned) */
+	int nb_slabs;
+	size_t slab_offset[BUFFER_POOL_MAX_SLABS];
+	size_t slab_size[BUFFER_POOL_MAX_SLABS];
+	buffer_pool_pages_t pages; /* Pages actually used */
+} buffer_pool_t;
+
+/* Pages from their name ("default", "thp" or "hugetlb"), -1 if unknown */
+int buffer_pool_pages_parse(const char* name);
+const char* buffer_pool_pages_name(buffer_pool_pages_t pages);
+
+void buffer_pool_init(buffer_pool_t* pool);
+/* Add a slab of size bytes (before buffer_pool_map()), return its index or -1 */
+int buffer_pool_add(buffer_pool_t* pool, size_t size);
+/* Map all the slabs, return 0 if OK or -1 */
+int buffer_pool_map(buffer_pool_t* pool, buffer_pool_pages_t pages);
+/* Slab of index slab (NULL before buffer_pool_map()) */
+unsigned char* buffer_pool_slab(const buffer_pool_t* pool, int slab);
+void buffer_pool_free(buffer_pool_t* pool);
+void buffer_pool_print(const buffer_pool_t* pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BUFFER_POOL_H__ */
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "socket_portable.h"
+#include "capture_ring.h"
+
+static void* capture_ring_writer(void* arg)
+{
+	capture_ring_t* ring = (capture_ring_t*)arg;
+	capture_slot_t* slot;
+	struct timeval start_write;
+	struct timeval end_write;
+	size_t fwrite_nb;
+
+	pthread_mutex_lock(&ring->lock);
+	while(1)
+	{
+		while( ((ring->count == 0) || (ring->slots[ring->tail].state == CAPTURE_SLOT_HELD)) && (ring->stop == 0) )
+			pthread_cond_wait(&ring->not_empty, &ring->lock);
+		if(ring->count == 0) // stop and nothing left to write
+			break;
+		slot = &ring->slots[ring->tail];
+		if(slot->state != CAPTURE_SLOT_WRITE)
+		{
+			/* Discarded or still held at the end (no event after it) */
+			ring->tail = (ring->tail + 1) % ring->nb_slots;
+			ring->count--;
+			pthread_cond_signal(&ring->not_full);
+			continue;
+		}
+		pthread_mutex_unlock(&ring->lock);
+
+		/* Write without holding the lock, the network thread fills the other slots */
+		gettimeofday(&start_write, NULL);
+		if(ring->codec != NULL)
+			fwrite_nb = (codec_writer_write(ring->codec, slot->data, slot->len) == 0) ? slot->len : 0;
+		else
+			fwrite_nb = fwrite(slot->data, sizeof(char), slot->len, ring->fp);
+		gettimeofday(&end_write, NULL);
+
+		pthread_mutex_lock(&ring->lock);
+		ring->write_time_s += TimevalDiff(&end_write, &start_write);
+		if(ring->write_hist != NULL)
+			latency_hist_record_s(ring->write_hist, TimevalDiff(&end_write, &start_write));
+		if(fwrite_nb != slot->len)
+		{
+			printf("fwrite() on outfp error len=%zu != expected %zu (waveform %u)\n", fwrite_nb, slot->len, slot->waveform_nb);
+			ring->nb_write_error++;
+		}
+		ring->bytes_written += fwrite_nb;
+		ring->nb_written++;
+		ring->tail = (ring->tail + 1) % ring->nb_slots;
+		ring->count--;
+		pthread_cond_signal(&ring->not_full);
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	return NULL;
+}
+
+static void capture_ring_free(capture_ring_t* ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+static size_t capture_ring_slot_stride(size_t slot_size)
+{
+	return (slot_size + CAPTURE_RING_SLOT_ALIGN - 1) & ~((size_t)CAPTURE_RING_SLOT_ALIGN - 1);
+}
+
+size_t capture_ring_buffers_size(int nb_slots, size_t slot_size, int drop_when_full)
+{
+	return capture_ring_slot_stride(slot_size) * (size_t)(nb_slots + (drop_when_full ? 1 : 0));
+}
+
+int capture_ring_init(capture_ring_t* ring, int nb_slots, unsigned char* buffers, size_t slot_size, FILE* fp, int drop_when_full)
+{
+	int i;
+	size_t stride = capture_ring_slot_stride(slot_size);
+
+	memset(ring, 0, sizeof(capture_ring_t));
+	ring->nb_slots = nb_slots;
+	ring->drop_when_full = drop_when_full;
+	ring->fp = fp;
+
+	if(buffers == NULL)
+		return -1;
+	ring->slots = calloc(nb_slots + 1, sizeof(capture_slot_t));
+	if(ring->slots == NULL)
+		return -1;
+	for(i = 0; i < nb_slots; i++)
+	{
+		ring->slots[i].data = buffers + (size_t)i * stride;
+		ring->slots[i].capacity = slot_size;
+	}
+	/* The scratch slot is only used in drop mode */
+	if(drop_when_full)
+	{
+		ring->slots[nb_slots].data = buffers + (size_t)nb_slots * stride;
+		ring->slots[nb_slots].capacity = slot_size;
+	}
+	ring->slots[nb_slots].dropped = 1;
+
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->not_empty, NULL);
+	pthread_cond_init(&ring->not_full, NULL);
+	if(pthread_create(&ring->thread, NULL, capture_ring_writer, ring) != 0)
+	{
+		printf("ERROR capture_ring_init() pthread_create()\n");
+		capture_ring_free(ring);
+		return -1;
+	}
+	return 0;
+}
+
+capture_slot_t* capture_ring_acquire(capture_ring_t* ring)
+{
+	capture_slot_t* slot;
+	struct timeval start_wait;
+	struct timeval end_wait;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&ring->lock);
+	if(ring->count == ring->nb_slots)
+	{
+		if(ring->drop_when_full)
+		{
+			pthread_mutex_unlock(&ring->lock);
+			slot = &ring->slots[ring->nb_slots];
+			slot->len = 0;
+			return slot;
+		}
+		ring->nb_full_wait++;
+		gettimeofday(&start_wait, NULL);
+		while( (ring->count == ring->nb_slots) && ((ring->stop_flag == NULL) || !*ring->stop_flag) )
+		{
+			TimespecAfterMs(&deadline, CAPTURE_RING_STOP_POLL_MS);
+			pthread_cond_timedwait(&ring->not_full, &ring->lock, &deadline);
+		}
+		gettimeofday(&end_wait, NULL);
+		ring->full_wait_time_s += TimevalDiff(&end_wait, &start_wait);
+		if(ring->count == ring->nb_slots)
+		{
+			pthread_mutex_unlock(&ring->lock);
+			return NULL;
+		}
+	}
+	slot = &ring->slots[ring->head];
+	pthread_mutex_unlock(&ring->lock);
+
+	slot->len = 0;
+	return slot;
+}
+
+/* Retention: state of the slot submitted, called with the lock */
+static void capture_ring_retain(capture_ring_t* ring, capture_slot_t* slot)
+{
+	int i;
+
+	if(ring->event_pending)
+	{
+		/* The held slots are written before the slot of the event */
+		for(i = 1; i <= ring->nb_held; i++)
+			ring->slots[(ring->head - i + ring->nb_slots) % ring->nb_slots].state = CAPTURE_SLOT_WRITE;
+		ring->nb_held = 0;
+		ring->post_left = ring->retain_post;
+		ring->event_pending = 0;
+		ring->nb_events++;
+		slot->state = CAPTURE_SLOT_WRITE;
+	} else if(ring->post_left > 0)
+	{
+		ring->post_left--;
+		slot->state = CAPTURE_SLOT_WRITE;
+	} else
+	{
+		slot->state = CAPTURE_SLOT_HELD;
+		ring->nb_held++;
+		if(ring->nb_held > ring->retain_pre)
+		{
+			/* Oldest held slot, the held slots are the last submitted */
+			ring->slots[(ring->head - (ring->nb_held - 1) + ring->nb_slots) % ring->nb_slots].state = CAPTURE_SLOT_DISCARD;
+			ring->nb_held--;
+			ring->nb_discarded++;
+		}
+	}
+}
+
+void capture_ring_submit(capture_ring_t* ring, capture_slot_t* slot)
+{
+	pthread_mutex_lock(&ring->lock);
+	if(slot->dropped)
+	{
+		ring->nb_dropped++;
+	} else
+	{
+		if(ring->retain)
+			capture_ring_retain(ring, slot);
+		else
+			slot->state = CAPTURE_SLOT_WRITE;
+		ring->head = (ring->head + 1) % ring->nb_slots;
+		ring->count++;
+		if((unsigned int)ring->count > ring->max_count)
+			ring->max_count = (unsigned int)ring->count;
+		pthread_cond_signal(&ring->not_empty);
+	}
+	pthread_mutex_unlock(&ring->lock);
+}
+
+int capture_ring_set_retention(capture_ring_t* ring, int pre, int post)
+{
+	if( (pre < 0) || (post < 0) || (pre >= ring->nb_slots) )
+		return -1;
+	pthread_mutex_lock(&ring->lock);
+	ring->retain = 1;
+	ring->retain_pre = pre;
+	ring->retain_post = post;
+	pthread_mutex_unlock(&ring->lock);
+	return 0;
+}
+
+void capture_ring_event(capture_ring_t* ring)
+{
+	pthread_mutex_lock(&ring->lock);
+	ring->event_pending = 1;
+	pthread_mutex_unlock(&ring->lock);
+}
+
+void capture_ring_close(capture_ring_t* ring)
+{
+	if(ring->slots == NULL)
+		return;
+
+	pthread_mutex_lock(&ring->lock);
+	ring->stop = 1;
+	pthread_cond_signal(&ring->not_empty);
+	pthread_mutex_unlock(&ring->lock);
+	pthread_join(ring->thread, NULL);
+
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->not_empty);
+	pthread_cond_destroy(&ring->not_full);
+
+	capture_ring_free(ring);
+}
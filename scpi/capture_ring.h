@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CAPTURE_RING_H__
+#define __CAPTURE_RING_H__
+
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "latency_hist.h"
+#include "codec_writer.h"
+
+/*
+ * Bounded ring of capture buffers (one buffer = one waveform, all channels)
+ * The network thread fills a buffer while a writer thread writes the
+ * previous ones to disk.
+ * When the ring is full the network thread waits (back-pressure) or, in drop
+ * mode, receives the waveform in a scratch buffer which is not written.
+ * With retention the last pre waveforms are held in the ring (older ones are
+ * discarded, not written) until an event releases them to the writer with the
+ * waveform of the event and the post waveforms after it.
+ */
+
+#define CAPTURE_RING_SLOT_ALIGN (4096) /* Each slot buffer starts on a page */
+#define CAPTURE_RING_STOP_POLL_MS (100) /* stop_flag checked while waiting for a free slot */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	CAPTURE_SLOT_WRITE = 0,
+	CAPTURE_SLOT_HELD, /* Retention: kept until an event or discarded */
+	CAPTURE_SLOT_DISCARD
+} capture_slot_state_t;
+
+typedef struct
+{
+	unsigned char* data;
+	size_t capacity;
+	size_t len;
+	unsigned int waveform_nb;
+	int dropped; /* 1 for the scratch buffer used when the ring is full in drop mode */
+	capture_slot_state_t state;
+} capture_slot_t;
+
+typedef struct
+{
+	capture_slot_t* slots; /* nb_slots + 1 scratch slot (without buffer if not in drop mode) */
+	int nb_slots;
+	int head; /* Next slot to fill */
+	int tail; /* Next slot to write */
+	int count; /* Slots filled and not yet written */
+	int drop_when_full;
+	int stop;
+	FILE* fp;
+	codec_writer_t* codec; /* Optional, slots are compressed to fp (set before the first submit) */
+	const volatile sig_atomic_t* stop_flag; /* Optional, capture_ring_acquire() gives up waiting once it is set */
+
+	/* Retention (capture_ring_set_retention()) */
+	int retain;
+	int retain_pre;
+	int retain_post;
+	int nb_held; /* Last submitted slots held */
+	int post_left; /* Slots still written after the last event */
+	int event_pending;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+
+	/* Statistics */
+	unsigned int nb_written;
+	unsigned int nb_dropped;
+	unsigned int nb_full_wait; /* Back-pressure: nb times the network thread waited for a free slot */
+	unsigned int nb_write_error;
+	unsigned int max_count;
+	unsigned int nb_events;
+	unsigned int nb_discarded; /* Retention: slots not written (older than pre) */
+	unsigned long long bytes_written;
+	double full_wait_time_s;
+	double write_time_s;
+	latency_hist_t* write_hist; /* Optional, duration of each slot write (under lock) */
+} capture_ring_t;
+
+/* Size of the buffers of capture_ring_init() (slots of slot_size bytes page aligned, + scratch slot in drop mode) */
+size_t capture_ring_buffers_size(int nb_slots, size_t slot_size, int drop_when_full);
+/* Split buffers (capture_ring_buffers_size() bytes, page aligned, owned by the caller) in slots of slot_size bytes and start the writer thread, return 0 if OK or -1 */
+int capture_ring_init(capture_ring_t* ring, int nb_slots, unsigned char* buffers, size_t slot_size, FILE* fp, int drop_when_full);
+/* Get a free slot to fill (wait if the ring is full, except in drop mode), NULL if stop_flag is set while waiting */
+capture_slot_t* capture_ring_acquire(capture_ring_t* ring);
+/* Give a filled slot to the writer thread (slot->len bytes are written) */
+void capture_ring_submit(capture_ring_t* ring, capture_slot_t* slot);
+/* Retention: hold the last pre slots and write only pre + 1 + post slots around each event (pre < nb_slots, before the first submit) */
+int capture_ring_set_retention(capture_ring_t* ring, int pre, int post);
+/* Retention: the next submitted slot is an event (called by the network thread before capture_ring_submit()) */
+void capture_ring_event(capture_ring_t* ring);
+/* Wait until all submitted slots are written, stop the writer thread and free the slots (not the buffers) */
+void capture_ring_close(capture_ring_t* ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __CAPTURE_RING_H__ */
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "socket_portable.h"
+#include "codec_writer.h"
+
+static void* codec_writer_thread(void* arg)
+{
+	codec_writer_t* w = (codec_writer_t*)arg;
+	struct timeval start_tv;
+	struct timeval end_tv;
+	const unsigned char* src;
+	size_t block;
+	size_t nb;
+	size_t len;
+	int slot;
+
+	pthread_mutex_lock(&w->lock);
+	while(1)
+	{
+		/* A block can only be compressed once its output buffer is written */
+		while( (w->stop == 0) &&
+				!((w->next_block < w->nb_blocks) && (w->next_block < (w->nb_written + w->nb_out))) )
+			pthread_cond_wait(&w->work, &w->lock);
+		if(w->stop)
+			break;
+		block = w->next_block++;
+		slot = block % w->nb_out;
+		src = &w->src[block * SAMPLE_CODEC_BLOCK_SIZE];
+		nb = w->src_len - block * SAMPLE_CODEC_BLOCK_SIZE;
+		if(nb > SAMPLE_CODEC_BLOCK_SIZE)
+			nb = SAMPLE_CODEC_BLOCK_SIZE;
+		pthread_mutex_unlock(&w->lock);
+
+		gettimeofday(&start_tv, NULL);
+		len = sample_codec_compress_block(src, nb, w->out[slot]);
+		gettimeofday(&end_tv, NULL);
+
+		pthread_mutex_lock(&w->lock);
+		w->out_len[slot] = len;
+		w->compress_time_s += TimevalDiff(&end_tv, &start_tv);
+		if(len == SAMPLE_CODEC_BOUND(nb))
+			w->nb_blocks_stored++;
+		pthread_cond_broadcast(&w->done);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+static void codec_writer_free(codec_writer_t* w)
+{
+	int i;
+
+	if(w->out != NULL)
+	{
+		for(i = 0; i < w->nb_out; i++)
+			free(w->out[i]);
+	}
+	free(w->out);
+	free(w->out_len);
+	free(w->threads);
+	w->out = NULL;
+	w->out_len = NULL;
+	w->threads = NULL;
+}
+
+int codec_writer_init(codec_writer_t* w, FILE* fp, int nb_threads)
+{
+	unsigned char file_hdr[SAMPLE_CODEC_FILE_HDR_SIZE];
+	int i;
+
+	memset(w, 0, sizeof(codec_writer_t));
+	if( (nb_threads < 1) || (nb_threads > CODEC_WRITER_MAX_THREADS) )
+		return -1;
+	w->fp = fp;
+	w->nb_out = 2 * nb_threads;
+	w->out = calloc(w->nb_out, sizeof(unsigned char*));
+	w->out_len = calloc(w->nb_out, sizeof(size_t));
+	w->threads = calloc(nb_threads, sizeof(pthread_t));
+	if( (w->out == NULL) || (w->out_len == NULL) || (w->threads == NULL) )
+	{
+		codec_writer_free(w);
+		return -1;
+	}
+	for(i = 0; i < w->nb_out; i++)
+	{
+		w->out[i] = malloc(SAMPLE_CODEC_BOUND(SAMPLE_CODEC_BLOCK_SIZE));
+		if(w->out[i] == NULL)
+		{
+			printf("ERROR codec_writer_init() malloc(%d)\n", SAMPLE_CODEC_BOUND(SAMPLE_CODEC_BLOCK_SIZE));
+			codec_writer_free(w);
+			return -1;
+		}
+	}
+
+	sample_codec_file_header(file_hdr, SAMPLE_CODEC_BLOCK_SIZE);
+	if(fwrite(file_hdr, sizeof(file_hdr), 1, fp) != 1)
+	{
+		codec_writer_free(w);
+		return -1;
+	}
+	w->comp_bytes = sizeof(file_hdr);
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->work, NULL);
+	pthread_cond_init(&w->done, NULL);
+	for(w->nb_threads = 0; w->nb_threads < nb_threads; w->nb_threads++)
+	{
+		if(pthread_create(&w->threads[w->nb_threads], NULL, codec_writer_thread, w) != 0)
+		{
+			printf("ERROR codec_writer_init() pthread_create()\n");
+			codec_writer_close(w);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int codec_writer_write(codec_writer_t* w, const unsigned char* data, size_t nb_bytes)
+{
+	struct timeval start_tv;
+	struct timeval end_tv;
+	size_t len;
+	int slot;
+	int err = 0;
+
+	if(nb_bytes == 0)
+		return 0;
+	gettimeofday(&start_tv, NULL);
+	pthread_mutex_lock(&w->lock);
+	w->src = data;
+	w->src_len = nb_bytes;
+	w->nb_blocks = (nb_bytes + SAMPLE_CODEC_BLOCK_SIZE - 1) / SAMPLE_CODEC_BLOCK_SIZE;
+	w->next_block = 0;
+	w->nb_written = 0;
+	pthread_cond_broadcast(&w->work);
+	while(w->nb_written < w->nb_blocks)
+	{
+		/* Blocks are written in order, the threads compress the next ones meanwhile */
+		slot = w->nb_written % w->nb_out;
+		while(w->out_len[slot] == 0)
+			pthread_cond_wait(&w->done, &w->lock);
+		len = w->out_len[slot];
+		pthread_mutex_unlock(&w->lock);
+
+		if(fwrite(w->out[slot], sizeof(char), len, w->fp) != len)
+			err = -1;
+
+		pthread_mutex_lock(&w->lock);
+		w->out_len[slot] = 0;
+		w->nb_written++;
+		w->comp_bytes += len;
+		pthread_cond_broadcast(&w->work);
+	}
+	w->nb_blocks_total += w->nb_blocks;
+	w->nb_blocks = 0;
+	w->raw_bytes += nb_bytes;
+	if(err != 0)
+		w->nb_write_error++;
+	pthread_mutex_unlock(&w->lock);
+	gettimeofday(&end_tv, NULL);
+	w->write_time_s += TimevalDiff(&end_tv, &start_tv);
+	return err;
+}
+
+void codec_writer_close(codec_writer_t* w)
+{
+	int i;
+
+	if(w->threads == NULL)
+		return;
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_broadcast(&w->work);
+	pthread_mutex_unlock(&w->lock);
+	for(i = 0; i < w->nb_threads; i++)
+		pthread_join(w->threads[i], NULL);
+	codec_writer_free(w);
+}
+
+void codec_writer_print(const codec_writer_t* w)
+{
+	printf("Compression %s: %llu bytes -> %llu bytes (ratio %.2f), %llu blocks (%llu stored), %d threads, %05.03f MBytes/s per thread, %05.03f MBytes/s (compression + write)%s\n",
+			SAMPLE_CODEC_MAGIC, w->raw_bytes, w->comp_bytes,
+			(w->comp_bytes > 0) ? (double)w->raw_bytes / w->comp_bytes : 0.0,
+			w->nb_blocks_total, w->nb_blocks_stored, w->nb_threads,
+			(w->compress_time_s > 0) ? (w->raw_bytes / 1e6) / w->compress_time_s : 0.0,
+			(w->write_time_s > 0) ? (w->raw_bytes / 1e6) / w->write_time_s : 0.0,
+			(w->nb_write_error > 0) ? " WRITE ERROR" : "");
+}
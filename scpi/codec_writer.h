@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CODEC_WRITER_H__
+#define __CODEC_WRITER_H__
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "sample_codec.h"
+
+/*
+ * Compressed (sample_codec "DBR1") output file
+ * The data of each codec_writer_write() is cut in blocks compressed in parallel
+ * by nb_threads worker threads, the caller writes the compressed blocks in order
+ * as they complete (at most 2 blocks per thread are kept in memory).
+ * Called from the capture_ring writer thread (-w) the network thread keeps
+ * receiving during the compression.
+ */
+
+#define CODEC_WRITER_MAX_THREADS (64)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	FILE* fp;
+	int nb_threads;
+	pthread_t* threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* Blocks to compress or stop */
+	pthread_cond_t done; /* A block is compressed */
+	int stop;
+
+	/* Current codec_writer_write(), block k is compressed in out[k % nb_out] */
+	const unsigned char* src;
+	size_t src_len;
+	size_t nb_blocks;
+	size_t next_block;
+	size_t nb_written;
+	int nb_out;
+	unsigned char** out;
+	size_t* out_len; /* 0 until the block is compressed */
+
+	/* Statistics */
+	unsigned long long raw_bytes;
+	unsigned long long comp_bytes;
+	unsigned long long nb_blocks_total;
+	unsigned long long nb_blocks_stored;
+	unsigned int nb_write_error;
+	double compress_time_s; /* Sum of the compression time of all threads */
+	double write_time_s; /* Wall time in codec_writer_write() (compression + fwrite) */
+} codec_writer_t;
+
+/* Write the file header and start nb_threads compression threads, return 0 if OK or -1 */
+int codec_writer_init(codec_writer_t* w, FILE* fp, int nb_threads);
+/* Compress and write nb_bytes, data can be reused on return, return 0 if OK or -1 in case of write error */
+int codec_writer_write(codec_writer_t* w, const unsigned char* data, size_t nb_bytes);
+/* Stop the threads and free buffers (fp is not closed) */
+void codec_writer_close(codec_writer_t* w);
+/* Ratio and throughput report */
+void codec_writer_print(const codec_writer_t* w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __CODEC_WRITER_H__ */
@@ -0,0 +1,146 @@
+/*
+ * Decompress a MSO5000_SCPI -z file (sample_codec "DBR1") to the raw data
+ */
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "socket_portable.h"
+#include "sample_codec.h"
+
+#define APP_NAME "MSO5000_UNPACK"
+#define VERSION "v0.1.2 13/12/2020 B.VERNOUX"
+
+#define BANNER1 APP_NAME " " VERSION "\n"
+#define SYNTAX "Syntax: " APP_NAME " <waveform.dbr> [<waveform_rx_raw_data.bin>]\nWithout output file the blocks are only checked\nExample:\n" APP_NAME " waveform.dbr waveform_rx_raw_data.bin\n"
+
+void error(char *msg)
+{
+	if(msg != NULL)
+		printf("%s\n", msg);
+	exit(-1);
+}
+
+#ifdef _WIN32
+BOOL WINAPI consoleHandler(DWORD signal)
+{
+	(void)signal;
+	return TRUE;
+}
+#else
+void consoleHandler(int s)
+{
+	(void)s;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	unsigned char hdr[SAMPLE_CODEC_FILE_HDR_SIZE];
+	unsigned char* in;
+	unsigned char* out;
+	FILE* infp;
+	FILE* outfp = NULL;
+	uint32_t block_size;
+	uint32_t raw_len;
+	uint32_t comp_len;
+	int method;
+	long nb;
+	unsigned long long raw_bytes = 0;
+	unsigned long long comp_bytes = SAMPLE_CODEC_FILE_HDR_SIZE;
+	unsigned int nb_blocks = 0;
+	unsigned int nb_stored = 0;
+	double decompress_time_s = 0;
+	struct timeval start_tv;
+	struct timeval end_tv;
+
+	printf(BANNER1);
+	if(argc < 2)
+	{
+		printf(SYNTAX);
+		exit(0);
+	}
+	infp = fopen(argv[1], "rb");
+	if(infp == NULL)
+	{
+		printf("ERROR fopen(%s)\n", argv[1]);
+		exit(-3);
+	}
+	if( (fread(hdr, sizeof(hdr), 1, infp) != 1) || ((block_size = sample_codec_parse_file_header(hdr)) == 0) )
+	{
+		printf("ERROR %s is not a %s file\n", argv[1], SAMPLE_CODEC_MAGIC);
+		exit(-3);
+	}
+	if(argc > 2)
+	{
+		outfp = fopen(argv[2], "wb");
+		if(outfp == NULL)
+		{
+			printf("ERROR fopen(%s)\n", argv[2]);
+			exit(-3);
+		}
+	}
+	in = malloc(SAMPLE_CODEC_BOUND(block_size));
+	out = malloc(block_size);
+	if( (in == NULL) || (out == NULL) )
+		error("ERROR malloc()");
+
+	while(fread(in, SAMPLE_CODEC_BLOCK_HDR_SIZE, 1, infp) == 1)
+	{
+		if( (sample_codec_block_info(in, &raw_len, &comp_len, &method) != 0) ||
+			(raw_len > block_size) || (comp_len > raw_len) )
+		{
+			printf("ERROR invalid header of block %u (offset %llu)\n", nb_blocks, comp_bytes);
+			exit(-1);
+		}
+		if(fread(&in[SAMPLE_CODEC_BLOCK_HDR_SIZE], 1, comp_len, infp) != comp_len)
+		{
+			printf("ERROR block %u truncated (offset %llu)\n", nb_blocks, comp_bytes);
+			exit(-1);
+		}
+		gettimeofday(&start_tv, NULL);
+		nb = sample_codec_decompress_block(in, SAMPLE_CODEC_BLOCK_HDR_SIZE + comp_len, out, block_size);
+		gettimeofday(&end_tv, NULL);
+		decompress_time_s += TimevalDiff(&end_tv, &start_tv);
+		if(nb < 0)
+		{
+			printf("ERROR block %u corrupted (offset %llu)\n", nb_blocks, comp_bytes);
+			exit(-1);
+		}
+		if( (outfp != NULL) && (fwrite(out, 1, nb, outfp) != (size_t)nb) )
+			error("ERROR fwrite()");
+		if(method == SAMPLE_CODEC_STORED)
+			nb_stored++;
+		nb_blocks++;
+		raw_bytes += nb;
+		comp_bytes += SAMPLE_CODEC_BLOCK_HDR_SIZE + comp_len;
+	}
+	if(!feof(infp))
+		error("ERROR fread()");
+
+	printf("%u blocks (%u stored), %llu bytes -> %llu bytes (ratio %.2f), decompression %05.03f MBytes/s\n",
+			nb_blocks, nb_stored, comp_bytes, raw_bytes,
+			(comp_bytes > 0) ? (double)raw_bytes / comp_bytes : 0.0,
+			(decompress_time_s > 0) ? (raw_bytes / 1e6) / decompress_time_s : 0.0);
+	if(outfp != NULL)
+		fclose(outfp);
+	fclose(infp);
+	free(in);
+	free(out);
+	return 0;
+}
@@ -0,0 +1,1005 @@
+/*
+ * Fake Rigol MSO5000 SCPI server (TCP) to test/benchmark the clients without a scope
+ */
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdarg.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "socket_portable.h"
+#include "hislip.h"
+
+#define APP_NAME "MSO5000_FAKE"
+#define VERSION "v0.1.2 13/12/2020 B.VERNOUX"
+
+#define BANNER1 APP_NAME " " VERSION "\n"
+#define BANNER2 APP_NAME " <port> [-n<memory_depth>] [-c<nb_chan>] [-t<trigger_delay_ms>] [-b<bandwidth_MBytes_per_s>] [-l<command_latency_us>] [-e<error_period> [-E<term|trunc|short|indef>]] [-w<ramp|sine>] [-d<nb_digital>] [-g] [-s] [-i<hislip_port>] [-x] [-v]\n"
+#define SYNTAX "Syntax: " APP_NAME " <port> [-n<memory depth in points (default 1000000)>] [-c<nb channels enabled 1 to 4 (default 4)>] [-t<delay from :SING to trigger in ms (default 0)>] [-b<link bandwidth in MBytes/s (default 0=unlimited)>] [-l<latency before each command in us (default 0)>] [-e<inject an error every error_period :WAV:DATA? (default 0=never)> [-E<error: term (bad terminator, default), trunc (block shorter than its header), short (payload sent by small segments), indef (#0 indefinite length block)>]] [-w<waveform: ramp ((i*chan)&0xFF, default), sine>] [-d<nb digital channels D0 to D(n-1) displayed 0 to 16 (default 0)>] [-g (:WAV:SOUR shared by all the connections)] [-s (connections share the link bandwidth, sent one at a time)] [-i<also listen on hislip_port for HiSLIP sessions (overlapped mode, service request when a status byte bit enabled by *SRE is set)>] [-x (exit when the last client disconnects)] [-v (print commands)]\nExample:\n" APP_NAME " 5555 -n10000000 -t10 -b100\n"
+
+#define FAKE_IDN "RIGOL TECHNOLOGIES,MSO5074,FAKE000000001,00.01.02.00.02\n"
+#define FAKE_SEC_PER_SAMPLE (1e-9)
+#define FAKE_YINCREMENT (0.04)
+#define FAKE_YREFERENCE (128)
+#define FAKE_NB_DIGITAL (16)
+#define PATTERN_SIZE (65536) /* Samples are sent from a pattern repeated every PATTERN_SIZE points */
+#define SHORT_SEGMENT_MAX (64)
+#define FAKE_RECORD_MEMORY (500000000) /* Waveform recording: frames x memory depth */
+#define FAKE_FRAMES_MAX (100000)
+#define FAKE_FRAME_INTERVAL (1e-6) /* :FUNC:WREC:FINT? */
+#define FRAME_PATTERN_SHIFT (17) /* Samples of frame n start at (n - 1) * FRAME_PATTERN_SHIFT in the pattern */
+#define RX_LINE_SIZE (256)
+#define FAKE_HISLIP_SESSIONS_MAX (64)
+#define FAKE_HISLIP_VENDOR_ID (0x5247) /* "RG" */
+#define FAKE_HISLIP_MAX_MESSAGE_SIZE (1024*1024)
+
+#ifdef _WIN32
+	#define SHUT_RDWR SD_BOTH
+#endif
+
+#define CURR_TIME_SIZE (40)
+char currTime[CURR_TIME_SIZE+1] = "";
+struct timeval start_tv;
+
+typedef enum
+{
+	ERR_TERM = 0, /* Bad block terminator */
+	ERR_TRUNC, /* Less payload bytes than in the block header */
+	ERR_SHORT, /* Payload sent by small segments (short reads for the client) */
+	ERR_INDEF /* #0 indefinite length block (ends at the first 0x0A sample for the client) */
+} error_type_t;
+const char* error_type_name[] = { "term", "trunc", "short", "indef" };
+
+/* Configuration (read only once the server is started) */
+size_t memory_depth = 1000000;
+int nb_chan = 4;
+int nb_digital = 0;
+int trigger_delay_ms = 0;
+double bandwidth_mbytes_per_s = 0;
+int command_latency_us = 0;
+int error_period = 0;
+error_type_t error_type = ERR_TERM;
+int sine_waveform = 0;
+int exit_on_disconnect = 0;
+int verbose = 0;
+int shared_source = 0; /* -g: single waveform state for all the connections */
+int shared_link = 0; /* -s: the connections share the link (data sent by one connection at a time) */
+unsigned char pattern[4 + FAKE_NB_DIGITAL][PATTERN_SIZE]; /* CH1 to CH4 then D0 to D15 */
+
+/* Shared state of the connections (-g and -s) */
+pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+int nb_clients = 0; /* Connections open (-x exits when the last one is closed) */
+int shared_chan = 0;
+double shared_link_free_s = 0;
+
+/* State of one client connection */
+typedef struct
+{
+	int fd;
+	int chan; /* :WAV:SOUR (4 + n for Dn) */
+	size_t star; /* :WAV:STAR (1 based) */
+	size_t stop; /* :WAV:STOP */
+	struct timeval trig_tv; /* Acquisition complete after :SING */
+	int opc_pending; /* *OPC received, OPC bit set at the end of the acquisition */
+	int wrec_fend; /* :FUNC:WREC:FEND, frames recorded by :FUNC:WREC:OPER RUN */
+	struct timeval wrec_tv; /* Recording complete (wrec_fend triggers) */
+	int frame; /* :FUNC:WREP:FCUR, 0 = last acquisition */
+	int esr;
+	int ese;
+	unsigned int nb_data; /* :WAV:DATA? replied */
+	unsigned long long bytes_sent;
+	struct timeval first_send_tv;
+	double link_free_s; /* -b: time (since start_tv) at which the data sent is out of the link */
+	char line[RX_LINE_SIZE]; /* Command being received */
+	int line_len;
+
+	/* -i: HiSLIP connection (synchronous or asynchronous channel depending on its first message) */
+	int hislip;
+	uint16_t session_id;
+	uint32_t message_id; /* Of the DataEND message being processed, its replies are sent with it */
+	int async_fd; /* Asynchronous channel of the session, -1 until AsyncInitialize */
+	int sre; /* *SRE */
+	int srq_sent; /* AsyncServiceRequest sent, sent again once the request is cleared then set */
+} client_t;
+
+/* -i: HiSLIP sessions (session ID = index + 1), the lock also serializes the commands and the asynchronous messages */
+int hislip_port = 0;
+pthread_mutex_t hislip_lock = PTHREAD_MUTEX_INITIALIZER;
+client_t* hislip_sessions[FAKE_HISLIP_SESSIONS_MAX];
+
+void printf_dbg(const char *fmt, ...)
+{
+	struct timeval curr_tv;
+	char curr_time[CURR_TIME_SIZE+1];
+	va_list args;
+
+	gettimeofday(&curr_tv, NULL);
+	get_CurrentTime(curr_time, CURR_TIME_SIZE);
+	printf("%s (%05.03f s) ", curr_time, TimevalDiff(&curr_tv, &start_tv));
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+void syntax(void)
+{
+	printf(BANNER2);
+	printf(SYNTAX);
+}
+
+/* TCP port from its decimal string, -1 if not a number or out of 1 to 65535 */
+int parse_port(const char* str)
+{
+	char* end;
+	long port;
+
+	port = strtol(str, &end, 10);
+	if( (end == str) || (*end != '\0') || (port < 1) || (port > 65535) )
+		return -1;
+	return (int)port;
+}
+
+/*
+* error - wrapper for perror
+*/
+void error(char *msg)
+{
+	if(msg != NULL)
+	{
+		if(sockGetErrno() != 0)
+		{
+			printf("%s:\n %s\n", msg, sockStrError(sockGetErrno()));
+		}else
+		{
+			printf("%s\n", msg);
+		}
+	}
+	sockQuit();
+	exit(-1);
+}
+
+#ifdef _WIN32
+BOOL WINAPI consoleHandler(DWORD signal)
+{
+	if (signal == CTRL_C_EVENT)
+	{
+		printf("\nCtrl-C pressed\nExit\n");
+		error(NULL);
+	}
+	return TRUE;
+}
+#else
+void consoleHandler(int s)
+{
+	if (s == SIGINT) // Ctrl-C
+	{
+		printf("\nCtrl-C pressed\nExit\n");
+		error(NULL);
+	}
+}
+#endif
+
+void sleep_us(int us)
+{
+#ifdef _WIN32
+	Sleep((us + 999) / 1000);
+#else
+	struct timespec ts;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000L;
+	nanosleep(&ts, NULL);
+#endif
+}
+
+void pattern_init(void)
+{
+	/* Sine periods divide PATTERN_SIZE so the pattern can be repeated */
+	static const int sine_period[4] = { 1024, 512, 256, 2048 };
+	int chan;
+	int i;
+
+	for(chan = 0; chan < 4; chan++)
+	{
+		for(i = 0; i < PATTERN_SIZE; i++)
+		{
+			if(sine_waveform)
+				pattern[chan][i] = (unsigned char)(FAKE_YREFERENCE + 100.0 * sin(2.0 * M_PI * i / sine_period[chan]));
+			else
+				pattern[chan][i] = (unsigned char)((i * (chan + 1)) & 0xFF);
+		}
+	}
+	/* Digital channel Dn: square wave of period 2^(3 + n%8) points, inverted for D8 to D15 */
+	for(chan = 0; chan < FAKE_NB_DIGITAL; chan++)
+	{
+		for(i = 0; i < PATTERN_SIZE; i++)
+			pattern[4 + chan][i] = (unsigned char)(((i >> (2 + (chan & 7))) ^ (chan >> 3)) & 1);
+	}
+}
+
+int client_send(client_t* cl, const unsigned char* data, int len)
+{
+	struct timeval curr_tv;
+	double curr_s;
+	double* link_free_s = shared_link ? &shared_link_free_s : &cl->link_free_s;
+	int ret = 0;
+
+	if(shared_link)
+		pthread_mutex_lock(&shared_lock);
+	if(socket_write_nbytes(cl->fd, (unsigned char*)data, len) != len)
+	{
+		ret = -1;
+	} else
+	{
+		if(cl->bytes_sent == 0)
+			gettimeofday(&cl->first_send_tv, NULL);
+		cl->bytes_sent += len;
+		if(bandwidth_mbytes_per_s > 0)
+		{
+			/* Wait until the data is out of the link at its bandwidth (no credit for the time the link was idle) */
+			gettimeofday(&curr_tv, NULL);
+			curr_s = TimevalDiff(&curr_tv, &start_tv);
+			if(*link_free_s < curr_s)
+				*link_free_s = curr_s;
+			*link_free_s += len / (bandwidth_mbytes_per_s * 1e6);
+			if(*link_free_s > curr_s)
+				sleep_us((int)((*link_free_s - curr_s) * 1e6));
+		}
+	}
+	if(shared_link)
+		pthread_mutex_unlock(&shared_lock);
+	return ret;
+}
+
+/* -i: header of the DataEND message of the reply of len bytes (nothing on a raw SCPI connection) */
+int client_msg_begin(client_t* cl, size_t len)
+{
+	unsigned char header[HISLIP_HEADER_SIZE];
+
+	if(!cl->hislip)
+		return 0;
+	hislip_header_encode(header, HISLIP_DATA_END, 0, cl->message_id, len);
+	return client_send(cl, header, sizeof(header));
+}
+
+/* :WAV:SOUR of the connection (4 + n for Dn) */
+int* client_source(client_t* cl)
+{
+	return shared_source ? &shared_chan : &cl->chan;
+}
+
+int client_reply(client_t* cl, const char* fmt, ...)
+{
+	char reply[256];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(reply, sizeof(reply), fmt, args);
+	va_end(args);
+	if(client_msg_begin(cl, len) != 0)
+		return -1;
+	return client_send(cl, (const unsigned char*)reply, len);
+}
+
+int client_acq_done(client_t* cl)
+{
+	struct timeval curr_tv;
+
+	gettimeofday(&curr_tv, NULL);
+	if(!timercmp(&curr_tv, &cl->trig_tv, <))
+	{
+		if(cl->opc_pending)
+		{
+			cl->esr |= 0x01; /* OPC */
+			cl->opc_pending = 0;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* Status byte: ESB (0x20) from *ESE, MSS/RQS (0x40) from *SRE */
+int client_stb(client_t* cl)
+{
+	int stb;
+
+	client_acq_done(cl);
+	stb = (cl->esr & cl->ese) ? 0x20 : 0;
+	if(stb & cl->sre)
+		stb |= 0x40;
+	return stb;
+}
+
+/* :WAV:DATA? of points [star, stop] of the source channel, with the error injection */
+int client_send_data(client_t* cl)
+{
+	char header[16];
+	size_t star = cl->star;
+	size_t stop = (cl->stop < memory_depth) ? cl->stop : memory_depth;
+	size_t nb_points = (stop >= star) ? (stop - star + 1) : 0;
+	size_t nb_payload = nb_points;
+	size_t pos;
+	size_t n;
+	size_t shift = (cl->frame > 0) ? ((size_t)(cl->frame - 1) * FRAME_PATTERN_SHIFT) % PATTERN_SIZE : 0;
+	int source = *client_source(cl);
+	int inject;
+
+	cl->nb_data++;
+	inject = (error_period > 0) && ((cl->nb_data % error_period) == 0);
+	if(inject)
+		printf_dbg("fd=%d inject error %s in :WAV:DATA? %u (CH%d)\n", cl->fd, error_type_name[error_type], cl->nb_data, source + 1);
+	if(inject && (error_type == ERR_TRUNC))
+		nb_payload = nb_points / 2;
+
+	if(inject && (error_type == ERR_INDEF))
+		strcpy(header, "#0");
+	else
+		sprintf(header, "#9%09zu", nb_points);
+	if(client_msg_begin(cl, strlen(header) + nb_payload + 1) != 0)
+		return -1;
+	if(client_send(cl, (const unsigned char*)header, (int)strlen(header)) != 0)
+		return -1;
+	for(pos = star - 1; pos < (star - 1 + nb_payload); pos += n)
+	{
+		/* Contiguous part of the pattern */
+		n = PATTERN_SIZE - ((pos + shift) % PATTERN_SIZE);
+		if(n > ((star - 1 + nb_payload) - pos))
+			n = (star - 1 + nb_payload) - pos;
+		if(inject && (error_type == ERR_SHORT) && (n > SHORT_SEGMENT_MAX))
+			n = 1 + (rand() % SHORT_SEGMENT_MAX);
+		if(client_send(cl, &pattern[source][(pos + shift) % PATTERN_SIZE], (int)n) != 0)
+			return -1;
+	}
+	return client_send(cl, (const unsigned char*)((inject && (error_type == ERR_TERM)) ? "X" : "\n"), 1);
+}
+
+/* Process one command line, return < 0 if the connection shall be closed */
+int client_command(client_t* cl, char* cmd)
+{
+	struct timeval curr_tv;
+	unsigned int n;
+	long long us;
+	int chan;
+
+	if(verbose)
+		printf_dbg("fd=%d %s\n", cl->fd, cmd);
+	if(command_latency_us > 0)
+		sleep_us(command_latency_us);
+
+	if(strcmp(cmd, "*IDN?") == 0)
+	{
+		return client_reply(cl, FAKE_IDN);
+	} else if(strcmp(cmd, "*CLS") == 0)
+	{
+		cl->esr = 0;
+		cl->opc_pending = 0;
+	} else if(strncmp(cmd, "*ESE ", 5) == 0)
+	{
+		cl->ese = atoi(&cmd[5]);
+	} else if(strcmp(cmd, "*OPC") == 0)
+	{
+		cl->opc_pending = 1;
+		client_acq_done(cl);
+	} else if(strcmp(cmd, "*OPC?") == 0)
+	{
+		/* Blocks until the end of the acquisition */
+		while(!client_acq_done(cl))
+			sleep_us(100);
+		return client_reply(cl, "1\n");
+	} else if(strcmp(cmd, "*ESR?") == 0)
+	{
+		client_acq_done(cl);
+		n = cl->esr;
+		cl->esr = 0;
+		return client_reply(cl, "%u\n", n);
+	} else if(strncmp(cmd, "*SRE ", 5) == 0)
+	{
+		cl->sre = atoi(&cmd[5]);
+	} else if(strcmp(cmd, "*STB?") == 0)
+	{
+		return client_reply(cl, "%d\n", client_stb(cl));
+	} else if(strcmp(cmd, ":SING") == 0)
+	{
+		gettimeofday(&curr_tv, NULL);
+		cl->trig_tv.tv_sec = curr_tv.tv_sec + (curr_tv.tv_usec + trigger_delay_ms * 1000L) / 1000000;
+		cl->trig_tv.tv_usec = (curr_tv.tv_usec + trigger_delay_ms * 1000L) % 1000000;
+		cl->frame = 0;
+	} else if(strcmp(cmd, ":FUNC:WREC:FMAX?") == 0)
+	{
+		n = FAKE_RECORD_MEMORY / memory_depth;
+		return client_reply(cl, "%u\n", (n < 1) ? 1 : ((n > FAKE_FRAMES_MAX) ? FAKE_FRAMES_MAX : n));
+	} else if(strcmp(cmd, ":FUNC:WREC:FINT?") == 0)
+	{
+		return client_reply(cl, "%e\n", FAKE_FRAME_INTERVAL);
+	} else if(strncmp(cmd, ":FUNC:WREC:FEND ", 16) == 0)
+	{
+		cl->wrec_fend = atoi(&cmd[16]);
+	} else if(strcmp(cmd, ":FUNC:WREC:OPER RUN") == 0)
+	{
+		/* One trigger per frame */
+		gettimeofday(&curr_tv, NULL);
+		us = curr_tv.tv_usec + cl->wrec_fend * (trigger_delay_ms * 1000LL + (long long)(FAKE_FRAME_INTERVAL * 1e6));
+		cl->wrec_tv.tv_sec = curr_tv.tv_sec + us / 1000000;
+		cl->wrec_tv.tv_usec = us % 1000000;
+		cl->frame = 0;
+	} else if(strcmp(cmd, ":FUNC:WREC:OPER?") == 0)
+	{
+		gettimeofday(&curr_tv, NULL);
+		return client_reply(cl, timercmp(&curr_tv, &cl->wrec_tv, <) ? "RUN\n" : "STOP\n");
+	} else if(strncmp(cmd, ":FUNC:WREP:FCUR ", 16) == 0)
+	{
+		cl->frame = atoi(&cmd[16]);
+	} else if(strcmp(cmd, ":TRIG:STAT?") == 0)
+	{
+		return client_reply(cl, client_acq_done(cl) ? "STOP\n" : "WAIT\n");
+	} else if( (sscanf(cmd, ":CHAN%d:DISP?", &chan) == 1) && (chan >= 1) && (chan <= 4) )
+	{
+		return client_reply(cl, "%d\n", (chan <= nb_chan) ? 1 : 0);
+	} else if(strncmp(cmd, ":WAV:SOUR CHAN", 14) == 0)
+	{
+		chan = atoi(&cmd[14]);
+		if( (chan >= 1) && (chan <= 4) )
+			*client_source(cl) = chan - 1;
+	} else if(strncmp(cmd, ":WAV:SOUR D", 11) == 0)
+	{
+		chan = atoi(&cmd[11]);
+		if( (chan >= 0) && (chan < FAKE_NB_DIGITAL) )
+			*client_source(cl) = 4 + chan;
+	} else if(strcmp(cmd, ":WAV:SOUR?") == 0)
+	{
+		chan = *client_source(cl);
+		return (chan < 4) ? client_reply(cl, "CHAN%d\n", chan + 1) : client_reply(cl, "D%d\n", chan - 4);
+	} else if(strcmp(cmd, ":LA:STAT?") == 0)
+	{
+		return client_reply(cl, "%d\n", (nb_digital > 0) ? 1 : 0);
+	} else if( (sscanf(cmd, ":LA:DIG%d:DISP?", &chan) == 1) && (chan >= 0) && (chan < FAKE_NB_DIGITAL) )
+	{
+		return client_reply(cl, "%d\n", (chan < nb_digital) ? 1 : 0);
+	} else if(strncmp(cmd, ":WAV:STAR ", 10) == 0)
+	{
+		cl->star = strtoul(&cmd[10], NULL, 10);
+		if(cl->star < 1)
+			cl->star = 1;
+	} else if(strncmp(cmd, ":WAV:STOP ", 10) == 0)
+	{
+		cl->stop = strtoul(&cmd[10], NULL, 10);
+	} else if(strcmp(cmd, ":WAV:PRE?") == 0)
+	{
+		return client_reply(cl, "0,2,%zu,1,%e,%e,0,%e,0,%d\n", memory_depth, FAKE_SEC_PER_SAMPLE,
+							-(double)(memory_depth / 2) * FAKE_SEC_PER_SAMPLE, FAKE_YINCREMENT, FAKE_YREFERENCE);
+	} else if(strcmp(cmd, ":WAV:DATA?") == 0)
+	{
+		return client_send_data(cl);
+	} else if(cmd[0] != '\0' && cmd[strlen(cmd) - 1] == '?')
+	{
+		/* A scope does not reply to an unknown query */
+		printf_dbg("fd=%d unknown query %s\n", cl->fd, cmd);
+	}
+	/* Other commands (:STOP, *WAI, :WAV:MODE, :WAV:FORM, :FUNC:WREC:ENAB...) are accepted and ignored */
+	return 0;
+}
+
+/* Process the bytes received, one command per line, return < 0 if the connection shall be closed */
+int client_rx(client_t* cl, const char* data, int len)
+{
+	int i;
+
+	for(i = 0; i < len; i++)
+	{
+		if(data[i] == '\n')
+		{
+			/* Trailing spaces/CR are ignored */
+			while( (cl->line_len > 0) && ((cl->line[cl->line_len-1] == '\r') || (cl->line[cl->line_len-1] == ' ')) )
+				cl->line_len--;
+			cl->line[cl->line_len] = '\0';
+			cl->line_len = 0;
+			if(client_command(cl, cl->line) < 0)
+				return -1;
+		} else if(cl->line_len < (RX_LINE_SIZE - 1))
+		{
+			cl->line[cl->line_len++] = data[i];
+		}
+	}
+	return 0;
+}
+
+/* -i: receive exactly len bytes (NULL: dropped), return 0 if OK or -1 */
+int hislip_recv(int fd, void* dst, uint64_t len)
+{
+	unsigned char drop[4096];
+	int n;
+
+	while(len > 0)
+	{
+		n = (len > sizeof(drop)) ? (int)sizeof(drop) : (int)len;
+		n = recv(fd, (char*)((dst != NULL) ? dst : drop), n, MSG_WAITALL);
+		if(n <= 0)
+			return -1;
+		if(dst != NULL)
+			dst = (unsigned char*)dst + n;
+		len -= n;
+	}
+	return 0;
+}
+
+int hislip_recv_header(int fd, hislip_header_t* hdr)
+{
+	unsigned char buf[HISLIP_HEADER_SIZE];
+
+	if(hislip_recv(fd, buf, sizeof(buf)) != 0)
+		return -1;
+	if(hislip_header_decode(buf, hdr) != 0)
+	{
+		printf_dbg("fd=%d invalid HiSLIP header\n", fd);
+		return -1;
+	}
+	return 0;
+}
+
+int hislip_send(int fd, uint8_t type, uint8_t control, uint32_t param, const void* payload, uint64_t len)
+{
+	unsigned char buf[HISLIP_HEADER_SIZE + 8];
+
+	hislip_header_encode(buf, type, control, param, len);
+	if(len > 0)
+		memcpy(&buf[HISLIP_HEADER_SIZE], payload, len);
+	return (socket_write_nbytes(fd, buf, HISLIP_HEADER_SIZE + (int)len) > 0) ? 0 : -1;
+}
+
+/* -i: AsyncServiceRequest when RQS is set in the status byte (called with hislip_lock) */
+void hislip_srq_check(client_t* cl)
+{
+	int stb;
+
+	if(cl->async_fd < 0)
+		return;
+	stb = client_stb(cl);
+	if(!(stb & 0x40))
+	{
+		cl->srq_sent = 0;
+		return;
+	}
+	if(cl->srq_sent)
+		return;
+	if(verbose)
+		printf_dbg("fd=%d AsyncServiceRequest STB=0x%02X\n", cl->fd, stb);
+	hislip_send(cl->async_fd, HISLIP_ASYNC_SERVICE_REQUEST, (uint8_t)stb, 0, NULL, 0);
+	cl->srq_sent = 1;
+}
+
+/* -i: wait for the next message, the end of the acquisition requests service meanwhile, return < 0 on error */
+int hislip_wait_rx(client_t* cl)
+{
+	struct timeval curr_tv, tv;
+	fd_set fds;
+	long long us;
+	int ret;
+
+	while(1)
+	{
+		pthread_mutex_lock(&hislip_lock);
+		hislip_srq_check(cl);
+		gettimeofday(&curr_tv, NULL);
+		ret = (cl->sre != 0) && cl->opc_pending && timercmp(&curr_tv, &cl->trig_tv, <);
+		if(ret)
+		{
+			us = (cl->trig_tv.tv_sec - curr_tv.tv_sec) * 1000000LL + (cl->trig_tv.tv_usec - curr_tv.tv_usec);
+			tv.tv_sec = (long)(us / 1000000);
+			tv.tv_usec = (long)(us % 1000000);
+		}
+		pthread_mutex_unlock(&hislip_lock);
+		if(!ret)
+			return 0;
+		FD_ZERO(&fds);
+		FD_SET(cl->fd, &fds);
+		ret = select(cl->fd + 1, &fds, NULL, NULL, &tv);
+		if(ret != 0)
+			return (ret > 0) ? 0 : -1;
+	}
+}
+
+/* -i: synchronous channel, SCPI lines in Data/DataEND messages */
+void hislip_sync_loop(client_t* cl)
+{
+	hislip_header_t hdr;
+	char rx_buf[4096];
+	uint64_t left;
+	int n;
+	int ret;
+
+	while( (hislip_wait_rx(cl) == 0) && (hislip_recv_header(cl->fd, &hdr) == 0) )
+	{
+		if( (hdr.type == HISLIP_DATA) || (hdr.type == HISLIP_DATA_END) )
+		{
+			cl->message_id = hdr.param;
+			for(left = hdr.length; left > 0; left -= n)
+			{
+				n = (left > sizeof(rx_buf)) ? (int)sizeof(rx_buf) : (int)left;
+				if(hislip_recv(cl->fd, rx_buf, n) != 0)
+					return;
+				pthread_mutex_lock(&hislip_lock);
+				ret = client_rx(cl, rx_buf, n);
+				if(ret == 0)
+					hislip_srq_check(cl);
+				pthread_mutex_unlock(&hislip_lock);
+				if(ret < 0)
+					return;
+			}
+		} else if(hdr.type == HISLIP_DEVICE_CLEAR_COMPLETE)
+		{
+			/* The replies of the commands received before are already sent (commands processed in order) */
+			if(verbose)
+				printf_dbg("fd=%d DeviceClearComplete\n", cl->fd);
+			cl->line_len = 0;
+			if( (hislip_recv(cl->fd, NULL, hdr.length) != 0) ||
+				(hislip_send(cl->fd, HISLIP_DEVICE_CLEAR_ACKNOWLEDGE, HISLIP_CTRL_OVERLAPPED, 0, NULL, 0) != 0) )
+				return;
+		} else
+		{
+			printf_dbg("fd=%d HiSLIP %s ignored\n", cl->fd, hislip_msg_name(hdr.type));
+			if(hislip_recv(cl->fd, NULL, hdr.length) != 0)
+				return;
+		}
+	}
+}
+
+/* -i: asynchronous channel of session_id */
+void hislip_async_loop(client_t* acl, uint16_t session_id)
+{
+	hislip_header_t hdr;
+	unsigned char size_buf[8];
+	uint64_t max_size = FAKE_HISLIP_MAX_MESSAGE_SIZE;
+	client_t* cl;
+	int stb;
+	int ret;
+	int i;
+
+	while(hislip_recv_header(acl->fd, &hdr) == 0)
+	{
+		if(hislip_recv(acl->fd, NULL, hdr.length) != 0)
+			break;
+		pthread_mutex_lock(&hislip_lock);
+		cl = hislip_sessions[session_id - 1];
+		switch(hdr.type)
+		{
+			case HISLIP_ASYNC_MAXIMUM_MESSAGE_SIZE:
+				for(i = 0; i < 8; i++)
+					size_buf[i] = (unsigned char)(max_size >> (8 * (7 - i)));
+				ret = hislip_send(acl->fd, HISLIP_ASYNC_MAXIMUM_MESSAGE_SIZE_RESPONSE, 0, 0, size_buf, sizeof(size_buf));
+				break;
+			case HISLIP_ASYNC_STATUS_QUERY:
+				stb = (cl != NULL) ? client_stb(cl) : 0;
+				ret = hislip_send(acl->fd, HISLIP_ASYNC_STATUS_RESPONSE, (uint8_t)stb, 0, NULL, 0);
+				break;
+			case HISLIP_ASYNC_DEVICE_CLEAR:
+				if(verbose)
+					printf_dbg("fd=%d AsyncDeviceClear\n", acl->fd);
+				ret = hislip_send(acl->fd, HISLIP_ASYNC_DEVICE_CLEAR_ACKNOWLEDGE, HISLIP_CTRL_OVERLAPPED, 0, NULL, 0);
+				break;
+			default:
+				printf_dbg("fd=%d HiSLIP %s ignored\n", acl->fd, hislip_msg_name(hdr.type));
+				ret = 0;
+				break;
+		}
+		pthread_mutex_unlock(&hislip_lock);
+		if(ret != 0)
+			break;
+	}
+	pthread_mutex_lock(&hislip_lock);
+	cl = hislip_sessions[session_id - 1];
+	if( (cl != NULL) && (cl->async_fd == acl->fd) )
+		cl->async_fd = -1;
+	pthread_mutex_unlock(&hislip_lock);
+}
+
+/* -i: the first message of a HiSLIP connection selects its channel */
+void hislip_client(client_t* cl)
+{
+	hislip_header_t hdr;
+	char sub_address[HISLIP_SUB_ADDRESS_MAX_SIZE];
+	size_t len;
+	int k;
+
+	if(hislip_recv_header(cl->fd, &hdr) != 0)
+		return;
+	len = (hdr.length < (sizeof(sub_address) - 1)) ? (size_t)hdr.length : (sizeof(sub_address) - 1);
+	if( (hislip_recv(cl->fd, sub_address, len) != 0) || (hislip_recv(cl->fd, NULL, hdr.length - len) != 0) )
+		return;
+	sub_address[len] = '\0';
+
+	if(hdr.type == HISLIP_INITIALIZE)
+	{
+		pthread_mutex_lock(&hislip_lock);
+		for(k = 0; (k < FAKE_HISLIP_SESSIONS_MAX) && (hislip_sessions[k] != NULL); k++);
+		if(k < FAKE_HISLIP_SESSIONS_MAX)
+			hislip_sessions[k] = cl;
+		pthread_mutex_unlock(&hislip_lock);
+		if(k == FAKE_HISLIP_SESSIONS_MAX)
+		{
+			hislip_send(cl->fd, HISLIP_FATAL_ERROR, 0, 0, NULL, 0);
+			return;
+		}
+		cl->session_id = (uint16_t)(k + 1);
+		printf_dbg("fd=%d HiSLIP session %u (%s)\n", cl->fd, cl->session_id, sub_address);
+		if(hislip_send(cl->fd, HISLIP_INITIALIZE_RESPONSE, HISLIP_CTRL_OVERLAPPED,
+						((uint32_t)HISLIP_PROTOCOL_VERSION << 16) | cl->session_id, NULL, 0) == 0)
+			hislip_sync_loop(cl);
+		pthread_mutex_lock(&hislip_lock);
+		hislip_sessions[k] = NULL;
+		/* Ends the asynchronous channel thread */
+		if(cl->async_fd >= 0)
+			shutdown(cl->async_fd, SHUT_RDWR);
+		pthread_mutex_unlock(&hislip_lock);
+	} else if(hdr.type == HISLIP_ASYNC_INITIALIZE)
+	{
+		pthread_mutex_lock(&hislip_lock);
+		k = (int)(hdr.param & 0xFFFF) - 1;
+		if( (k >= 0) && (k < FAKE_HISLIP_SESSIONS_MAX) && (hislip_sessions[k] != NULL) && (hislip_sessions[k]->async_fd < 0) )
+			hislip_sessions[k]->async_fd = cl->fd;
+		else
+			k = -1;
+		pthread_mutex_unlock(&hislip_lock);
+		if(k < 0)
+		{
+			hislip_send(cl->fd, HISLIP_FATAL_ERROR, 0, 0, NULL, 0);
+			return;
+		}
+		printf_dbg("fd=%d HiSLIP session %u asynchronous channel\n", cl->fd, k + 1);
+		if(hislip_send(cl->fd, HISLIP_ASYNC_INITIALIZE_RESPONSE, 0, FAKE_HISLIP_VENDOR_ID, NULL, 0) == 0)
+			hislip_async_loop(cl, (uint16_t)(k + 1));
+	} else
+	{
+		printf_dbg("fd=%d HiSLIP %s instead of Initialize\n", cl->fd, hislip_msg_name(hdr.type));
+	}
+}
+
+void* client_thread(void* arg)
+{
+	client_t* cl = (client_t*)arg;
+	char rx_buf[4096];
+	int read_nb;
+	struct timeval end_tv;
+
+	if(cl->hislip)
+	{
+		hislip_client(cl);
+	} else
+	{
+		while((read_nb = recv(cl->fd, rx_buf, sizeof(rx_buf), 0)) > 0)
+		{
+			if(client_rx(cl, rx_buf, read_nb) < 0)
+				break;
+		}
+	}
+	gettimeofday(&end_tv, NULL);
+	printf_dbg("fd=%d disconnected (%u :WAV:DATA?, %llu bytes sent, %.3f MBytes/s)\n", cl->fd, cl->nb_data, cl->bytes_sent,
+			(cl->bytes_sent > 0) ? (cl->bytes_sent / 1e6) / TimevalDiff(&end_tv, &cl->first_send_tv) : 0.0);
+	sockClose(cl->fd);
+	free(cl);
+	pthread_mutex_lock(&shared_lock);
+	nb_clients--;
+	if(exit_on_disconnect && (nb_clients == 0))
+		exit(0);
+	pthread_mutex_unlock(&shared_lock);
+	return NULL;
+}
+
+/* Listening socket on portno */
+int listen_port(int portno)
+{
+	struct sockaddr_in serveraddr;
+	int listenfd;
+	int optval;
+
+	listenfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenfd < 0)
+	{
+		error("ERROR opening socket");
+	}
+	optval = 1;
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const char*)&optval, sizeof(optval));
+
+	bzero((char *) &serveraddr, sizeof(serveraddr));
+	serveraddr.sin_family = AF_INET;
+	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	serveraddr.sin_port = htons(portno);
+	if(bind(listenfd, (const struct sockaddr*)&serveraddr, sizeof(serveraddr)) < 0)
+	{
+		error("ERROR bind()");
+	}
+	if(listen(listenfd, 8) < 0)
+	{
+		error("ERROR listen()");
+	}
+	return listenfd;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in clientaddr;
+	socklen_t clientlen;
+	pthread_t thread;
+	client_t* cl;
+	int listenfd;
+	int hislip_listenfd = -1;
+	fd_set fds;
+	int fd;
+	int portno;
+	int i, k;
+
+	sockInit();
+#ifndef _WIN32
+	/* A client disconnecting while data is sent shall not kill the server */
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	printf(BANNER1);
+	printf("Parameters:\n");
+	for(i = 0; i < argc; i++)
+	{
+		printf("%s ", argv[i]);
+	}
+	printf("\n");
+
+	/* check command line arguments */
+	if (argc < 2)
+	{
+		syntax();
+		exit(0);
+	}
+	portno = parse_port(argv[1]);
+	if(portno < 0)
+	{
+		printf("Error invalid port %s (1 to 65535)\n", argv[1]);
+		syntax();
+		exit(-3);
+	}
+	for(i = 2; i < argc; i++)
+	{
+		if(strncmp(argv[i], "-n", 2) == 0)
+		{
+			memory_depth = strtoul(&argv[i][2], NULL, 10);
+		} else if(strncmp(argv[i], "-c", 2) == 0)
+		{
+			nb_chan = atoi(&argv[i][2]);
+		} else if(strncmp(argv[i], "-d", 2) == 0)
+		{
+			nb_digital = atoi(&argv[i][2]);
+		} else if(strncmp(argv[i], "-t", 2) == 0)
+		{
+			trigger_delay_ms = atoi(&argv[i][2]);
+		} else if(strncmp(argv[i], "-b", 2) == 0)
+		{
+			bandwidth_mbytes_per_s = atof(&argv[i][2]);
+		} else if(strncmp(argv[i], "-l", 2) == 0)
+		{
+			command_latency_us = atoi(&argv[i][2]);
+		} else if(strncmp(argv[i], "-e", 2) == 0)
+		{
+			error_period = atoi(&argv[i][2]);
+		} else if(strncmp(argv[i], "-E", 2) == 0)
+		{
+			for(k = 0; k <= ERR_INDEF; k++)
+			{
+				if(strcmp(&argv[i][2], error_type_name[k]) == 0)
+					break;
+			}
+			if(k > ERR_INDEF)
+			{
+				printf("Error unknown error type %s\n", &argv[i][2]);
+				syntax();
+				exit(-3);
+			}
+			error_type = (error_type_t)k;
+		} else if(strncmp(argv[i], "-w", 2) == 0)
+		{
+			sine_waveform = (strcmp(&argv[i][2], "sine") == 0);
+		} else if(strcmp(argv[i], "-g") == 0)
+		{
+			shared_source = 1;
+		} else if(strcmp(argv[i], "-s") == 0)
+		{
+			shared_link = 1;
+		} else if(strncmp(argv[i], "-i", 2) == 0)
+		{
+			hislip_port = parse_port(&argv[i][2]);
+			if(hislip_port < 0)
+			{
+				printf("Error invalid HiSLIP port %s (1 to 65535)\n", &argv[i][2]);
+				syntax();
+				exit(-3);
+			}
+		} else if(strcmp(argv[i], "-x") == 0)
+		{
+			exit_on_disconnect = 1;
+		} else if(strcmp(argv[i], "-v") == 0)
+		{
+			verbose = 1;
+		} else
+		{
+			printf("Error unknown argument %s\n", argv[i]);
+			syntax();
+			exit(-3);
+		}
+	}
+	if( (memory_depth < 1) || (nb_chan < 1) || (nb_chan > 4) || (nb_digital < 0) || (nb_digital > FAKE_NB_DIGITAL) )
+	{
+		printf("Error invalid memory_depth(%zu), nb_chan(%d) or nb_digital(%d)\n", memory_depth, nb_chan, nb_digital);
+		exit(-3);
+	}
+	printf("memory_depth=%zu nb_chan=%d nb_digital=%d trigger_delay=%dms bandwidth=%.1fMBytes/s command_latency=%dus error_period=%d error=%s waveform=%s shared_source=%d shared_link=%d\n",
+			memory_depth, nb_chan, nb_digital, trigger_delay_ms, bandwidth_mbytes_per_s, command_latency_us,
+			error_period, error_type_name[error_type], sine_waveform ? "sine" : "ramp", shared_source, shared_link);
+	pattern_init();
+
+	listenfd = listen_port(portno);
+	gettimeofday(&start_tv, NULL);
+	printf_dbg("Listening on port %d\n", portno);
+	if(hislip_port > 0)
+	{
+		hislip_listenfd = listen_port(hislip_port);
+		printf_dbg("Listening on port %d (HiSLIP)\n", hislip_port);
+	}
+
+	/* One thread per client connection (two per HiSLIP session) */
+	while(1)
+	{
+		FD_ZERO(&fds);
+		FD_SET(listenfd, &fds);
+		if(hislip_listenfd >= 0)
+			FD_SET(hislip_listenfd, &fds);
+		if(select(((listenfd > hislip_listenfd) ? listenfd : hislip_listenfd) + 1, &fds, NULL, NULL, NULL) < 0)
+		{
+			error("ERROR select()");
+		}
+		k = (hislip_listenfd >= 0) && FD_ISSET(hislip_listenfd, &fds);
+		clientlen = sizeof(clientaddr);
+		fd = accept(k ? hislip_listenfd : listenfd, (struct sockaddr*)&clientaddr, &clientlen);
+		if(fd < 0)
+		{
+			error("ERROR accept()");
+		}
+		sockSetOpt(fd, "TCP_NODELAY", IPPROTO_TCP, TCP_NODELAY, 1);
+		printf_dbg("fd=%d connected from %s:%d\n", fd, inet_ntoa(clientaddr.sin_addr), ntohs(clientaddr.sin_port));
+
+		cl = calloc(1, sizeof(client_t));
+		if(cl == NULL)
+		{
+			error("ERROR calloc(client_t)");
+		}
+		cl->fd = fd;
+		cl->star = 1;
+		cl->stop = memory_depth;
+		cl->hislip = k;
+		cl->async_fd = -1;
+		pthread_mutex_lock(&shared_lock);
+		nb_clients++;
+		pthread_mutex_unlock(&shared_lock);
+		if(pthread_create(&thread, NULL, client_thread, cl) != 0)
+		{
+			error("ERROR pthread_create()");
+		}
+		pthread_detach(thread);
+	}
+	return 0;
+}
@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "fft.h"
+
+#ifndef M_PI
+	#define M_PI (3.14159265358979323846)
+#endif
+
+typedef struct
+{
+	float re;
+	float im;
+} cpx_t;
+
+/* One fft_real_power(), the threads wait for go then share each stage and the bins */
+typedef struct
+{
+	fft_plan_t* p;
+	double* pow_acc;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	int go;
+	int nb_threads; /* Threads actually started (set before go) */
+	pthread_barrier_t barrier;
+} fft_run_t;
+
+typedef struct
+{
+	fft_run_t* run;
+	int thread;
+} fft_job_t;
+
+static cpx_t cpx_mul(cpx_t a, cpx_t b)
+{
+	cpx_t r = { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+	return r;
+}
+
+/* -i * a */
+static cpx_t cpx_mul_mi(cpx_t a)
+{
+	cpx_t r = { a.im, -a.re };
+	return r;
+}
+
+/* Forward DFT of r points in place */
+static void fft_dft(cpx_t* v, int r)
+{
+	static const float c1 = 0.30901699437494745f; /* cos(2*pi/5) */
+	static const float c2 = -0.8090169943749473f; /* cos(4*pi/5) */
+	static const float s1 = 0.9510565162951535f; /* sin(2*pi/5) */
+	static const float s2 = 0.5877852522924732f; /* sin(4*pi/5) */
+	static const float s3 = -0.8660254037844386f; /* -sin(2*pi/3) */
+	cpx_t t0, t1, t2, t3, a1, a2, b1, b2;
+
+	switch(r)
+	{
+		case 2:
+			t0 = v[0];
+			v[0].re = t0.re + v[1].re; v[0].im = t0.im + v[1].im;
+			v[1].re = t0.re - v[1].re; v[1].im = t0.im - v[1].im;
+			break;
+
+		case 3:
+			t1.re = v[1].re + v[2].re; t1.im = v[1].im + v[2].im;
+			t2.re = v[0].re - 0.5f * t1.re; t2.im = v[0].im - 0.5f * t1.im;
+			/* i * s3 * (v1 - v2) */
+			t3.re = -s3 * (v[1].im - v[2].im); t3.im = s3 * (v[1].re - v[2].re);
+			v[0].re += t1.re; v[0].im += t1.im;
+			v[1].re = t2.re + t3.re; v[1].im = t2.im + t3.im;
+			v[2].re = t2.re - t3.re; v[2].im = t2.im - t3.im;
+			break;
+
+		case 4:
+			t0.re = v[0].re + v[2].re; t0.im = v[0].im + v[2].im;
+			t1.re = v[0].re - v[2].re; t1.im = v[0].im - v[2].im;
+			t2.re = v[1].re + v[3].re; t2.im = v[1].im + v[3].im;
+			b1.re = v[1].re - v[3].re; b1.im = v[1].im - v[3].im;
+			t3 = cpx_mul_mi(b1);
+			v[0].re = t0.re + t2.re; v[0].im = t0.im + t2.im;
+			v[1].re = t1.re + t3.re; v[1].im = t1.im + t3.im;
+			v[2].re = t0.re - t2.re; v[2].im = t0.im - t2.im;
+			v[3].re = t1.re - t3.re; v[3].im = t1.im - t3.im;
+			break;
+
+		case 5:
+			a1.re = v[1].re + v[4].re; a1.im = v[1].im + v[4].im;
+			b1.re = v[1].re - v[4].re; b1.im = v[1].im - v[4].im;
+			a2.re = v[2].re + v[3].re; a2.im = v[2].im + v[3].im;
+			b2.re = v[2].re - v[3].re; b2.im = v[2].im - v[3].im;
+			t0.re = v[0].re + c1 * a1.re + c2 * a2.re; t0.im = v[0].im + c1 * a1.im + c2 * a2.im;
+			t1.re = v[0].re + c2 * a1.re + c1 * a2.re; t1.im = v[0].im + c2 * a1.im + c1 * a2.im;
+			/* -i * (s1 b1 + s2 b2) and -i * (s2 b1 - s1 b2) */
+			t2.re = s1 * b1.re + s2 * b2.re; t2.im = s1 * b1.im + s2 * b2.im;
+			t2 = cpx_mul_mi(t2);
+			t3.re = s2 * b1.re - s1 * b2.re; t3.im = s2 * b1.im - s1 * b2.im;
+			t3 = cpx_mul_mi(t3);
+			v[0].re += a1.re + a2.re; v[0].im += a1.im + a2.im;
+			v[1].re = t0.re + t2.re; v[1].im = t0.im + t2.im;
+			v[4].re = t0.re - t2.re; v[4].im = t0.im - t2.im;
+			v[2].re = t1.re + t3.re; v[2].im = t1.im + t3.im;
+			v[3].re = t1.re - t3.re; v[3].im = t1.im - t3.im;
+			break;
+	}
+}
+
+/*
+ * Butterflies [j0, j1) of a Stockham stage of radix r after the stages of product ns:
+ * inputs in[j + q * n2 / r] twiddled by exp(-2*pi*i*q*(j % ns)/(ns * r)),
+ * outputs out[(j / ns) * ns * r + j % ns + q * ns]
+ */
+static void fft_stage(const cpx_t* in, cpx_t* out, const cpx_t* tw, size_t n2, size_t ns, int r, size_t j0, size_t j1)
+{
+	const size_t m = n2 / r;
+	const size_t tw_scale = n2 / (ns * r);
+	cpx_t v[5];
+	size_t jm = j0 % ns;
+	size_t base = (j0 / ns) * ns * r;
+	size_t j;
+	int q;
+
+	for(j = j0; j < j1; j++)
+	{
+		v[0] = in[j];
+		for(q = 1; q < r; q++)
+			v[q] = (jm == 0) ? in[j + q * m] : cpx_mul(in[j + q * m], tw[q * jm * tw_scale]);
+		fft_dft(v, r);
+		for(q = 0; q < r; q++)
+			out[base + jm + q * ns] = v[q];
+		if(++jm == ns)
+		{
+			jm = 0;
+			base += ns * r;
+		}
+	}
+}
+
+/* Bins [k0, k1) of the real transform from the n2 points complex transform z */
+static void fft_split_power(const fft_plan_t* p, const cpx_t* z, double* pow_acc, size_t k0, size_t k1)
+{
+	const cpx_t* tw = (const cpx_t*)p->tw_split;
+	cpx_t zk, zc, e, o, x;
+	size_t k;
+
+	for(k = k0; k < k1; k++)
+	{
+		zk = z[(k == p->n2) ? 0 : k];
+		zc = z[(k == 0) ? 0 : (p->n2 - k)];
+		zc.im = -zc.im;
+		/* e = (zk + zc) / 2, o = -i * (zk - zc) / 2, x = e + exp(-2*pi*i*k/n) * o */
+		e.re = 0.5f * (zk.re + zc.re); e.im = 0.5f * (zk.im + zc.im);
+		o.re = 0.5f * (zk.im - zc.im); o.im = -0.5f * (zk.re - zc.re);
+		if(k == p->n2)
+		{
+			x.re = e.re - o.re; x.im = e.im - o.im;
+		} else
+		{
+			o = cpx_mul(o, tw[k]);
+			x.re = e.re + o.re; x.im = e.im + o.im;
+		}
+		pow_acc[k] += (double)x.re * x.re + (double)x.im * x.im;
+	}
+}
+
+static void* fft_worker(void* arg)
+{
+	fft_job_t* job = (fft_job_t*)arg;
+	fft_run_t* run = job->run;
+	fft_plan_t* p = run->p;
+	cpx_t* in = (cpx_t*)p->a;
+	cpx_t* out = (cpx_t*)p->b;
+	cpx_t* tmp;
+	size_t ns = 1;
+	size_t nb;
+	int nb_threads;
+	int s;
+
+	pthread_mutex_lock(&run->lock);
+	while(!run->go)
+		pthread_cond_wait(&run->start, &run->lock);
+	nb_threads = run->nb_threads;
+	pthread_mutex_unlock(&run->lock);
+
+	for(s = 0; s < p->nb_stages; s++)
+	{
+		nb = p->n2 / p->radix[s];
+		fft_stage(in, out, (const cpx_t*)p->tw, p->n2, ns, p->radix[s],
+					nb * job->thread / nb_threads, nb * (job->thread + 1) / nb_threads);
+		if(nb_threads > 1)
+			pthread_barrier_wait(&run->barrier);
+		ns *= p->radix[s];
+		tmp = in;
+		in = out;
+		out = tmp;
+	}
+	nb = p->n2 + 1;
+	fft_split_power(p, in, run->pow_acc, nb * job->thread / nb_threads, nb * (job->thread + 1) / nb_threads);
+	return NULL;
+}
+
+size_t fft_size_valid(size_t max_n)
+{
+	size_t n2;
+	size_t m;
+
+	for(n2 = max_n / 2; n2 > 0; n2--)
+	{
+		m = n2;
+		while((m % 2) == 0)
+			m /= 2;
+		while((m % 3) == 0)
+			m /= 3;
+		while((m % 5) == 0)
+			m /= 5;
+		if(m == 1)
+			return n2 * 2;
+	}
+	return 0;
+}
+
+int fft_plan_init(fft_plan_t* p, size_t n, int nb_threads)
+{
+	cpx_t* tw;
+	size_t m;
+	size_t t;
+
+	memset(p, 0, sizeof(fft_plan_t));
+	if( (n < 2) || (fft_size_valid(n) != n) )
+		return -1;
+	p->n = n;
+	p->n2 = n / 2;
+	p->nb_threads = (nb_threads < 1) ? 1 : ((nb_threads > FFT_MAX_THREADS) ? FFT_MAX_THREADS : nb_threads);
+	/* Radix 4 first, then 2, 3 and 5 */
+	for(m = p->n2; m > 1; p->nb_stages++)
+	{
+		if((m % 4) == 0)
+			p->radix[p->nb_stages] = 4;
+		else if((m % 2) == 0)
+			p->radix[p->nb_stages] = 2;
+		else if((m % 3) == 0)
+			p->radix[p->nb_stages] = 3;
+		else
+			p->radix[p->nb_stages] = 5;
+		m /= p->radix[p->nb_stages];
+	}
+
+	p->tw = malloc(p->n2 * sizeof(cpx_t));
+	p->tw_split = malloc(p->n2 * sizeof(cpx_t));
+	p->a = malloc(p->n2 * sizeof(cpx_t));
+	p->b = malloc(p->n2 * sizeof(cpx_t));
+	if( (p->tw == NULL) || (p->tw_split == NULL) || (p->a == NULL) || (p->b == NULL) )
+	{
+		printf("ERROR fft_plan_init() malloc(%zu)\n", p->n2 * sizeof(cpx_t));
+		fft_plan_free(p);
+		return -1;
+	}
+	/* Twiddles computed in double */
+	tw = (cpx_t*)p->tw;
+	for(t = 0; t < p->n2; t++)
+	{
+		tw[t].re = (float)cos(2.0 * M_PI * t / p->n2);
+		tw[t].im = (float)-sin(2.0 * M_PI * t / p->n2);
+	}
+	tw = (cpx_t*)p->tw_split;
+	for(t = 0; t < p->n2; t++)
+	{
+		tw[t].re = (float)cos(2.0 * M_PI * t / p->n);
+		tw[t].im = (float)-sin(2.0 * M_PI * t / p->n);
+	}
+	return 0;
+}
+
+float* fft_input(fft_plan_t* p)
+{
+	return p->a;
+}
+
+void fft_real_power(fft_plan_t* p, double* pow_acc)
+{
+	fft_run_t run;
+	fft_job_t job[FFT_MAX_THREADS];
+	pthread_t threads[FFT_MAX_THREADS];
+	int nb_threads = p->nb_threads;
+	int t;
+
+	if(p->n2 < FFT_MT_MIN_POINTS)
+		nb_threads = 1;
+	run.p = p;
+	run.pow_acc = pow_acc;
+	run.go = 0;
+	pthread_mutex_init(&run.lock, NULL);
+	pthread_cond_init(&run.start, NULL);
+	for(t = 0; t < nb_threads; t++)
+	{
+		job[t].run = &run;
+		job[t].thread = t;
+		/* Thread 0 is the caller */
+		if( (t > 0) && (pthread_create(&threads[t], NULL, fft_worker, &job[t]) != 0) )
+			break;
+	}
+	/* The butterflies are shared by the threads started */
+	pthread_mutex_lock(&run.lock);
+	run.nb_threads = t;
+	if(t > 1)
+		pthread_barrier_init(&run.barrier, NULL, t);
+	run.go = 1;
+	pthread_cond_broadcast(&run.start);
+	pthread_mutex_unlock(&run.lock);
+
+	fft_worker(&job[0]);
+	while(--t > 0)
+		pthread_join(threads[t], NULL);
+	if(run.nb_threads > 1)
+		pthread_barrier_destroy(&run.barrier);
+	pthread_cond_destroy(&run.start);
+	pthread_mutex_destroy(&run.lock);
+}
+
+void fft_plan_free(fft_plan_t* p)
+{
+	free(p->tw);
+	free(p->tw_split);
+	free(p->a);
+	free(p->b);
+	memset(p, 0, sizeof(fft_plan_t));
+}
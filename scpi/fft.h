@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __FFT_H__
+#define __FFT_H__
+
+#include <stddef.h>
+
+/*
+ * Self-contained real input FFT (float32)
+ * The n real samples are transformed as n/2 complex points (even samples in
+ * the real part, odd samples in the imaginary part) by a mixed-radix 4/2/3/5
+ * Stockham FFT (output in natural order, no bit reversal), then split into the
+ * n/2 + 1 bins of the real transform. n/2 shall only have 2, 3 and 5 factors,
+ * which covers all the MSO5000 memory depths (1k to 200M points).
+ * Above FFT_MT_MIN_POINTS the butterflies of each stage are shared by
+ * nb_threads threads (one barrier per stage).
+ */
+
+#define FFT_MAX_STAGES (64)
+#define FFT_MT_MIN_POINTS (1 << 16)
+#define FFT_MAX_THREADS (64)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	size_t n; /* Real points */
+	size_t n2; /* Complex points (n / 2) */
+	int nb_stages;
+	int radix[FFT_MAX_STAGES];
+	float* tw; /* exp(-2*pi*i*t/n2), n2 complex */
+	float* tw_split; /* exp(-2*pi*i*k/n), n2 complex */
+	float* a; /* Input (n real samples), work buffer */
+	float* b; /* Work buffer */
+	int nb_threads;
+} fft_plan_t;
+
+/* Biggest size <= max_n supported by the FFT (even, n/2 with only 2, 3 and 5 factors), 0 if none */
+size_t fft_size_valid(size_t max_n);
+/* Allocate the buffers and twiddles of a n points FFT, return 0 if OK or -1 (invalid size, out of memory) */
+int fft_plan_init(fft_plan_t* p, size_t n, int nb_threads);
+/* The n real samples to transform are written here before fft_real_power() */
+float* fft_input(fft_plan_t* p);
+/* Transform fft_input() (overwritten) and add |X[k]|^2 of the n/2 + 1 bins to pow_acc */
+void fft_real_power(fft_plan_t* p, double* pow_acc);
+void fft_plan_free(fft_plan_t* p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __FFT_H__ */
@@ -0,0 +1,517 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "socket_portable.h"
+#include "hislip.h"
+
+#define HISLIP_SKIP_SIZE (16384)
+#define HISLIP_TEXT_MAX_SIZE (256) /* Error/FatalError message printed */
+
+static const char* hislip_msg_names[] =
+{
+	"Initialize", "InitializeResponse", "FatalError", "Error", "AsyncLock", "AsyncLockResponse",
+	"Data", "DataEND", "DeviceClearComplete", "DeviceClearAcknowledge", "AsyncRemoteLocalControl",
+	"AsyncRemoteLocalResponse", "Trigger", "Interrupted", "AsyncInterrupted", "AsyncMaximumMessageSize",
+	"AsyncMaximumMessageSizeResponse", "AsyncInitialize", "AsyncInitializeResponse", "AsyncDeviceClear",
+	"AsyncServiceRequest", "AsyncStatusQuery", "AsyncStatusResponse", "AsyncDeviceClearAcknowledge"
+};
+
+void hislip_header_encode(unsigned char* buf, uint8_t type, uint8_t control, uint32_t param, uint64_t length)
+{
+	int i;
+
+	buf[0] = 'H';
+	buf[1] = 'S';
+	buf[2] = type;
+	buf[3] = control;
+	for(i = 0; i < 4; i++)
+		buf[4 + i] = (unsigned char)(param >> (8 * (3 - i)));
+	for(i = 0; i < 8; i++)
+		buf[8 + i] = (unsigned char)(length >> (8 * (7 - i)));
+}
+
+int hislip_header_decode(const unsigned char* buf, hislip_header_t* hdr)
+{
+	int i;
+
+	if( (buf[0] != 'H') || (buf[1] != 'S') )
+		return -1;
+	hdr->type = buf[2];
+	hdr->control = buf[3];
+	hdr->param = 0;
+	for(i = 0; i < 4; i++)
+		hdr->param = (hdr->param << 8) | buf[4 + i];
+	hdr->length = 0;
+	for(i = 0; i < 8; i++)
+		hdr->length = (hdr->length << 8) | buf[8 + i];
+	return 0;
+}
+
+const char* hislip_msg_name(uint8_t type)
+{
+	return (type < (sizeof(hislip_msg_names) / sizeof(hislip_msg_names[0]))) ? hislip_msg_names[type] : "unknown";
+}
+
+/* Receive exactly nb_bytes, return 0 if OK or -1 */
+static int hislip_recv_all(int fd, void* buf, size_t nb_bytes)
+{
+	unsigned char* p = (unsigned char*)buf;
+	int read_nb;
+
+	while(nb_bytes > 0)
+	{
+		read_nb = sockRecv(fd, p, (int)nb_bytes, MSG_WAITALL);
+		if(read_nb <= 0)
+			return -1;
+		p += read_nb;
+		nb_bytes -= read_nb;
+	}
+	return 0;
+}
+
+/* Receive and drop nb_bytes of payload, return 0 if OK or -1 */
+static int hislip_skip(int fd, uint64_t nb_bytes)
+{
+	unsigned char buf[HISLIP_SKIP_SIZE];
+	size_t len;
+
+	while(nb_bytes > 0)
+	{
+		len = (nb_bytes > sizeof(buf)) ? sizeof(buf) : (size_t)nb_bytes;
+		if(hislip_recv_all(fd, buf, len) < 0)
+			return -1;
+		nb_bytes -= len;
+	}
+	return 0;
+}
+
+static int hislip_recv_header(int fd, hislip_header_t* hdr)
+{
+	unsigned char buf[HISLIP_HEADER_SIZE];
+
+	if(hislip_recv_all(fd, buf, sizeof(buf)) < 0)
+	{
+		printf("ERROR HiSLIP recv header failed (errno=%d)\n", errno);
+		return -1;
+	}
+	if(hislip_header_decode(buf, hdr) < 0)
+	{
+		printf("ERROR HiSLIP invalid header (0x%02X 0x%02X)\n", buf[0], buf[1]);
+		return -1;
+	}
+	return 0;
+}
+
+static int hislip_send_msg(int fd, uint8_t type, uint8_t control, uint32_t param, const void* payload, uint64_t length)
+{
+	unsigned char buf[HISLIP_HEADER_SIZE + 64];
+
+	hislip_header_encode(buf, type, control, param, length);
+	/* Short payloads (sub-address, message size) are sent with the header */
+	if(length <= (sizeof(buf) - HISLIP_HEADER_SIZE))
+	{
+		if(length > 0)
+			memcpy(&buf[HISLIP_HEADER_SIZE], payload, (size_t)length);
+		return (socket_write_nbytes(fd, buf, HISLIP_HEADER_SIZE + (int)length) > 0) ? 0 : -1;
+	}
+	if(socket_write_nbytes(fd, buf, HISLIP_HEADER_SIZE) <= 0)
+		return -1;
+	return (socket_write_nbytes(fd, (unsigned char*)payload, (int)length) > 0) ? 0 : -1;
+}
+
+/* Print an unexpected message (with the text of Error/FatalError) and drop its payload, return -1 */
+static int hislip_unexpected(int fd, const hislip_header_t* hdr, const char* func_name)
+{
+	char text[HISLIP_TEXT_MAX_SIZE];
+	size_t len = 0;
+
+	if( (hdr->type == HISLIP_ERROR) || (hdr->type == HISLIP_FATAL_ERROR) )
+	{
+		len = (hdr->length < (sizeof(text) - 1)) ? (size_t)hdr->length : (sizeof(text) - 1);
+		if(hislip_recv_all(fd, text, len) < 0)
+			len = 0;
+	}
+	text[len] = '\0';
+	printf("ERROR %s() HiSLIP %s (control=%u param=0x%08X) %s\n", func_name,
+			hislip_msg_name(hdr->type), hdr->control, hdr->param, text);
+	hislip_skip(fd, hdr->length - len);
+	return -1;
+}
+
+/* Next asynchronous message of type (payload not read), AsyncServiceRequest received meanwhile are recorded */
+static int hislip_async_expect(hislip_t* h, uint8_t type, hislip_header_t* hdr, const char* func_name)
+{
+	while(1)
+	{
+		if(hislip_recv_header(h->async_fd, hdr) < 0)
+			return -1;
+		if(hdr->type == type)
+			return 0;
+		if(hdr->type != HISLIP_ASYNC_SERVICE_REQUEST)
+			return hislip_unexpected(h->async_fd, hdr, func_name);
+		h->srq_pending = 1;
+		h->nb_srq++;
+		if(hislip_skip(h->async_fd, hdr->length) < 0)
+			return -1;
+	}
+}
+
+static int hislip_connect(const char* hostname, int portno, int timeout_s)
+{
+	struct hostent* server;
+	struct sockaddr_in serveraddr;
+	int sockfd;
+
+	server = gethostbyname(hostname);
+	if(server == NULL)
+		return -1;
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if(sockfd < 0)
+		return -1;
+	memset(&serveraddr, 0, sizeof(serveraddr));
+	serveraddr.sin_family = AF_INET;
+	memcpy(&serveraddr.sin_addr.s_addr, server->h_addr, server->h_length);
+	serveraddr.sin_port = htons(portno);
+	if(connect(sockfd, (const struct sockaddr*)&serveraddr, sizeof(serveraddr)) < 0)
+	{
+		sockClose(sockfd);
+		return -1;
+	}
+	sockSetOpt(sockfd, "TCP_NODELAY", IPPROTO_TCP, TCP_NODELAY, 1);
+	sockSetOpt_Timeout(sockfd, "SO_RCVTIMEO", SOL_SOCKET, SO_RCVTIMEO, timeout_s);
+	sockSetOpt_Timeout(sockfd, "SO_SNDTIMEO", SOL_SOCKET, SO_SNDTIMEO, timeout_s);
+	return sockfd;
+}
+
+static uint64_t hislip_get_u64(const unsigned char* buf)
+{
+	uint64_t val = 0;
+	int i;
+
+	for(i = 0; i < 8; i++)
+		val = (val << 8) | buf[i];
+	return val;
+}
+
+int hislip_open(hislip_t* h, int sync_fd, const char* hostname, int portno, const char* sub_address, int timeout_s)
+{
+	hislip_header_t hdr;
+	unsigned char size_buf[8];
+	int i;
+
+	memset(h, 0, sizeof(hislip_t));
+	h->sync_fd = sync_fd;
+	h->async_fd = -1;
+	h->message_id = HISLIP_MESSAGE_ID_INIT;
+
+	if(hislip_send_msg(sync_fd, HISLIP_INITIALIZE, 0, ((uint32_t)HISLIP_PROTOCOL_VERSION << 16) | HISLIP_VENDOR_ID,
+						sub_address, strlen(sub_address)) < 0)
+		return -1;
+	if(hislip_recv_header(sync_fd, &hdr) < 0)
+		return -1;
+	if(hdr.type != HISLIP_INITIALIZE_RESPONSE)
+		return hislip_unexpected(sync_fd, &hdr, "hislip_open");
+	if(hislip_skip(sync_fd, hdr.length) < 0)
+		return -1;
+	h->overlapped = (hdr.control & HISLIP_CTRL_OVERLAPPED) ? 1 : 0;
+	h->server_version = (uint16_t)(hdr.param >> 16);
+	h->session_id = (uint16_t)(hdr.param & 0xFFFF);
+
+	h->async_fd = hislip_connect(hostname, portno, timeout_s);
+	if(h->async_fd < 0)
+	{
+		printf("ERROR hislip_open() asynchronous channel connection to %s:%d failed\n", hostname, portno);
+		return -1;
+	}
+	if(hislip_send_msg(h->async_fd, HISLIP_ASYNC_INITIALIZE, 0, h->session_id, NULL, 0) < 0)
+		return -1;
+	if(hislip_async_expect(h, HISLIP_ASYNC_INITIALIZE_RESPONSE, &hdr, "hislip_open") < 0)
+		return -1;
+	if(hislip_skip(h->async_fd, hdr.length) < 0)
+		return -1;
+	h->server_vendor_id = (uint16_t)(hdr.param & 0xFFFF);
+
+	for(i = 0; i < 8; i++)
+		size_buf[i] = (unsigned char)(HISLIP_MAX_MESSAGE_SIZE >> (8 * (7 - i)));
+	if(hislip_send_msg(h->async_fd, HISLIP_ASYNC_MAXIMUM_MESSAGE_SIZE, 0, 0, size_buf, sizeof(size_buf)) < 0)
+		return -1;
+	if(hislip_async_expect(h, HISLIP_ASYNC_MAXIMUM_MESSAGE_SIZE_RESPONSE, &hdr, "hislip_open") < 0)
+		return -1;
+	if(hdr.length != sizeof(size_buf))
+		return hislip_unexpected(h->async_fd, &hdr, "hislip_open");
+	if(hislip_recv_all(h->async_fd, size_buf, sizeof(size_buf)) < 0)
+		return -1;
+	h->server_max_message_size = hislip_get_u64(size_buf);
+	return 0;
+}
+
+void hislip_set_transport(hislip_t* h, transport_profile_t* tp)
+{
+	h->tp = tp;
+}
+
+/* SCPI query: '?' in the header (first token) of the line */
+static int hislip_is_query(const unsigned char* line, size_t len)
+{
+	size_t i;
+
+	for(i = 0; i < len; i++)
+	{
+		if(line[i] == '?')
+			return 1;
+		if( (line[i] == ' ') || (line[i] == '\n') )
+			break;
+	}
+	return 0;
+}
+
+int hislip_write(hislip_t* h, const unsigned char* buf, int nb_bytes)
+{
+	const unsigned char* line = buf;
+	const unsigned char* end = buf + nb_bytes;
+	const unsigned char* eol;
+	size_t len;
+	int tx_len = 0;
+
+	while(line < end)
+	{
+		eol = memchr(line, '\n', end - line);
+		len = (eol != NULL) ? (size_t)(eol + 1 - line) : (size_t)(end - line);
+		if( (tx_len > 0) && ((tx_len + HISLIP_HEADER_SIZE + len) > sizeof(h->tx_buf)) )
+		{
+			if(socket_write_nbytes(h->sync_fd, h->tx_buf, tx_len) <= 0)
+				return -1;
+			tx_len = 0;
+		}
+		if(h->overlapped && hislip_is_query(line, len))
+		{
+			if(h->pending_count == HISLIP_MAX_PENDING)
+			{
+				printf("ERROR hislip_write() too many queries in flight\n");
+				return -1;
+			}
+			h->pending[(h->pending_head + h->pending_count) % HISLIP_MAX_PENDING] = h->message_id;
+			h->pending_count++;
+		}
+		hislip_header_encode(&h->tx_buf[tx_len], HISLIP_DATA_END, h->rmt_delivered ? HISLIP_CTRL_RMT_DELIVERED : 0,
+							h->message_id, len);
+		tx_len += HISLIP_HEADER_SIZE;
+		if((tx_len + len) <= sizeof(h->tx_buf))
+		{
+			memcpy(&h->tx_buf[tx_len], line, len);
+			tx_len += (int)len;
+		} else
+		{
+			/* Line longer than the TX buffer */
+			if( (socket_write_nbytes(h->sync_fd, h->tx_buf, tx_len) <= 0) ||
+				(socket_write_nbytes(h->sync_fd, (unsigned char*)line, (int)len) <= 0) )
+				return -1;
+			tx_len = 0;
+		}
+		h->rmt_delivered = 0;
+		h->message_id += 2;
+		h->nb_msg_tx++;
+		line += len;
+	}
+	if( (tx_len > 0) && (socket_write_nbytes(h->sync_fd, h->tx_buf, tx_len) <= 0) )
+		return -1;
+	return nb_bytes;
+}
+
+int hislip_read(hislip_t* h, unsigned char* dst, int nb_bytes, int exact)
+{
+	hislip_header_t hdr;
+	int read_nb;
+
+	while(h->rx_left == 0)
+	{
+		if(h->overlapped && (h->pending_count == 0))
+		{
+			/* The caller reads past the end of the last reply (no wait for a message which will never come) */
+			printf("ERROR hislip_read() no reply pending\n");
+			return -1;
+		}
+		if(hislip_recv_header(h->sync_fd, &hdr) < 0)
+			return -1;
+		h->nb_msg_rx++;
+		if(hdr.type == HISLIP_INTERRUPTED)
+		{
+			/* Synchronized mode: the reply in progress was discarded by the server */
+			if(hislip_skip(h->sync_fd, hdr.length) < 0)
+				return -1;
+			continue;
+		}
+		if( (hdr.type != HISLIP_DATA) && (hdr.type != HISLIP_DATA_END) )
+			return hislip_unexpected(h->sync_fd, &hdr, "hislip_read");
+		if(h->overlapped && (h->pending_count > 0))
+		{
+			/* Overlapped mode: a reply has the message ID of its query */
+			if(hdr.param != h->pending[h->pending_head])
+			{
+				h->nb_id_mismatch++;
+				printf("ERROR hislip_read() reply message ID 0x%08X instead of 0x%08X\n",
+						hdr.param, h->pending[h->pending_head]);
+				return -1;
+			}
+			if(hdr.type == HISLIP_DATA_END)
+			{
+				h->pending_head = (h->pending_head + 1) % HISLIP_MAX_PENDING;
+				h->pending_count--;
+			}
+		}
+		h->rx_left = hdr.length;
+		h->rx_end = (hdr.type == HISLIP_DATA_END);
+		if( (h->rx_left == 0) && h->rx_end )
+			h->rmt_delivered = 1;
+	}
+
+	/* All the bytes up to the end of the message belong to the current reply */
+	(void)exact;
+	if((uint64_t)nb_bytes > h->rx_left)
+		nb_bytes = (int)h->rx_left;
+	if(h->tp != NULL)
+		read_nb = transport_profile_recv(h->tp, dst, nb_bytes, 1);
+	else
+		read_nb = sockRecv(h->sync_fd, dst, nb_bytes, 0);
+	if(read_nb > 0)
+	{
+		h->rx_left -= read_nb;
+		if( (h->rx_left == 0) && h->rx_end )
+			h->rmt_delivered = 1;
+	}
+	return read_nb;
+}
+
+int hislip_wait_srq(hislip_t* h, int timeout_ms)
+{
+	hislip_header_t hdr;
+	struct timeval start_tv, tv;
+	fd_set fds;
+	int wait_ms;
+	int ret;
+
+	gettimeofday(&start_tv, NULL);
+	while(!h->srq_pending)
+	{
+		gettimeofday(&tv, NULL);
+		wait_ms = timeout_ms - (int)(TimevalDiff(&tv, &start_tv) * 1000);
+		if(wait_ms <= 0)
+			return 0;
+		tv.tv_sec = wait_ms / 1000;
+		tv.tv_usec = (wait_ms % 1000) * 1000;
+		FD_ZERO(&fds);
+		FD_SET(h->async_fd, &fds);
+		ret = select(h->async_fd + 1, &fds, NULL, NULL, &tv);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			printf("ERROR hislip_wait_srq() select failed (errno=%d)\n", errno);
+			return -1;
+		}
+		if(ret == 0)
+			return 0;
+		if(hislip_async_expect(h, HISLIP_ASYNC_SERVICE_REQUEST, &hdr, "hislip_wait_srq") < 0)
+			return -1;
+		if(hislip_skip(h->async_fd, hdr.length) < 0)
+			return -1;
+		h->nb_srq++;
+		break;
+	}
+	h->srq_pending = 0;
+	return 1;
+}
+
+int hislip_status_query(hislip_t* h)
+{
+	hislip_header_t hdr;
+
+	if(hislip_send_msg(h->async_fd, HISLIP_ASYNC_STATUS_QUERY, h->rmt_delivered ? HISLIP_CTRL_RMT_DELIVERED : 0,
+						h->message_id - 2, NULL, 0) < 0)
+		return -1;
+	if(hislip_async_expect(h, HISLIP_ASYNC_STATUS_RESPONSE, &hdr, "hislip_status_query") < 0)
+		return -1;
+	if(hislip_skip(h->async_fd, hdr.length) < 0)
+		return -1;
+	h->nb_status_query++;
+	return hdr.control;
+}
+
+long long hislip_device_clear(hislip_t* h)
+{
+	hislip_header_t hdr;
+	long long nb_dropped = 0;
+	uint8_t feature;
+
+	if(hislip_send_msg(h->async_fd, HISLIP_ASYNC_DEVICE_CLEAR, 0, 0, NULL, 0) < 0)
+		return -1;
+	if(hislip_async_expect(h, HISLIP_ASYNC_DEVICE_CLEAR_ACKNOWLEDGE, &hdr, "hislip_device_clear") < 0)
+		return -1;
+	if(hislip_skip(h->async_fd, hdr.length) < 0)
+		return -1;
+	feature = hdr.control;
+
+	/* Rest of the current message then all the replies in flight until the server acknowledges */
+	if(hislip_skip(h->sync_fd, h->rx_left) < 0)
+		return -1;
+	nb_dropped += h->rx_left;
+	h->rx_left = 0;
+	if(hislip_send_msg(h->sync_fd, HISLIP_DEVICE_CLEAR_COMPLETE, feature, 0, NULL, 0) < 0)
+		return -1;
+	while(1)
+	{
+		if(hislip_recv_header(h->sync_fd, &hdr) < 0)
+			return -1;
+		if(hdr.type == HISLIP_DEVICE_CLEAR_ACKNOWLEDGE)
+			break;
+		if( (hdr.type != HISLIP_DATA) && (hdr.type != HISLIP_DATA_END) && (hdr.type != HISLIP_INTERRUPTED) )
+			return hislip_unexpected(h->sync_fd, &hdr, "hislip_device_clear");
+		if(hislip_skip(h->sync_fd, hdr.length) < 0)
+			return -1;
+		nb_dropped += hdr.length;
+	}
+	if(hislip_skip(h->sync_fd, hdr.length) < 0)
+		return -1;
+	h->overlapped = (hdr.control & HISLIP_CTRL_OVERLAPPED) ? 1 : 0;
+	h->message_id = HISLIP_MESSAGE_ID_INIT;
+	h->pending_head = 0;
+	h->pending_count = 0;
+	h->rx_end = 0;
+	h->rmt_delivered = 0;
+	h->nb_device_clear++;
+	return nb_dropped;
+}
+
+void hislip_close(hislip_t* h)
+{
+	if(h->async_fd >= 0)
+		sockClose(h->async_fd);
+	h->async_fd = -1;
+}
+
+void hislip_print(const hislip_t* h)
+{
+	printf("HiSLIP: session %u (server protocol %u.%u, vendor %c%c), %s mode, server max message size %llu\n",
+			h->session_id, h->server_version >> 8, h->server_version & 0xFF,
+			(char)(h->server_vendor_id >> 8), (char)(h->server_vendor_id & 0xFF),
+			h->overlapped ? "overlapped" : "synchronized", (unsigned long long)h->server_max_message_size);
+	printf("HiSLIP: %u messages sent, %u received, %u SRQ, %u status queries, %u device clears, %u message ID mismatches\n",
+			h->nb_msg_tx, h->nb_msg_rx, h->nb_srq, h->nb_status_query, h->nb_device_clear, h->nb_id_mismatch);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __HISLIP_H__
+#define __HISLIP_H__
+
+#include <stdint.h>
+
+#include "transport_profile.h"
+
+/*
+ * HiSLIP (IVI-6.1) client transport
+ * A session has two TCP connections to the instrument port (usually 4880):
+ * - synchronous channel: SCPI commands/replies framed in Data/DataEND messages
+ * - asynchronous channel: service requests (SRQ), status query (STB) and device clear
+ * Each message has a 16 bytes header: "HS", message type, control code,
+ * 32 bits message parameter and 64 bits payload length (big endian).
+ * hislip_write() sends each SCPI line as a DataEND message with its own message ID
+ * (all the messages with a single write). In overlapped mode the server replies
+ * to the queries as soon as possible with the message ID of the query, the IDs of
+ * the queries sent are kept in a FIFO and checked against the replies.
+ * hislip_read() returns the payload of the current message only so replies
+ * are never mixed, like a raw socket read the SCPI framing ('\n', ieee488 block)
+ * is done by the caller (scpi_queue).
+ * Device clear drops all the replies in flight on both sides without closing
+ * the connections.
+ */
+
+#define HISLIP_PORT (4880)
+#define HISLIP_HEADER_SIZE (16)
+#define HISLIP_PROTOCOL_VERSION (0x0100) /* 1.0 */
+#define HISLIP_VENDOR_ID (0x5343) /* "SC" */
+#define HISLIP_MESSAGE_ID_INIT (0xFFFFFF00)
+#define HISLIP_MESSAGE_ID_UNKNOWN (0xFFFFFFFF)
+#define HISLIP_SUB_ADDRESS_DEFAULT "hislip0"
+#define HISLIP_SUB_ADDRESS_MAX_SIZE (64)
+/* Maximum message size announced to the server (largest reply payload received) */
+#define HISLIP_MAX_MESSAGE_SIZE (0xFFFFFFFFULL)
+#define HISLIP_MAX_PENDING (64)
+#define HISLIP_TX_SIZE (8192)
+
+/* InitializeResponse/DeviceClearAcknowledge control code */
+#define HISLIP_CTRL_OVERLAPPED (0x01)
+/* Data/DataEND control code: the previous reply was fully received (RMT-delivered) */
+#define HISLIP_CTRL_RMT_DELIVERED (0x01)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	HISLIP_INITIALIZE = 0,
+	HISLIP_INITIALIZE_RESPONSE = 1,
+	HISLIP_FATAL_ERROR = 2,
+	HISLIP_ERROR = 3,
+	HISLIP_ASYNC_LOCK = 4,
+	HISLIP_ASYNC_LOCK_RESPONSE = 5,
+	HISLIP_DATA = 6,
+	HISLIP_DATA_END = 7,
+	HISLIP_DEVICE_CLEAR_COMPLETE = 8,
+	HISLIP_DEVICE_CLEAR_ACKNOWLEDGE = 9,
+	HISLIP_ASYNC_REMOTE_LOCAL_CONTROL = 10,
+	HISLIP_ASYNC_REMOTE_LOCAL_RESPONSE = 11,
+	HISLIP_TRIGGER = 12,
+	HISLIP_INTERRUPTED = 13,
+	HISLIP_ASYNC_INTERRUPTED = 14,
+	HISLIP_ASYNC_MAXIMUM_MESSAGE_SIZE = 15,
+	HISLIP_ASYNC_MAXIMUM_MESSAGE_SIZE_RESPONSE = 16,
+	HISLIP_ASYNC_INITIALIZE = 17,
+	HISLIP_ASYNC_INITIALIZE_RESPONSE = 18,
+	HISLIP_ASYNC_DEVICE_CLEAR = 19,
+	HISLIP_ASYNC_SERVICE_REQUEST = 20,
+	HISLIP_ASYNC_STATUS_QUERY = 21,
+	HISLIP_ASYNC_STATUS_RESPONSE = 22,
+	HISLIP_ASYNC_DEVICE_CLEAR_ACKNOWLEDGE = 23
+} hislip_msg_type_t;
+
+typedef struct
+{
+	uint8_t type;
+	uint8_t control;
+	uint32_t param;
+	uint64_t length;
+} hislip_header_t;
+
+typedef struct
+{
+	int sync_fd;
+	int async_fd;
+	transport_profile_t* tp; /* NULL: plain recv() on the synchronous channel */
+	uint16_t session_id;
+	uint16_t server_version;
+	uint16_t server_vendor_id;
+	int overlapped;
+	uint64_t server_max_message_size;
+	uint32_t message_id; /* Of the next Data/DataEND message sent */
+	int rmt_delivered; /* Set in the next message sent */
+	int srq_pending; /* AsyncServiceRequest received while waiting for another async message */
+
+	/* FIFO of the message IDs of the queries sent for which the reply is not yet received (overlapped mode) */
+	uint32_t pending[HISLIP_MAX_PENDING];
+	int pending_head;
+	int pending_count;
+
+	/* Synchronous channel message being received */
+	uint64_t rx_left; /* Payload bytes not yet read */
+	int rx_end; /* DataEND */
+
+	unsigned char tx_buf[HISLIP_TX_SIZE];
+
+	/* Statistics */
+	unsigned int nb_msg_tx;
+	unsigned int nb_msg_rx;
+	unsigned int nb_srq;
+	unsigned int nb_status_query;
+	unsigned int nb_device_clear;
+	unsigned int nb_id_mismatch;
+} hislip_t;
+
+/* Header encoding/decoding (buf of HISLIP_HEADER_SIZE bytes), decode returns 0 if OK or -1 (no "HS" prologue) */
+void hislip_header_encode(unsigned char* buf, uint8_t type, uint8_t control, uint32_t param, uint64_t length);
+int hislip_header_decode(const unsigned char* buf, hislip_header_t* hdr);
+const char* hislip_msg_name(uint8_t type);
+
+/*
+ * Open the session, sync_fd is the synchronous channel already connected to hostname:portno,
+ * the asynchronous channel is connected to the same port (receive timeout timeout_s),
+ * return 0 if OK or -1
+ */
+int hislip_open(hislip_t* h, int sync_fd, const char* hostname, int portno, const char* sub_address, int timeout_s);
+/* Receive the synchronous channel with the socket options of a transport profile */
+void hislip_set_transport(hislip_t* h, transport_profile_t* tp);
+/* Send the SCPI lines of buf (one DataEND message per line), return nb_bytes if OK or <= 0 in case of error */
+int hislip_write(hislip_t* h, const unsigned char* buf, int nb_bytes);
+/*
+ * Read up to nb_bytes of the payload of the current reply message (exact != 0: all belong to the
+ * current message, see transport_profile_recv()), return nb bytes or <= 0 in case of error
+ */
+int hislip_read(hislip_t* h, unsigned char* dst, int nb_bytes, int exact);
+/* Wait for an AsyncServiceRequest, return 1 if received, 0 on timeout or -1 in case of error */
+int hislip_wait_srq(hislip_t* h, int timeout_ms);
+/* AsyncStatusQuery, return the status byte (STB) or -1 */
+int hislip_status_query(hislip_t* h);
+/* Device clear (replies in flight dropped), return the number of payload bytes dropped or -1 */
+long long hislip_device_clear(hislip_t* h);
+/* Close the asynchronous channel (the synchronous one is closed by the caller) */
+void hislip_close(hislip_t* h);
+void hislip_print(const hislip_t* h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __HISLIP_H__ */
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ieee488_block.h"
+
+void ieee488_block_init(ieee488_block_t* blk, const ieee488_block_cb_t* cb, void* ctx)
+{
+	memset(blk, 0, sizeof(ieee488_block_t));
+	blk->cb = cb;
+	blk->ctx = ctx;
+	ieee488_block_reset(blk);
+}
+
+void ieee488_block_reset(ieee488_block_t* blk)
+{
+	blk->state = IEEE488_BLOCK_HASH;
+	blk->digits_left = 0;
+	blk->length = 0;
+	blk->payload_left = 0;
+	blk->error = NULL;
+}
+
+static long ieee488_block_fail(ieee488_block_t* blk, const char* error)
+{
+	blk->state = IEEE488_BLOCK_ERROR;
+	blk->error = error;
+	return -1;
+}
+
+static int ieee488_block_header_done(ieee488_block_t* blk)
+{
+	if( (blk->cb->on_header != NULL) && (blk->cb->on_header(blk->ctx, blk->length) < 0) )
+		return -1;
+	if(blk->length == IEEE488_BLOCK_INDEFINITE)
+	{
+		blk->state = IEEE488_BLOCK_PAYLOAD_INDEFINITE;
+	} else
+	{
+		blk->payload_left = blk->length;
+		blk->state = (blk->length > 0) ? IEEE488_BLOCK_PAYLOAD : IEEE488_BLOCK_TERM;
+	}
+	return 0;
+}
+
+long ieee488_block_feed(ieee488_block_t* blk, const unsigned char* data, size_t len)
+{
+	size_t nb = 0;
+	size_t n;
+	const unsigned char* eol;
+	unsigned char c;
+
+	while( (nb < len) && (blk->state != IEEE488_BLOCK_DONE) )
+	{
+		switch(blk->state)
+		{
+			case IEEE488_BLOCK_HASH:
+				if(data[nb++] != '#')
+					return ieee488_block_fail(blk, "invalid block header (no '#')");
+				blk->state = IEEE488_BLOCK_NB_DIGITS;
+				break;
+
+			case IEEE488_BLOCK_NB_DIGITS:
+				c = data[nb++];
+				if( (c < '0') || (c > '9') )
+					return ieee488_block_fail(blk, "invalid block header (nb digits)");
+				if(c == '0')
+				{
+					blk->length = IEEE488_BLOCK_INDEFINITE;
+					if(ieee488_block_header_done(blk) < 0)
+						return ieee488_block_fail(blk, "header rejected");
+				} else
+				{
+					blk->digits_left = c - '0';
+					blk->length = 0;
+					blk->state = IEEE488_BLOCK_LENGTH;
+				}
+				break;
+
+			case IEEE488_BLOCK_LENGTH:
+				c = data[nb++];
+				if( (c < '0') || (c > '9') )
+					return ieee488_block_fail(blk, "invalid block header (length)");
+				blk->length = (blk->length * 10) + (c - '0');
+				blk->digits_left--;
+				if( (blk->digits_left == 0) && (ieee488_block_header_done(blk) < 0) )
+					return ieee488_block_fail(blk, "header rejected");
+				break;
+
+			case IEEE488_BLOCK_PAYLOAD:
+				n = len - nb;
+				if((long long)n > blk->payload_left)
+					n = (size_t)blk->payload_left;
+				if( (blk->cb->on_payload != NULL) && (blk->cb->on_payload(blk->ctx, &data[nb], n) < 0) )
+					return ieee488_block_fail(blk, "payload rejected");
+				blk->payload_left -= n;
+				nb += n;
+				if(blk->payload_left == 0)
+					blk->state = IEEE488_BLOCK_TERM;
+				break;
+
+			case IEEE488_BLOCK_PAYLOAD_INDEFINITE:
+				eol = memchr(&data[nb], '\n', len - nb);
+				n = (eol != NULL) ? (size_t)(eol - &data[nb]) : (len - nb);
+				if( (n > 0) && (blk->cb->on_payload != NULL) && (blk->cb->on_payload(blk->ctx, &data[nb], n) < 0) )
+					return ieee488_block_fail(blk, "payload rejected");
+				nb += n;
+				if(eol != NULL)
+					blk->state = IEEE488_BLOCK_TERM;
+				break;
+
+			case IEEE488_BLOCK_TERM:
+				if(data[nb++] != '\n')
+					return ieee488_block_fail(blk, "invalid block terminator (not 0x0A)");
+				blk->state = IEEE488_BLOCK_DONE;
+				if(blk->cb->on_end != NULL)
+					blk->cb->on_end(blk->ctx);
+				break;
+
+			case IEEE488_BLOCK_DONE:
+				break;
+
+			case IEEE488_BLOCK_ERROR:
+			default:
+				return -1;
+		}
+	}
+	return (long)nb;
+}
+
+int ieee488_block_done(const ieee488_block_t* blk)
+{
+	return (blk->state == IEEE488_BLOCK_DONE);
+}
+
+size_t ieee488_block_bytes_left(const ieee488_block_t* blk)
+{
+	switch(blk->state)
+	{
+		case IEEE488_BLOCK_PAYLOAD:
+			return (size_t)blk->payload_left + 1;
+		case IEEE488_BLOCK_TERM:
+			return 1;
+		default:
+			return 0;
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __IEEE488_BLOCK_H__
+#define __IEEE488_BLOCK_H__
+
+#include <stddef.h>
+
+/*
+ * Incremental parser of IEEE 488.2 arbitrary block responses (:WAV:DATA?)
+ *   Definite length:   #<N><N digits length><length bytes>\n
+ *   Indefinite length: #0<bytes>\n (ends at the first '\n', no END over TCP, so binary
+ *   data is cut at its first 0x0A byte: the caller checks the nb of bytes it expected)
+ * Data can be fed by chunks of any size, the header, payload and terminator
+ * are reported with callbacks and the parser never consumes bytes after the
+ * terminator (they belong to the next reply).
+ */
+
+#define IEEE488_BLOCK_INDEFINITE (-1)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	/* Header parsed, length is IEEE488_BLOCK_INDEFINITE for #0, return < 0 to abort */
+	int (*on_header)(void* ctx, long long length);
+	/* Payload bytes (called once per fed chunk), data points in the fed chunk, return < 0 to abort */
+	int (*on_payload)(void* ctx, const unsigned char* data, size_t len);
+	/* Terminator received */
+	void (*on_end)(void* ctx);
+} ieee488_block_cb_t;
+
+typedef enum
+{
+	IEEE488_BLOCK_HASH = 0, /* '#' */
+	IEEE488_BLOCK_NB_DIGITS, /* '0'..'9' */
+	IEEE488_BLOCK_LENGTH, /* Length digits */
+	IEEE488_BLOCK_PAYLOAD,
+	IEEE488_BLOCK_PAYLOAD_INDEFINITE,
+	IEEE488_BLOCK_TERM, /* '\n' */
+	IEEE488_BLOCK_DONE,
+	IEEE488_BLOCK_ERROR
+} ieee488_block_state_t;
+
+typedef struct
+{
+	ieee488_block_state_t state;
+	int digits_left;
+	long long length; /* Payload length or IEEE488_BLOCK_INDEFINITE */
+	long long payload_left;
+	const char* error; /* Reason of IEEE488_BLOCK_ERROR */
+
+	const ieee488_block_cb_t* cb;
+	void* ctx;
+} ieee488_block_t;
+
+void ieee488_block_init(ieee488_block_t* blk, const ieee488_block_cb_t* cb, void* ctx);
+/* Ready to parse the next block */
+void ieee488_block_reset(ieee488_block_t* blk);
+
+/*
+ * Parse len bytes, stop after the terminator
+ * Return nb bytes consumed (< len if the block ended before the end of data)
+ * or -1 in case of framing error or callback abort (blk->error is set)
+ */
+long ieee488_block_feed(ieee488_block_t* blk, const unsigned char* data, size_t len);
+
+/* 1 when the terminator was received */
+int ieee488_block_done(const ieee488_block_t* blk);
+
+/*
+ * Nb bytes which can be read without reading after the end of the block
+ * (payload left + terminator), 0 while the length is not known (header or #0)
+ */
+size_t ieee488_block_bytes_left(const ieee488_block_t* blk);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __IEEE488_BLOCK_H__ */
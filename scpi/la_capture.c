@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "socket_portable.h"
+#include "la_capture.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define LA_X86 1
+	#include <immintrin.h>
+#endif
+
+/* Set bit of words[i] if samples[i] != 0, clear it else */
+typedef void (*la_pack_fn)(const unsigned char* samples, uint16_t* words, size_t nb_samples, uint16_t bit);
+/* Edges of words [i0, i1) (i0 >= 1) appended to edges, return the number of edges */
+typedef size_t (*la_edges_fn)(const uint16_t* words, size_t i0, size_t i1, uint64_t* edges);
+
+static void la_pack_scalar(const unsigned char* samples, uint16_t* words, size_t nb_samples, uint16_t bit)
+{
+	size_t i;
+
+	for(i = 0; i < nb_samples; i++)
+		words[i] = (words[i] & ~bit) | (samples[i] ? bit : 0);
+}
+
+static size_t la_edges_scalar(const uint16_t* words, size_t i0, size_t i1, uint64_t* edges)
+{
+	size_t nb = 0;
+	uint16_t x;
+	size_t i;
+
+	for(i = i0; i < i1; i++)
+	{
+		x = words[i] ^ words[i - 1];
+		if(x != 0)
+			edges[nb++] = (uint64_t)i | ((uint64_t)x << LA_EDGE_INDEX_BITS);
+	}
+	return nb;
+}
+
+static la_pack_fn la_pack_kernel = la_pack_scalar;
+static la_edges_fn la_edges_kernel = la_edges_scalar;
+static const char* la_kernel_name_str = "scalar";
+
+#ifdef LA_X86
+__attribute__((target("sse2")))
+static void la_pack_sse2(const unsigned char* samples, uint16_t* words, size_t nb_samples, uint16_t bit)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i vbit = _mm_set1_epi16((short)bit);
+	__m128i b, w, set;
+	size_t i;
+
+	/* 8 samples per iteration: u8 => u16, bit where the sample is not 0 */
+	for(i = 0; (i + 8) <= nb_samples; i += 8)
+	{
+		b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&samples[i]), zero);
+		set = _mm_andnot_si128(_mm_cmpeq_epi16(b, zero), vbit);
+		w = _mm_loadu_si128((const __m128i*)&words[i]);
+		_mm_storeu_si128((__m128i*)&words[i], _mm_or_si128(_mm_andnot_si128(vbit, w), set));
+	}
+	la_pack_scalar(&samples[i], &words[i], nb_samples - i, bit);
+}
+
+__attribute__((target("sse2")))
+static size_t la_edges_sse2(const uint16_t* words, size_t i0, size_t i1, uint64_t* edges)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i x;
+	size_t nb = 0;
+	size_t i;
+
+	/* 8 words per iteration, blocks without change are skipped with one movemask */
+	for(i = i0; (i + 8) <= i1; i += 8)
+	{
+		x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&words[i]), _mm_loadu_si128((const __m128i*)&words[i - 1]));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi16(x, zero)) != 0xFFFF)
+			nb += la_edges_scalar(words, i, i + 8, &edges[nb]);
+	}
+	return nb + la_edges_scalar(words, i, i1, &edges[nb]);
+}
+
+__attribute__((target("avx2")))
+static void la_pack_avx2(const unsigned char* samples, uint16_t* words, size_t nb_samples, uint16_t bit)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i vbit = _mm256_set1_epi16((short)bit);
+	__m256i b, w, set;
+	size_t i;
+
+	/* 16 samples per iteration */
+	for(i = 0; (i + 16) <= nb_samples; i += 16)
+	{
+		b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)&samples[i]));
+		set = _mm256_andnot_si256(_mm256_cmpeq_epi16(b, zero), vbit);
+		w = _mm256_loadu_si256((const __m256i*)&words[i]);
+		_mm256_storeu_si256((__m256i*)&words[i], _mm256_or_si256(_mm256_andnot_si256(vbit, w), set));
+	}
+	la_pack_sse2(&samples[i], &words[i], nb_samples - i, bit);
+}
+
+__attribute__((target("avx2")))
+static size_t la_edges_avx2(const uint16_t* words, size_t i0, size_t i1, uint64_t* edges)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i x;
+	size_t nb = 0;
+	size_t i;
+
+	for(i = i0; (i + 16) <= i1; i += 16)
+	{
+		x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)&words[i]), _mm256_loadu_si256((const __m256i*)&words[i - 1]));
+		if((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi16(x, zero)) != 0xFFFFFFFF)
+			nb += la_edges_scalar(words, i, i + 16, &edges[nb]);
+	}
+	return nb + la_edges_sse2(words, i, i1, &edges[nb]);
+}
+#endif
+
+void la_init(void)
+{
+#ifdef LA_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		la_pack_kernel = la_pack_avx2;
+		la_edges_kernel = la_edges_avx2;
+		la_kernel_name_str = "avx2";
+	} else if(__builtin_cpu_supports("sse2"))
+	{
+		la_pack_kernel = la_pack_sse2;
+		la_edges_kernel = la_edges_sse2;
+		la_kernel_name_str = "sse2";
+	}
+#endif
+}
+
+const char* la_kernel_name(void)
+{
+	return la_kernel_name_str;
+}
+
+static void put_u32(unsigned char* dst, uint32_t val)
+{
+	int i;
+
+	for(i = 0; i < 4; i++)
+		dst[i] = (unsigned char)(val >> (i * 8));
+}
+
+static void put_u64(unsigned char* dst, uint64_t val)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		dst[i] = (unsigned char)(val >> (i * 8));
+}
+
+int la_capture_init(la_capture_t* la, const char* filename, uint16_t chan_mask, size_t max_points, int edges_only)
+{
+	unsigned char hdr[LA_FILE_HDR_SIZE];
+	int k;
+
+	memset(la, 0, sizeof(la_capture_t));
+	if(chan_mask == 0)
+		return -1;
+	la->chan_mask = chan_mask;
+	la->edges_only = edges_only;
+	for(k = 0; k < LA_NB_CHAN; k++)
+	{
+		if(chan_mask & (1 << k))
+			la->last_chan = k;
+	}
+	la->capacity = max_points;
+	/* Bits of the disabled channels stay 0 */
+	la->words = calloc((max_points > 0) ? max_points : 1, sizeof(uint16_t));
+	if(la->words == NULL)
+	{
+		printf("ERROR la_capture_init() calloc(%zu words)\n", max_points);
+		return -1;
+	}
+	la->fp = fopen(filename, "wb");
+	if(la->fp == NULL)
+	{
+		la_capture_close(la);
+		return -1;
+	}
+	memcpy(hdr, LA_MAGIC, 4);
+	put_u32(&hdr[4], edges_only ? LA_FILE_EDGES_ONLY : 0);
+	if(fwrite(hdr, sizeof(hdr), 1, la->fp) != 1)
+	{
+		la_capture_close(la);
+		return -1;
+	}
+	la->bytes_written = sizeof(hdr);
+	return 0;
+}
+
+void la_capture_begin(la_capture_t* la)
+{
+	la->nb_samples = 0;
+	la->nb_edges = 0;
+	la->edge_end = 0;
+}
+
+int la_capture_feed(la_capture_t* la, int chan, size_t offset, const unsigned char* samples, size_t nb_samples)
+{
+	struct timeval start_tv;
+	struct timeval pack_tv;
+	struct timeval end_tv;
+	size_t end = offset + nb_samples;
+	size_t cap;
+	uint64_t* p;
+
+	if( (chan < 0) || (chan >= LA_NB_CHAN) || (end > la->capacity) )
+		return -1;
+	gettimeofday(&start_tv, NULL);
+	la_pack_kernel(samples, &la->words[offset], nb_samples, (uint16_t)(1 << chan));
+	if(end > la->nb_samples)
+		la->nb_samples = end;
+	gettimeofday(&pack_tv, NULL);
+	la->pack_time_s += TimevalDiff(&pack_tv, &start_tv);
+	if(chan != la->last_chan)
+		return 0;
+
+	if(offset < la->edge_end)
+	{
+		/* Request received again, the edges of the failed attempt are removed */
+		while( (la->nb_edges > 0) && (LA_EDGE_INDEX(la->edges[la->nb_edges - 1]) >= offset) )
+			la->nb_edges--;
+		la->edge_end = offset;
+	}
+	if(la->edge_end == 0)
+		la->edge_end = 1; /* Sample 0 is the first_word of the record */
+	if(end <= la->edge_end)
+		return 0;
+	/* At most one edge per word */
+	if((la->nb_edges + (end - la->edge_end)) > la->edges_capacity)
+	{
+		cap = 2 * la->edges_capacity;
+		if(cap < (la->nb_edges + (end - la->edge_end)))
+			cap = la->nb_edges + (end - la->edge_end);
+		p = realloc(la->edges, cap * sizeof(uint64_t));
+		if(p == NULL)
+			return -1;
+		la->edges = p;
+		la->edges_capacity = cap;
+	}
+	la->nb_edges += la_edges_kernel(la->words, la->edge_end, end, &la->edges[la->nb_edges]);
+	la->edge_end = end;
+	gettimeofday(&end_tv, NULL);
+	la->edge_time_s += TimevalDiff(&end_tv, &pack_tv);
+	return 0;
+}
+
+int la_capture_write(la_capture_t* la, unsigned int waveform_nb, double sec_per_sample)
+{
+	unsigned char hdr[LA_RECORD_HDR_SIZE];
+
+	put_u32(&hdr[0], waveform_nb);
+	put_u32(&hdr[4], la->chan_mask);
+	put_u64(&hdr[8], la->nb_samples);
+	put_u64(&hdr[16], la->nb_edges);
+	put_u32(&hdr[24], (la->nb_samples > 0) ? la->words[0] : 0);
+	put_u32(&hdr[28], 0);
+	memcpy(&hdr[32], &sec_per_sample, sizeof(double));
+	if(fwrite(hdr, sizeof(hdr), 1, la->fp) != 1)
+		return -1;
+	if( !la->edges_only && (fwrite(la->words, sizeof(uint16_t), la->nb_samples, la->fp) != la->nb_samples) )
+		return -1;
+	if(fwrite(la->edges, sizeof(uint64_t), la->nb_edges, la->fp) != la->nb_edges)
+		return -1;
+	la->bytes_written += sizeof(hdr) + la->nb_edges * sizeof(uint64_t) + (la->edges_only ? 0 : la->nb_samples * sizeof(uint16_t));
+	la->nb_records++;
+	la->total_samples += la->nb_samples;
+	la->total_edges += la->nb_edges;
+	return 0;
+}
+
+void la_capture_close(la_capture_t* la)
+{
+	if(la->fp != NULL)
+	{
+		fclose(la->fp);
+		la->fp = NULL;
+	}
+	free(la->words);
+	free(la->edges);
+	la->words = NULL;
+	la->edges = NULL;
+	la->capacity = 0;
+	la->edges_capacity = 0;
+}
+
+void la_capture_print(const la_capture_t* la)
+{
+	printf("la %s: %u records, %llu samples, %llu edges, %llu bytes written (%05.03f bytes/sample), pack %05.04f s, edges %05.04f s\n",
+			la_kernel_name(), la->nb_records, la->total_samples, la->total_edges, la->bytes_written,
+			(la->total_samples > 0) ? (double)la->bytes_written / la->total_samples : 0.0,
+			la->pack_time_s, la->edge_time_s);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __LA_CAPTURE_H__
+#define __LA_CAPTURE_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Logic analyzer (D0 to D15) capture
+ * :WAV:DATA? of a digital channel Dn has one byte per point (0 or 1), the bytes
+ * of each chunk received are packed in bit n of one uint16 word per point
+ * (same layout as the LA data of the Rigol .bin files), so 16 channels take
+ * 2 bytes per point instead of 16.
+ * While the chunks of the last enabled channel are received, the words are
+ * complete and the edge list is extracted: consecutive words are XORed by
+ * blocks of 8 (SSE2) or 16 (AVX2) with a movemask test, only the blocks with
+ * a change are scanned. Each edge is a uint64: sample index (bits 0 to 47)
+ * and mask of the channels changed (bits 48 to 63).
+ *
+ * File: "LA01" + flags (uint32, LA_FILE_EDGES_ONLY) then one record per waveform:
+ * waveform_nb (uint32), chan_mask (uint32), nb_samples (uint64), nb_edges (uint64),
+ * first_word (uint32, state of the channels at sample 0), reserved (uint32),
+ * sec_per_sample (float64), then the nb_samples uint16 words (not with
+ * LA_FILE_EDGES_ONLY) and the nb_edges uint64 edges (little endian)
+ */
+
+#define LA_MAGIC "LA01"
+#define LA_NB_CHAN (16)
+#define LA_FILE_HDR_SIZE (8)
+#define LA_RECORD_HDR_SIZE (40)
+#define LA_FILE_EDGES_ONLY (1)
+#define LA_EDGE_INDEX_BITS (48)
+#define LA_EDGE_INDEX(edge) ((edge) & ((1ULL << LA_EDGE_INDEX_BITS) - 1))
+#define LA_EDGE_CHANGED(edge) ((uint16_t)((edge) >> LA_EDGE_INDEX_BITS))
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	FILE* fp;
+	int edges_only;
+	uint16_t chan_mask; /* Channels enabled */
+	int last_chan; /* Last channel received of each waveform (edges extracted with its chunks) */
+	uint16_t* words;
+	size_t capacity;
+	size_t nb_samples;
+	uint64_t* edges;
+	size_t nb_edges;
+	size_t edges_capacity;
+	size_t edge_end; /* Words scanned for edges */
+
+	/* Statistics */
+	unsigned int nb_records;
+	unsigned long long total_samples;
+	unsigned long long total_edges;
+	unsigned long long bytes_written;
+	double pack_time_s;
+	double edge_time_s;
+} la_capture_t;
+
+/* Select the fastest kernels supported by the CPU */
+void la_init(void);
+/* Name of the kernel selected ("avx2", "sse2" or "scalar") */
+const char* la_kernel_name(void);
+
+/* Create the file and allocate max_points words for the channels of chan_mask, return 0 if OK or -1 */
+int la_capture_init(la_capture_t* la, const char* filename, uint16_t chan_mask, size_t max_points, int edges_only);
+/* Start a new waveform */
+void la_capture_begin(la_capture_t* la);
+/*
+ * Pack nb_samples bytes of channel chan (0 to 15) received at offset (0 based point),
+ * for the last channel the edges up to offset + nb_samples are extracted (the edges
+ * after offset are removed first when a request is received again), return 0 if OK or -1
+ */
+int la_capture_feed(la_capture_t* la, int chan, size_t offset, const unsigned char* samples, size_t nb_samples);
+/* Append the record of the waveform, return 0 if OK or -1 */
+int la_capture_write(la_capture_t* la, unsigned int waveform_nb, double sec_per_sample);
+void la_capture_close(la_capture_t* la);
+void la_capture_print(const la_capture_t* la);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __LA_CAPTURE_H__ */
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency_hist.h"
+
+#define LATENCY_HIST_SUB_COUNT (1 << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_HALF_COUNT (1 << (LATENCY_HIST_SUB_BITS - 1))
+
+static int latency_hist_msb(uint64_t v)
+{
+	int msb = 0;
+
+	while(v >>= 1)
+		msb++;
+	return msb;
+}
+
+static int latency_hist_index(uint64_t us)
+{
+	int msb;
+	int shift;
+
+	if(us < LATENCY_HIST_SUB_COUNT)
+		return (int)us;
+	/* SUB_BITS most significant bits of the value */
+	msb = latency_hist_msb(us);
+	shift = msb - (LATENCY_HIST_SUB_BITS - 1);
+	return LATENCY_HIST_SUB_COUNT + (msb - LATENCY_HIST_SUB_BITS) * LATENCY_HIST_HALF_COUNT +
+		   (int)((us >> shift) - LATENCY_HIST_HALF_COUNT);
+}
+
+/* Highest value of bucket idx */
+static uint64_t latency_hist_bucket_max(int idx)
+{
+	int e;
+	uint64_t mant;
+	int shift;
+
+	if(idx < LATENCY_HIST_SUB_COUNT)
+		return (uint64_t)idx;
+	idx -= LATENCY_HIST_SUB_COUNT;
+	e = LATENCY_HIST_SUB_BITS + (idx / LATENCY_HIST_HALF_COUNT);
+	mant = LATENCY_HIST_HALF_COUNT + (idx % LATENCY_HIST_HALF_COUNT);
+	shift = e - (LATENCY_HIST_SUB_BITS - 1);
+	return ((mant + 1) << shift) - 1;
+}
+
+void latency_hist_init(latency_hist_t* h, const char* name)
+{
+	memset(h, 0, sizeof(latency_hist_t));
+	h->name = name;
+	h->min_us = UINT64_MAX;
+}
+
+void latency_hist_record(latency_hist_t* h, uint64_t us)
+{
+	if(us > LATENCY_HIST_MAX_US)
+		us = LATENCY_HIST_MAX_US;
+	h->buckets[latency_hist_index(us)]++;
+	h->count++;
+	h->sum_us += us;
+	if(us < h->min_us)
+		h->min_us = us;
+	if(us > h->max_us)
+		h->max_us = us;
+}
+
+void latency_hist_record_s(latency_hist_t* h, float s)
+{
+	latency_hist_record(h, (s > 0) ? (uint64_t)(s * 1e6 + 0.5) : 0);
+}
+
+uint64_t latency_hist_percentile(const latency_hist_t* h, double p)
+{
+	uint64_t target;
+	uint64_t cumul = 0;
+	uint64_t v;
+	int i;
+
+	if(h->count == 0)
+		return 0;
+	target = (uint64_t)((p / 100.0) * h->count + 0.5);
+	if(target < 1)
+		target = 1;
+	if(target > h->count)
+		target = h->count;
+	for(i = 0; i < LATENCY_HIST_NB_BUCKETS; i++)
+	{
+		cumul += h->buckets[i];
+		if(cumul >= target)
+		{
+			v = latency_hist_bucket_max(i);
+			return (v > h->max_us) ? h->max_us : v;
+		}
+	}
+	return h->max_us;
+}
+
+void latency_hist_print(latency_hist_t** list, int nb)
+{
+	const latency_hist_t* h;
+	int i;
+
+	for(i = 0; i < nb; i++)
+	{
+		h = list[i];
+		if(h->count == 0)
+			continue;
+		printf("Latency %-16s count=%llu min=%lluus p50=%lluus p99=%lluus p99.9=%lluus max=%lluus avg=%.0fus\n",
+				h->name, (unsigned long long)h->count, (unsigned long long)h->min_us,
+				(unsigned long long)latency_hist_percentile(h, 50.0),
+				(unsigned long long)latency_hist_percentile(h, 99.0),
+				(unsigned long long)latency_hist_percentile(h, 99.9),
+				(unsigned long long)h->max_us, h->sum_us / h->count);
+	}
+}
+
+static void latency_hist_write_json(FILE* fp, latency_hist_t** list, int nb, double elapsed_s)
+{
+	const latency_hist_t* h;
+	int i, j;
+	int first;
+
+	fprintf(fp, "{\n  \"timestamp\": %lld,\n  \"elapsed_s\": %.3f,\n  \"unit\": \"us\",\n  \"phases\": [\n",
+			(long long)time(NULL), elapsed_s);
+	for(i = 0; i < nb; i++)
+	{
+		h = list[i];
+		fprintf(fp, "    {\"name\": \"%s\", \"count\": %llu, \"min\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p99.9\": %llu, \"max\": %llu, \"mean\": %.1f,\n",
+				h->name, (unsigned long long)h->count, (unsigned long long)((h->count > 0) ? h->min_us : 0),
+				(unsigned long long)latency_hist_percentile(h, 50.0),
+				(unsigned long long)latency_hist_percentile(h, 90.0),
+				(unsigned long long)latency_hist_percentile(h, 99.0),
+				(unsigned long long)latency_hist_percentile(h, 99.9),
+				(unsigned long long)h->max_us, (h->count > 0) ? (h->sum_us / h->count) : 0.0);
+		/* Non empty buckets as [upper bound, count] to rebuild the distribution */
+		fprintf(fp, "     \"buckets\": [");
+		first = 1;
+		for(j = 0; j < LATENCY_HIST_NB_BUCKETS; j++)
+		{
+			if(h->buckets[j] == 0)
+				continue;
+			fprintf(fp, "%s[%llu, %llu]", first ? "" : ", ",
+					(unsigned long long)latency_hist_bucket_max(j), (unsigned long long)h->buckets[j]);
+			first = 0;
+		}
+		fprintf(fp, "]}%s\n", (i < (nb - 1)) ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+}
+
+static void latency_hist_write_csv(FILE* fp, latency_hist_t** list, int nb, double elapsed_s)
+{
+	const latency_hist_t* h;
+	int i;
+
+	fprintf(fp, "phase,count,min_us,p50_us,p90_us,p99_us,p99.9_us,max_us,mean_us,elapsed_s\n");
+	for(i = 0; i < nb; i++)
+	{
+		h = list[i];
+		fprintf(fp, "%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.1f,%.3f\n",
+				h->name, (unsigned long long)h->count, (unsigned long long)((h->count > 0) ? h->min_us : 0),
+				(unsigned long long)latency_hist_percentile(h, 50.0),
+				(unsigned long long)latency_hist_percentile(h, 90.0),
+				(unsigned long long)latency_hist_percentile(h, 99.0),
+				(unsigned long long)latency_hist_percentile(h, 99.9),
+				(unsigned long long)h->max_us, (h->count > 0) ? (h->sum_us / h->count) : 0.0, elapsed_s);
+	}
+}
+
+int latency_hist_export(const char* filename, latency_hist_t** list, int nb, double elapsed_s)
+{
+	char tmp_filename[1024];
+	const char* ext;
+	FILE* fp;
+
+	/* Written to a temporary file then renamed so a reader never sees a partial file */
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+	fp = fopen(tmp_filename, "w");
+	if(fp == NULL)
+	{
+		printf("ERROR latency_hist_export(%s) fopen()\n", tmp_filename);
+		return -1;
+	}
+	ext = strrchr(filename, '.');
+	if( (ext != NULL) && (strcmp(ext, ".csv") == 0) )
+		latency_hist_write_csv(fp, list, nb, elapsed_s);
+	else
+		latency_hist_write_json(fp, list, nb, elapsed_s);
+	fclose(fp);
+#ifdef _WIN32
+	remove(filename);
+#endif
+	if(rename(tmp_filename, filename) != 0)
+	{
+		printf("ERROR latency_hist_export(%s) rename()\n", filename);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __LATENCY_HIST_H__
+#define __LATENCY_HIST_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram (HDR histogram like) of values in microseconds
+ * Values < 256us are exact, bigger values are in buckets of 128 per power of 2
+ * (relative error < 0.8%) up to LATENCY_HIST_MAX_US.
+ */
+
+#define LATENCY_HIST_SUB_BITS (8)
+#define LATENCY_HIST_MAX_BITS (40) /* 2^40us (12 days), bigger values are clamped */
+#define LATENCY_HIST_NB_BUCKETS ((1 << LATENCY_HIST_SUB_BITS) + (LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS) * (1 << (LATENCY_HIST_SUB_BITS - 1)))
+#define LATENCY_HIST_MAX_US ((1ULL << LATENCY_HIST_MAX_BITS) - 1)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	const char* name;
+	uint64_t count;
+	uint64_t min_us;
+	uint64_t max_us;
+	double sum_us;
+	uint64_t buckets[LATENCY_HIST_NB_BUCKETS];
+} latency_hist_t;
+
+void latency_hist_init(latency_hist_t* h, const char* name);
+void latency_hist_record(latency_hist_t* h, uint64_t us);
+/* Record a duration in seconds (as returned by TimevalDiff()) */
+void latency_hist_record_s(latency_hist_t* h, float s);
+/* Value in us at percentile p (0 to 100), upper bound of its bucket */
+uint64_t latency_hist_percentile(const latency_hist_t* h, double p);
+
+/* Print min/p50/p99/p99.9/max of each histogram */
+void latency_hist_print(latency_hist_t** list, int nb);
+/* Write all histograms as JSON or CSV (format from filename extension .json/.csv), return 0 if OK */
+int latency_hist_export(const char* filename, latency_hist_t** list, int nb, double elapsed_s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __LATENCY_HIST_H__ */
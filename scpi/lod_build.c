@@ -0,0 +1,238 @@
+/*
+ * Build the min/max LOD sidecar index (lod_pyramid "LOD1") of a MSO5000_SCPI raw data file
+ * and render a range of samples from it
+ */
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "socket_portable.h"
+#include "lod_pyramid.h"
+
+#define APP_NAME "MSO5000_LOD"
+#define VERSION "v0.1.2 13/12/2020 B.VERNOUX"
+
+#define BANNER1 APP_NAME " " VERSION "\n"
+#define SYNTAX "Syntax: " APP_NAME " <waveform_rx_raw_data.bin> -n<nb_points per channel> [-c<nb_chan (default 4)>] [-o<index.lod (default <waveform_rx_raw_data.bin>.lod)>]\n" \
+	"        " APP_NAME " <index.lod> -r<waveform_nb>,<chan>,<start>,<nb_samples>,<nb_pixels>\n" \
+	"Build the index of the raw data (nb_chan channels CH1..CHn of nb_points per waveform) or print the min/max of nb_pixels columns of a range (chan 1 based)\n" \
+	"Example:\n" APP_NAME " waveform_rx_raw_data.bin -n1000000 -c4\n" APP_NAME " waveform_rx_raw_data.bin.lod -r1,1,0,1000000,800\n"
+
+#define READ_CHUNK_SIZE (1024 * 1024)
+
+void error(char *msg)
+{
+	if(msg != NULL)
+		printf("%s\n", msg);
+	exit(-1);
+}
+
+#ifdef _WIN32
+BOOL WINAPI consoleHandler(DWORD signal)
+{
+	(void)signal;
+	return TRUE;
+}
+#else
+void consoleHandler(int s)
+{
+	(void)s;
+}
+#endif
+
+int lod_build(const char* in_filename, const char* out_filename, size_t nb_points, int nb_chan)
+{
+	lod_pyramid_t lod;
+	unsigned char* chunk;
+	FILE* infp;
+	FILE* outfp;
+	size_t chan_left = nb_points;
+	size_t nb;
+	unsigned long long nb_samples = 0;
+	unsigned int waveform_nb = 1;
+	int chan = 0;
+	double reduce_time_s = 0;
+	struct timeval start_tv;
+	struct timeval end_tv;
+
+	infp = fopen(in_filename, "rb");
+	if(infp == NULL)
+	{
+		printf("ERROR fopen(%s)\n", in_filename);
+		return -1;
+	}
+	outfp = fopen(out_filename, "wb");
+	if(outfp == NULL)
+	{
+		printf("ERROR fopen(%s)\n", out_filename);
+		fclose(infp);
+		return -1;
+	}
+	chunk = malloc(READ_CHUNK_SIZE);
+	memset(&lod, 0, sizeof(lod));
+	if( (chunk == NULL) || (lod_file_header(outfp) != 0) || (lod_pyramid_begin(&lod, nb_points) != 0) )
+	{
+		printf("ERROR init\n");
+		goto end;
+	}
+	/* Channels of a waveform one after the other, as written by MSO5000_SCPI (raw output) */
+	while((nb = fread(chunk, 1, (chan_left < READ_CHUNK_SIZE) ? chan_left : READ_CHUNK_SIZE, infp)) > 0)
+	{
+		gettimeofday(&start_tv, NULL);
+		if(lod_pyramid_feed(&lod, chunk, nb) != 0)
+		{
+			printf("ERROR lod_pyramid_feed()\n");
+			goto end;
+		}
+		gettimeofday(&end_tv, NULL);
+		reduce_time_s += TimevalDiff(&end_tv, &start_tv);
+		nb_samples += nb;
+		chan_left -= nb;
+		if(chan_left > 0)
+			continue;
+		if( (lod_pyramid_finish(&lod) != 0) || (lod_pyramid_write(&lod, outfp, waveform_nb, chan) != 0) ||
+			(lod_pyramid_begin(&lod, nb_points) != 0) )
+		{
+			printf("ERROR write waveform %u CH%d\n", waveform_nb, chan + 1);
+			goto end;
+		}
+		chan_left = nb_points;
+		if(++chan == nb_chan)
+		{
+			chan = 0;
+			waveform_nb++;
+		}
+	}
+	if(chan_left != nb_points)
+		printf("Warning last channel incomplete (%zu points missing), not indexed\n", chan_left);
+	printf("%s: %u waveforms x %d chan, %llu samples, index %lld bytes\n", out_filename, waveform_nb - 1 + (chan > 0), nb_chan,
+			nb_samples, (long long)ftell(outfp));
+	printf("lod_pyramid %s: %05.04f s (%05.03f MSamples/s)\n", lod_kernel_name(), reduce_time_s,
+			(reduce_time_s > 0) ? (nb_samples / 1e6) / reduce_time_s : 0.0);
+end:
+	lod_pyramid_free(&lod);
+	free(chunk);
+	fclose(infp);
+	if(fclose(outfp) != 0)
+		return -1;
+	return (nb_samples > 0) && (chan_left == nb_points) ? 0 : -1;
+}
+
+int lod_print_range(const char* filename, const char* range)
+{
+	unsigned long long start;
+	unsigned long long nb_samples;
+	unsigned char* min;
+	unsigned char* max;
+	unsigned int waveform_nb;
+	unsigned int chan;
+	int nb_pixels;
+	int level;
+	int x;
+	FILE* fp;
+
+	if( (sscanf(range, "%u,%u,%llu,%llu,%d", &waveform_nb, &chan, &start, &nb_samples, &nb_pixels) != 5) ||
+		(chan < 1) || (nb_pixels < 1) )
+	{
+		printf("ERROR invalid range %s\n", range);
+		return -1;
+	}
+	fp = fopen(filename, "rb");
+	if(fp == NULL)
+	{
+		printf("ERROR fopen(%s)\n", filename);
+		return -1;
+	}
+	min = malloc(2 * nb_pixels);
+	if(min == NULL)
+	{
+		fclose(fp);
+		return -1;
+	}
+	max = &min[nb_pixels];
+	if(lod_render(fp, waveform_nb, chan - 1, start, nb_samples, nb_pixels, min, max, &level) != 0)
+	{
+		printf("ERROR waveform %u CH%u [%llu, %llu) not found in %s\n", waveform_nb, chan, start, start + nb_samples, filename);
+		free(min);
+		fclose(fp);
+		return -1;
+	}
+	printf("Waveform %u CH%u [%llu, %llu) %d pixels from level %d (%d samples per entry)\n", waveform_nb, chan,
+			start, start + nb_samples, nb_pixels, level, 1 << (4 * (level + 1)));
+	for(x = 0; x < nb_pixels; x++)
+		printf("%d %u %u\n", x, min[x], max[x]);
+	free(min);
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char* out_filename = NULL;
+	char* range = NULL;
+	size_t nb_points = 0;
+	int nb_chan = 4;
+	int ret;
+	int i;
+
+	printf(BANNER1);
+	if(argc < 3)
+	{
+		printf(SYNTAX);
+		exit(0);
+	}
+	for(i = 2; i < argc; i++)
+	{
+		if(strncmp(argv[i], "-n", 2) == 0)
+		{
+			nb_points = strtoul(&argv[i][2], NULL, 10);
+		} else if(strncmp(argv[i], "-c", 2) == 0)
+		{
+			nb_chan = atoi(&argv[i][2]);
+		} else if(strncmp(argv[i], "-o", 2) == 0)
+		{
+			out_filename = &argv[i][2];
+		} else if(strncmp(argv[i], "-r", 2) == 0)
+		{
+			range = &argv[i][2];
+		} else
+		{
+			printf("Error unknown argument %s\n", argv[i]);
+			printf(SYNTAX);
+			exit(-3);
+		}
+	}
+	if(range != NULL)
+		return (lod_print_range(argv[1], range) == 0) ? 0 : -1;
+
+	if( (nb_points < 1) || (nb_chan < 1) || (nb_chan > 4) )
+	{
+		printf("Error invalid nb_points(%zu) or nb_chan(%d)\n", nb_points, nb_chan);
+		exit(-3);
+	}
+	if(out_filename == NULL)
+	{
+		out_filename = malloc(strlen(argv[1]) + 5);
+		if(out_filename == NULL)
+			error("ERROR malloc()");
+		sprintf(out_filename, "%s.lod", argv[1]);
+	}
+	lod_init();
+	ret = lod_build(argv[1], out_filename, nb_points, nb_chan);
+	return (ret == 0) ? 0 : -1;
+}
@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lod_pyramid.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define LOD_X86 1
+	#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+	#define fseeko _fseeki64
+	#define ftello _ftelli64
+#endif
+
+typedef void (*lod_reduce_fn)(const unsigned char* min_in, const unsigned char* max_in, size_t nb_groups,
+							unsigned char* min_out, unsigned char* max_out);
+
+static lod_reduce_fn lod_reduce_kernel = lod_reduce_scalar;
+static const char* lod_reduce_kernel_name = "scalar";
+
+void lod_reduce_scalar(const unsigned char* min_in, const unsigned char* max_in, size_t nb_groups,
+						unsigned char* min_out, unsigned char* max_out)
+{
+	unsigned char vmin, vmax;
+	size_t g;
+	int i;
+
+	for(g = 0; g < nb_groups; g++)
+	{
+		vmin = min_in[0];
+		vmax = max_in[0];
+		for(i = 1; i < LOD_FACTOR; i++)
+		{
+			if(min_in[i] < vmin)
+				vmin = min_in[i];
+			if(max_in[i] > vmax)
+				vmax = max_in[i];
+		}
+		min_out[g] = vmin;
+		max_out[g] = vmax;
+		min_in += LOD_FACTOR;
+		max_in += LOD_FACTOR;
+	}
+}
+
+#ifdef LOD_X86
+__attribute__((target("sse2")))
+static void lod_reduce_sse2(const unsigned char* min_in, const unsigned char* max_in, size_t nb_groups,
+							unsigned char* min_out, unsigned char* max_out)
+{
+	__m128i vmin, vmax;
+	size_t g;
+
+	/* One group of 16 per vector, horizontal min/max by halving shifts */
+	for(g = 0; g < nb_groups; g++)
+	{
+		vmin = _mm_loadu_si128((const __m128i*)&min_in[g * LOD_FACTOR]);
+		vmax = (max_in == min_in) ? vmin : _mm_loadu_si128((const __m128i*)&max_in[g * LOD_FACTOR]);
+		vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 8));
+		vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 8));
+		vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 4));
+		vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 4));
+		vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 2));
+		vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 2));
+		vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 1));
+		vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 1));
+		min_out[g] = (unsigned char)_mm_cvtsi128_si32(vmin);
+		max_out[g] = (unsigned char)_mm_cvtsi128_si32(vmax);
+	}
+}
+
+__attribute__((target("avx2")))
+static void lod_reduce_avx2(const unsigned char* min_in, const unsigned char* max_in, size_t nb_groups,
+							unsigned char* min_out, unsigned char* max_out)
+{
+	__m256i vmin, vmax;
+	size_t g;
+
+	/* Two groups per vector (one per 128-bit lane, the byte shifts stay in their lane) */
+	for(g = 0; (g + 2) <= nb_groups; g += 2)
+	{
+		vmin = _mm256_loadu_si256((const __m256i*)&min_in[g * LOD_FACTOR]);
+		vmax = (max_in == min_in) ? vmin : _mm256_loadu_si256((const __m256i*)&max_in[g * LOD_FACTOR]);
+		vmin = _mm256_min_epu8(vmin, _mm256_srli_si256(vmin, 8));
+		vmax = _mm256_max_epu8(vmax, _mm256_srli_si256(vmax, 8));
+		vmin = _mm256_min_epu8(vmin, _mm256_srli_si256(vmin, 4));
+		vmax = _mm256_max_epu8(vmax, _mm256_srli_si256(vmax, 4));
+		vmin = _mm256_min_epu8(vmin, _mm256_srli_si256(vmin, 2));
+		vmax = _mm256_max_epu8(vmax, _mm256_srli_si256(vmax, 2));
+		vmin = _mm256_min_epu8(vmin, _mm256_srli_si256(vmin, 1));
+		vmax = _mm256_max_epu8(vmax, _mm256_srli_si256(vmax, 1));
+		min_out[g] = (unsigned char)_mm256_extract_epi8(vmin, 0);
+		min_out[g + 1] = (unsigned char)_mm256_extract_epi8(vmin, 16);
+		max_out[g] = (unsigned char)_mm256_extract_epi8(vmax, 0);
+		max_out[g + 1] = (unsigned char)_mm256_extract_epi8(vmax, 16);
+	}
+	lod_reduce_sse2(&min_in[g * LOD_FACTOR], &max_in[g * LOD_FACTOR], nb_groups - g, &min_out[g], &max_out[g]);
+}
+#endif
+
+void lod_init(void)
+{
+#ifdef LOD_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		lod_reduce_kernel = lod_reduce_avx2;
+		lod_reduce_kernel_name = "avx2";
+	} else if(__builtin_cpu_supports("sse2"))
+	{
+		lod_reduce_kernel = lod_reduce_sse2;
+		lod_reduce_kernel_name = "sse2";
+	}
+#endif
+}
+
+const char* lod_kernel_name(void)
+{
+	return lod_reduce_kernel_name;
+}
+
+void lod_reduce(const unsigned char* min_in, const unsigned char* max_in, size_t nb_groups,
+				unsigned char* min_out, unsigned char* max_out)
+{
+	lod_reduce_kernel(min_in, max_in, nb_groups, min_out, max_out);
+}
+
+static int lod_level_reserve(lod_level_t* l, size_t capacity)
+{
+	unsigned char* min;
+	unsigned char* max;
+
+	if(capacity <= l->capacity)
+		return 0;
+	if(capacity < (l->capacity * 2))
+		capacity = l->capacity * 2;
+	min = realloc(l->min, capacity);
+	if(min == NULL)
+		return -1;
+	l->min = min;
+	max = realloc(l->max, capacity);
+	if(max == NULL)
+		return -1;
+	l->max = max;
+	l->capacity = capacity;
+	return 0;
+}
+
+int lod_pyramid_begin(lod_pyramid_t* p, size_t expected_samples)
+{
+	size_t nb = expected_samples;
+	int k;
+
+	for(k = 0; k < LOD_MAX_LEVELS; k++)
+	{
+		nb = (nb + LOD_FACTOR - 1) / LOD_FACTOR;
+		if(lod_level_reserve(&p->level[k], (nb > 0) ? nb : 1) != 0)
+			return -1;
+		p->level[k].len = 0;
+		p->level[k].next = 0;
+	}
+	p->nb_levels = 0;
+	p->nb_samples = 0;
+	p->part_nb = 0;
+	return 0;
+}
+
+/* Reduce the complete groups of level k in level k+1 and so on */
+static int lod_pyramid_propagate(lod_pyramid_t* p, int k)
+{
+	lod_level_t* l;
+	lod_level_t* up;
+	size_t nb_groups;
+
+	for(; k < (LOD_MAX_LEVELS - 1); k++)
+	{
+		l = &p->level[k];
+		up = &p->level[k + 1];
+		nb_groups = (l->len - l->next) / LOD_FACTOR;
+		if(nb_groups == 0)
+			break;
+		if(lod_level_reserve(up, up->len + nb_groups) != 0)
+			return -1;
+		lod_reduce_kernel(&l->min[l->next], &l->max[l->next], nb_groups, &up->min[up->len], &up->max[up->len]);
+		up->len += nb_groups;
+		l->next += nb_groups * LOD_FACTOR;
+	}
+	return 0;
+}
+
+static int lod_level_append(lod_level_t* l, unsigned char vmin, unsigned char vmax)
+{
+	if(lod_level_reserve(l, l->len + 1) != 0)
+		return -1;
+	l->min[l->len] = vmin;
+	l->max[l->len] = vmax;
+	l->len++;
+	return 0;
+}
+
+int lod_pyramid_feed(lod_pyramid_t* p, const unsigned char* samples, size_t nb_samples)
+{
+	lod_level_t* l0 = &p->level[0];
+	size_t nb_groups;
+	size_t i = 0;
+
+	p->nb_samples += nb_samples;
+	/* Complete the group started by the previous chunk */
+	if(p->part_nb > 0)
+	{
+		for(; (i < nb_samples) && (p->part_nb < LOD_FACTOR); i++, p->part_nb++)
+		{
+			if(samples[i] < p->part_min)
+				p->part_min = samples[i];
+			if(samples[i] > p->part_max)
+				p->part_max = samples[i];
+		}
+		if(p->part_nb < LOD_FACTOR)
+			return 0;
+		if(lod_level_append(l0, p->part_min, p->part_max) != 0)
+			return -1;
+		p->part_nb = 0;
+	}
+
+	nb_groups = (nb_samples - i) / LOD_FACTOR;
+	if(nb_groups > 0)
+	{
+		if(lod_level_reserve(l0, l0->len + nb_groups) != 0)
+			return -1;
+		lod_reduce_kernel(&samples[i], &samples[i], nb_groups, &l0->min[l0->len], &l0->max[l0->len]);
+		l0->len += nb_groups;
+		i += nb_groups * LOD_FACTOR;
+	}
+
+	/* Start of the next group */
+	if(i < nb_samples)
+	{
+		p->part_min = samples[i];
+		p->part_max = samples[i];
+		for(p->part_nb = 1, i++; i < nb_samples; i++, p->part_nb++)
+		{
+			if(samples[i] < p->part_min)
+				p->part_min = samples[i];
+			if(samples[i] > p->part_max)
+				p->part_max = samples[i];
+		}
+	}
+	return lod_pyramid_propagate(p, 0);
+}
+
+void lod_pyramid_mark(const lod_pyramid_t* p, lod_mark_t* mark)
+{
+	int k;
+
+	for(k = 0; k < LOD_MAX_LEVELS; k++)
+	{
+		mark->len[k] = p->level[k].len;
+		mark->next[k] = p->level[k].next;
+	}
+	mark->nb_samples = p->nb_samples;
+	mark->part_nb = p->part_nb;
+	mark->part_min = p->part_min;
+	mark->part_max = p->part_max;
+}
+
+void lod_pyramid_rollback(lod_pyramid_t* p, const lod_mark_t* mark)
+{
+	int k;
+
+	/* Levels are only appended, entries after the mark are overwritten later */
+	for(k = 0; k < LOD_MAX_LEVELS; k++)
+	{
+		p->level[k].len = mark->len[k];
+		p->level[k].next = mark->next[k];
+	}
+	p->nb_samples = mark->nb_samples;
+	p->part_nb = mark->part_nb;
+	p->part_min = mark->part_min;
+	p->part_max = mark->part_max;
+}
+
+int lod_pyramid_finish(lod_pyramid_t* p)
+{
+	lod_level_t* l;
+	unsigned char vmin, vmax;
+	size_t i;
+	int k;
+
+	if(p->part_nb > 0)
+	{
+		if(lod_level_append(&p->level[0], p->part_min, p->part_max) != 0)
+			return -1;
+		p->part_nb = 0;
+	}
+	for(k = 0; k < LOD_MAX_LEVELS; k++)
+	{
+		l = &p->level[k];
+		p->nb_levels = k + 1;
+		if( (l->len <= 1) || (k == (LOD_MAX_LEVELS - 1)) )
+			break;
+		if(lod_pyramid_propagate(p, k) != 0)
+			return -1;
+		if(l->next < l->len)
+		{
+			/* Incomplete last group */
+			vmin = l->min[l->next];
+			vmax = l->max[l->next];
+			for(i = l->next + 1; i < l->len; i++)
+			{
+				if(l->min[i] < vmin)
+					vmin = l->min[i];
+				if(l->max[i] > vmax)
+					vmax = l->max[i];
+			}
+			if(lod_level_append(&p->level[k + 1], vmin, vmax) != 0)
+				return -1;
+			l->next = l->len;
+		}
+	}
+	return 0;
+}
+
+void lod_pyramid_free(lod_pyramid_t* p)
+{
+	int k;
+
+	for(k = 0; k < LOD_MAX_LEVELS; k++)
+	{
+		free(p->level[k].min);
+		free(p->level[k].max);
+	}
+	memset(p, 0, sizeof(lod_pyramid_t));
+}
+
+static void put_u32(unsigned char* dst, uint32_t val)
+{
+	int i;
+
+	for(i = 0; i < 4; i++)
+		dst[i] = (unsigned char)(val >> (i * 8));
+}
+
+static void put_u64(unsigned char* dst, uint64_t val)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		dst[i] = (unsigned char)(val >> (i * 8));
+}
+
+int lod_file_header(FILE* fp)
+{
+	unsigned char hdr[LOD_FILE_HDR_SIZE];
+
+	memcpy(hdr, LOD_MAGIC, 4);
+	put_u32(&hdr[4], LOD_FACTOR);
+	return (fwrite(hdr, sizeof(hdr), 1, fp) == 1) ? 0 : -1;
+}
+
+int lod_pyramid_write(const lod_pyramid_t* p, FILE* fp, unsigned int waveform_nb, unsigned int chan)
+{
+	unsigned char hdr[LOD_RECORD_HDR_SIZE + LOD_MAX_LEVELS * 8];
+	const lod_level_t* l;
+	int k;
+
+	put_u32(&hdr[0], waveform_nb);
+	put_u32(&hdr[4], chan);
+	put_u64(&hdr[8], p->nb_samples);
+	put_u32(&hdr[16], p->nb_levels);
+	put_u32(&hdr[20], 0);
+	for(k = 0; k < p->nb_levels; k++)
+		put_u64(&hdr[LOD_RECORD_HDR_SIZE + k * 8], p->level[k].len);
+	if(fwrite(hdr, LOD_RECORD_HDR_SIZE + p->nb_levels * 8, 1, fp) != 1)
+		return -1;
+	for(k = 0; k < p->nb_levels; k++)
+	{
+		l = &p->level[k];
+		if( (fwrite(l->min, 1, l->len, fp) != l->len) || (fwrite(l->max, 1, l->len, fp) != l->len) )
+			return -1;
+	}
+	return 0;
+}
+
+static uint32_t get_u32(const unsigned char* src)
+{
+	return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static uint64_t get_u64(const unsigned char* src)
+{
+	return get_u32(src) | ((uint64_t)get_u32(&src[4]) << 32);
+}
+
+int lod_render(FILE* fp, unsigned int waveform_nb, unsigned int chan, uint64_t start, uint64_t nb_samples,
+				int nb_pixels, unsigned char* min_out, unsigned char* max_out, int* level)
+{
+	unsigned char hdr[LOD_RECORD_HDR_SIZE + LOD_MAX_LEVELS * 8];
+	uint64_t nb_entries[LOD_MAX_LEVELS];
+	unsigned char* min;
+	unsigned char* max;
+	uint64_t span = LOD_FACTOR;
+	uint64_t first, last, a, b, e;
+	long long offset = LOD_FILE_HDR_SIZE;
+	long long data_size;
+	uint32_t nb_levels;
+	int found = 0;
+	int k, x;
+
+	if( (nb_pixels < 1) || (nb_samples < 1) )
+		return -1;
+	/* Find the record, the levels of the other records are skipped */
+	while(!found)
+	{
+		if( (fseeko(fp, offset, SEEK_SET) != 0) || (fread(hdr, LOD_RECORD_HDR_SIZE, 1, fp) != 1) )
+			return -1;
+		nb_levels = get_u32(&hdr[16]);
+		if( (nb_levels < 1) || (nb_levels > LOD_MAX_LEVELS) ||
+			(fread(&hdr[LOD_RECORD_HDR_SIZE], nb_levels * 8, 1, fp) != 1) )
+			return -1;
+		data_size = 0;
+		for(k = 0; k < (int)nb_levels; k++)
+		{
+			nb_entries[k] = get_u64(&hdr[LOD_RECORD_HDR_SIZE + k * 8]);
+			data_size += 2 * nb_entries[k];
+		}
+		found = (get_u32(&hdr[0]) == waveform_nb) && (get_u32(&hdr[4]) == chan);
+		if(!found)
+			offset += LOD_RECORD_HDR_SIZE + nb_levels * 8 + data_size;
+	}
+	if( (start + nb_samples) > get_u64(&hdr[8]) )
+		return -1;
+
+	/* Coarsest level with entries not bigger than a column (level 0 when zoomed below LOD_FACTOR samples per column) */
+	for(k = 0; (k + 1) < (int)nb_levels; k++, span *= LOD_FACTOR)
+	{
+		if( (span * LOD_FACTOR) > (nb_samples / nb_pixels) )
+			break;
+	}
+	*level = k;
+	first = start / span;
+	last = (start + nb_samples + span - 1) / span;
+	min = malloc(2 * (last - first));
+	if(min == NULL)
+		return -1;
+	max = &min[last - first];
+	offset += LOD_RECORD_HDR_SIZE + nb_levels * 8;
+	for(e = 0; e < (uint64_t)k; e++)
+		offset += 2 * nb_entries[e];
+	if( (fseeko(fp, offset + first, SEEK_SET) != 0) || (fread(min, last - first, 1, fp) != 1) ||
+		(fseeko(fp, offset + nb_entries[k] + first, SEEK_SET) != 0) || (fread(max, last - first, 1, fp) != 1) )
+	{
+		free(min);
+		return -1;
+	}
+	for(x = 0; x < nb_pixels; x++)
+	{
+		/* Entries overlapping the samples of the column (at least one) */
+		a = (start + (nb_samples * x) / nb_pixels) / span;
+		b = (start + (nb_samples * (x + 1)) / nb_pixels + span - 1) / span;
+		if(b <= a)
+			b = a + 1;
+		min_out[x] = min[a - first];
+		max_out[x] = max[a - first];
+		for(e = a + 1; e < b; e++)
+		{
+			if(min[e - first] < min_out[x])
+				min_out[x] = min[e - first];
+			if(max[e - first] > max_out[x])
+				max_out[x] = max[e - first];
+		}
+	}
+	free(min);
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __LOD_PYRAMID_H__
+#define __LOD_PYRAMID_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Min/max envelope pyramid (level of detail index) of 8-bit samples
+ * Level 0 has the min and max of each group of LOD_FACTOR samples, level k+1
+ * the min and max of each group of LOD_FACTOR entries of level k, up to a
+ * level with a single entry. A viewer draws nb_pixels columns of any zoom with
+ * the finest level having at most about nb_pixels entries in the range.
+ * Samples are fed by chunks as they are received (the reduction kernel is
+ * AVX2/SSE2 on x86, selected at runtime).
+ *
+ * Sidecar file: "LOD1" + factor (uint32) then one record per channel:
+ * waveform_nb (uint32), chan (uint32, 0 based), nb_samples (uint64),
+ * nb_levels (uint32), reserved (uint32), nb_levels x nb_entries (uint64),
+ * then for each level the nb_entries min followed by the nb_entries max (little endian)
+ */
+
+#define LOD_MAGIC "LOD1"
+#define LOD_FACTOR (16)
+#define LOD_MAX_LEVELS (8) /* 16^8 samples */
+#define LOD_FILE_HDR_SIZE (8)
+#define LOD_RECORD_HDR_SIZE (24)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	unsigned char* min;
+	unsigned char* max;
+	size_t len;
+	size_t capacity;
+	size_t next; /* Entries already reduced in the next level */
+} lod_level_t;
+
+typedef struct
+{
+	lod_level_t level[LOD_MAX_LEVELS];
+	int nb_levels; /* Set by lod_pyramid_finish() */
+	unsigned long long nb_samples;
+	/* Samples of the incomplete group of level 0 */
+	int part_nb;
+	unsigned char part_min;
+	unsigned char part_max;
+} lod_pyramid_t;
+
+/* Position in the stream to remove the samples fed after it (request failed and sent again) */
+typedef struct
+{
+	size_t len[LOD_MAX_LEVELS];
+	size_t next[LOD_MAX_LEVELS];
+	unsigned long long nb_samples;
+	int part_nb;
+	unsigned char part_min;
+	unsigned char part_max;
+} lod_mark_t;
+
+/* Select the fastest reduction kernel supported by the CPU */
+void lod_init(void);
+/* Name of the kernel selected ("avx2", "sse2" or "scalar") */
+const char* lod_kernel_name(void);
+
+/* Start a new channel, expected_samples preallocates the levels (0 if not known) */
+int lod_pyramid_begin(lod_pyramid_t* p, size_t expected_samples);
+/* Add nb_samples, return 0 if OK or -1 (out of memory) */
+int lod_pyramid_feed(lod_pyramid_t* p, const unsigned char* samples, size_t nb_samples);
+void lod_pyramid_mark(const lod_pyramid_t* p, lod_mark_t* mark);
+void lod_pyramid_rollback(lod_pyramid_t* p, const lod_mark_t* mark);
+/* Reduce the incomplete groups and the last levels, return 0 if OK or -1 */
+int lod_pyramid_finish(lod_pyramid_t* p);
+void lod_pyramid_free(lod_pyramid_t* p);
+
+/* Sidecar file */
+int lod_file_header(FILE* fp);
+/* Append the record of a finished pyramid, return 0 if OK or -1 */
+int lod_pyramid_write(const lod_pyramid_t* p, FILE* fp, unsigned int waveform_nb, unsigned int chan);
+/*
+ * Viewer side: min/max of nb_pixels columns of samples [start, start + nb_samples) of a record
+ * read from the coarsest level with at most one entry per column (O(nb_pixels) entries read),
+ * *level is the level used, return 0 if OK or -1 (record not found, invalid range)
+ */
+int lod_render(FILE* fp, unsigned int waveform_nb, unsigned int chan, uint64_t start, uint64_t nb_samples,
+				int nb_pixels, unsigned char* min_out, unsigned char* max_out, int* level);
+
+/* Reduction of nb_groups groups of LOD_FACTOR entries (min_in == max_in for samples) */
+void lod_reduce(const unsigned char* min_in, const unsigned char* max_in, size_t nb_groups,
+				unsigned char* min_out, unsigned char* max_out);
+void lod_reduce_scalar(const unsigned char* min_in, const unsigned char* max_in, size_t nb_groups,
+				unsigned char* min_out, unsigned char* max_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __LOD_PYRAMID_H__ */
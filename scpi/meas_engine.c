@@ -0,0 +1,527 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "socket_portable.h"
+#include "meas_engine.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define MEAS_X86 1
+	#include <immintrin.h>
+#endif
+
+/* Levels closer than this (in codes) are noise, no edge measurement */
+#define MEAS_MIN_RANGE (4)
+/* madd_epi16 of u8 squares adds up to 4 x 255^2 per 32-bit lane per iteration */
+#define MEAS_SQ_FLUSH (4096)
+
+typedef struct
+{
+	unsigned char min;
+	unsigned char max;
+	uint64_t sum;
+	uint64_t sumsq;
+} meas_amp_t;
+
+/* Amplitude pass, a is updated with nb_samples */
+typedef void (*meas_amp_fn)(const unsigned char* s, size_t nb_samples, meas_amp_t* a);
+/* Index of the first sample >= level (above) or <= level (below) in [i, nb_samples), nb_samples if none */
+typedef size_t (*meas_scan_fn)(const unsigned char* s, size_t i, size_t nb_samples, unsigned char level, int above);
+
+static void meas_amp_scalar(const unsigned char* s, size_t nb_samples, meas_amp_t* a)
+{
+	size_t i;
+
+	for(i = 0; i < nb_samples; i++)
+	{
+		a->min = (s[i] < a->min) ? s[i] : a->min;
+		a->max = (s[i] > a->max) ? s[i] : a->max;
+		a->sum += s[i];
+		a->sumsq += (uint32_t)s[i] * s[i];
+	}
+}
+
+static size_t meas_scan_scalar(const unsigned char* s, size_t i, size_t nb_samples, unsigned char level, int above)
+{
+	if(above)
+	{
+		for(; i < nb_samples; i++)
+		{
+			if(s[i] >= level)
+				return i;
+		}
+	} else
+	{
+		for(; i < nb_samples; i++)
+		{
+			if(s[i] <= level)
+				return i;
+		}
+	}
+	return nb_samples;
+}
+
+static meas_amp_fn meas_amp_kernel = meas_amp_scalar;
+static meas_scan_fn meas_scan_kernel = meas_scan_scalar;
+static const char* meas_kernel_name_str = "scalar";
+
+#ifdef MEAS_X86
+static void meas_amp_reduce_sse2(__m128i vmin, __m128i vmax, __m128i sum64, __m128i sq64, meas_amp_t* a)
+{
+	unsigned char bmin[16];
+	unsigned char bmax[16];
+	uint64_t q[2];
+	int k;
+
+	_mm_storeu_si128((__m128i*)bmin, vmin);
+	_mm_storeu_si128((__m128i*)bmax, vmax);
+	for(k = 0; k < 16; k++)
+	{
+		a->min = (bmin[k] < a->min) ? bmin[k] : a->min;
+		a->max = (bmax[k] > a->max) ? bmax[k] : a->max;
+	}
+	_mm_storeu_si128((__m128i*)q, sum64);
+	a->sum += q[0] + q[1];
+	_mm_storeu_si128((__m128i*)q, sq64);
+	a->sumsq += q[0] + q[1];
+}
+
+__attribute__((target("sse2")))
+static void meas_amp_sse2(const unsigned char* s, size_t nb_samples, meas_amp_t* a)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i vmin = _mm_set1_epi8((char)0xFF);
+	__m128i vmax = zero;
+	__m128i sum64 = zero;
+	__m128i sq32 = zero;
+	__m128i sq64 = zero;
+	__m128i b, lo, hi;
+	size_t i;
+	int k = 0;
+
+	for(i = 0; (i + 16) <= nb_samples; i += 16)
+	{
+		b = _mm_loadu_si128((const __m128i*)&s[i]);
+		vmin = _mm_min_epu8(vmin, b);
+		vmax = _mm_max_epu8(vmax, b);
+		sum64 = _mm_add_epi64(sum64, _mm_sad_epu8(b, zero));
+		lo = _mm_unpacklo_epi8(b, zero);
+		hi = _mm_unpackhi_epi8(b, zero);
+		sq32 = _mm_add_epi32(sq32, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+		if(++k == MEAS_SQ_FLUSH)
+		{
+			sq64 = _mm_add_epi64(sq64, _mm_add_epi64(_mm_unpacklo_epi32(sq32, zero), _mm_unpackhi_epi32(sq32, zero)));
+			sq32 = zero;
+			k = 0;
+		}
+	}
+	sq64 = _mm_add_epi64(sq64, _mm_add_epi64(_mm_unpacklo_epi32(sq32, zero), _mm_unpackhi_epi32(sq32, zero)));
+	meas_amp_reduce_sse2(vmin, vmax, sum64, sq64, a);
+	meas_amp_scalar(&s[i], nb_samples - i, a);
+}
+
+__attribute__((target("avx2")))
+static void meas_amp_avx2(const unsigned char* s, size_t nb_samples, meas_amp_t* a)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i vmin = _mm256_set1_epi8((char)0xFF);
+	__m256i vmax = zero;
+	__m256i sum64 = zero;
+	__m256i sq32 = zero;
+	__m256i sq64 = zero;
+	__m256i b, lo, hi;
+	size_t i;
+	int k = 0;
+
+	for(i = 0; (i + 32) <= nb_samples; i += 32)
+	{
+		b = _mm256_loadu_si256((const __m256i*)&s[i]);
+		vmin = _mm256_min_epu8(vmin, b);
+		vmax = _mm256_max_epu8(vmax, b);
+		sum64 = _mm256_add_epi64(sum64, _mm256_sad_epu8(b, zero));
+		lo = _mm256_unpacklo_epi8(b, zero);
+		hi = _mm256_unpackhi_epi8(b, zero);
+		sq32 = _mm256_add_epi32(sq32, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+		if(++k == MEAS_SQ_FLUSH)
+		{
+			sq64 = _mm256_add_epi64(sq64, _mm256_add_epi64(_mm256_unpacklo_epi32(sq32, zero), _mm256_unpackhi_epi32(sq32, zero)));
+			sq32 = zero;
+			k = 0;
+		}
+	}
+	sq64 = _mm256_add_epi64(sq64, _mm256_add_epi64(_mm256_unpacklo_epi32(sq32, zero), _mm256_unpackhi_epi32(sq32, zero)));
+	meas_amp_reduce_sse2(_mm_min_epu8(_mm256_castsi256_si128(vmin), _mm256_extracti128_si256(vmin, 1)),
+						_mm_max_epu8(_mm256_castsi256_si128(vmax), _mm256_extracti128_si256(vmax, 1)),
+						_mm_add_epi64(_mm256_castsi256_si128(sum64), _mm256_extracti128_si256(sum64, 1)),
+						_mm_add_epi64(_mm256_castsi256_si128(sq64), _mm256_extracti128_si256(sq64, 1)), a);
+	meas_amp_scalar(&s[i], nb_samples - i, a);
+}
+
+__attribute__((target("sse2")))
+static size_t meas_scan_sse2(const unsigned char* s, size_t i, size_t nb_samples, unsigned char level, int above)
+{
+	const __m128i lvl = _mm_set1_epi8((char)level);
+	__m128i b;
+	int mask;
+
+	for(; (i + 16) <= nb_samples; i += 16)
+	{
+		b = _mm_loadu_si128((const __m128i*)&s[i]);
+		/* Unsigned compare: b >= level <=> max(b, level) == b */
+		if(above)
+			mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(b, lvl), b));
+		else
+			mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(b, lvl), b));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return meas_scan_scalar(s, i, nb_samples, level, above);
+}
+
+__attribute__((target("avx2")))
+static size_t meas_scan_avx2(const unsigned char* s, size_t i, size_t nb_samples, unsigned char level, int above)
+{
+	const __m256i lvl = _mm256_set1_epi8((char)level);
+	__m256i b;
+	unsigned int mask;
+
+	for(; (i + 32) <= nb_samples; i += 32)
+	{
+		b = _mm256_loadu_si256((const __m256i*)&s[i]);
+		if(above)
+			mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(b, lvl), b));
+		else
+			mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(b, lvl), b));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return meas_scan_sse2(s, i, nb_samples, level, above);
+}
+#endif
+
+void meas_init(void)
+{
+#ifdef MEAS_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		meas_amp_kernel = meas_amp_avx2;
+		meas_scan_kernel = meas_scan_avx2;
+		meas_kernel_name_str = "avx2";
+	} else if(__builtin_cpu_supports("sse2"))
+	{
+		meas_amp_kernel = meas_amp_sse2;
+		meas_scan_kernel = meas_scan_sse2;
+		meas_kernel_name_str = "sse2";
+	}
+#endif
+}
+
+const char* meas_kernel_name(void)
+{
+	return meas_kernel_name_str;
+}
+
+void meas_compute(const unsigned char* samples, size_t nb_samples, double ydelta, double yinc, double sec_per_sample,
+				meas_result_t* r)
+{
+	meas_amp_t a = { 0xFF, 0, 0, 0 };
+	unsigned char lo, hi;
+	double mean_code;
+	double sq;
+	double first_rising = 0;
+	double last_rising = 0;
+	double rise_sum = 0;
+	double fall_sum = 0;
+	size_t i, j, k;
+	size_t i_lo, i_hi;
+	int high;
+
+	memset(r, 0, sizeof(meas_result_t));
+	r->nb_samples = nb_samples;
+	if(nb_samples == 0)
+		return;
+
+	meas_amp_kernel(samples, nb_samples, &a);
+	mean_code = (double)a.sum / nb_samples;
+	r->vmin = (a.min - ydelta) * yinc;
+	r->vmax = (a.max - ydelta) * yinc;
+	r->vpp = (a.max - a.min) * yinc;
+	r->mean = (mean_code - ydelta) * yinc;
+	/* sum((s - ydelta)^2) / n from the sums of the codes */
+	sq = (double)a.sumsq / nb_samples - 2.0 * ydelta * mean_code + ydelta * ydelta;
+	r->rms = (sq > 0) ? sqrt(sq) * fabs(yinc) : 0;
+
+	if((a.max - a.min) < MEAS_MIN_RANGE)
+		return;
+	/* 10% and 90% levels between min and max, the hysteresis between them rejects the noise */
+	lo = (unsigned char)floor(a.min + 0.1 * (a.max - a.min));
+	hi = (unsigned char)ceil(a.min + 0.9 * (a.max - a.min));
+
+	/* Start in the state of the first sample out of the [lo, hi] band */
+	i_lo = meas_scan_kernel(samples, 0, nb_samples, lo, 0);
+	i_hi = meas_scan_kernel(samples, 0, nb_samples, hi, 1);
+	high = (i_hi < i_lo);
+	i = high ? i_hi : i_lo;
+	while(i < nb_samples)
+	{
+		/* Next crossing of the opposite level, then back to the last sample at the level it left */
+		j = meas_scan_kernel(samples, i, nb_samples, high ? lo : hi, !high);
+		if(j == nb_samples)
+			break;
+		k = j - 1;
+		if(high)
+		{
+			while(samples[k] < hi)
+				k--;
+			fall_sum += j - k;
+			r->nb_falling++;
+		} else
+		{
+			while(samples[k] > lo)
+				k--;
+			rise_sum += j - k;
+			/* Edge time in the middle of the 10-90% transition */
+			last_rising = (j + k) / 2.0;
+			if(r->nb_rising == 0)
+				first_rising = last_rising;
+			r->nb_rising++;
+		}
+		high = !high;
+		i = j;
+	}
+	if(r->nb_rising > 0)
+		r->rise_s = rise_sum / r->nb_rising * sec_per_sample;
+	if(r->nb_falling > 0)
+		r->fall_s = fall_sum / r->nb_falling * sec_per_sample;
+	if(r->nb_rising > 1)
+	{
+		r->period_s = (last_rising - first_rising) / (r->nb_rising - 1) * sec_per_sample;
+		if(r->period_s > 0)
+			r->freq_hz = 1.0 / r->period_s;
+	}
+}
+
+/* Write the row of the waveform once all channels are measured (lock held) */
+static void meas_engine_emit(meas_engine_t* m)
+{
+	meas_chan_t* c;
+	int k;
+
+	for(k = 0; k < m->nb_chan; k++)
+	{
+		if(m->ch[m->chan_list[k]].state != MEAS_CHAN_DONE)
+			return;
+	}
+	c = &m->ch[m->chan_list[0]];
+	if(m->own_fp)
+		fprintf(m->fp, "%u", c->waveform_nb);
+	else
+		fprintf(m->fp, "Meas waveform %u:", c->waveform_nb);
+	for(k = 0; k < m->nb_chan; k++)
+	{
+		c = &m->ch[m->chan_list[k]];
+		if(m->own_fp)
+		{
+			fprintf(m->fp, ",%zu,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e",
+					c->result.nb_samples, c->result.vpp, c->result.vmin, c->result.vmax, c->result.mean, c->result.rms,
+					c->result.freq_hz, c->result.period_s, c->result.rise_s, c->result.fall_s);
+		} else
+		{
+			fprintf(m->fp, " CH%d Vpp=%.4f V mean=%.4f V RMS=%.4f V freq=%.6e Hz rise=%.3e s fall=%.3e s",
+					c->chan+1, c->result.vpp, c->result.mean, c->result.rms, c->result.freq_hz, c->result.rise_s, c->result.fall_s);
+		}
+		c->state = MEAS_CHAN_IDLE;
+	}
+	fprintf(m->fp, "\n");
+	m->nb_rows++;
+	pthread_cond_broadcast(&m->idle);
+}
+
+static void* meas_engine_thread(void* arg)
+{
+	meas_chan_t* c = (meas_chan_t*)arg;
+	meas_engine_t* m = c->engine;
+	struct timeval start_tv;
+	struct timeval end_tv;
+	meas_result_t result;
+
+	pthread_mutex_lock(&m->lock);
+	while(1)
+	{
+		while( (m->stop == 0) && (c->state != MEAS_CHAN_QUEUED) )
+			pthread_cond_wait(&m->work, &m->lock);
+		/* A queued channel is measured before stopping */
+		if(c->state != MEAS_CHAN_QUEUED)
+			break;
+		pthread_mutex_unlock(&m->lock);
+
+		gettimeofday(&start_tv, NULL);
+		meas_compute(c->data, c->nb_samples, c->ydelta, c->yinc, c->sec_per_sample, &result);
+		gettimeofday(&end_tv, NULL);
+
+		pthread_mutex_lock(&m->lock);
+		c->result = result;
+		c->state = MEAS_CHAN_DONE;
+		m->nb_samples += c->nb_samples;
+		m->compute_time_s += TimevalDiff(&end_tv, &start_tv);
+		meas_engine_emit(m);
+	}
+	pthread_mutex_unlock(&m->lock);
+
+	return NULL;
+}
+
+int meas_engine_init(meas_engine_t* m, const char* filename, const int* chan_list, int nb_chan, size_t max_points,
+					unsigned char* const* slabs)
+{
+	meas_chan_t* c;
+	int k;
+
+	memset(m, 0, sizeof(meas_engine_t));
+	if( (nb_chan < 1) || (nb_chan > MEAS_MAX_CHAN) )
+		return -1;
+	m->fp = stdout;
+	if(filename != NULL)
+	{
+		m->fp = fopen(filename, "w");
+		if(m->fp == NULL)
+			return -1;
+		m->own_fp = 1;
+		fprintf(m->fp, "waveform");
+		for(k = 0; k < nb_chan; k++)
+		{
+			fprintf(m->fp, ",CH%d_nb_samples,CH%d_vpp,CH%d_vmin,CH%d_vmax,CH%d_mean,CH%d_rms,CH%d_freq_hz,CH%d_period_s,CH%d_rise_s,CH%d_fall_s",
+					chan_list[k]+1, chan_list[k]+1, chan_list[k]+1, chan_list[k]+1, chan_list[k]+1,
+					chan_list[k]+1, chan_list[k]+1, chan_list[k]+1, chan_list[k]+1, chan_list[k]+1);
+		}
+		fprintf(m->fp, "\n");
+	}
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->work, NULL);
+	pthread_cond_init(&m->idle, NULL);
+	m->nb_chan = nb_chan;
+	for(k = 0; k < nb_chan; k++)
+	{
+		m->chan_list[k] = chan_list[k];
+		c = &m->ch[chan_list[k]];
+		c->engine = m;
+		c->chan = chan_list[k];
+		c->capacity = max_points;
+		if( (slabs != NULL) && (slabs[chan_list[k]] != NULL) )
+		{
+			c->data = slabs[chan_list[k]];
+		} else
+		{
+			c->data = malloc((max_points > 0) ? max_points : 1);
+			c->own_data = 1;
+		}
+		if(c->data == NULL)
+		{
+			printf("ERROR meas_engine_init() malloc(%zu)\n", max_points);
+			meas_engine_close(m);
+			return -1;
+		}
+		if(pthread_create(&c->thread, NULL, meas_engine_thread, c) != 0)
+		{
+			meas_engine_close(m);
+			return -1;
+		}
+		c->thread_started = 1;
+	}
+	return 0;
+}
+
+void meas_engine_begin(meas_engine_t* m, int chan)
+{
+	meas_chan_t* c = &m->ch[chan];
+
+	pthread_mutex_lock(&m->lock);
+	while(c->state != MEAS_CHAN_IDLE)
+		pthread_cond_wait(&m->idle, &m->lock);
+	pthread_mutex_unlock(&m->lock);
+	c->nb_samples = 0;
+}
+
+int meas_engine_feed(meas_engine_t* m, int chan, size_t offset, const unsigned char* samples, size_t nb_samples)
+{
+	meas_chan_t* c = &m->ch[chan];
+
+	if( (offset + nb_samples) > c->capacity )
+		return -1;
+	if(&c->data[offset] != samples)
+		memcpy(&c->data[offset], samples, nb_samples);
+	if( (offset + nb_samples) > c->nb_samples )
+		c->nb_samples = offset + nb_samples;
+	return 0;
+}
+
+void meas_engine_submit(meas_engine_t* m, int chan, unsigned int waveform_nb, double ydelta, double yinc, double sec_per_sample)
+{
+	meas_chan_t* c = &m->ch[chan];
+
+	pthread_mutex_lock(&m->lock);
+	c->waveform_nb = waveform_nb;
+	c->ydelta = ydelta;
+	c->yinc = yinc;
+	c->sec_per_sample = sec_per_sample;
+	c->state = MEAS_CHAN_QUEUED;
+	pthread_cond_broadcast(&m->work);
+	pthread_mutex_unlock(&m->lock);
+}
+
+void meas_engine_close(meas_engine_t* m)
+{
+	meas_chan_t* c;
+	int k;
+
+	if(m->nb_chan == 0)
+		return;
+	pthread_mutex_lock(&m->lock);
+	m->stop = 1;
+	pthread_cond_broadcast(&m->work);
+	pthread_mutex_unlock(&m->lock);
+	for(k = 0; k < m->nb_chan; k++)
+	{
+		c = &m->ch[m->chan_list[k]];
+		if(c->thread_started)
+			pthread_join(c->thread, NULL);
+		c->thread_started = 0;
+		if(c->own_data)
+			free(c->data);
+		c->data = NULL;
+		c->own_data = 0;
+	}
+	if(m->own_fp)
+		fclose(m->fp);
+	m->fp = NULL;
+	m->own_fp = 0;
+	m->nb_chan = 0;
+	pthread_cond_destroy(&m->idle);
+	pthread_cond_destroy(&m->work);
+	pthread_mutex_destroy(&m->lock);
+}
+
+void meas_engine_print(const meas_engine_t* m)
+{
+	printf("meas %s: %u rows, %llu samples measured in %05.04f s of worker time (%05.03f MSamples/s)\n",
+			meas_kernel_name(), m->nb_rows, m->nb_samples, m->compute_time_s,
+			(m->compute_time_s > 0) ? (m->nb_samples / 1e6) / m->compute_time_s : 0.0);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __MEAS_ENGINE_H__
+#define __MEAS_ENGINE_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * On-host measurements of 8-bit channels (Vpp, min, max, mean, RMS,
+ * frequency/period, 10-90% rise and fall time) with the :WAV:PRE? scaling
+ * volts = (sample - (yorigin + yreference)) * yincrement
+ * The samples of each channel are copied in a channel slab as they are
+ * received, the measurements are done by one worker thread per channel once
+ * the channel is complete, so the network thread keeps receiving.
+ * Each worker does an amplitude pass (min/max/sum/sum of squares) then an
+ * edge pass (compare masks of 32 samples against the 10/90% levels, blocks
+ * without a level change are skipped), both AVX2/SSE2 on x86 selected at runtime.
+ * One row per waveform (all channels) is written when its last channel is measured.
+ */
+
+#define MEAS_MAX_CHAN (4)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	size_t nb_samples;
+	double vmin;
+	double vmax;
+	double vpp;
+	double mean;
+	double rms;
+	double period_s; /* 0 if less than 2 rising edges */
+	double freq_hz;
+	double rise_s; /* Average 10% to 90% time of the rising edges, 0 if none */
+	double fall_s;
+	unsigned int nb_rising;
+	unsigned int nb_falling;
+} meas_result_t;
+
+typedef enum
+{
+	MEAS_CHAN_IDLE = 0, /* Slab can be filled */
+	MEAS_CHAN_QUEUED, /* Channel complete, measured by the worker */
+	MEAS_CHAN_DONE /* Result kept until the row of the waveform is written */
+} meas_chan_state_t;
+
+struct meas_engine_s;
+
+typedef struct
+{
+	struct meas_engine_s* engine;
+	int chan; /* 0 based */
+	pthread_t thread;
+	int thread_started;
+	unsigned char* data;
+	int own_data; /* Slab allocated by meas_engine_init() */
+	size_t capacity;
+	size_t nb_samples;
+	unsigned int waveform_nb;
+	double ydelta; /* yorigin + yreference */
+	double yinc;
+	double sec_per_sample;
+	meas_chan_state_t state;
+	meas_result_t result;
+} meas_chan_t;
+
+typedef struct meas_engine_s
+{
+	FILE* fp; /* Rows (CSV), stdout if no file */
+	int own_fp;
+	int nb_chan;
+	int chan_list[MEAS_MAX_CHAN];
+	meas_chan_t ch[MEAS_MAX_CHAN];
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* A channel is queued or stop */
+	pthread_cond_t idle; /* A row is written (slabs can be filled again) */
+	int stop;
+
+	/* Statistics */
+	unsigned int nb_rows;
+	unsigned long long nb_samples;
+	double compute_time_s; /* Sum of the measurement time of all workers */
+} meas_engine_t;
+
+/* Select the fastest kernels supported by the CPU */
+void meas_init(void);
+/* Name of the kernel selected ("avx2", "sse2" or "scalar") */
+const char* meas_kernel_name(void);
+
+/*
+ * Allocate a slab of max_points for each of the nb_chan channels of chan_list and start the workers,
+ * rows are written to filename (CSV with a header line) or printed if filename is NULL, return 0 if OK or -1
+ * slabs (indexed by channel, can be NULL) gives the slabs of max_points the channels are already received in
+ */
+int meas_engine_init(meas_engine_t* m, const char* filename, const int* chan_list, int nb_chan, size_t max_points,
+					unsigned char* const* slabs);
+/* Wait until the slab of the channel can be filled (result of the previous waveform written) */
+void meas_engine_begin(meas_engine_t* m, int chan);
+/* Copy nb_samples received at offset (0 based point) of the channel (unless already in its slab), return 0 if OK or -1 (out of slab) */
+int meas_engine_feed(meas_engine_t* m, int chan, size_t offset, const unsigned char* samples, size_t nb_samples);
+/* Channel complete (samples fed up to the highest offset), measured by its worker */
+void meas_engine_submit(meas_engine_t* m, int chan, unsigned int waveform_nb, double ydelta, double yinc, double sec_per_sample);
+/* Wait for the last rows, stop the workers and free the slabs */
+void meas_engine_close(meas_engine_t* m);
+void meas_engine_print(const meas_engine_t* m);
+
+/* Measurements of nb_samples (single threaded, used by the workers) */
+void meas_compute(const unsigned char* samples, size_t nb_samples, double ydelta, double yinc, double sec_per_sample,
+				meas_result_t* r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __MEAS_ENGINE_H__ */
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmap_file.h"
+
+#ifdef _WIN32
+
+int mmap_file_open(mmap_file_t* mf, const char* filename)
+{
+	memset(mf, 0, sizeof(mmap_file_t));
+	mf->fd = -1;
+	printf("ERROR mmap_file_open(%s) memory-mapped output file not supported on Windows\n", filename);
+	return -1;
+}
+
+unsigned char* mmap_file_reserve(mmap_file_t* mf, size_t nb_bytes)
+{
+	return NULL;
+}
+
+void mmap_file_commit(mmap_file_t* mf, size_t nb_bytes)
+{
+}
+
+void mmap_file_close(mmap_file_t* mf)
+{
+}
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+static void mmap_file_unmap(mmap_file_t* mf)
+{
+	if(mf->map != NULL)
+	{
+		munmap(mf->map, mf->map_len);
+		mf->map = NULL;
+		mf->map_len = 0;
+	}
+}
+
+int mmap_file_open(mmap_file_t* mf, const char* filename)
+{
+	memset(mf, 0, sizeof(mmap_file_t));
+	mf->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(mf->fd < 0)
+	{
+		printf("ERROR mmap_file_open(%s) open() (errno=%d)\n", filename, errno);
+		return -1;
+	}
+	return 0;
+}
+
+unsigned char* mmap_file_reserve(mmap_file_t* mf, size_t nb_bytes)
+{
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t end = mf->file_size + nb_bytes;
+	size_t alloc_size;
+	size_t offset;
+	size_t len;
+	void* map;
+	int err;
+
+	if( (mf->fd < 0) || (nb_bytes == 0) )
+		return NULL;
+
+	/* Most blocks fit in the current mapping, no system call */
+	if( (mf->map != NULL) && (mf->file_size >= mf->map_offset) && (end <= (mf->map_offset + mf->map_len)) )
+		return &mf->map[mf->file_size - mf->map_offset];
+
+	mmap_file_unmap(mf);
+	if(end > mf->alloc_size)
+	{
+		/* Next chunk, the blocks are allocated now so a full disk is reported here */
+		alloc_size = (end > (mf->alloc_size + MMAP_FILE_CHUNK_SIZE)) ? end : (mf->alloc_size + MMAP_FILE_CHUNK_SIZE);
+		alloc_size = (alloc_size + page_size - 1) - ((alloc_size + page_size - 1) % page_size);
+		err = posix_fallocate(mf->fd, (off_t)mf->alloc_size, (off_t)(alloc_size - mf->alloc_size));
+		if( (err == ENOSPC) && (alloc_size > end) )
+		{
+			/* Not enough room for a whole chunk, only the block */
+			alloc_size = end;
+			err = posix_fallocate(mf->fd, (off_t)mf->alloc_size, (off_t)(alloc_size - mf->alloc_size));
+		}
+		if(err != 0)
+		{
+			printf("ERROR mmap_file_reserve() posix_fallocate(%zu) (errno=%d)\n", alloc_size, err);
+			return NULL;
+		}
+		mf->alloc_size = alloc_size;
+	}
+
+	/* From the page containing file_size to the end of the allocated chunk */
+	offset = mf->file_size - (mf->file_size % page_size);
+	len = mf->alloc_size - offset;
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, mf->fd, (off_t)offset);
+	if(map == MAP_FAILED)
+	{
+		printf("ERROR mmap_file_reserve() mmap(%zu) (errno=%d)\n", len, errno);
+		return NULL;
+	}
+	madvise(map, len, MADV_SEQUENTIAL);
+
+	mf->map = (unsigned char*)map;
+	mf->map_offset = offset;
+	mf->map_len = len;
+	return &mf->map[mf->file_size - offset];
+}
+
+void mmap_file_commit(mmap_file_t* mf, size_t nb_bytes)
+{
+	mf->file_size += nb_bytes;
+}
+
+void mmap_file_close(mmap_file_t* mf)
+{
+	if(mf->fd < 0)
+		return;
+
+	mmap_file_unmap(mf);
+	if(ftruncate(mf->fd, (off_t)mf->file_size) != 0)
+	{
+		printf("ERROR mmap_file_close() ftruncate(%zu) (errno=%d)\n", mf->file_size, errno);
+	}
+	close(mf->fd);
+	mf->fd = -1;
+}
+
+#endif
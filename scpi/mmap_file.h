@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __MMAP_FILE_H__
+#define __MMAP_FILE_H__
+
+#include <stddef.h>
+
+/*
+ * Output file written through a memory mapping which grows with each block
+ * received, data received from the socket goes directly in the mapping.
+ * The file is allocated (posix_fallocate()) by chunks of at least
+ * MMAP_FILE_CHUNK_SIZE bytes so a full disk is an error of mmap_file_reserve()
+ * instead of a SIGBUS on a write in the mapping, and the mapping (up to the end
+ * of the allocated chunk) is only replaced when a block does not fit in it.
+ * The file is truncated to the committed data on close.
+ * Not supported on Windows (mmap_file_open() return -1).
+ */
+
+#define MMAP_FILE_CHUNK_SIZE (64 * 1024 * 1024)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	int fd;
+	size_t file_size; /* Committed bytes */
+	size_t alloc_size; /* Bytes allocated in the file (>= file_size) */
+	unsigned char* map; /* Current mapping (page aligned) */
+	size_t map_offset; /* File offset of map */
+	size_t map_len;
+} mmap_file_t;
+
+/* Static initializer (no file open) */
+#define MMAP_FILE_INIT { -1, 0, 0, NULL, 0, 0 }
+
+/* Create/truncate the file, return 0 if OK or -1 in case of error */
+int mmap_file_open(mmap_file_t* mf, const char* filename);
+/* Allocate (if needed) nb_bytes after committed data and map them, return a pointer on it or NULL in case of error */
+unsigned char* mmap_file_reserve(mmap_file_t* mf, size_t nb_bytes);
+/* Commit nb_bytes of the last reserve, not committed data is overwritten by the next reserve */
+void mmap_file_commit(mmap_file_t* mf, size_t nb_bytes);
+/* Unmap and truncate the file to committed data */
+void mmap_file_close(mmap_file_t* mf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __MMAP_FILE_H__ */
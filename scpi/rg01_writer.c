@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rg01_writer.h"
+
+#ifdef _WIN32
+	#define fseeko _fseeki64
+	#define ftello _ftelli64
+#endif
+
+void rg01_writer_init(rg01_writer_t* w, const char* idn)
+{
+	char model[10];
+	char serial[14];
+	time_t t;
+	struct tm* tm;
+
+	memset(w, 0, sizeof(rg01_writer_t));
+	/* *IDN? => RIGOL TECHNOLOGIES,<model>,<serial>,<firmware> */
+	if(sscanf(idn, "%*[^,],%9[^,],%13[^,]", model, serial) == 2)
+		snprintf(w->model_sn, sizeof(w->model_sn), "%s:%s", model, serial);
+
+	t = time(NULL);
+	tm = localtime(&t);
+	if(tm != NULL)
+	{
+		strftime(w->date, sizeof(w->date), "%Y-%m-%d", tm);
+		strftime(w->time, sizeof(w->time), "%H:%M:%S", tm);
+	}
+}
+
+void rg01_writer_file_header(rigol_mso5k_bin* hdr)
+{
+	memset(hdr, 0, sizeof(rigol_mso5k_bin));
+	memcpy(hdr->cookie, "RG", 2);
+	memcpy(hdr->file_version, "01", 2);
+	hdr->file_size = RIGOL_BIN_FILE_HEADER_SIZE;
+	hdr->nb_waveforms = 0;
+}
+
+void rg01_writer_waveform_header(const rg01_writer_t* w, rigol_mso5k_bin_waveforms* hdr, int chan,
+								 uint32_t nb_points, double x_increment, double x_origin,
+								 uint32_t segment_index, double time_tag)
+{
+	char label[16];
+
+	memset(hdr, 0, sizeof(rigol_mso5k_bin_waveforms));
+	hdr->waveform_header_size = RIGOL_BIN_WAVEFORM_HEADER_SIZE;
+	hdr->waveform_type = Normal;
+	hdr->nb_waveform_buffers = 1;
+	hdr->nb_points = nb_points;
+	hdr->count = 0;
+	hdr->x_display_range = (float)(nb_points * x_increment);
+	/* :WAV:PRE? xorigin is the time of the first point relative to the trigger, files store its opposite */
+	hdr->x_display_origin = -x_origin;
+	hdr->x_increment = x_increment;
+	hdr->x_origin = -x_origin;
+	hdr->x_units = Seconds;
+	hdr->y_units = Volts;
+	memcpy(hdr->date, w->date, sizeof(hdr->date));
+	memcpy(hdr->time, w->time, sizeof(hdr->time));
+	memcpy(hdr->model_sn, w->model_sn, sizeof(hdr->model_sn));
+	snprintf(label, sizeof(label), "CH%d", chan + 1);
+	memcpy(hdr->waveform_label, label, sizeof(hdr->waveform_label));
+	hdr->time_tags = time_tag;
+	hdr->segment_index = segment_index;
+
+	hdr->waveform_data_header_size = RIGOL_BIN_DATA_HEADER_SIZE;
+	hdr->buffer_type = Normal_32bit_float_data;
+	hdr->bytes_per_point = sizeof(float);
+	hdr->buffer_size = nb_points * sizeof(float);
+}
+
+int rg01_writer_finish(const char* filename)
+{
+	FILE* fp;
+	rigol_mso5k_bin hdr;
+	rigol_mso5k_bin_waveforms wfm;
+	long long file_size;
+	long long offset;
+	int nb_waveforms = 0;
+
+	fp = fopen(filename, "r+b");
+	if(fp == NULL)
+	{
+		printf("ERROR rg01_writer_finish(%s) fopen()\n", filename);
+		return -1;
+	}
+	fseeko(fp, 0, SEEK_END);
+	file_size = ftello(fp);
+	fseeko(fp, 0, SEEK_SET);
+	if(fread(&hdr, sizeof(hdr), 1, fp) != 1)
+	{
+		printf("ERROR rg01_writer_finish(%s) file header truncated\n", filename);
+		fclose(fp);
+		return -1;
+	}
+
+	offset = RIGOL_BIN_FILE_HEADER_SIZE;
+	while((offset + (long long)sizeof(wfm)) <= file_size)
+	{
+		fseeko(fp, offset, SEEK_SET);
+		if(fread(&wfm, sizeof(wfm), 1, fp) != 1)
+			break;
+		if((offset + (long long)sizeof(wfm) + wfm.buffer_size) > file_size)
+			break;
+		offset += sizeof(wfm) + wfm.buffer_size;
+		nb_waveforms++;
+	}
+
+	/* 32bits field, saturated for files bigger than 4GiB (readers shall use the real size) */
+	hdr.file_size = (offset > UINT32_MAX) ? UINT32_MAX : (uint32_t)offset;
+	hdr.nb_waveforms = nb_waveforms;
+	fseeko(fp, 0, SEEK_SET);
+	if(fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+	{
+		printf("ERROR rg01_writer_finish(%s) fwrite()\n", filename);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	return nb_waveforms;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __RG01_WRITER_H__
+#define __RG01_WRITER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rigol_bin.h"
+
+/*
+ * Writer of Rigol MSO5000 "RG01" *.bin files (see ../waveform_bin/Rigol_MSO5000_Waveform_bin.bt)
+ * rigol_mso5k_bin file header, then for each channel of each waveform a
+ * rigol_mso5k_bin_waveforms header followed by float32 volts samples.
+ * The file header is written first with nb_waveforms=0 and is patched by
+ * rg01_writer_finish() once the file is closed.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	char model_sn[24]; /* "<model>:<serial>" from *IDN? */
+	char date[16];
+	char time[16];
+} rg01_writer_t;
+
+/* Set model/serial from *IDN? reply and date/time from current time */
+void rg01_writer_init(rg01_writer_t* w, const char* idn);
+
+/* File header written at the start of the file (file_size/nb_waveforms set by rg01_writer_finish()) */
+void rg01_writer_file_header(rigol_mso5k_bin* hdr);
+
+/*
+ * Header of one channel with nb_points float32 samples
+ * x_increment/x_origin are :WAV:PRE? <xincrement>/<xorigin> of the channel
+ */
+void rg01_writer_waveform_header(const rg01_writer_t* w, rigol_mso5k_bin_waveforms* hdr, int chan,
+								 uint32_t nb_points, double x_increment, double x_origin,
+								 uint32_t segment_index, double time_tag);
+
+/*
+ * Patch file_size/nb_waveforms of a closed file by walking the waveform headers
+ * A truncated last waveform (Ctrl-C) is not counted
+ * Return the number of waveforms or -1 in case of error
+ */
+int rg01_writer_finish(const char* filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __RG01_WRITER_H__ */
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample_codec.h"
+
+#define TOKEN_RUN (0x80)
+
+static void put_u32(unsigned char* dst, uint32_t val)
+{
+	dst[0] = (unsigned char)val;
+	dst[1] = (unsigned char)(val >> 8);
+	dst[2] = (unsigned char)(val >> 16);
+	dst[3] = (unsigned char)(val >> 24);
+}
+
+static uint32_t get_u32(const unsigned char* src)
+{
+	return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+void sample_codec_file_header(unsigned char* dst, uint32_t block_size)
+{
+	memcpy(dst, SAMPLE_CODEC_MAGIC, 4);
+	put_u32(&dst[4], block_size);
+}
+
+uint32_t sample_codec_parse_file_header(const unsigned char* src)
+{
+	if(memcmp(src, SAMPLE_CODEC_MAGIC, 4) != 0)
+		return 0;
+	return get_u32(&src[4]);
+}
+
+static void block_header(unsigned char* dst, uint32_t raw_len, uint32_t comp_len, int method)
+{
+	put_u32(&dst[0], raw_len);
+	put_u32(&dst[4], comp_len);
+	dst[8] = (unsigned char)method;
+	dst[9] = 0;
+	dst[10] = 0;
+	dst[11] = 0;
+}
+
+/* Number of bits of the biggest value */
+static int bit_width(unsigned int val)
+{
+	int width = 0;
+
+	while(val != 0)
+	{
+		width++;
+		val >>= 1;
+	}
+	return width;
+}
+
+/* 8 values of width bits in width bytes */
+static void pack8(const unsigned char* z, int width, unsigned char* dst)
+{
+	uint64_t acc = 0;
+	int i;
+
+	for(i = 0; i < 8; i++)
+		acc |= (uint64_t)z[i] << (i * width);
+	for(i = 0; i < width; i++)
+		dst[i] = (unsigned char)(acc >> (i * 8));
+}
+
+static void unpack8(const unsigned char* src, int width, unsigned char* z)
+{
+	uint64_t acc = 0;
+	unsigned int mask = (1u << width) - 1;
+	int i;
+
+	for(i = 0; i < width; i++)
+		acc |= (uint64_t)src[i] << (i * 8);
+	for(i = 0; i < 8; i++)
+		z[i] = (unsigned char)((acc >> (i * width)) & mask);
+}
+
+/* Return the compressed size or 0 if it would not be smaller than dst_max */
+static size_t dbr_encode(const unsigned char* src, size_t nb_bytes, unsigned char* dst, size_t dst_max)
+{
+	unsigned char z[SAMPLE_CODEC_GROUP];
+	unsigned char prev = 0;
+	unsigned char zmax;
+	size_t run_pos = 0; /* Position of the token of the current run + 1, 0 if none */
+	size_t out = 0;
+	size_t pos;
+	size_t cnt;
+	size_t i;
+	int8_t d;
+	int same;
+	int width;
+
+	for(pos = 0; pos < nb_bytes; pos += SAMPLE_CODEC_GROUP)
+	{
+		cnt = nb_bytes - pos;
+		if(cnt > SAMPLE_CODEC_GROUP)
+			cnt = SAMPLE_CODEC_GROUP;
+		zmax = 0;
+		for(i = 0; i < cnt; i++)
+		{
+			/* Zigzag delta: small positive and negative deltas give small codes */
+			d = (int8_t)(src[pos + i] - prev);
+			prev = src[pos + i];
+			z[i] = (unsigned char)((d << 1) ^ (d >> 7));
+			zmax |= z[i];
+		}
+		/* The last group is padded with its last value (ignored by the decoder) */
+		for(; i < SAMPLE_CODEC_GROUP; i++)
+			z[i] = z[cnt - 1];
+
+		same = 1;
+		for(i = 1; i < SAMPLE_CODEC_GROUP; i++)
+		{
+			if(z[i] != z[0])
+			{
+				same = 0;
+				break;
+			}
+		}
+		if(out + 1 + (SAMPLE_CODEC_GROUP / 8) * 8 > dst_max)
+			return 0;
+		if(same)
+		{
+			if( (run_pos != 0) && (dst[run_pos] == z[0]) && ((dst[run_pos - 1] & ~TOKEN_RUN) < SAMPLE_CODEC_RUN_MAX) )
+			{
+				dst[run_pos - 1]++;
+			} else
+			{
+				dst[out++] = TOKEN_RUN | 1;
+				run_pos = out;
+				dst[out++] = z[0];
+			}
+			continue;
+		}
+		run_pos = 0;
+		width = bit_width(zmax);
+		dst[out++] = (unsigned char)width;
+		for(i = 0; i < SAMPLE_CODEC_GROUP; i += 8)
+		{
+			pack8(&z[i], width, &dst[out]);
+			out += width;
+		}
+	}
+	return out;
+}
+
+static long dbr_decode(const unsigned char* src, size_t src_len, unsigned char* dst, size_t nb_bytes)
+{
+	unsigned char z[SAMPLE_CODEC_GROUP];
+	unsigned char prev = 0;
+	unsigned char token;
+	size_t in = 0;
+	size_t pos = 0;
+	size_t cnt;
+	size_t i;
+	int nb_groups;
+	int width;
+	int g;
+
+	while(pos < nb_bytes)
+	{
+		if(in >= src_len)
+			return -1;
+		token = src[in++];
+		if(token & TOKEN_RUN)
+		{
+			nb_groups = token & ~TOKEN_RUN;
+			if( (nb_groups == 0) || (in >= src_len) )
+				return -1;
+			memset(z, src[in++], SAMPLE_CODEC_GROUP);
+		} else
+		{
+			width = token;
+			if( (width == 0) || (width > 8) || ((in + (SAMPLE_CODEC_GROUP / 8) * width) > src_len) )
+				return -1;
+			for(i = 0; i < SAMPLE_CODEC_GROUP; i += 8)
+			{
+				unpack8(&src[in], width, &z[i]);
+				in += width;
+			}
+			nb_groups = 1;
+		}
+		for(g = 0; g < nb_groups; g++)
+		{
+			if(pos >= nb_bytes)
+				return -1;
+			cnt = nb_bytes - pos;
+			if(cnt > SAMPLE_CODEC_GROUP)
+				cnt = SAMPLE_CODEC_GROUP;
+			for(i = 0; i < cnt; i++)
+			{
+				prev = (unsigned char)(prev + (int8_t)((z[i] >> 1) ^ -(z[i] & 1)));
+				dst[pos + i] = prev;
+			}
+			pos += cnt;
+		}
+	}
+	return (in == src_len) ? (long)nb_bytes : -1;
+}
+
+size_t sample_codec_compress_block(const unsigned char* src, size_t nb_bytes, unsigned char* dst)
+{
+	size_t comp_len;
+
+	comp_len = dbr_encode(src, nb_bytes, &dst[SAMPLE_CODEC_BLOCK_HDR_SIZE], nb_bytes);
+	if( (comp_len == 0) || (comp_len >= nb_bytes) )
+	{
+		/* Noise: stored */
+		memcpy(&dst[SAMPLE_CODEC_BLOCK_HDR_SIZE], src, nb_bytes);
+		block_header(dst, nb_bytes, nb_bytes, SAMPLE_CODEC_STORED);
+		return SAMPLE_CODEC_BLOCK_HDR_SIZE + nb_bytes;
+	}
+	block_header(dst, nb_bytes, comp_len, SAMPLE_CODEC_DBR);
+	return SAMPLE_CODEC_BLOCK_HDR_SIZE + comp_len;
+}
+
+int sample_codec_block_info(const unsigned char* src, uint32_t* raw_len, uint32_t* comp_len, int* method)
+{
+	*raw_len = get_u32(&src[0]);
+	*comp_len = get_u32(&src[4]);
+	*method = src[8];
+	if( (*method != SAMPLE_CODEC_STORED) && (*method != SAMPLE_CODEC_DBR) )
+		return -1;
+	if( (*method == SAMPLE_CODEC_STORED) && (*comp_len != *raw_len) )
+		return -1;
+	return 0;
+}
+
+long sample_codec_decompress_block(const unsigned char* src, size_t src_len, unsigned char* dst, size_t dst_size)
+{
+	uint32_t raw_len;
+	uint32_t comp_len;
+	int method;
+
+	if( (src_len < SAMPLE_CODEC_BLOCK_HDR_SIZE) || (sample_codec_block_info(src, &raw_len, &comp_len, &method) != 0) )
+		return -1;
+	if( (raw_len > dst_size) || ((SAMPLE_CODEC_BLOCK_HDR_SIZE + (size_t)comp_len) > src_len) )
+		return -1;
+	src += SAMPLE_CODEC_BLOCK_HDR_SIZE;
+	if(method == SAMPLE_CODEC_STORED)
+	{
+		memcpy(dst, src, raw_len);
+		return raw_len;
+	}
+	return dbr_decode(src, comp_len, dst, raw_len);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __SAMPLE_CODEC_H__
+#define __SAMPLE_CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Lossless codec for 8-bit ADC sample streams ("DBR1" file)
+ * The stream is cut in independent blocks (compressed in parallel by codec_writer)
+ * Each block stores the delta of consecutive samples (zigzag coded) by groups
+ * of SAMPLE_CODEC_GROUP values:
+ * - token 0x01 to 0x08: group bit-packed with this width (4 * width bytes follow)
+ * - token 0x80 | n: run of n (1 to 127) groups with the same delta (1 byte follows),
+ *   flat signal or linear ramp
+ * A block which does not compress is stored.
+ *
+ * File: "DBR1" + block_size (uint32) then for each block raw_len (uint32),
+ * comp_len (uint32), method (uint8), 3 reserved bytes and comp_len bytes
+ * (little endian)
+ */
+
+#define SAMPLE_CODEC_MAGIC "DBR1"
+#define SAMPLE_CODEC_FILE_HDR_SIZE (8)
+#define SAMPLE_CODEC_BLOCK_HDR_SIZE (12)
+#define SAMPLE_CODEC_BLOCK_SIZE (1024*1024)
+#define SAMPLE_CODEC_GROUP (32)
+#define SAMPLE_CODEC_RUN_MAX (127)
+/* Biggest compressed block (block header included) for nb_bytes of samples */
+#define SAMPLE_CODEC_BOUND(nb_bytes) (SAMPLE_CODEC_BLOCK_HDR_SIZE + (nb_bytes))
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	SAMPLE_CODEC_STORED = 0,
+	SAMPLE_CODEC_DBR = 1
+} sample_codec_method_t;
+
+void sample_codec_file_header(unsigned char* dst, uint32_t block_size);
+/* Return the block size of a DBR1 file header or 0 if invalid */
+uint32_t sample_codec_parse_file_header(const unsigned char* src);
+
+/* Compress nb_bytes (<= SAMPLE_CODEC_BLOCK_SIZE) to dst (SAMPLE_CODEC_BOUND(nb_bytes) bytes), return the block size with its header */
+size_t sample_codec_compress_block(const unsigned char* src, size_t nb_bytes, unsigned char* dst);
+/*
+ * Parse a block header, return 0 if OK or -1 if invalid
+ * (raw_len and comp_len do not include the header)
+ */
+int sample_codec_block_info(const unsigned char* src, uint32_t* raw_len, uint32_t* comp_len, int* method);
+/* Decompress a block (header included) to dst (dst_size >= raw_len), return raw_len or -1 if corrupted */
+long sample_codec_decompress_block(const unsigned char* src, size_t src_len, unsigned char* dst, size_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SAMPLE_CODEC_H__ */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define SAMPLE_CONVERT_X86 1
+	#include <immintrin.h>
+#endif
+
+typedef void (*sample_convert_fn)(const unsigned char* src, float* dst, size_t nb_samples, float ydelta, float yincrement);
+
+static sample_convert_fn sample_convert_kernel = sample_convert_scalar;
+static const char* sample_convert_kernel_name = "scalar";
+
+void sample_convert_scalar(const unsigned char* src, float* dst, size_t nb_samples, float ydelta, float yincrement)
+{
+	size_t i;
+
+	for(i = 0; i < nb_samples; i++)
+		dst[i] = ((float)src[i] - ydelta) * yincrement;
+}
+
+#ifdef SAMPLE_CONVERT_X86
+__attribute__((target("sse2")))
+static void sample_convert_sse2(const unsigned char* src, float* dst, size_t nb_samples, float ydelta, float yincrement)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 delta = _mm_set1_ps(ydelta);
+	const __m128 inc = _mm_set1_ps(yincrement);
+	__m128i b, w_lo, w_hi;
+	size_t i;
+
+	/* 16 samples per iteration: u8 => u16 => u32 => float */
+	for(i = 0; (i + 16) <= nb_samples; i += 16)
+	{
+		b = _mm_loadu_si128((const __m128i*)&src[i]);
+		w_lo = _mm_unpacklo_epi8(b, zero);
+		w_hi = _mm_unpackhi_epi8(b, zero);
+		_mm_storeu_ps(&dst[i + 0], _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(w_lo, zero)), delta), inc));
+		_mm_storeu_ps(&dst[i + 4], _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(w_lo, zero)), delta), inc));
+		_mm_storeu_ps(&dst[i + 8], _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(w_hi, zero)), delta), inc));
+		_mm_storeu_ps(&dst[i + 12], _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(w_hi, zero)), delta), inc));
+	}
+	sample_convert_scalar(&src[i], &dst[i], nb_samples - i, ydelta, yincrement);
+}
+
+__attribute__((target("avx2")))
+static void sample_convert_avx2(const unsigned char* src, float* dst, size_t nb_samples, float ydelta, float yincrement)
+{
+	const __m256 delta = _mm256_set1_ps(ydelta);
+	const __m256 inc = _mm256_set1_ps(yincrement);
+	__m128i b;
+	size_t i;
+
+	/* 32 samples per iteration: 4 x (8 x u8 => 8 x u32 => 8 x float) */
+	for(i = 0; (i + 32) <= nb_samples; i += 32)
+	{
+		b = _mm_loadu_si128((const __m128i*)&src[i]);
+		_mm256_storeu_ps(&dst[i + 0], _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b)), delta), inc));
+		_mm256_storeu_ps(&dst[i + 8], _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(b, 8))), delta), inc));
+		b = _mm_loadu_si128((const __m128i*)&src[i + 16]);
+		_mm256_storeu_ps(&dst[i + 16], _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b)), delta), inc));
+		_mm256_storeu_ps(&dst[i + 24], _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(b, 8))), delta), inc));
+	}
+	sample_convert_sse2(&src[i], &dst[i], nb_samples - i, ydelta, yincrement);
+}
+#endif
+
+void sample_convert_init(void)
+{
+#ifdef SAMPLE_CONVERT_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		sample_convert_kernel = sample_convert_avx2;
+		sample_convert_kernel_name = "avx2";
+	} else if(__builtin_cpu_supports("sse2"))
+	{
+		sample_convert_kernel = sample_convert_sse2;
+		sample_convert_kernel_name = "sse2";
+	}
+#endif
+}
+
+const char* sample_convert_name(void)
+{
+	return sample_convert_kernel_name;
+}
+
+void sample_convert(const unsigned char* src, float* dst, size_t nb_samples, float ydelta, float yincrement)
+{
+	sample_convert_kernel(src, dst, nb_samples, ydelta, yincrement);
+}
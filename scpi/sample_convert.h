@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __SAMPLE_CONVERT_H__
+#define __SAMPLE_CONVERT_H__
+
+#include <stddef.h>
+
+/*
+ * Conversion of :WAV:FORM BYTE samples to volts with :WAV:PRE? scaling
+ * volts = (sample - (yorigin + yreference)) * yincrement
+ * AVX2/SSE2 kernels on x86 selected at runtime, scalar kernel otherwise.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Select the fastest kernel supported by the CPU */
+void sample_convert_init(void);
+/* Name of the kernel selected ("avx2", "sse2" or "scalar") */
+const char* sample_convert_name(void);
+
+void sample_convert(const unsigned char* src, float* dst, size_t nb_samples, float ydelta, float yincrement);
+void sample_convert_scalar(const unsigned char* src, float* dst, size_t nb_samples, float ydelta, float yincrement);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SAMPLE_CONVERT_H__ */
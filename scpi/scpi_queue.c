@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "socket_portable.h"
+#include "scpi_queue.h"
+
+void scpi_queue_init(scpi_queue_t* q, int sockfd)
+{
+	memset(q, 0, sizeof(scpi_queue_t));
+	q->sockfd = sockfd;
+}
+
+void scpi_queue_set_transport(scpi_queue_t* q, transport_profile_t* tp)
+{
+	q->tp = tp;
+}
+
+void scpi_queue_set_hislip(scpi_queue_t* q, hislip_t* hs)
+{
+	q->hs = hs;
+}
+
+/* Single recv() from the socket (payload of the current HiSLIP message), with the transport profile if any */
+static int scpi_queue_sock_recv(scpi_queue_t* q, unsigned char* dst, int nb_bytes, int exact)
+{
+	if(q->hs != NULL)
+		return hislip_read(q->hs, dst, nb_bytes, exact);
+	if(q->tp != NULL)
+		return transport_profile_recv(q->tp, dst, nb_bytes, exact);
+	return sockRecv(q->sockfd, dst, nb_bytes, 0);
+}
+
+void scpi_queue_reset(scpi_queue_t* q)
+{
+	q->tx_len = 0;
+	q->pending_head = 0;
+	q->pending_count = 0;
+	q->rx_pos = 0;
+	q->rx_len = 0;
+}
+
+int scpi_queue_cmd(scpi_queue_t* q, const char* cmd)
+{
+	int len = strlen(cmd);
+
+	if(len > (SCPI_QUEUE_TX_SIZE - q->tx_len))
+	{
+		/* Make room by sending what is already queued */
+		if(scpi_queue_flush(q) < 0)
+			return -1;
+		if(len > SCPI_QUEUE_TX_SIZE)
+			return -1;
+	}
+	memcpy(&q->tx_buf[q->tx_len], cmd, len);
+	q->tx_len += len;
+	q->nb_cmd++;
+	return 0;
+}
+
+int scpi_queue_query(scpi_queue_t* q, const char* query)
+{
+	int idx;
+
+	if(q->pending_count >= SCPI_QUEUE_MAX_PENDING)
+	{
+		printf("ERROR scpi_queue_query() too many pending queries (%d)\n", q->pending_count);
+		return -1;
+	}
+	if(scpi_queue_cmd(q, query) < 0)
+		return -1;
+
+	idx = (q->pending_head + q->pending_count) % SCPI_QUEUE_MAX_PENDING;
+	strncpy(q->pending[idx], query, SCPI_QUEUE_QUERY_MAX_SIZE - 1);
+	q->pending[idx][SCPI_QUEUE_QUERY_MAX_SIZE - 1] = '\0';
+	q->pending_count++;
+	return 0;
+}
+
+int scpi_queue_flush(scpi_queue_t* q)
+{
+	int write_nb;
+
+	if(q->tx_len == 0)
+		return 0;
+
+	if(q->hs != NULL)
+		write_nb = hislip_write(q->hs, q->tx_buf, q->tx_len);
+	else
+		write_nb = socket_write_nbytes(q->sockfd, q->tx_buf, q->tx_len);
+	q->nb_write++;
+	q->tx_len = 0;
+	return write_nb;
+}
+
+int scpi_queue_in_flight(scpi_queue_t* q)
+{
+	return q->pending_count;
+}
+
+const char* scpi_queue_begin_reply(scpi_queue_t* q)
+{
+	const char* query;
+
+	if(scpi_queue_flush(q) < 0)
+		return NULL;
+
+	if(q->pending_count == 0)
+		return NULL;
+
+	query = q->pending[q->pending_head];
+	q->pending_head = (q->pending_head + 1) % SCPI_QUEUE_MAX_PENDING;
+	q->pending_count--;
+	return query;
+}
+
+/* Refill the RX buffer with a single recv(), return nb bytes received or <= 0 in case of error */
+static int scpi_queue_fill(scpi_queue_t* q)
+{
+	int read_nb;
+
+	if(q->rx_pos == q->rx_len)
+	{
+		q->rx_pos = 0;
+		q->rx_len = 0;
+	}
+	read_nb = scpi_queue_sock_recv(q, &q->rx_buf[q->rx_len], SCPI_QUEUE_RX_SIZE - q->rx_len, 0);
+	if(read_nb > 0)
+		q->rx_len += read_nb;
+	return read_nb;
+}
+
+int scpi_queue_read_line(scpi_queue_t* q, char* dst, int dst_size)
+{
+	int nb = 0;
+	int read_nb;
+
+	if(scpi_queue_begin_reply(q) == NULL)
+		return -1;
+
+	while(nb < (dst_size - 1))
+	{
+		if(q->rx_pos == q->rx_len)
+		{
+			read_nb = scpi_queue_fill(q);
+			if(read_nb <= 0)
+			{
+				dst[nb] = '\0';
+				return read_nb;
+			}
+		}
+		dst[nb] = q->rx_buf[q->rx_pos++];
+		if(dst[nb++] == '\n')
+			break;
+	}
+	dst[nb] = '\0';
+	return nb;
+}
+
+int scpi_queue_read(scpi_queue_t* q, unsigned char* dst, int nb_bytes)
+{
+	int nb = 0;
+	int read_nb;
+
+	if(q->rx_pos < q->rx_len)
+	{
+		nb = q->rx_len - q->rx_pos;
+		if(nb > nb_bytes)
+			nb = nb_bytes;
+		memcpy(dst, &q->rx_buf[q->rx_pos], nb);
+		q->rx_pos += nb;
+	}
+	while( (q->hs != NULL) && (nb < nb_bytes) )
+	{
+		read_nb = hislip_read(q->hs, &dst[nb], nb_bytes - nb, 1);
+		if(read_nb <= 0)
+			return read_nb;
+		nb += read_nb;
+	}
+	if(nb < nb_bytes)
+	{
+		read_nb = socket_read_nbytes(q->sockfd, &dst[nb], nb_bytes - nb);
+		if(read_nb <= 0)
+			return read_nb;
+		nb += read_nb;
+	}
+	return nb;
+}
+
+static int scpi_queue_recv_bytes(scpi_queue_t* q, unsigned char* dst, int nb_bytes, int exact)
+{
+	int nb;
+
+	if(q->rx_pos < q->rx_len)
+	{
+		nb = q->rx_len - q->rx_pos;
+		if(nb > nb_bytes)
+			nb = nb_bytes;
+		memcpy(dst, &q->rx_buf[q->rx_pos], nb);
+		q->rx_pos += nb;
+		return nb;
+	}
+	return scpi_queue_sock_recv(q, dst, nb_bytes, exact);
+}
+
+int scpi_queue_recv(scpi_queue_t* q, unsigned char* dst, int nb_bytes)
+{
+	return scpi_queue_recv_bytes(q, dst, nb_bytes, 0);
+}
+
+int scpi_queue_recv_exact(scpi_queue_t* q, unsigned char* dst, int nb_bytes)
+{
+	return scpi_queue_recv_bytes(q, dst, nb_bytes, 1);
+}
+
+int scpi_queue_recv_write(scpi_queue_t* q, unsigned char* dst, int nb_bytes,
+							int out_fd, const unsigned char* src, size_t src_len, long long out_off, int* written)
+{
+	if( (q->rx_pos < q->rx_len) || (q->tp == NULL) || (q->hs != NULL) )
+	{
+		/* Buffered bytes are returned first, the caller writes them later */
+		*written = 0;
+		return scpi_queue_recv_bytes(q, dst, nb_bytes, 1);
+	}
+	return transport_profile_recv_write(q->tp, dst, nb_bytes, out_fd, src, src_len, out_off, written);
+}
+
+int scpi_queue_unread(scpi_queue_t* q, const unsigned char* data, int nb_bytes)
+{
+	int nb_buffered = q->rx_len - q->rx_pos;
+
+	if(nb_bytes <= q->rx_pos)
+	{
+		q->rx_pos -= nb_bytes;
+		memmove(&q->rx_buf[q->rx_pos], data, nb_bytes);
+		return 0;
+	}
+	if((nb_buffered + nb_bytes) > SCPI_QUEUE_RX_SIZE)
+		return -1;
+	memmove(&q->rx_buf[nb_bytes], &q->rx_buf[q->rx_pos], nb_buffered);
+	memcpy(q->rx_buf, data, nb_bytes);
+	q->rx_pos = 0;
+	q->rx_len = nb_bytes + nb_buffered;
+	return 0;
+}
+
+long long scpi_queue_resync(scpi_queue_t* q, const char* idn_reply, unsigned char* scratch, size_t scratch_size)
+{
+	size_t idn_len = strlen(idn_reply);
+	size_t len = 0;
+	size_t i;
+	int read_nb;
+	long long nb_dropped = 0;
+
+	scpi_queue_reset(q);
+	if(q->hs != NULL)
+	{
+		/* Out of band device clear, no marker needed */
+		return hislip_device_clear(q->hs);
+	}
+	if( (idn_len == 0) || (idn_len >= scratch_size) || (scpi_queue_query(q, "*IDN?\n") < 0) )
+		return -1;
+	scpi_queue_begin_reply(q);
+	while(1)
+	{
+		if(len == scratch_size)
+		{
+			/* Keep the end which can be the start of the marker */
+			memmove(scratch, &scratch[len - idn_len], idn_len);
+			len = idn_len;
+		}
+		/* Same transport (profile, io_uring) as the other reads */
+		read_nb = scpi_queue_sock_recv(q, &scratch[len], (int)(((scratch_size - len) > INT_MAX) ? INT_MAX : (scratch_size - len)), 0);
+		if(read_nb <= 0)
+			return -1;
+		nb_dropped += read_nb;
+		/* Only the positions not checked before (a marker can start in the last idn_len - 1 bytes) */
+		i = (len >= idn_len) ? (len - idn_len + 1) : 0;
+		len += read_nb;
+		for(; (i + idn_len) <= len; i++)
+		{
+			if( (scratch[i] == (unsigned char)idn_reply[0]) && (memcmp(&scratch[i], idn_reply, idn_len) == 0) )
+			{
+				i += idn_len;
+				if( (i < len) && (scpi_queue_unread(q, &scratch[i], len - i) != 0) )
+					return -1;
+				return nb_dropped - (long long)(len - i);
+			}
+		}
+	}
+}
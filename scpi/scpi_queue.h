@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __SCPI_QUEUE_H__
+#define __SCPI_QUEUE_H__
+
+#include "transport_profile.h"
+#include "hislip.h"
+
+/*
+ * SCPI request queue
+ * Commands/queries are appended to a TX buffer and sent with a single write
+ * by scpi_queue_flush() (or automatically when a reply is read).
+ * Queries are kept in a FIFO and replies are matched back to them in order.
+ * Bytes received after a reply (for example the start of the next reply)
+ * are kept in an RX buffer and returned first by the read functions.
+ * With a HiSLIP session the commands are sent and the replies received
+ * through it instead of the raw socket.
+ */
+
+#define SCPI_QUEUE_TX_SIZE (4096)
+#define SCPI_QUEUE_RX_SIZE (65536)
+#define SCPI_QUEUE_MAX_PENDING (64)
+#define SCPI_QUEUE_QUERY_MAX_SIZE (32)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	int sockfd;
+	transport_profile_t* tp; /* NULL: plain recv() */
+	hislip_t* hs; /* NULL: raw SCPI socket */
+
+	/* Outgoing commands not yet written to the socket */
+	unsigned char tx_buf[SCPI_QUEUE_TX_SIZE];
+	int tx_len;
+
+	/* FIFO of queries for which the reply is not yet read */
+	char pending[SCPI_QUEUE_MAX_PENDING][SCPI_QUEUE_QUERY_MAX_SIZE];
+	int pending_head;
+	int pending_count;
+
+	/* Data received but not yet consumed */
+	unsigned char rx_buf[SCPI_QUEUE_RX_SIZE];
+	int rx_pos;
+	int rx_len;
+
+	/* Statistics */
+	unsigned int nb_cmd;
+	unsigned int nb_write;
+} scpi_queue_t;
+
+void scpi_queue_init(scpi_queue_t* q, int sockfd);
+/* Receive with the socket options of a transport profile (applied by the caller) */
+void scpi_queue_set_transport(scpi_queue_t* q, transport_profile_t* tp);
+/* Send/receive through a HiSLIP session (opened by the caller) */
+void scpi_queue_set_hislip(scpi_queue_t* q, hislip_t* hs);
+/* Drop unsent commands, pending queries and buffered RX data (after a desync) */
+void scpi_queue_reset(scpi_queue_t* q);
+
+/* Append a command (shall end with '\n'), return 0 if OK or -1 if TX buffer is full */
+int scpi_queue_cmd(scpi_queue_t* q, const char* cmd);
+/* Append a query (shall end with '\n') and push it in the pending FIFO, return 0 if OK or -1 */
+int scpi_queue_query(scpi_queue_t* q, const char* query);
+/* Write all queued commands with a single write, return nb bytes written or <= 0 in case of error */
+int scpi_queue_flush(scpi_queue_t* q);
+/* Number of queries sent or queued for which the reply is not yet read */
+int scpi_queue_in_flight(scpi_queue_t* q);
+
+/* Flush and pop the oldest pending query, return it or NULL if FIFO is empty */
+const char* scpi_queue_begin_reply(scpi_queue_t* q);
+/* Read the reply of the oldest pending query up to '\n' (included), return nb bytes or <= 0 in case of error */
+int scpi_queue_read_line(scpi_queue_t* q, char* dst, int dst_size);
+/* Read exactly nb_bytes of the current reply, return nb bytes or <= 0 in case of error */
+int scpi_queue_read(scpi_queue_t* q, unsigned char* dst, int nb_bytes);
+/* Read up to nb_bytes of the current reply (single recv() if RX buffer is empty) */
+int scpi_queue_recv(scpi_queue_t* q, unsigned char* dst, int nb_bytes);
+/* Same as scpi_queue_recv() when the nb_bytes are known to belong to the current reply (MSG_WAITALL read with a bulk/lowlat transport profile) */
+int scpi_queue_recv_exact(scpi_queue_t* q, unsigned char* dst, int nb_bytes);
+/*
+ * scpi_queue_recv_exact() chained with the write of src/src_len at offset out_off of out_fd (-u io_uring)
+ * *written is 0 when the write is not done (bytes from the RX buffer, short read or no io_uring)
+ */
+int scpi_queue_recv_write(scpi_queue_t* q, unsigned char* dst, int nb_bytes,
+							int out_fd, const unsigned char* src, size_t src_len, long long out_off, int* written);
+/* Give back bytes received after the end of the current reply, they are returned first by the next read, return 0 if OK or -1 */
+int scpi_queue_unread(scpi_queue_t* q, const unsigned char* data, int nb_bytes);
+/*
+ * Drop the queries in flight and all data received until the reply to *IDN? (idn_reply, the replies
+ * are sent in order so the data after it is in sync), scratch receives the data dropped,
+ * return the number of bytes dropped or -1 in case of error
+ * With HiSLIP a device clear is done instead (idn_reply and scratch not used).
+ */
+long long scpi_queue_resync(scpi_queue_t* q, const char* idn_reply, unsigned char* scratch, size_t scratch_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SCPI_QUEUE_H__ */
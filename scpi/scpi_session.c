@@ -0,0 +1,507 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "ieee488_block.h"
+#include "scpi_session.h"
+
+#define SESSION_HDR_SIZE (64) /* First recv() of a :WAV:DATA? reply (block header + start of payload) */
+
+#ifdef _WIN32
+	#define SHUT_RDWR SD_BOTH
+#endif
+
+/* :WAV:DATA? block being received by a session */
+typedef struct
+{
+	scpi_session_req_t* req;
+	long long nb_data;
+	int header_done;
+} session_rx_t;
+
+static int session_rx_on_header(void* ctx, long long length)
+{
+	session_rx_t* rx = (session_rx_t*)ctx;
+
+	gettimeofday(&rx->req->header_tv, NULL);
+	rx->nb_data = length;
+	rx->header_done = 1;
+	if( (length != IEEE488_BLOCK_INDEFINITE) && ((size_t)length >= rx->req->dst_size) )
+		return -1;
+	return 0;
+}
+
+static int session_rx_on_payload(void* ctx, const unsigned char* data, size_t len)
+{
+	session_rx_t* rx = (session_rx_t*)ctx;
+	scpi_session_req_t* req = rx->req;
+	unsigned char* p = &req->dst[req->nb_read];
+
+	if((req->nb_read + len) >= req->dst_size)
+		return -1;
+	/* Bulk data is received in place, only the bytes received with the header are copied */
+	if(data != p)
+		memcpy(p, data, len);
+	req->nb_read += len;
+	return 0;
+}
+
+static const ieee488_block_cb_t session_rx_cb = { session_rx_on_header, session_rx_on_payload, NULL };
+
+static int session_connect(const char* hostname, int portno, int timeout_s)
+{
+	struct hostent* server;
+	struct sockaddr_in serveraddr;
+	int sockfd;
+
+	server = gethostbyname(hostname);
+	if(server == NULL)
+		return -1;
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if(sockfd < 0)
+		return -1;
+	memset(&serveraddr, 0, sizeof(serveraddr));
+	serveraddr.sin_family = AF_INET;
+	memcpy(&serveraddr.sin_addr.s_addr, server->h_addr, server->h_length);
+	serveraddr.sin_port = htons(portno);
+	if(connect(sockfd, (const struct sockaddr*)&serveraddr, sizeof(serveraddr)) < 0)
+	{
+		sockClose(sockfd);
+		return -1;
+	}
+	sockSetOpt(sockfd, "TCP_NODELAY", IPPROTO_TCP, TCP_NODELAY, 1);
+	sockSetOpt_Timeout(sockfd, "SO_RCVTIMEO", SOL_SOCKET, SO_RCVTIMEO, timeout_s);
+	sockSetOpt_Timeout(sockfd, "SO_SNDTIMEO", SOL_SOCKET, SO_SNDTIMEO, timeout_s);
+	return sockfd;
+}
+
+/* Query and read its reply line, return 0 if OK or -1 */
+static int session_query(scpi_session_t* s, const char* query, char* reply, int reply_size)
+{
+	int read_nb;
+
+	if(scpi_queue_query(&s->q, query) < 0)
+		return -1;
+	read_nb = scpi_queue_read_line(&s->q, reply, reply_size - 1);
+	if(read_nb <= 0)
+		return -1;
+	reply[read_nb] = '\0';
+	return 0;
+}
+
+static int session_send_request(scpi_session_t* s, scpi_session_req_t* req)
+{
+	char str_buf[64];
+
+	snprintf(str_buf, sizeof(str_buf), ":WAV:SOUR %s\n", req->source);
+	if(scpi_queue_cmd(&s->q, str_buf) < 0)
+		return -1;
+	if(req->start > 0)
+	{
+		/* :WAV:STAR 1 first so :WAV:STOP is never before :WAV:STAR whatever the previous window */
+		snprintf(str_buf, sizeof(str_buf), ":WAV:STAR 1\n:WAV:STOP %zu\n", req->start + req->nb_points - 1);
+		if(scpi_queue_cmd(&s->q, str_buf) < 0)
+			return -1;
+		if(req->start > 1)
+		{
+			snprintf(str_buf, sizeof(str_buf), ":WAV:STAR %zu\n", req->start);
+			if(scpi_queue_cmd(&s->q, str_buf) < 0)
+				return -1;
+		}
+	}
+	return scpi_queue_query(&s->q, ":WAV:DATA?\n");
+}
+
+/* Receive the reply of the oldest request sent, return nb payload bytes or -1 */
+static long long session_read_block(scpi_session_t* s, scpi_session_req_t* req)
+{
+	unsigned char hdr_buf[SESSION_HDR_SIZE];
+	ieee488_block_t blk;
+	session_rx_t rx;
+	const char* query;
+	unsigned char* p;
+	size_t max_nb;
+	int read_nb;
+	long nb;
+
+	query = scpi_queue_begin_reply(&s->q);
+	if( (query == NULL) || (strncmp(query, ":WAV:DATA?", 10) != 0) )
+		return -1;
+	memset(&rx, 0, sizeof(rx));
+	rx.req = req;
+	req->nb_read = 0;
+	ieee488_block_init(&blk, &session_rx_cb, &rx);
+	while(!ieee488_block_done(&blk))
+	{
+		if(!rx.header_done)
+		{
+			p = hdr_buf;
+			max_nb = sizeof(hdr_buf);
+		} else
+		{
+			p = &req->dst[req->nb_read];
+			max_nb = (rx.nb_data == IEEE488_BLOCK_INDEFINITE) ? (req->dst_size - 1 - req->nb_read) : ieee488_block_bytes_left(&blk);
+		}
+		if(max_nb > INT_MAX)
+			max_nb = INT_MAX;
+		if( rx.header_done && (rx.nb_data != IEEE488_BLOCK_INDEFINITE) )
+			read_nb = scpi_queue_recv_exact(&s->q, p, (int)max_nb);
+		else
+			read_nb = scpi_queue_recv(&s->q, p, (int)max_nb);
+		if(read_nb <= 0)
+			return -1;
+		nb = ieee488_block_feed(&blk, p, read_nb);
+		if(nb < 0)
+			return -1;
+		if( (nb < read_nb) && (scpi_queue_unread(&s->q, &p[nb], read_nb - nb) != 0) )
+			return -1;
+	}
+	/* Complete channel or window (a #0 block also ends early at the first sample equal to 0x0A) */
+	if((size_t)req->nb_read != req->nb_points)
+		return -1;
+	gettimeofday(&req->end_tv, NULL);
+	return req->nb_read;
+}
+
+static void session_req_complete(scpi_session_t* s, scpi_session_req_t* req, scpi_session_req_state_t state)
+{
+	scpi_sessions_t* set = s->set;
+
+	pthread_mutex_lock(&set->lock);
+	req->state = state;
+	pthread_cond_broadcast(&set->done);
+	pthread_mutex_unlock(&set->lock);
+}
+
+/*
+ * Receive the requests of the session in order, keeping pipeline_depth in flight
+ * (reqs is not accessed once the last request of the session is complete, the caller can release it)
+ */
+static void session_run(scpi_session_t* s, scpi_session_req_t* reqs, int nb_reqs)
+{
+	struct timeval curr_tv;
+	int next = 0; /* Next request to send */
+	int read = 0; /* Next request to receive */
+	int end = 0; /* After the last request of the session */
+	int broken = 0;
+	int k;
+
+	for(k = 0; k < nb_reqs; k++)
+	{
+		if(reqs[k].session == s->idx)
+			end = k + 1;
+	}
+	while(read < end)
+	{
+		if( (reqs[read].session != s->idx) || broken )
+		{
+			if(reqs[read].session == s->idx)
+				session_req_complete(s, &reqs[read], SCPI_SESSION_REQ_FAILED);
+			read++;
+			continue;
+		}
+		if(next < read)
+			next = read;
+		while( (next < end) && (scpi_queue_in_flight(&s->q) < s->set->pipeline_depth) )
+		{
+			if( (reqs[next].session == s->idx) && (session_send_request(s, &reqs[next]) < 0) )
+				break;
+			next++;
+		}
+		scpi_queue_flush(&s->q);
+		gettimeofday(&curr_tv, NULL);
+		for(k = read; k < next; k++)
+		{
+			if( (reqs[k].session == s->idx) && (reqs[k].sent_tv.tv_sec == 0) && (reqs[k].sent_tv.tv_usec == 0) )
+				reqs[k].sent_tv = curr_tv;
+		}
+		if(session_read_block(s, &reqs[read]) >= 0)
+		{
+			s->nb_bytes += reqs[read].nb_read;
+			s->nb_requests++;
+			session_req_complete(s, &reqs[read], SCPI_SESSION_REQ_DONE);
+			read++;
+			continue;
+		}
+		/* Replies in flight dropped, requested again from the failed one */
+		reqs[read].nb_failed++;
+		s->nb_failed++;
+		if(scpi_queue_resync(&s->q, s->idn_reply, s->scratch, SCPI_SESSION_SCRATCH_SIZE) < 0)
+			broken = 1;
+		if( broken || (reqs[read].nb_failed >= SCPI_SESSION_NB_RETRY) )
+		{
+			session_req_complete(s, &reqs[read], SCPI_SESSION_REQ_FAILED);
+			read++;
+		}
+		for(k = read; k < next; k++)
+		{
+			if(reqs[k].session == s->idx)
+				memset(&reqs[k].sent_tv, 0, sizeof(struct timeval));
+		}
+		next = read;
+	}
+}
+
+static void* session_thread(void* arg)
+{
+	scpi_session_t* s = (scpi_session_t*)arg;
+	scpi_sessions_t* set = s->set;
+	scpi_session_req_t* reqs;
+	int nb_reqs;
+
+	/* Pinned by the thread itself, the thread which opened the sessions keeps its affinity */
+	if(transport_profile_pin_cpu(&s->tp) != 0)
+		printf("ERROR scpi_sessions session %d transport_profile_pin_cpu(%d)\n", s->idx, s->tp.cpu);
+
+	pthread_mutex_lock(&set->lock);
+	while(1)
+	{
+		while( !set->stop && (s->generation == set->generation) )
+			pthread_cond_wait(&set->go, &set->lock);
+		if(set->stop)
+			break;
+		s->generation = set->generation;
+		reqs = set->reqs;
+		nb_reqs = set->nb_reqs;
+		pthread_mutex_unlock(&set->lock);
+		session_run(s, reqs, nb_reqs);
+		pthread_mutex_lock(&set->lock);
+	}
+	pthread_mutex_unlock(&set->lock);
+	return NULL;
+}
+
+int scpi_sessions_open(scpi_sessions_t* set, const char* hostname, int portno, int nb_sessions, int timeout_s,
+						transport_profile_mode_t mode, int pipeline_depth, int first_cpu)
+{
+	scpi_session_t* s;
+	int k;
+
+	memset(set, 0, sizeof(scpi_sessions_t));
+	if( (nb_sessions < 1) || (nb_sessions > SCPI_SESSION_MAX) )
+		return -1;
+	pthread_mutex_init(&set->lock, NULL);
+	pthread_cond_init(&set->go, NULL);
+	pthread_cond_init(&set->done, NULL);
+	set->pipeline_depth = pipeline_depth;
+	for(k = 0; k < nb_sessions; k++)
+	{
+		s = &set->s[k];
+		s->set = set;
+		s->idx = k;
+		s->sockfd = session_connect(hostname, portno, timeout_s);
+		set->nb_sessions++;
+		s->scratch = malloc(SCPI_SESSION_SCRATCH_SIZE);
+		if( (s->sockfd < 0) || (s->scratch == NULL) )
+		{
+			printf("ERROR scpi_sessions_open() session %d connection to %s:%d\n", k, hostname, portno);
+			scpi_sessions_close(set);
+			return -1;
+		}
+		scpi_queue_init(&s->q, s->sockfd);
+		transport_profile_init(&s->tp, s->sockfd, mode, (first_cpu >= 0) ? first_cpu + k : -1);
+		scpi_queue_set_transport(&s->q, &s->tp);
+		if(session_query(s, "*IDN?\n", s->idn_reply, sizeof(s->idn_reply)) != 0)
+		{
+			printf("ERROR scpi_sessions_open() session %d *IDN?\n", k);
+			scpi_sessions_close(set);
+			return -1;
+		}
+		if(pthread_create(&s->thread, NULL, session_thread, s) != 0)
+		{
+			scpi_sessions_close(set);
+			return -1;
+		}
+		s->thread_started = 1;
+	}
+	return 0;
+}
+
+int scpi_sessions_check_source(scpi_sessions_t* set, const char* const* sources)
+{
+	char str_buf[64];
+	char reply[64];
+	int k;
+
+	/* All the sources are set before any is read back */
+	for(k = 0; k < set->nb_sessions; k++)
+	{
+		snprintf(str_buf, sizeof(str_buf), ":WAV:SOUR %s\n", sources[k]);
+		if( (scpi_queue_cmd(&set->s[k].q, str_buf) < 0) || (scpi_queue_flush(&set->s[k].q) <= 0) )
+			return -1;
+	}
+	for(k = 0; k < set->nb_sessions; k++)
+	{
+		if(session_query(&set->s[k], ":WAV:SOUR?\n", reply, sizeof(reply)) != 0)
+			return -1;
+		reply[strcspn(reply, "\r\n")] = '\0';
+		if(strcmp(reply, sources[k]) != 0)
+		{
+			printf("scpi_sessions: session %d :WAV:SOUR?=%s (expected %s), waveform source shared by the sessions\n",
+					k, reply, sources[k]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int scpi_sessions_cmd(scpi_sessions_t* set, const char* cmd)
+{
+	int k;
+
+	for(k = 0; k < set->nb_sessions; k++)
+	{
+		if( (scpi_queue_cmd(&set->s[k].q, cmd) < 0) || (scpi_queue_flush(&set->s[k].q) <= 0) )
+			return -1;
+	}
+	return 0;
+}
+
+void scpi_sessions_start(scpi_sessions_t* set, scpi_session_req_t* reqs, int nb_reqs)
+{
+	int k;
+
+	for(k = 0; k < nb_reqs; k++)
+	{
+		reqs[k].state = SCPI_SESSION_REQ_PENDING;
+		reqs[k].nb_read = 0;
+		reqs[k].nb_failed = 0;
+		memset(&reqs[k].sent_tv, 0, sizeof(struct timeval));
+	}
+	pthread_mutex_lock(&set->lock);
+	set->reqs = reqs;
+	set->nb_reqs = nb_reqs;
+	set->generation++;
+	pthread_cond_broadcast(&set->go);
+	pthread_mutex_unlock(&set->lock);
+}
+
+const scpi_session_req_t* scpi_sessions_wait(scpi_sessions_t* set, int idx)
+{
+	scpi_session_req_t* req = &set->reqs[idx];
+	struct timespec deadline;
+
+	pthread_mutex_lock(&set->lock);
+	while( (req->state == SCPI_SESSION_REQ_PENDING) && ((set->stop_flag == NULL) || !*set->stop_flag) )
+	{
+		TimespecAfterMs(&deadline, SCPI_SESSION_STOP_POLL_MS);
+		pthread_cond_timedwait(&set->done, &set->lock, &deadline);
+	}
+	if(req->state == SCPI_SESSION_REQ_PENDING)
+		req = NULL;
+	pthread_mutex_unlock(&set->lock);
+	return req;
+}
+
+void scpi_sessions_wait_all(scpi_sessions_t* set)
+{
+	int k;
+
+	for(k = 0; k < set->nb_reqs; k++)
+		scpi_sessions_wait(set, k);
+}
+
+/* Receive reqs and wait for all of them, return the time in seconds or -1 if a request failed */
+static double sessions_timed_batch(scpi_sessions_t* set, scpi_session_req_t* reqs, int nb_reqs)
+{
+	struct timeval start_tv;
+	struct timeval end_tv;
+	int k;
+
+	gettimeofday(&start_tv, NULL);
+	scpi_sessions_start(set, reqs, nb_reqs);
+	scpi_sessions_wait_all(set);
+	gettimeofday(&end_tv, NULL);
+	for(k = 0; k < nb_reqs; k++)
+	{
+		if(reqs[k].state != SCPI_SESSION_REQ_DONE)
+			return -1;
+	}
+	return TimevalDiff(&end_tv, &start_tv);
+}
+
+int scpi_sessions_probe(scpi_sessions_t* set, scpi_session_req_t* reqs, int nb_reqs)
+{
+	double seq_s;
+	double par_s;
+	int k;
+
+	set->speedup = 0;
+	for(k = 0; k < nb_reqs; k++)
+		reqs[k].session = 0;
+	seq_s = sessions_timed_batch(set, reqs, nb_reqs);
+	for(k = 0; k < nb_reqs; k++)
+		reqs[k].session = k % set->nb_sessions;
+	par_s = sessions_timed_batch(set, reqs, nb_reqs);
+	if( (seq_s < 0) || (par_s < 0) )
+	{
+		printf("scpi_sessions: probe requests failed\n");
+		return -1;
+	}
+	set->speedup = (par_s > 0) ? seq_s / par_s : 0;
+	printf("scpi_sessions: probe %d requests one after another %05.04f s, on %d sessions %05.04f s (speedup %.2f)\n",
+			nb_reqs, seq_s, set->nb_sessions, par_s, set->speedup);
+	return (set->speedup >= SCPI_SESSION_MIN_SPEEDUP) ? 0 : -1;
+}
+
+void scpi_sessions_close(scpi_sessions_t* set)
+{
+	scpi_session_t* s;
+	int k;
+
+	if(set->nb_sessions == 0)
+		return;
+	pthread_mutex_lock(&set->lock);
+	set->stop = 1;
+	pthread_cond_broadcast(&set->go);
+	pthread_mutex_unlock(&set->lock);
+	for(k = 0; k < set->nb_sessions; k++)
+	{
+		s = &set->s[k];
+		/* Unblock a thread waiting for data */
+		if(s->sockfd >= 0)
+			shutdown(s->sockfd, SHUT_RDWR);
+		if(s->thread_started)
+			pthread_join(s->thread, NULL);
+		s->thread_started = 0;
+		if(s->sockfd >= 0)
+			sockClose(s->sockfd);
+		s->sockfd = -1;
+		free(s->scratch);
+		s->scratch = NULL;
+	}
+	set->nb_sessions = 0;
+	pthread_cond_destroy(&set->done);
+	pthread_cond_destroy(&set->go);
+	pthread_mutex_destroy(&set->lock);
+}
+
+void scpi_sessions_print(const scpi_sessions_t* set)
+{
+	int k;
+
+	for(k = 0; k < set->nb_sessions; k++)
+	{
+		printf("scpi_session %d: %u requests, %llu bytes, %u failed (SCPI commands=%u, socket writes=%u)",
+				k, set->s[k].nb_requests, set->s[k].nb_bytes, set->s[k].nb_failed, set->s[k].q.nb_cmd, set->s[k].q.nb_write);
+		if(set->s[k].tp.cpu >= 0)
+			printf(", receive thread CPU=%d%s", set->s[k].tp.cpu, set->s[k].tp.cpu_pinned ? "" : " (pinning failed)");
+		printf("\n");
+	}
+}
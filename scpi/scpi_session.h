@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __SCPI_SESSION_H__
+#define __SCPI_SESSION_H__
+
+#include <stddef.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "socket_portable.h"
+#include "scpi_queue.h"
+#include "transport_profile.h"
+
+/*
+ * Parallel :WAV:DATA? over several SCPI sessions (TCP connections) to the same instrument
+ * Each session has its own connection, queue and receive thread. The requests
+ * of a waveform are assigned to the sessions (one session per channel) and
+ * received concurrently, pipelined on each session, in the memory given with
+ * each request. The caller waits for each request in order and processes it
+ * while the next ones are still received.
+ * A failed request is requested again by its session after a resync with the
+ * *IDN? marker (up to SCPI_SESSION_NB_RETRY attempts).
+ * Before being used the sessions are checked:
+ * - each session sets a different :WAV:SOUR then reads it back with :WAV:SOUR?,
+ *   an instrument with a single waveform state shared by its sessions fails
+ * - the same requests are received one after another by one session then
+ *   concurrently by all sessions, an instrument which serializes the sessions
+ *   is not faster in parallel (speedup below SCPI_SESSION_MIN_SPEEDUP)
+ */
+
+#define SCPI_SESSION_MAX (8)
+#define SCPI_SESSION_NB_RETRY (10)
+#define SCPI_SESSION_MIN_SPEEDUP (1.2)
+#define SCPI_SESSION_SOURCE_SIZE (16)
+#define SCPI_SESSION_SCRATCH_SIZE (65536)
+#define SCPI_SESSION_STOP_POLL_MS (100) /* stop_flag checked while waiting for a request */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	SCPI_SESSION_REQ_PENDING = 0,
+	SCPI_SESSION_REQ_DONE,
+	SCPI_SESSION_REQ_FAILED
+} scpi_session_req_state_t;
+
+typedef struct
+{
+	int session; /* Session receiving the request */
+	char source[SCPI_SESSION_SOURCE_SIZE]; /* :WAV:SOUR parameter ("CHAN1", "D0"...) */
+	size_t start; /* First point (1 based) with :WAV:STAR/:WAV:STOP, 0 for the whole channel */
+	size_t nb_points;
+	unsigned char* dst; /* Payload received here (1 spare byte for the terminator) */
+	size_t dst_size;
+
+	/* Result (valid once state is not SCPI_SESSION_REQ_PENDING) */
+	scpi_session_req_state_t state;
+	long long nb_read; /* Payload bytes */
+	unsigned int nb_failed; /* Failed attempts */
+	struct timeval sent_tv;
+	struct timeval header_tv;
+	struct timeval end_tv;
+} scpi_session_req_t;
+
+struct scpi_sessions_s;
+
+typedef struct
+{
+	struct scpi_sessions_s* set;
+	int idx;
+	int sockfd;
+	scpi_queue_t q;
+	transport_profile_t tp;
+	char idn_reply[256]; /* Resync marker */
+	unsigned char* scratch;
+	pthread_t thread;
+	int thread_started;
+	unsigned int generation; /* Last batch of requests processed */
+
+	/* Statistics */
+	unsigned long long nb_bytes;
+	unsigned int nb_requests;
+	unsigned int nb_failed;
+} scpi_session_t;
+
+typedef struct scpi_sessions_s
+{
+	int nb_sessions;
+	scpi_session_t s[SCPI_SESSION_MAX];
+	int pipeline_depth;
+	scpi_session_req_t* reqs;
+	int nb_reqs;
+	pthread_mutex_t lock;
+	pthread_cond_t go; /* New batch of requests or stop */
+	pthread_cond_t done; /* A request is complete */
+	unsigned int generation;
+	int stop;
+	double speedup; /* Measured by scpi_sessions_probe() */
+	const volatile sig_atomic_t* stop_flag; /* Optional, scpi_sessions_wait() gives up waiting once it is set */
+} scpi_sessions_t;
+
+/*
+ * Open nb_sessions connections to hostname:portno (receive timeout timeout_s, transport profile mode)
+ * and start their threads (the thread of session k pinned to first_cpu + k if first_cpu >= 0), return 0 if OK or -1
+ */
+int scpi_sessions_open(scpi_sessions_t* set, const char* hostname, int portno, int nb_sessions, int timeout_s,
+						transport_profile_mode_t mode, int pipeline_depth, int first_cpu);
+/*
+ * Check that each session keeps its own :WAV:SOUR (sources[k] set by session k at the same time),
+ * return 0 if OK or -1 (shared by the sessions or error)
+ */
+int scpi_sessions_check_source(scpi_sessions_t* set, const char* const* sources);
+/*
+ * Receive the nb_reqs requests (one per session) one after another on session 0 then concurrently,
+ * set set->speedup and return 0 if the sessions overlap (speedup >= SCPI_SESSION_MIN_SPEEDUP) or -1
+ */
+int scpi_sessions_probe(scpi_sessions_t* set, scpi_session_req_t* reqs, int nb_reqs);
+/* Send cmd to all the sessions (while no request is received), return 0 if OK or -1 */
+int scpi_sessions_cmd(scpi_sessions_t* set, const char* cmd);
+/* Receive the nb_reqs requests (assigned with their session field), each session in the order of reqs */
+void scpi_sessions_start(scpi_sessions_t* set, scpi_session_req_t* reqs, int nb_reqs);
+/* Wait for the request idx of the last scpi_sessions_start(), NULL if stop_flag is set while waiting */
+const scpi_session_req_t* scpi_sessions_wait(scpi_sessions_t* set, int idx);
+/* Wait for all the requests */
+void scpi_sessions_wait_all(scpi_sessions_t* set);
+/* Stop the threads and close the connections */
+void scpi_sessions_close(scpi_sessions_t* set);
+void scpi_sessions_print(const scpi_sessions_t* set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SCPI_SESSION_H__ */
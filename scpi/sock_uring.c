@@ -0,0 +1,541 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sock_uring.h"
+
+#ifdef SOCK_URING_SUPPORTED
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#define SOCK_URING_UD_CANCEL (1ULL << 62) /* user_data of the cancel requests after a timeout */
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params* p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void* arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int sock_uring_init(sock_uring_t* u, unsigned int entries)
+{
+	struct io_uring_params p;
+
+	memset(u, 0, sizeof(sock_uring_t));
+	u->ring_fd = -1;
+	memset(&p, 0, sizeof(p));
+	u->ring_fd = sys_io_uring_setup(entries, &p);
+	if(u->ring_fd < 0)
+	{
+		u->error = (errno == ENOSYS) ? "io_uring not supported by the kernel" : "io_uring_setup() failed (disabled or not allowed)";
+		return -1;
+	}
+	u->features = p.features;
+	u->sq_entries = p.sq_entries;
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = u->sq_ring_size;
+	}
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+	if(u->sq_ring == MAP_FAILED)
+	{
+		u->sq_ring = NULL;
+		u->error = "mmap(IORING_OFF_SQ_RING) failed";
+		sock_uring_exit(u);
+		return -1;
+	}
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		u->cq_ring = u->sq_ring;
+	} else
+	{
+		u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING);
+		if(u->cq_ring == MAP_FAILED)
+		{
+			u->cq_ring = NULL;
+			u->error = "mmap(IORING_OFF_CQ_RING) failed";
+			sock_uring_exit(u);
+			return -1;
+		}
+	}
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+	if(u->sqes == MAP_FAILED)
+	{
+		u->sqes = NULL;
+		u->error = "mmap(IORING_OFF_SQES) failed";
+		sock_uring_exit(u);
+		return -1;
+	}
+
+	u->sq_head = (unsigned int*)((char*)u->sq_ring + p.sq_off.head);
+	u->sq_tail = (unsigned int*)((char*)u->sq_ring + p.sq_off.tail);
+	u->sq_mask = (unsigned int*)((char*)u->sq_ring + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int*)((char*)u->sq_ring + p.sq_off.array);
+	u->cq_head = (unsigned int*)((char*)u->cq_ring + p.cq_off.head);
+	u->cq_tail = (unsigned int*)((char*)u->cq_ring + p.cq_off.tail);
+	u->cq_mask = (unsigned int*)((char*)u->cq_ring + p.cq_off.ring_mask);
+	u->cqes = (char*)u->cq_ring + p.cq_off.cqes;
+	u->sq_local_tail = *u->sq_tail;
+	u->bgid = -1;
+	return 0;
+}
+
+void sock_uring_exit(sock_uring_t* u)
+{
+	if(u->sqes != NULL)
+		munmap(u->sqes, u->sqes_size);
+	if( (u->cq_ring != NULL) && (u->cq_ring != u->sq_ring) )
+		munmap(u->cq_ring, u->cq_ring_size);
+	if(u->sq_ring != NULL)
+		munmap(u->sq_ring, u->sq_ring_size);
+	if(u->ring_fd >= 0)
+		close(u->ring_fd);
+	free(u->br);
+	free(u->br_bufs);
+	u->sqes = NULL;
+	u->cq_ring = NULL;
+	u->sq_ring = NULL;
+	u->ring_fd = -1;
+	u->br = NULL;
+	u->br_bufs = NULL;
+}
+
+int sock_uring_register_buffer(sock_uring_t* u, void* buf, size_t len)
+{
+	struct iovec iov;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	if(sys_io_uring_register(u->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+	{
+		u->error = (errno == ENOMEM) ? "IORING_REGISTER_BUFFERS failed (RLIMIT_MEMLOCK too small)" : "IORING_REGISTER_BUFFERS failed";
+		return -1;
+	}
+	u->fixed_buf = (unsigned char*)buf;
+	u->fixed_len = len;
+	return 0;
+}
+
+static struct io_uring_sqe* sock_uring_get_sqe(sock_uring_t* u)
+{
+	struct io_uring_sqe* sqe;
+	unsigned int head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	unsigned int idx;
+
+	if((u->sq_local_tail - head) >= u->sq_entries)
+		return NULL;
+	idx = u->sq_local_tail & *u->sq_mask;
+	sqe = &((struct io_uring_sqe*)u->sqes)[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	u->sq_array[idx] = idx;
+	u->sq_local_tail++;
+	u->nb_pending++;
+	u->nb_sqe++;
+	return sqe;
+}
+
+/* Submit the prepared SQEs and wait for min_complete completions (up to timeout_ms if > 0) */
+static int sock_uring_enter(sock_uring_t* u, unsigned int min_complete, int timeout_ms)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+	unsigned int to_submit = u->nb_pending;
+	int ret;
+
+	__atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+	u->nb_enter++;
+	if( (timeout_ms > 0) && (min_complete > 0) && (u->features & IORING_FEAT_EXT_ARG) )
+	{
+		memset(&arg, 0, sizeof(arg));
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+		arg.ts = (unsigned long long)(uintptr_t)&ts;
+		ret = sys_io_uring_enter(u->ring_fd, to_submit, min_complete, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	} else
+	{
+		ret = sys_io_uring_enter(u->ring_fd, to_submit, min_complete, flags, NULL, 0);
+	}
+	if(ret >= 0)
+		u->nb_pending -= ((unsigned int)ret < u->nb_pending) ? (unsigned int)ret : u->nb_pending;
+	return ret;
+}
+
+int sock_uring_next(sock_uring_t* u, sock_uring_cqe_t* cqe)
+{
+	unsigned int head = *u->cq_head;
+	struct io_uring_cqe* c;
+
+	if(head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	c = &((struct io_uring_cqe*)u->cqes)[head & *u->cq_mask];
+	cqe->user_data = c->user_data;
+	cqe->res = c->res;
+	cqe->flags = c->flags;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * Submit nb_ops operations (user_data 1 to nb_ops) and wait for all their completions
+ * After u->timeout_ms the operations are cancelled (they complete with -ECANCELED)
+ * Return 0, 1 if cancelled after the timeout or -1 in case of error
+ */
+static int sock_uring_run(sock_uring_t* u, int nb_ops, int* res)
+{
+	struct io_uring_sqe* sqe;
+	sock_uring_cqe_t cqe;
+	int nb_done = 0;
+	int cancelled = 0;
+	int i;
+
+	for(i = 0; i < nb_ops; i++)
+		res[i] = -ECANCELED;
+	while(nb_done < nb_ops)
+	{
+		if(sock_uring_enter(u, nb_ops - nb_done, cancelled ? 0 : u->timeout_ms) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if( (errno != ETIME) || cancelled )
+				return -1;
+			for(i = 0; i < nb_ops; i++)
+			{
+				sqe = sock_uring_get_sqe(u);
+				if(sqe == NULL)
+					return -1;
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->addr = i + 1;
+				sqe->user_data = SOCK_URING_UD_CANCEL;
+			}
+			cancelled = 1;
+			continue;
+		}
+		while(sock_uring_next(u, &cqe))
+		{
+			if( (cqe.user_data >= 1) && (cqe.user_data <= (unsigned long long)nb_ops) )
+			{
+				res[cqe.user_data - 1] = cqe.res;
+				nb_done++;
+			}
+		}
+	}
+	return cancelled;
+}
+
+static int sock_uring_result(int res, int cancelled)
+{
+	if(res >= 0)
+		return res;
+	/* Same errno as a recv() with SO_RCVTIMEO */
+	errno = ((res == -ECANCELED) && cancelled) ? EAGAIN : -res;
+	return -1;
+}
+
+int sock_uring_recv(sock_uring_t* u, int sockfd, void* dst, int nb_bytes, int flags)
+{
+	struct io_uring_sqe* sqe;
+	unsigned char* p = (unsigned char*)dst;
+	int res;
+	int cancelled;
+
+	sqe = sock_uring_get_sqe(u);
+	if(sqe == NULL)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	sqe->fd = sockfd;
+	sqe->addr = (unsigned long long)(uintptr_t)dst;
+	sqe->len = nb_bytes;
+	sqe->user_data = 1;
+	if( (flags == 0) && (u->fixed_buf != NULL) && (p >= u->fixed_buf) && ((p + nb_bytes) <= (u->fixed_buf + u->fixed_len)) )
+	{
+		/* Pages of the registered buffer are already pinned */
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->buf_index = 0;
+	} else
+	{
+		sqe->opcode = IORING_OP_RECV;
+		sqe->msg_flags = flags;
+	}
+	cancelled = sock_uring_run(u, 1, &res);
+	if(cancelled < 0)
+		return -1;
+	return sock_uring_result(res, cancelled);
+}
+
+int sock_uring_recv_write(sock_uring_t* u, int sockfd, void* dst, int nb_bytes,
+							int out_fd, const void* src, size_t src_len, long long out_off, int* written)
+{
+	struct io_uring_sqe* sqe;
+	int res[2];
+	int nb_ops = (src_len > 0) ? 2 : 1;
+	int cancelled;
+
+	*written = 0;
+	if(((*u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE)) + nb_ops) > u->sq_entries)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	/* The write is only started once all nb_bytes are received (a short recv breaks the link) */
+	sqe = sock_uring_get_sqe(u);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sockfd;
+	sqe->addr = (unsigned long long)(uintptr_t)dst;
+	sqe->len = nb_bytes;
+	sqe->msg_flags = MSG_WAITALL;
+	sqe->user_data = 1;
+	if(nb_ops == 2)
+	{
+		sqe->flags = IOSQE_IO_LINK;
+		sqe = sock_uring_get_sqe(u);
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = out_fd;
+		sqe->addr = (unsigned long long)(uintptr_t)src;
+		sqe->len = src_len;
+		sqe->off = out_off;
+		sqe->user_data = 2;
+	}
+	cancelled = sock_uring_run(u, nb_ops, res);
+	if(cancelled < 0)
+		return -1;
+	if(nb_ops == 2)
+		*written = (res[1] == -ECANCELED) ? 0 : res[1];
+	return sock_uring_result(res[0], cancelled);
+}
+
+int sock_uring_setup_buffers(sock_uring_t* u, unsigned int nb_bufs, unsigned int buf_size)
+{
+	struct io_uring_buf_reg reg;
+	struct io_uring_buf_ring* br;
+	void* ring;
+	unsigned int i;
+
+	if( (nb_bufs == 0) || ((nb_bufs & (nb_bufs - 1)) != 0) )
+	{
+		u->error = "nb_bufs shall be a power of 2";
+		return -1;
+	}
+	if(posix_memalign(&ring, (size_t)sysconf(_SC_PAGESIZE), nb_bufs * sizeof(struct io_uring_buf)) != 0)
+	{
+		u->error = "posix_memalign(buffer ring) failed";
+		return -1;
+	}
+	memset(ring, 0, nb_bufs * sizeof(struct io_uring_buf));
+	u->br_bufs = malloc((size_t)nb_bufs * buf_size);
+	if(u->br_bufs == NULL)
+	{
+		free(ring);
+		u->error = "malloc(provided buffers) failed";
+		return -1;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long)(uintptr_t)ring;
+	reg.ring_entries = nb_bufs;
+	reg.bgid = 0;
+	if(sys_io_uring_register(u->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		free(ring);
+		free(u->br_bufs);
+		u->br_bufs = NULL;
+		u->error = "IORING_REGISTER_PBUF_RING failed (kernel < 5.19)";
+		return -1;
+	}
+	u->br = ring;
+	u->br_nb = nb_bufs;
+	u->br_size = buf_size;
+	u->bgid = 0;
+
+	br = (struct io_uring_buf_ring*)u->br;
+	for(i = 0; i < nb_bufs; i++)
+	{
+		br->bufs[i].addr = (unsigned long long)(uintptr_t)&u->br_bufs[(size_t)i * buf_size];
+		br->bufs[i].len = buf_size;
+		br->bufs[i].bid = i;
+	}
+	u->br_tail = nb_bufs;
+	__atomic_store_n(&br->tail, u->br_tail, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int sock_uring_recv_multishot(sock_uring_t* u, int sockfd, unsigned long long user_data)
+{
+	struct io_uring_sqe* sqe;
+
+	sqe = sock_uring_get_sqe(u);
+	if(sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sockfd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = u->bgid;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+int sock_uring_poll_multishot(sock_uring_t* u, int fd, unsigned int poll_events, unsigned long long user_data)
+{
+	struct io_uring_sqe* sqe;
+
+	sqe = sock_uring_get_sqe(u);
+	if(sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = poll_events;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+int sock_uring_wait(sock_uring_t* u, int timeout_ms)
+{
+	if(sock_uring_enter(u, 1, timeout_ms) < 0)
+	{
+		if( (errno == ETIME) || (errno == EINTR) )
+			return 0;
+		return -1;
+	}
+	return (int)(__atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - *u->cq_head);
+}
+
+int sock_uring_cqe_more(const sock_uring_cqe_t* cqe)
+{
+	return (cqe->flags & IORING_CQE_F_MORE) != 0;
+}
+
+unsigned char* sock_uring_cqe_buffer(sock_uring_t* u, const sock_uring_cqe_t* cqe)
+{
+	if(!(cqe->flags & IORING_CQE_F_BUFFER))
+		return NULL;
+	return &u->br_bufs[(size_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) * u->br_size];
+}
+
+void sock_uring_buffer_recycle(sock_uring_t* u, const sock_uring_cqe_t* cqe)
+{
+	struct io_uring_buf_ring* br = (struct io_uring_buf_ring*)u->br;
+	struct io_uring_buf* b;
+	unsigned int bid;
+
+	if(!(cqe->flags & IORING_CQE_F_BUFFER))
+		return;
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	b = &br->bufs[u->br_tail & (u->br_nb - 1)];
+	b->addr = (unsigned long long)(uintptr_t)&u->br_bufs[(size_t)bid * u->br_size];
+	b->len = u->br_size;
+	b->bid = bid;
+	u->br_tail++;
+	__atomic_store_n(&br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+#else /* SOCK_URING_SUPPORTED */
+
+int sock_uring_init(sock_uring_t* u, unsigned int entries)
+{
+	memset(u, 0, sizeof(sock_uring_t));
+	u->ring_fd = -1;
+	u->error = "io_uring only available on Linux";
+	return -1;
+}
+
+void sock_uring_exit(sock_uring_t* u)
+{
+}
+
+int sock_uring_register_buffer(sock_uring_t* u, void* buf, size_t len)
+{
+	return -1;
+}
+
+int sock_uring_recv(sock_uring_t* u, int sockfd, void* dst, int nb_bytes, int flags)
+{
+	return -1;
+}
+
+int sock_uring_recv_write(sock_uring_t* u, int sockfd, void* dst, int nb_bytes,
+							int out_fd, const void* src, size_t src_len, long long out_off, int* written)
+{
+	*written = 0;
+	return -1;
+}
+
+int sock_uring_setup_buffers(sock_uring_t* u, unsigned int nb_bufs, unsigned int buf_size)
+{
+	return -1;
+}
+
+int sock_uring_recv_multishot(sock_uring_t* u, int sockfd, unsigned long long user_data)
+{
+	return -1;
+}
+
+int sock_uring_poll_multishot(sock_uring_t* u, int fd, unsigned int poll_events, unsigned long long user_data)
+{
+	return -1;
+}
+
+int sock_uring_wait(sock_uring_t* u, int timeout_ms)
+{
+	return -1;
+}
+
+int sock_uring_next(sock_uring_t* u, sock_uring_cqe_t* cqe)
+{
+	return 0;
+}
+
+int sock_uring_cqe_more(const sock_uring_cqe_t* cqe)
+{
+	return 0;
+}
+
+unsigned char* sock_uring_cqe_buffer(sock_uring_t* u, const sock_uring_cqe_t* cqe)
+{
+	return NULL;
+}
+
+void sock_uring_buffer_recycle(sock_uring_t* u, const sock_uring_cqe_t* cqe)
+{
+}
+
+#endif /* SOCK_URING_SUPPORTED */
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __SOCK_URING_H__
+#define __SOCK_URING_H__
+
+#include <stddef.h>
+
+/*
+ * Minimal Linux io_uring wrapper (raw syscalls, no liburing) used as optional
+ * receive backend by socket_portable:
+ * - recv (MSG_WAITALL) or READ_FIXED into a registered buffer
+ * - recv linked to a file write (IOSQE_IO_LINK), one io_uring_enter() for both
+ * - multishot recv with a provided buffer ring, to serve several sockets from one thread
+ * On other platforms (or without <linux/io_uring.h>) sock_uring_init() fails
+ * and the callers keep the recv() path.
+ */
+
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#define SOCK_URING_SUPPORTED 1
+	#endif
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+	unsigned long long user_data;
+	int res;
+	unsigned int flags;
+} sock_uring_cqe_t;
+
+typedef struct
+{
+	int ring_fd;
+	unsigned int features;
+	const char* error; /* Reason why sock_uring_init() or a setup function failed */
+
+	/* Submission queue */
+	unsigned int sq_entries;
+	unsigned int* sq_head;
+	unsigned int* sq_tail;
+	unsigned int* sq_mask;
+	unsigned int* sq_array;
+	void* sqes;
+	unsigned int sq_local_tail; /* SQEs prepared but not yet submitted */
+	unsigned int nb_pending;
+
+	/* Completion queue */
+	unsigned int* cq_head;
+	unsigned int* cq_tail;
+	unsigned int* cq_mask;
+	void* cqes;
+
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	/* Registered (fixed) buffer, index 0 */
+	unsigned char* fixed_buf;
+	size_t fixed_len;
+
+	/* Provided buffer ring for multishot recv */
+	void* br;
+	unsigned char* br_bufs;
+	unsigned int br_nb;
+	unsigned int br_size;
+	unsigned short br_tail;
+	int bgid;
+
+	int timeout_ms; /* Blocking operations are cancelled after timeout_ms (0 = no timeout) */
+
+	/* Statistics */
+	unsigned int nb_enter;
+	unsigned int nb_sqe;
+} sock_uring_t;
+
+/* Return 0 if OK or -1 if io_uring is not available (u->error is set) */
+int sock_uring_init(sock_uring_t* u, unsigned int entries);
+void sock_uring_exit(sock_uring_t* u);
+
+/* Register buf as fixed buffer (pinned once instead of at each read), return 0 if OK or -1 */
+int sock_uring_register_buffer(sock_uring_t* u, void* buf, size_t len);
+
+/*
+ * Blocking receive, return nb bytes received, 0 if the connection is closed or -1 with errno set
+ * READ_FIXED when dst is in the registered buffer (flags 0), else RECV with flags
+ */
+int sock_uring_recv(sock_uring_t* u, int sockfd, void* dst, int nb_bytes, int flags);
+/*
+ * RECV of nb_bytes (MSG_WAITALL) linked to a write of src/src_len at offset out_off of out_fd
+ * The write is cancelled when the recv is short, *written is then 0
+ * Return nb bytes received, 0 if the connection is closed or -1 with errno set
+ */
+int sock_uring_recv_write(sock_uring_t* u, int sockfd, void* dst, int nb_bytes,
+							int out_fd, const void* src, size_t src_len, long long out_off, int* written);
+
+/* Provided buffer ring of nb_bufs (power of 2) buffers of buf_size bytes, return 0 if OK or -1 */
+int sock_uring_setup_buffers(sock_uring_t* u, unsigned int nb_bufs, unsigned int buf_size);
+/* Queue a multishot recv on sockfd (data in provided buffers), completions carry user_data */
+int sock_uring_recv_multishot(sock_uring_t* u, int sockfd, unsigned long long user_data);
+/* Queue a multishot poll on fd */
+int sock_uring_poll_multishot(sock_uring_t* u, int fd, unsigned int poll_events, unsigned long long user_data);
+/* Submit queued operations and wait up to timeout_ms for at least one completion, return nb completions ready or -1 */
+int sock_uring_wait(sock_uring_t* u, int timeout_ms);
+/* Pop the next completion, return 1 or 0 if none */
+int sock_uring_next(sock_uring_t* u, sock_uring_cqe_t* cqe);
+/* Multishot operation still armed after this completion */
+int sock_uring_cqe_more(const sock_uring_cqe_t* cqe);
+/* Provided buffer of a recv completion (NULL if none) */
+unsigned char* sock_uring_cqe_buffer(sock_uring_t* u, const sock_uring_cqe_t* cqe);
+/* Give the buffer of a completion back to the kernel once its data is consumed */
+void sock_uring_buffer_recycle(sock_uring_t* u, const sock_uring_cqe_t* cqe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SOCK_URING_H__ */
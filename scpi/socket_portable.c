@@ -21,6 +21,9 @@
 
 void error(char *msg); /* shall be declared in user code */
 
+static sock_uring_t sock_uring;
+static int sock_uring_enabled = 0;
+
 #ifdef _WIN32
 	extern BOOL WINAPI consoleHandler(DWORD signal); // shall be declared in user code
 	/* strerror for WIN32 */
@@ -51,6 +54,17 @@ float TimevalDiff(const struct timeval *a, const struct timeval *b)
 	return (a->tv_sec - b->tv_sec) + 1e-6f * (a->tv_usec - b->tv_usec);
 }
 
+void TimespecAfterMs(struct timespec *ts, int milliseconds)
+{
+	struct timeval now;
+	long long nsec;
+
+	gettimeofday(&now, NULL);
+	nsec = (long long)now.tv_usec * 1000 + (long long)(milliseconds % 1000) * 1000000;
+	ts->tv_sec = now.tv_sec + milliseconds / 1000 + (time_t)(nsec / 1000000000);
+	ts->tv_nsec = (long)(nsec % 1000000000);
+}
+
 void get_CurrentTime(char* date_time_ms, int date_time_ms_max_size)
 {
 	#define CURRENT_TIME_SIZE (30)
@@ -331,7 +345,7 @@ int socket_read_nbytes(int sockfd, unsigned char* buf, int nb_bytes)
 
 	while(1)
 	{
-		nb_read = recv(sockfd, (char*)p, bytes_left, MSG_WAITALL);
+		nb_read = sockRecv(sockfd, p, bytes_left, MSG_WAITALL);
 		if(nb_read < 0)
 			break;
 
@@ -355,3 +369,58 @@ int socket_read_nbytes(int sockfd, unsigned char* buf, int nb_bytes)
 
 	return nb_total_read;
 }
+
+int sockUringInit(unsigned int entries, int timeout_second)
+{
+	if(sock_uring_init(&sock_uring, entries) != 0)
+		return -1;
+	sock_uring.timeout_ms = timeout_second * 1000;
+	sock_uring_enabled = 1;
+	return 0;
+}
+
+void sockUringQuit(void)
+{
+	if(sock_uring_enabled)
+	{
+		sock_uring_exit(&sock_uring);
+		sock_uring_enabled = 0;
+	}
+}
+
+int sockUringEnabled(void)
+{
+	return sock_uring_enabled;
+}
+
+const char* sockUringError(void)
+{
+	return (sock_uring.error != NULL) ? sock_uring.error : "io_uring not initialized";
+}
+
+int sockUringRegisterBuffer(void* buf, size_t len)
+{
+	if(!sock_uring_enabled)
+		return -1;
+	return sock_uring_register_buffer(&sock_uring, buf, len);
+}
+
+sock_uring_t* sockUring(void)
+{
+	return sock_uring_enabled ? &sock_uring : NULL;
+}
+
+int sockRecv(int socket, void* buf, int len, int flags)
+{
+	if(sock_uring_enabled)
+		return sock_uring_recv(&sock_uring, socket, buf, len, flags);
+	return recv(socket, (char*)buf, len, flags);
+}
+
+int sockRecvWrite(int socket, void* buf, int len, int out_fd, const void* src, size_t src_len, long long out_off, int* written)
+{
+	if(sock_uring_enabled)
+		return sock_uring_recv_write(&sock_uring, socket, buf, len, out_fd, src, src_len, out_off, written);
+	*written = 0;
+	return recv(socket, (char*)buf, len, MSG_WAITALL);
+}
@@ -17,6 +17,9 @@
 #define __SOCKET_PORTABLE_H__
 
 #include <time.h>
+#include <stddef.h>
+
+#include "sock_uring.h"
 
 #ifdef __MINGW32__
   #include <fcntl.h> // for open
@@ -60,6 +63,8 @@ int gettimeofday(struct timeval *tv, void* ignored);
 #endif
 void get_CurrentTime(char* date_time_ms, int date_time_ms_max_size);
 float TimevalDiff(const struct timeval *a, const struct timeval *b);
+/* Absolute time milliseconds from now (gettimeofday() clock, pthread_cond_timedwait() deadline) */
+void TimespecAfterMs(struct timespec *ts, int milliseconds);
 
 int sockInit(void);
 int sockQuit(void);
@@ -76,6 +81,31 @@ void sockSetOpt_Timeout(int socket, char* opt_name_ascii, int level, int opt_nam
 int socket_write_nbytes(int sockfd, unsigned char* buf, int nb_bytes);
 int socket_read_nbytes(int sockfd, unsigned char* buf, int nb_bytes);
 
+/*
+ * Optional io_uring receive backend (GNU/Linux only, see sock_uring.h)
+ * Once sockUringInit() succeeds sockRecv() goes through the ring (blocking
+ * operations cancelled after timeout_second like SO_RCVTIMEO), else it is recv()
+ * The ring shall only be used by a single thread.
+ */
+int sockUringInit(unsigned int entries, int timeout_second);
+void sockUringQuit(void);
+int sockUringEnabled(void);
+/* Reason why sockUringInit()/sockUringRegisterBuffer() failed */
+const char* sockUringError(void);
+/* Register buf so sockRecv() into it (flags 0) is a READ_FIXED, return 0 if OK or -1 */
+int sockUringRegisterBuffer(void* buf, size_t len);
+/* Ring used by sockRecv(), NULL if not enabled (multishot recv event loop) */
+sock_uring_t* sockUring(void);
+
+/* recv() through io_uring when enabled */
+int sockRecv(int socket, void* buf, int len, int flags);
+/*
+ * MSG_WAITALL recv() of len bytes chained (single io_uring_enter()) with the write
+ * of src/src_len at offset out_off of out_fd, *written is the nb bytes written
+ * Without io_uring only the recv() is done and *written is 0
+ */
+int sockRecvWrite(int socket, void* buf, int len, int out_fd, const void* src, size_t src_len, long long out_off, int* written);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "socket_portable.h"
+#include "sample_convert.h"
+#include "spectrum.h"
+
+#ifndef M_PI
+	#define M_PI (3.14159265358979323846)
+#endif
+
+/* Power floor of the empty bins (-300 dBV) */
+#define SPECTRUM_POW_MIN (1e-30)
+
+static const char* spectrum_window_names[SPECTRUM_NB_WINDOWS] = { "hann", "blackman", "flattop" };
+
+int spectrum_window_parse(const char* name)
+{
+	int k;
+
+	for(k = 0; k < SPECTRUM_NB_WINDOWS; k++)
+	{
+		if(strcmp(name, spectrum_window_names[k]) == 0)
+			return k;
+	}
+	return -1;
+}
+
+const char* spectrum_window_name(spectrum_window_t window)
+{
+	return ((unsigned int)window < SPECTRUM_NB_WINDOWS) ? spectrum_window_names[window] : "unknown";
+}
+
+/* Periodic window (spectral analysis) */
+static double spectrum_window_coef(spectrum_window_t window, size_t i, size_t n)
+{
+	double x = 2.0 * M_PI * i / n;
+
+	switch(window)
+	{
+		case SPECTRUM_WINDOW_BLACKMAN:
+			return 0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x);
+		case SPECTRUM_WINDOW_FLATTOP:
+			return 0.21557895 - 0.41663158 * cos(x) + 0.277263158 * cos(2 * x) - 0.083578947 * cos(3 * x) + 0.006947368 * cos(4 * x);
+		case SPECTRUM_WINDOW_HANN:
+		default:
+			return 0.5 - 0.5 * cos(x);
+	}
+}
+
+static void put_u32(unsigned char* dst, uint32_t val)
+{
+	int i;
+
+	for(i = 0; i < 4; i++)
+		dst[i] = (unsigned char)(val >> (i * 8));
+}
+
+static void put_u64(unsigned char* dst, uint64_t val)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		dst[i] = (unsigned char)(val >> (i * 8));
+}
+
+int spectrum_init(spectrum_t* s, const char* filename, spectrum_window_t window, size_t nfft, unsigned int nb_avg,
+				int nb_threads, const int* chan_list, int nb_chan, size_t max_points, unsigned char* const* slabs)
+{
+	unsigned char hdr[SPECTRUM_FILE_HDR_SIZE];
+	spectrum_chan_t* c;
+	size_t i;
+	int k;
+
+	memset(s, 0, sizeof(spectrum_t));
+	if( (nb_chan < 1) || (nb_chan > SPECTRUM_MAX_CHAN) || (nfft > max_points) || (nb_avg < 1) ||
+		(fft_plan_init(&s->plan, nfft, nb_threads) != 0) )
+		return -1;
+	s->window = window;
+	s->nb_avg = nb_avg;
+	s->win = malloc(nfft * sizeof(float));
+	s->db = malloc((nfft / 2 + 1) * sizeof(float));
+	if( (s->win == NULL) || (s->db == NULL) )
+	{
+		spectrum_close(s);
+		return -1;
+	}
+	for(i = 0; i < nfft; i++)
+	{
+		s->win[i] = (float)spectrum_window_coef(window, i, nfft);
+		s->win_sum += s->win[i];
+	}
+	s->nb_chan = nb_chan;
+	for(k = 0; k < nb_chan; k++)
+	{
+		s->chan_list[k] = chan_list[k];
+		c = &s->ch[chan_list[k]];
+		c->capacity = max_points;
+		if( (slabs != NULL) && (slabs[chan_list[k]] != NULL) )
+		{
+			c->data = slabs[chan_list[k]];
+		} else
+		{
+			c->data = malloc(max_points);
+			c->own_data = 1;
+		}
+		c->pow = calloc(nfft / 2 + 1, sizeof(double));
+		if( (c->data == NULL) || (c->pow == NULL) )
+		{
+			printf("ERROR spectrum_init() malloc(%zu)\n", max_points);
+			spectrum_close(s);
+			return -1;
+		}
+	}
+
+	s->fp = fopen(filename, "wb");
+	if(s->fp == NULL)
+	{
+		spectrum_close(s);
+		return -1;
+	}
+	memcpy(hdr, SPECTRUM_MAGIC, 4);
+	put_u32(&hdr[4], window);
+	if(fwrite(hdr, sizeof(hdr), 1, s->fp) != 1)
+	{
+		spectrum_close(s);
+		return -1;
+	}
+	return 0;
+}
+
+void spectrum_begin(spectrum_t* s, int chan)
+{
+	s->ch[chan].nb_samples = 0;
+}
+
+int spectrum_feed(spectrum_t* s, int chan, size_t offset, const unsigned char* samples, size_t nb_samples)
+{
+	spectrum_chan_t* c = &s->ch[chan];
+
+	if( (offset + nb_samples) > c->capacity )
+		return -1;
+	if(&c->data[offset] != samples)
+		memcpy(&c->data[offset], samples, nb_samples);
+	if( (offset + nb_samples) > c->nb_samples )
+		c->nb_samples = offset + nb_samples;
+	return 0;
+}
+
+static int spectrum_write(spectrum_t* s, spectrum_chan_t* c, int chan, unsigned int waveform_nb, double sec_per_sample)
+{
+	unsigned char hdr[SPECTRUM_RECORD_HDR_SIZE];
+	const size_t nb_bins = s->plan.n / 2 + 1;
+	/* |X[k]| = A/2 * sum(w) for a sine of amplitude A, RMS = A/sqrt(2) (DC and fs/2 bins are not doubled) */
+	const double scale = 1.0 / (s->win_sum * s->win_sum * c->nb_spectra);
+	double bin_hz = 1.0 / (s->plan.n * sec_per_sample);
+	double pw;
+	size_t k;
+
+	for(k = 0; k < nb_bins; k++)
+	{
+		pw = c->pow[k] * scale * (((k == 0) || (k == (nb_bins - 1))) ? 1.0 : 2.0);
+		s->db[k] = (float)(10.0 * log10((pw > SPECTRUM_POW_MIN) ? pw : SPECTRUM_POW_MIN));
+	}
+	put_u32(&hdr[0], waveform_nb);
+	put_u32(&hdr[4], chan);
+	put_u64(&hdr[8], nb_bins);
+	put_u32(&hdr[16], c->nb_spectra);
+	put_u32(&hdr[20], 0);
+	memcpy(&hdr[24], &bin_hz, sizeof(double));
+	if( (fwrite(hdr, sizeof(hdr), 1, s->fp) != 1) || (fwrite(s->db, sizeof(float), nb_bins, s->fp) != nb_bins) )
+		return -1;
+	s->nb_records++;
+	return 0;
+}
+
+int spectrum_channel(spectrum_t* s, int chan, unsigned int waveform_nb, double ydelta, double yinc, double sec_per_sample)
+{
+	spectrum_chan_t* c = &s->ch[chan];
+	const size_t nfft = s->plan.n;
+	struct timeval start_tv;
+	struct timeval end_tv;
+	float* in;
+	size_t start;
+	size_t i;
+	int err = 0;
+
+	if(c->nb_samples < nfft)
+		return -1;
+	gettimeofday(&start_tv, NULL);
+	/* Segments of nfft with 50% overlap (a single segment when nfft is the record length) */
+	for(start = 0; (start + nfft) <= c->nb_samples; start += (nfft / 2 > 0) ? nfft / 2 : 1)
+	{
+		in = fft_input(&s->plan);
+		sample_convert(&c->data[start], in, nfft, (float)ydelta, (float)yinc);
+		for(i = 0; i < nfft; i++)
+			in[i] *= s->win[i];
+		fft_real_power(&s->plan, c->pow);
+		c->nb_spectra++;
+		s->nb_fft++;
+	}
+	gettimeofday(&end_tv, NULL);
+	s->fft_time_s += TimevalDiff(&end_tv, &start_tv);
+
+	if(++c->nb_waveforms == s->nb_avg)
+	{
+		err = spectrum_write(s, c, chan, waveform_nb, sec_per_sample);
+		memset(c->pow, 0, (nfft / 2 + 1) * sizeof(double));
+		c->nb_spectra = 0;
+		c->nb_waveforms = 0;
+	}
+	return err;
+}
+
+void spectrum_close(spectrum_t* s)
+{
+	spectrum_chan_t* c;
+	int k;
+
+	for(k = 0; k < SPECTRUM_MAX_CHAN; k++)
+	{
+		c = &s->ch[k];
+		if(c->own_data)
+			free(c->data);
+		free(c->pow);
+		c->data = NULL;
+		c->own_data = 0;
+		c->pow = NULL;
+	}
+	free(s->win);
+	free(s->db);
+	s->win = NULL;
+	s->db = NULL;
+	if(s->plan.n > 0)
+		fft_plan_free(&s->plan);
+	if(s->fp != NULL)
+	{
+		fclose(s->fp);
+		s->fp = NULL;
+	}
+	s->nb_chan = 0;
+}
+
+void spectrum_print(const spectrum_t* s)
+{
+	printf("spectrum: %u records, %llu FFT in %05.04f s (%05.03f MSamples/s)\n",
+			s->nb_records, s->nb_fft, s->fft_time_s,
+			(s->fft_time_s > 0) ? (s->nb_fft * (double)s->plan.n / 1e6) / s->fft_time_s : 0.0);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __SPECTRUM_H__
+#define __SPECTRUM_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fft.h"
+
+/*
+ * Windowed magnitude spectra (dBV RMS) of 8-bit channels with the :WAV:PRE? scaling
+ * The samples of each channel are copied in a channel slab as they are received.
+ * Once the channel is complete it is cut in segments of nfft points (50% overlap
+ * when nfft is smaller than the record), each segment is converted to volts,
+ * windowed and transformed (fft.h, multi-threaded for big transforms), and the
+ * power of the bins is averaged over the segments of nb_avg waveforms (Welch)
+ * before the spectrum is written.
+ * A sine of amplitude A volts reads 20*log10(A/sqrt(2)) dBV at its bin (scaled by
+ * the coherent gain of the window, the flat-top window keeps it within 0.01 dB
+ * between bins).
+ *
+ * File: "SPC1" + window (uint32) then one record per channel and average:
+ * waveform_nb (uint32, last waveform of the average), chan (uint32, 0 based),
+ * nb_bins (uint64, nfft/2 + 1), nb_spectra (uint32, segments averaged), reserved (uint32),
+ * bin_hz (float64) followed by the nb_bins float32 dBV from DC to fs/2 (little endian)
+ */
+
+#define SPECTRUM_MAGIC "SPC1"
+#define SPECTRUM_FILE_HDR_SIZE (8)
+#define SPECTRUM_RECORD_HDR_SIZE (32)
+#define SPECTRUM_MAX_CHAN (4)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	SPECTRUM_WINDOW_HANN = 0,
+	SPECTRUM_WINDOW_BLACKMAN,
+	SPECTRUM_WINDOW_FLATTOP,
+	SPECTRUM_NB_WINDOWS
+} spectrum_window_t;
+
+typedef struct
+{
+	unsigned char* data;
+	int own_data; /* Slab allocated by spectrum_init() */
+	size_t capacity;
+	size_t nb_samples;
+	double* pow; /* Power of each bin summed over the spectra of the average */
+	unsigned int nb_spectra;
+	unsigned int nb_waveforms;
+} spectrum_chan_t;
+
+typedef struct
+{
+	FILE* fp;
+	fft_plan_t plan;
+	spectrum_window_t window;
+	float* win; /* nfft coefficients */
+	double win_sum;
+	unsigned int nb_avg; /* Waveforms averaged per record */
+	int nb_chan;
+	int chan_list[SPECTRUM_MAX_CHAN];
+	spectrum_chan_t ch[SPECTRUM_MAX_CHAN];
+	float* db; /* Record being written */
+
+	/* Statistics */
+	unsigned int nb_records;
+	unsigned long long nb_fft;
+	double fft_time_s; /* Conversion + window + FFT */
+} spectrum_t;
+
+/* Window from its name ("hann", "blackman" or "flattop"), -1 if unknown */
+int spectrum_window_parse(const char* name);
+const char* spectrum_window_name(spectrum_window_t window);
+
+/*
+ * Create the spectrum file, allocate a slab of max_points for each of the nb_chan channels of chan_list
+ * and plan the nfft points FFT (nfft shall be valid for fft.h and <= max_points), return 0 if OK or -1
+ * slabs (indexed by channel, can be NULL) gives the slabs of max_points the channels are already received in
+ */
+int spectrum_init(spectrum_t* s, const char* filename, spectrum_window_t window, size_t nfft, unsigned int nb_avg,
+				int nb_threads, const int* chan_list, int nb_chan, size_t max_points, unsigned char* const* slabs);
+/* Start a new waveform of the channel */
+void spectrum_begin(spectrum_t* s, int chan);
+/* Copy nb_samples received at offset (0 based point) of the channel (unless already in its slab), return 0 if OK or -1 (out of slab) */
+int spectrum_feed(spectrum_t* s, int chan, size_t offset, const unsigned char* samples, size_t nb_samples);
+/*
+ * Channel complete: add the spectra of its segments to the average, the record is written
+ * after nb_avg waveforms, return 0 if OK or -1 (less than nfft samples, write error)
+ */
+int spectrum_channel(spectrum_t* s, int chan, unsigned int waveform_nb, double ydelta, double yinc, double sec_per_sample);
+/* Free the slabs and the plan, close the file (incomplete averages are not written) */
+void spectrum_close(spectrum_t* s);
+void spectrum_print(const spectrum_t* s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SPECTRUM_H__ */
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WIN32
+	#define _GNU_SOURCE /* pthread_setaffinity_np() */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "socket_portable.h"
+#include "transport_profile.h"
+
+#ifndef _WIN32
+	#include <sched.h>
+#endif
+
+static const char* transport_profile_names[TRANSPORT_PROFILE_NB] = { "none", "bulk", "lowlat" };
+
+int transport_profile_parse(const char* name)
+{
+	int i;
+
+	for(i = 0; i < TRANSPORT_PROFILE_NB; i++)
+	{
+		if(strcmp(name, transport_profile_names[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+const char* transport_profile_name(transport_profile_mode_t mode)
+{
+	return transport_profile_names[mode];
+}
+
+static int transport_profile_get_rcvbuf(int sockfd)
+{
+	int val = 0;
+	socklen_t len = sizeof(val);
+
+	getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, (char*)&val, &len);
+	return val;
+}
+
+void transport_profile_init(transport_profile_t* tp, int sockfd, transport_profile_mode_t mode, int cpu)
+{
+	memset(tp, 0, sizeof(transport_profile_t));
+	tp->mode = mode;
+	tp->sockfd = sockfd;
+	tp->cpu = cpu;
+	tp->rcvbuf_default = transport_profile_get_rcvbuf(sockfd);
+	tp->rcvbuf = tp->rcvbuf_default;
+}
+
+#ifndef _WIN32
+/* Max SO_RCVBUF allowed without CAP_NET_ADMIN, 0 if unknown */
+static int transport_profile_rmem_max(void)
+{
+	FILE* f;
+	int val = 0;
+
+	f = fopen("/proc/sys/net/core/rmem_max", "r");
+	if(f == NULL)
+		return 0;
+	if(fscanf(f, "%d", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+#endif
+
+void transport_profile_apply(transport_profile_t* tp, size_t block_size, int nb_in_flight)
+{
+	size_t requested;
+	int val;
+	int sockfd = tp->sockfd;
+#ifndef _WIN32
+	int rmem_max;
+#endif
+
+	if(tp->mode == TRANSPORT_PROFILE_NONE)
+		return;
+
+	/* All the replies in flight fit in the socket buffer */
+	requested = block_size * (nb_in_flight > 0 ? nb_in_flight : 1);
+	if(requested > TRANSPORT_PROFILE_RCVBUF_MAX)
+		requested = TRANSPORT_PROFILE_RCVBUF_MAX;
+	tp->rcvbuf_requested = (int)requested;
+	if(tp->rcvbuf_requested > tp->rcvbuf_default)
+	{
+		val = tp->rcvbuf_requested;
+#ifdef _WIN32
+		setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, (const char*)&val, sizeof(val));
+#else
+		rmem_max = transport_profile_rmem_max();
+		if(val <= rmem_max)
+		{
+			setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+		} else if(setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &val, sizeof(val)) != 0)
+		{
+			/* SO_RCVBUF disables the autotuning, a value clamped to rmem_max would be worse */
+			tp->rcvbuf_autotuning = 1;
+		}
+#endif
+		tp->rcvbuf = transport_profile_get_rcvbuf(sockfd);
+	}
+	tp->waitall = 1;
+
+	if(tp->mode == TRANSPORT_PROFILE_LOWLAT)
+	{
+#ifdef SO_BUSY_POLL
+		/* Raising it above net.core.busy_read requires CAP_NET_ADMIN */
+		val = TRANSPORT_PROFILE_BUSY_POLL_US;
+		if(setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) == 0)
+			tp->busy_poll_us = val;
+#endif
+#ifdef TCP_QUICKACK
+		tp->quickack = 1;
+#endif
+	}
+}
+
+int transport_profile_pin_cpu(transport_profile_t* tp)
+{
+	if(tp->cpu < 0)
+		return 0;
+#ifdef _WIN32
+	if(SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << tp->cpu) == 0)
+		return -1;
+#else
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(tp->cpu, &cpuset);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+		return -1;
+#endif
+	tp->cpu_pinned = 1;
+	return 0;
+}
+
+static void transport_profile_rearm(transport_profile_t* tp)
+{
+#ifdef TCP_QUICKACK
+	/* Not permanent, the kernel can go back to delayed ACKs after each recv() */
+	if(tp->quickack)
+	{
+		int val = 1;
+		setsockopt(tp->sockfd, IPPROTO_TCP, TCP_QUICKACK, &val, sizeof(val));
+	}
+#endif
+}
+
+int transport_profile_recv(transport_profile_t* tp, void* dst, int nb_bytes, int exact)
+{
+	int flags = 0;
+	int read_nb;
+
+	if(exact && tp->waitall)
+	{
+		/* Returns only once nb_bytes are received (or on error/timeout/signal) */
+		flags = MSG_WAITALL;
+		if(nb_bytes > TRANSPORT_PROFILE_WAITALL_MAX)
+			nb_bytes = TRANSPORT_PROFILE_WAITALL_MAX;
+		tp->nb_recv_waitall++;
+	}
+	read_nb = sockRecv(tp->sockfd, dst, nb_bytes, flags);
+	tp->nb_recv++;
+	transport_profile_rearm(tp);
+	return read_nb;
+}
+
+int transport_profile_recv_write(transport_profile_t* tp, void* dst, int nb_bytes,
+								int out_fd, const void* src, size_t src_len, long long out_off, int* written)
+{
+	int read_nb;
+
+	read_nb = sockRecvWrite(tp->sockfd, dst, nb_bytes, out_fd, src, src_len, out_off, written);
+	tp->nb_recv++;
+	tp->nb_recv_waitall++;
+	transport_profile_rearm(tp);
+	return read_nb;
+}
+
+void transport_profile_print(const transport_profile_t* tp)
+{
+	printf("Transport profile %s: SO_RCVBUF=%d", transport_profile_name(tp->mode), tp->rcvbuf);
+	if(tp->rcvbuf_requested > 0)
+	{
+		printf(" (requested %d, default %d%s)", tp->rcvbuf_requested, tp->rcvbuf_default,
+				tp->rcvbuf_autotuning ? ", above rmem_max: kernel autotuning kept" : "");
+	}
+	printf(", MSG_WAITALL=%s", tp->waitall ? "on" : "off");
+	if(tp->waitall)
+		printf(" (reads up to %d bytes)", TRANSPORT_PROFILE_WAITALL_MAX);
+	if(tp->mode == TRANSPORT_PROFILE_LOWLAT)
+	{
+		if(tp->busy_poll_us > 0)
+			printf(", SO_BUSY_POLL=%dus", tp->busy_poll_us);
+		else
+			printf(", SO_BUSY_POLL=unavailable");
+		printf(", TCP_QUICKACK=%s", tp->quickack ? "on" : "unavailable");
+	}
+	if(tp->cpu >= 0)
+		printf(", receive thread CPU=%d%s", tp->cpu, tp->cpu_pinned ? "" : " (pinning failed)");
+	printf("\n");
+}
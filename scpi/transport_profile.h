@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __TRANSPORT_PROFILE_H__
+#define __TRANSPORT_PROFILE_H__
+
+#include <stddef.h>
+
+/*
+ * Socket tuning of the data connection
+ * none: kernel defaults, recv() returns whatever is available
+ * bulk: SO_RCVBUF sized for the blocks in flight and MSG_WAITALL reads when
+ *       the number of bytes of the current reply is known
+ * lowlat: bulk + SO_BUSY_POLL and TCP_QUICKACK (Linux only)
+ * The receive thread can also be pinned to a CPU.
+ */
+
+/* Largest MSG_WAITALL read (samples are converted/stored by chunks of this size) */
+#define TRANSPORT_PROFILE_WAITALL_MAX (1024*1024)
+/* SO_RCVBUF is never sized above this */
+#define TRANSPORT_PROFILE_RCVBUF_MAX (64*1024*1024)
+#define TRANSPORT_PROFILE_BUSY_POLL_US (50)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	TRANSPORT_PROFILE_NONE = 0,
+	TRANSPORT_PROFILE_BULK,
+	TRANSPORT_PROFILE_LOWLAT,
+	TRANSPORT_PROFILE_NB
+} transport_profile_mode_t;
+
+typedef struct
+{
+	transport_profile_mode_t mode;
+	int sockfd;
+	int cpu; /* -1 no pinning */
+	int cpu_pinned;
+
+	/* SO_RCVBUF as reported by getsockopt() (Linux reports twice the value set) */
+	int rcvbuf_default;
+	int rcvbuf_requested;
+	int rcvbuf;
+	int rcvbuf_autotuning; /* Requested size not allowed, kernel autotuning kept */
+
+	int waitall;
+	int busy_poll_us; /* Applied value, 0 if not enabled */
+	int quickack;
+
+	/* Statistics */
+	unsigned int nb_recv;
+	unsigned int nb_recv_waitall;
+} transport_profile_t;
+
+/* Return the mode from its name ("none", "bulk" or "lowlat") or -1 */
+int transport_profile_parse(const char* name);
+const char* transport_profile_name(transport_profile_mode_t mode);
+
+void transport_profile_init(transport_profile_t* tp, int sockfd, transport_profile_mode_t mode, int cpu);
+/* Apply the socket options, block_size is the biggest expected reply and nb_in_flight the number of replies in flight */
+void transport_profile_apply(transport_profile_t* tp, size_t block_size, int nb_in_flight);
+/* Pin the calling (receive) thread to tp->cpu, return 0 if OK or not requested */
+int transport_profile_pin_cpu(transport_profile_t* tp);
+
+/*
+ * recv() with the options of the profile
+ * exact != 0 when the nb_bytes all belong to the current reply, a MSG_WAITALL read is then used
+ */
+int transport_profile_recv(transport_profile_t* tp, void* dst, int nb_bytes, int exact);
+/*
+ * MSG_WAITALL recv() of nb_bytes (<= TRANSPORT_PROFILE_WAITALL_MAX) chained with a write of
+ * src/src_len at offset out_off of out_fd (see sockRecvWrite()), *written is 0 if not written
+ */
+int transport_profile_recv_write(transport_profile_t* tp, void* dst, int nb_bytes,
+								int out_fd, const void* src, size_t src_len, long long out_off, int* written);
+
+void transport_profile_print(const transport_profile_t* tp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __TRANSPORT_PROFILE_H__ */
@@ -0,0 +1,201 @@
+/*
+ * Parse Rigol MSO5000 Waveform *.bin files (same format as Rigol_MSO5000_Waveform_bin.bt)
+ */
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "rigol_bin.h"
+
+#define APP_NAME "MSO5000_BIN"
+#define VERSION "v0.1.2 13/12/2020 B.VERNOUX"
+
+#define BANNER1 APP_NAME " " VERSION "\n"
+#define SYNTAX "Syntax: " APP_NAME " <waveform.bin> [<waveform.bin> ...] [-c<chunk_samples>] [-d<channel number to dump as text>]\nExample:\n" APP_NAME " examples/Rigol_MSO5000_4CH_200KSPS_1Kpts.bin\n"
+
+#define CHUNK_SAMPLES_DEFAULT (1024*1024)
+
+void print_channel_info(const rigol_bin_channel_t* channel, unsigned int i, unsigned int* la_nb)
+{
+	const rigol_mso5k_bin_waveforms* wfm = channel->header;
+
+	/* Same output as Rigol_MSO5000_Waveform_bin.bt */
+	if(channel->sample_type == RIGOL_BIN_SAMPLE_LA)
+	{
+		printf((*la_nb == 0) ? "LA D7-D0 " : "LA D15-D8 ");
+		(*la_nb)++;
+	} else
+	{
+		printf("CH%u ", i+1);
+	}
+	if(wfm->x_increment <= 1e-9) {
+		printf("%.fGSa/s(%.1fns) ", (1/wfm->x_increment)/1e9, wfm->x_increment*1e9);
+	} else if(wfm->x_increment <= 1e-6) {
+		printf("%.1fMSa/s(%.3fus) ", (1/wfm->x_increment)/1e6, wfm->x_increment*1e6);
+	} else {
+		printf("%.fKSa/s(%.3fms) ", (1/wfm->x_increment)/1e3, (wfm->x_increment)*1e3);
+	}
+	if(wfm->nb_points >= 1e6) {
+		printf("%.fMpts ", wfm->nb_points/1e6);
+	} else {
+		printf("%.fkpts ", wfm->nb_points/1e3);
+	}
+	printf("x_origin: %fs\n", wfm->x_origin);
+	printf("  label=%.16s date=%.16s time=%.16s model_sn=%.24s buffer_type=%d bytes_per_point=%u nb_samples=%zu\n",
+			wfm->waveform_label, wfm->date, wfm->time, wfm->model_sn,
+			wfm->buffer_type, wfm->bytes_per_point, channel->nb_samples);
+}
+
+/* Compute min/max/mean with the chunked iterator */
+void print_channel_stats(const rigol_bin_t* rb, unsigned int i, size_t chunk_samples)
+{
+	rigol_bin_iter_t it;
+	double min = DBL_MAX;
+	double max = -DBL_MAX;
+	double sum = 0;
+	double v;
+	size_t j;
+	size_t nb_chunks = 0;
+
+	rigol_bin_iter_init(&it, rb, i, chunk_samples);
+	while(rigol_bin_iter_next(&it))
+	{
+		for(j = 0; j < it.nb_samples; j++)
+		{
+			switch(it.channel->sample_type)
+			{
+				case RIGOL_BIN_SAMPLE_FLOAT:
+					v = ((const float*)it.data)[j];
+					break;
+				case RIGOL_BIN_SAMPLE_LA:
+					v = ((const unsigned short*)it.data)[j];
+					break;
+				case RIGOL_BIN_SAMPLE_U8:
+				default:
+					v = ((const unsigned char*)it.data)[j];
+					break;
+			}
+			if(v < min)
+				min = v;
+			if(v > max)
+				max = v;
+			sum += v;
+		}
+		nb_chunks++;
+	}
+	if(it.channel->nb_samples > 0)
+		printf("  min=%f max=%f mean=%f (%zu chunks)\n", min, max, sum / it.channel->nb_samples, nb_chunks);
+}
+
+void dump_channel(const rigol_bin_t* rb, unsigned int i, size_t chunk_samples)
+{
+	rigol_bin_iter_t it;
+	size_t j;
+
+	rigol_bin_iter_init(&it, rb, i, chunk_samples);
+	while(rigol_bin_iter_next(&it))
+	{
+		for(j = 0; j < it.nb_samples; j++)
+		{
+			switch(it.channel->sample_type)
+			{
+				case RIGOL_BIN_SAMPLE_FLOAT:
+					printf("%g\n", ((const float*)it.data)[j]);
+					break;
+				case RIGOL_BIN_SAMPLE_LA:
+					printf("0x%04X\n", ((const unsigned short*)it.data)[j]);
+					break;
+				case RIGOL_BIN_SAMPLE_U8:
+				default:
+					printf("%u\n", ((const unsigned char*)it.data)[j]);
+					break;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	rigol_bin_t rb;
+	size_t chunk_samples = CHUNK_SAMPLES_DEFAULT;
+	int dump_chan = 0;
+	unsigned int la_nb;
+	unsigned int j;
+	int nb_files = 0;
+	int err = 0;
+	int i;
+
+	for(i = 1; i < argc; i++)
+	{
+		if(strncmp(argv[i], "-c", 2) == 0)
+		{
+			chunk_samples = strtoul(&argv[i][2], NULL, 10);
+		} else if(strncmp(argv[i], "-d", 2) == 0)
+		{
+			dump_chan = atoi(&argv[i][2]);
+		} else if(argv[i][0] == '-')
+		{
+			printf("Error unknown argument %s\n", argv[i]);
+			printf(SYNTAX);
+			exit(-3);
+		} else
+		{
+			nb_files++;
+		}
+	}
+	if(nb_files == 0)
+	{
+		printf(BANNER1);
+		printf(SYNTAX);
+		exit(0);
+	}
+
+	for(i = 1; i < argc; i++)
+	{
+		if(argv[i][0] == '-')
+			continue;
+		if(rigol_bin_open(&rb, argv[i]) != 0)
+		{
+			err = -1;
+			continue;
+		}
+		if(dump_chan > 0)
+		{
+			/* Only samples, to be used in a pipeline */
+			if((unsigned int)dump_chan <= rb.nb_channels)
+				dump_channel(&rb, dump_chan - 1, chunk_samples);
+			else
+				err = -1;
+			rigol_bin_close(&rb);
+			continue;
+		}
+
+		printf("%s: cookie=%.2s version=%.2s file_size=%u (real %zu) nb_waveforms=%u\n", argv[i],
+				rb.file_header->cookie, rb.file_header->file_version,
+				rb.file_header->file_size, rb.size, rb.file_header->nb_waveforms);
+		la_nb = 0;
+		for(j = 0; j < rb.nb_channels; j++)
+		{
+			print_channel_info(&rb.channels[j], j, &la_nb);
+			print_channel_stats(&rb, j, chunk_samples);
+		}
+		rigol_bin_close(&rb);
+	}
+	return err;
+}
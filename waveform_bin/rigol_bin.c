@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rigol_bin.h"
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <errno.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+static int rigol_bin_map(rigol_bin_t* rb, const char* filename)
+{
+#ifdef _WIN32
+	LARGE_INTEGER file_size;
+
+	rb->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(rb->file == INVALID_HANDLE_VALUE)
+	{
+		printf("ERROR rigol_bin_open(%s) CreateFile() (error=%lu)\n", filename, GetLastError());
+		return -1;
+	}
+	if(!GetFileSizeEx(rb->file, &file_size) || (file_size.QuadPart == 0))
+	{
+		printf("ERROR rigol_bin_open(%s) empty file\n", filename);
+		return -1;
+	}
+	rb->size = (size_t)file_size.QuadPart;
+	rb->mapping = CreateFileMapping(rb->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(rb->mapping == NULL)
+	{
+		printf("ERROR rigol_bin_open(%s) CreateFileMapping() (error=%lu)\n", filename, GetLastError());
+		return -1;
+	}
+	rb->map = (const unsigned char*)MapViewOfFile(rb->mapping, FILE_MAP_READ, 0, 0, 0);
+	if(rb->map == NULL)
+	{
+		printf("ERROR rigol_bin_open(%s) MapViewOfFile() (error=%lu)\n", filename, GetLastError());
+		return -1;
+	}
+#else
+	struct stat st;
+	void* map;
+
+	rb->fd = open(filename, O_RDONLY);
+	if(rb->fd < 0)
+	{
+		printf("ERROR rigol_bin_open(%s) open() (errno=%d)\n", filename, errno);
+		return -1;
+	}
+	if( (fstat(rb->fd, &st) != 0) || (st.st_size == 0) )
+	{
+		printf("ERROR rigol_bin_open(%s) empty file\n", filename);
+		return -1;
+	}
+	rb->size = (size_t)st.st_size;
+	map = mmap(NULL, rb->size, PROT_READ, MAP_SHARED, rb->fd, 0);
+	if(map == MAP_FAILED)
+	{
+		printf("ERROR rigol_bin_open(%s) mmap() (errno=%d)\n", filename, errno);
+		return -1;
+	}
+	rb->map = (const unsigned char*)map;
+#endif
+	return 0;
+}
+
+static void rigol_bin_unmap(rigol_bin_t* rb)
+{
+#ifdef _WIN32
+	if(rb->map != NULL)
+		UnmapViewOfFile(rb->map);
+	if(rb->mapping != NULL)
+		CloseHandle(rb->mapping);
+	if(rb->file != INVALID_HANDLE_VALUE)
+		CloseHandle(rb->file);
+	rb->file = INVALID_HANDLE_VALUE;
+	rb->mapping = NULL;
+#else
+	if(rb->map != NULL)
+		munmap((void*)rb->map, rb->size);
+	if(rb->fd >= 0)
+		close(rb->fd);
+	rb->fd = -1;
+#endif
+	rb->map = NULL;
+}
+
+int rigol_bin_open(rigol_bin_t* rb, const char* filename)
+{
+	const rigol_mso5k_bin_waveforms* wfm;
+	rigol_bin_channel_t* channel;
+	size_t offset;
+	size_t max_waveforms;
+	unsigned int i;
+
+	memset(rb, 0, sizeof(rigol_bin_t));
+#ifdef _WIN32
+	rb->file = INVALID_HANDLE_VALUE;
+#else
+	rb->fd = -1;
+#endif
+	if(rigol_bin_map(rb, filename) != 0)
+	{
+		rigol_bin_close(rb);
+		return -1;
+	}
+
+	if(rb->size < RIGOL_BIN_FILE_HEADER_SIZE)
+	{
+		printf("ERROR rigol_bin_open(%s) file too small (%zu bytes)\n", filename, rb->size);
+		rigol_bin_close(rb);
+		return -1;
+	}
+	rb->file_header = (const rigol_mso5k_bin*)rb->map;
+	if( !((rb->file_header->cookie[0] == 'R' && rb->file_header->cookie[1] == 'G') ||
+		  (rb->file_header->cookie[0] == 'A' && rb->file_header->cookie[1] == 'G')) )
+	{
+		printf("Invalid Rigol MSO5000 bin file %s\n", filename);
+		rigol_bin_close(rb);
+		return -1;
+	}
+
+	/* Each waveform has at least its headers, checked before the allocation (nb_waveforms + 1 can not wrap) */
+	max_waveforms = (rb->size - RIGOL_BIN_FILE_HEADER_SIZE) / sizeof(rigol_mso5k_bin_waveforms);
+	if((size_t)rb->file_header->nb_waveforms > max_waveforms)
+	{
+		printf("ERROR rigol_bin_open(%s) nb_waveforms=%u but %zu waveform headers at most in %zu bytes\n",
+				filename, rb->file_header->nb_waveforms, max_waveforms, rb->size);
+		rigol_bin_close(rb);
+		return -1;
+	}
+	rb->channels = calloc((size_t)rb->file_header->nb_waveforms + 1, sizeof(rigol_bin_channel_t));
+	if(rb->channels == NULL)
+	{
+		rigol_bin_close(rb);
+		return -1;
+	}
+
+	/* file_size field is not reliable (does not match the real size on MSO5000 files), real size is used */
+	offset = RIGOL_BIN_FILE_HEADER_SIZE;
+	for(i = 0; i < rb->file_header->nb_waveforms; i++)
+	{
+		if( (rb->size - offset) < sizeof(rigol_mso5k_bin_waveforms) )
+		{
+			printf("ERROR rigol_bin_open(%s) waveform %u header truncated\n", filename, i);
+			rigol_bin_close(rb);
+			return -1;
+		}
+		wfm = (const rigol_mso5k_bin_waveforms*)&rb->map[offset];
+		if( (wfm->waveform_header_size != RIGOL_BIN_WAVEFORM_HEADER_SIZE) ||
+			(wfm->waveform_data_header_size != RIGOL_BIN_DATA_HEADER_SIZE) )
+		{
+			printf("ERROR rigol_bin_open(%s) waveform %u invalid header (header_size=%u, data_header_size=%u)\n",
+					filename, i, wfm->waveform_header_size, wfm->waveform_data_header_size);
+			rigol_bin_close(rb);
+			return -1;
+		}
+		offset += sizeof(rigol_mso5k_bin_waveforms);
+		if( (rb->size - offset) < wfm->buffer_size )
+		{
+			printf("ERROR rigol_bin_open(%s) waveform %u data truncated (buffer_size=%u)\n", filename, i, wfm->buffer_size);
+			rigol_bin_close(rb);
+			return -1;
+		}
+
+		channel = &rb->channels[i];
+		channel->header = wfm;
+		channel->data = &rb->map[offset];
+		channel->offset = offset;
+		if( (wfm->waveform_label[0] == 'L') && (wfm->waveform_label[1] == 'A') &&
+			(rb->file_header->cookie[0] == 'R') && (rb->file_header->cookie[1] == 'G') )
+		{
+			channel->sample_type = RIGOL_BIN_SAMPLE_LA;
+		} else
+		{
+			switch(wfm->buffer_type)
+			{
+				case Normal_32bit_float_data:
+				case Maximum_float_data:
+				case Minimum_float_data:
+					channel->sample_type = RIGOL_BIN_SAMPLE_FLOAT;
+				break;
+
+				case Digital_u8_char_data:
+				default:
+					channel->sample_type = RIGOL_BIN_SAMPLE_U8;
+				break;
+			}
+		}
+		/* The typed views and the iterators access buffer_size / sample size samples */
+		if(wfm->bytes_per_point != rigol_bin_sample_size(channel))
+		{
+			printf("ERROR rigol_bin_open(%s) waveform %u bytes_per_point=%u does not match buffer_type=%d (%zu bytes samples)\n",
+					filename, i, wfm->bytes_per_point, wfm->buffer_type, rigol_bin_sample_size(channel));
+			rigol_bin_close(rb);
+			return -1;
+		}
+		channel->nb_samples = wfm->buffer_size / rigol_bin_sample_size(channel);
+		offset += wfm->buffer_size;
+		rb->nb_channels++;
+	}
+	return 0;
+}
+
+void rigol_bin_close(rigol_bin_t* rb)
+{
+	rigol_bin_unmap(rb);
+	free(rb->channels);
+	rb->channels = NULL;
+	rb->nb_channels = 0;
+	rb->file_header = NULL;
+}
+
+const float* rigol_bin_channel_float(const rigol_bin_channel_t* channel)
+{
+	return (channel->sample_type == RIGOL_BIN_SAMPLE_FLOAT) ? (const float*)channel->data : NULL;
+}
+
+const unsigned short* rigol_bin_channel_la(const rigol_bin_channel_t* channel)
+{
+	return (channel->sample_type == RIGOL_BIN_SAMPLE_LA) ? (const unsigned short*)channel->data : NULL;
+}
+
+const unsigned char* rigol_bin_channel_u8(const rigol_bin_channel_t* channel)
+{
+	return (channel->sample_type == RIGOL_BIN_SAMPLE_U8) ? (const unsigned char*)channel->data : NULL;
+}
+
+size_t rigol_bin_sample_size(const rigol_bin_channel_t* channel)
+{
+	switch(channel->sample_type)
+	{
+		case RIGOL_BIN_SAMPLE_FLOAT:
+			return sizeof(float);
+		case RIGOL_BIN_SAMPLE_LA:
+			return sizeof(unsigned short);
+		case RIGOL_BIN_SAMPLE_U8:
+		default:
+			return sizeof(unsigned char);
+	}
+}
+
+#ifndef _WIN32
+/* Apply advice on the pages of samples [start, start+nb_samples) */
+static void rigol_bin_iter_advise(rigol_bin_iter_t* it, size_t start, size_t nb_samples, int advice)
+{
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t sample_size = rigol_bin_sample_size(it->channel);
+	size_t begin = it->channel->offset + start * sample_size;
+	size_t end = begin + nb_samples * sample_size;
+
+	/* Only whole pages of the range are released, partial pages may be shared with the next chunk */
+	if(advice == MADV_DONTNEED)
+		begin = (begin + page_size - 1) & ~(page_size - 1);
+	else
+		begin &= ~(page_size - 1);
+	if(advice == MADV_DONTNEED)
+		end &= ~(page_size - 1);
+	if(end > it->rb->size)
+		end = it->rb->size;
+	if(end > begin)
+		madvise((void*)&it->rb->map[begin], end - begin, advice);
+}
+#endif
+
+void rigol_bin_iter_init(rigol_bin_iter_t* it, const rigol_bin_t* rb, unsigned int channel_idx, size_t chunk_samples)
+{
+	memset(it, 0, sizeof(rigol_bin_iter_t));
+	it->rb = rb;
+	it->channel = &rb->channels[channel_idx];
+	it->chunk_samples = (chunk_samples == 0) ? it->channel->nb_samples : chunk_samples;
+#ifndef _WIN32
+	rigol_bin_iter_advise(it, 0, it->chunk_samples, MADV_WILLNEED);
+#endif
+}
+
+int rigol_bin_iter_next(rigol_bin_iter_t* it)
+{
+	size_t nb_samples;
+	size_t sample_size = rigol_bin_sample_size(it->channel);
+
+#ifndef _WIN32
+	/* Release the chunk which was processed */
+	if(it->nb_samples > 0)
+		rigol_bin_iter_advise(it, it->pos - it->nb_samples, it->nb_samples, MADV_DONTNEED);
+#endif
+	if(it->pos >= it->channel->nb_samples)
+	{
+		it->data = NULL;
+		it->nb_samples = 0;
+		return 0;
+	}
+
+	nb_samples = it->channel->nb_samples - it->pos;
+	if(nb_samples > it->chunk_samples)
+		nb_samples = it->chunk_samples;
+	it->data = (const unsigned char*)it->channel->data + it->pos * sample_size;
+	it->nb_samples = nb_samples;
+	it->pos += nb_samples;
+
+#ifndef _WIN32
+	/* Prefetch the next chunk while this one is processed */
+	if(it->pos < it->channel->nb_samples)
+		rigol_bin_iter_advise(it, it->pos, it->chunk_samples, MADV_WILLNEED);
+#endif
+	return 1;
+}
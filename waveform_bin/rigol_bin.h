@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2020 Benjamin VERNOUX
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __RIGOL_BIN_H__
+#define __RIGOL_BIN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#endif
+
+/*
+ * Rigol MSO5000 Waveform *.bin file format (see Rigol_MSO5000_Waveform_bin.bt)
+ * All fields are little endian (host shall be little endian).
+ *
+ * rigol_mso5k_bin header
+ * then for each waveform (channel):
+ *   rigol_mso5k_bin_waveforms header (waveform header + waveform data header)
+ *   data (buffer_size bytes)
+ */
+
+#define RIGOL_BIN_FILE_HEADER_SIZE (12)
+#define RIGOL_BIN_WAVEFORM_HEADER_SIZE (140)
+#define RIGOL_BIN_DATA_HEADER_SIZE (12)
+
+typedef enum
+{
+	Unknown_Type = 0,
+	Normal = 1,
+	Peak_Detect = 2,
+	Average = 3,
+	Horizontal_Histogram = 4,
+	Vertical_Histogram = 5,
+	Logic = 6
+} waveform_type_t;
+
+typedef enum
+{
+	Unknown_data = 0,
+	Normal_32bit_float_data = 1,
+	Maximum_float_data = 2,
+	Minimum_float_data = 3,
+	Time_float_data = 4,
+	Counts_32bit_float_data = 5,
+	Digital_u8_char_data = 6
+} waveform_buffers_type_t;
+
+typedef enum
+{
+	Unknown_Unit = 0,
+	Volts = 1,
+	Seconds = 2,
+	Constant = 3,
+	Amps = 4,
+	dB = 5,
+	Hz = 6
+} units_t;
+
+#pragma pack(push, 1)
+typedef struct
+{
+	char cookie[2]; // RGXX (XX is often "01") or AGXX (For Agilent)
+	char file_version[2];
+	uint32_t file_size;
+	uint32_t nb_waveforms;
+} rigol_mso5k_bin;
+
+typedef struct
+{
+	/* Waveform header */
+	uint32_t waveform_header_size;
+	int32_t waveform_type; /* waveform_type_t */
+	uint32_t nb_waveform_buffers;
+	uint32_t nb_points;
+	uint32_t count;
+	float x_display_range;
+	double x_display_origin;
+	double x_increment;
+	double x_origin;
+	int32_t x_units; /* units_t */
+	int32_t y_units; /* units_t */
+	char date[16];
+	char time[16];
+	char model_sn[24];
+	char waveform_label[16];
+	double time_tags;
+	uint32_t segment_index;
+	/* Waveform data header */
+	uint32_t waveform_data_header_size;
+	int16_t buffer_type; /* waveform_buffers_type_t */
+	uint16_t bytes_per_point;
+	uint32_t buffer_size;
+} rigol_mso5k_bin_waveforms;
+#pragma pack(pop)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	RIGOL_BIN_SAMPLE_U8 = 0,
+	RIGOL_BIN_SAMPLE_FLOAT, /* float (Normal/Maximum/Minimum float data) */
+	RIGOL_BIN_SAMPLE_LA /* unsigned short (Logic Analyzer "LA" label) */
+} rigol_bin_sample_t;
+
+/* One waveform (channel) of the file, header and data point in the file mapping (zero-copy) */
+typedef struct
+{
+	const rigol_mso5k_bin_waveforms* header;
+	const void* data;
+	size_t offset; /* File offset of data */
+	size_t nb_samples;
+	rigol_bin_sample_t sample_type;
+} rigol_bin_channel_t;
+
+typedef struct
+{
+	const unsigned char* map;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	const rigol_mso5k_bin* file_header;
+	unsigned int nb_channels;
+	rigol_bin_channel_t* channels;
+} rigol_bin_t;
+
+/* Iterator over the data of one channel by chunks of chunk_samples samples */
+typedef struct
+{
+	const rigol_bin_t* rb;
+	const rigol_bin_channel_t* channel;
+	size_t chunk_samples;
+	size_t pos; /* Index of the next sample */
+	/* Current chunk */
+	const void* data;
+	size_t nb_samples;
+} rigol_bin_iter_t;
+
+/* Map the file and parse all headers, return 0 if OK or -1 in case of error */
+int rigol_bin_open(rigol_bin_t* rb, const char* filename);
+void rigol_bin_close(rigol_bin_t* rb);
+
+/* Zero-copy views on channel data, return NULL if the channel does not have this sample type */
+const float* rigol_bin_channel_float(const rigol_bin_channel_t* channel);
+const unsigned short* rigol_bin_channel_la(const rigol_bin_channel_t* channel);
+const unsigned char* rigol_bin_channel_u8(const rigol_bin_channel_t* channel);
+size_t rigol_bin_sample_size(const rigol_bin_channel_t* channel);
+
+/*
+ * Chunked iterator, pages of the previous chunk are released and the next
+ * chunk is prefetched so files bigger than RAM can be processed
+ */
+void rigol_bin_iter_init(rigol_bin_iter_t* it, const rigol_bin_t* rb, unsigned int channel_idx, size_t chunk_samples);
+/* Return 1 with it->data/it->nb_samples set to the next chunk or 0 at end of data */
+int rigol_bin_iter_next(rigol_bin_iter_t* it);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __RIGOL_BIN_H__ */